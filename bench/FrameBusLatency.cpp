@@ -0,0 +1,295 @@
+/**
+ * Latency test of the shared memory frame bus.
+ *
+ * Attaches to the stream's ring as a reader and reports the publish-to-read latency percentiles, the number of
+ * the received and missed entries and the entries overwritten while being processed (--hold-us simulates the
+ * consumer's processing time) as JSON. With --self-test a child process publishes synthetic frames, so the test
+ * doesn't require a camera, and reports its own publishing time (unaffected by the slow readers).
+ *
+ * Usage: LiveVideoStreamFrameBusLatency [--stream camera] [--kind frames|packets] [--duration 10] [--hold-us 0]
+ *                                       [--self-test] [--size 1280x720] [--fps 30] [--slots 4]
+ *                                       [--output <file.json>]
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameBusReader.hpp"
+#include "FrameBusWriter.hpp"
+#include "Logger.hpp"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+namespace {
+
+    /**
+     * Test parameters (see usage).
+     */
+    struct TestOptions {
+        std::string stream = "camera";
+        LIRS::FrameBusKind kind = LIRS::FRAME_BUS_FRAMES;
+        double durationSec = 10;
+        unsigned holdUs = 0;
+        bool selfTest = false;
+        int width = 1280;
+        int height = 720;
+        unsigned frameRate = 30;
+        uint32_t slots = 4;
+        std::string output;
+    };
+
+    /**
+     * Publishing time of the self-test writer (written by the child process into the pipe).
+     */
+    struct WriterResult {
+        uint64_t published = 0;
+        double publishAvgUs = 0;
+        double publishMaxUs = 0;
+    };
+
+    bool parseOptions(int argc, char **argv, TestOptions &options) {
+
+        for (int idx = 1; idx < argc; ++idx) {
+
+            std::string key = argv[idx];
+
+            if (key == "--self-test") {
+                options.selfTest = true;
+                continue;
+            }
+
+            if (idx + 1 >= argc) {
+                std::cerr << "Missing value for " << key << std::endl;
+                return false;
+            }
+
+            std::string value = argv[++idx];
+
+            if (key == "--stream") {
+                options.stream = value;
+            } else if (key == "--kind") {
+                if (value != "frames" && value != "packets") return false;
+                options.kind = value == "frames" ? LIRS::FRAME_BUS_FRAMES : LIRS::FRAME_BUS_PACKETS;
+            } else if (key == "--duration") {
+                options.durationSec = std::stod(value);
+            } else if (key == "--hold-us") {
+                options.holdUs = static_cast<unsigned>(std::stoul(value));
+            } else if (key == "--size") {
+                if (sscanf(value.c_str(), "%dx%d", &options.width, &options.height) != 2) return false;
+            } else if (key == "--fps") {
+                options.frameRate = static_cast<unsigned>(std::stoul(value));
+            } else if (key == "--slots") {
+                options.slots = static_cast<uint32_t>(std::stoul(value));
+            } else if (key == "--output") {
+                options.output = value;
+            } else {
+                std::cerr << "Unknown option: " << key << std::endl;
+                return false;
+            }
+        }
+
+        return options.frameRate > 0 && options.durationSec > 0;
+    }
+
+    /**
+     * Publishes synthetic YUV 4:2:0 frames at the framerate (the child process of the self-test).
+     */
+    WriterResult runWriter(const TestOptions &options, double durationSec) {
+
+        LIRS::FrameBusWriter writer(options.stream, LIRS::FRAME_BUS_FRAMES, options.slots);
+
+        auto frame = av_frame_alloc();
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = options.width;
+        frame->height = options.height;
+        av_frame_get_buffer(frame, 32);
+
+        WriterResult result;
+        double totalUs = 0;
+
+        auto interval = std::chrono::microseconds(1000000 / options.frameRate);
+        auto start = std::chrono::steady_clock::now();
+        auto end = start + std::chrono::microseconds(static_cast<int64_t>(durationSec * 1e6));
+
+        for (auto next = start; next < end; next += interval) {
+
+            std::this_thread::sleep_until(next);
+
+            // moving gradient, so the frames differ
+            for (int row = 0; row < frame->height; row++) {
+                memset(frame->data[0] + row * frame->linesize[0], static_cast<int>(row + result.published) & 0xFF,
+                       static_cast<size_t>(frame->width));
+            }
+
+            frame->pts = static_cast<int64_t>(result.published);
+            frame->key_frame = 1;
+
+            auto publishStart = std::chrono::steady_clock::now();
+
+            writer.publishFrame(frame, AVRational{1, static_cast<int>(options.frameRate)});
+
+            auto publishUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                       publishStart).count();
+
+            totalUs += publishUs;
+            result.publishMaxUs = std::max(result.publishMaxUs, publishUs);
+            result.published++;
+        }
+
+        result.publishAvgUs = result.published ? totalUs / result.published : 0;
+
+        av_frame_free(&frame);
+
+        return result;
+    }
+
+    double percentile(std::vector<double> &values, double rank) {
+
+        if (values.empty()) return 0;
+
+        auto idx = static_cast<size_t>(rank * (values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + idx, values.end());
+
+        return values[idx];
+    }
+}
+
+int main(int argc, char **argv) {
+
+    TestOptions options;
+
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--stream camera] [--kind frames|packets] [--duration 10]"
+                  << " [--hold-us 0] [--self-test] [--size WxH] [--fps 30] [--slots 4] [--output file.json]"
+                  << std::endl;
+        return 1;
+    }
+
+    int resultPipe[2] = {-1, -1};
+    pid_t writerPid = -1;
+
+    if (options.selfTest) {
+
+        options.stream = "latency_test_" + std::to_string(getpid());
+        options.kind = LIRS::FRAME_BUS_FRAMES;
+
+        if (pipe(resultPipe) != 0) return 1;
+
+        // forked before the logger's thread is started
+        writerPid = fork();
+
+        if (writerPid == 0) {
+
+            close(resultPipe[0]);
+
+            initLogger(log4cpp::Priority::WARN);
+
+            // the reader attaches while the first frames are published
+            auto result = runWriter(options, options.durationSec + 0.5);
+
+            auto written = write(resultPipe[1], &result, sizeof(result));
+
+            close(resultPipe[1]);
+            _exit(written == sizeof(result) ? 0 : 1);
+        }
+
+        close(resultPipe[1]);
+    }
+
+    initLogger(log4cpp::Priority::WARN);
+
+    LIRS::FrameBusReader reader(options.stream, options.kind);
+    LIRS::FrameBusEntry entry;
+
+    std::vector<double> latenciesUs;
+    uint64_t received = 0, overwritten = 0, bytes = 0;
+    volatile uint64_t checksumSink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::microseconds(static_cast<int64_t>(options.durationSec * 1e6));
+
+    while (std::chrono::steady_clock::now() < end) {
+
+        if (!reader.next(entry, 100)) continue;
+
+        latenciesUs.push_back((LIRS::FrameBus::nowNanos() - entry.publishTimeNs) / 1000.0);
+
+        // touch the data as the consumer would
+        uint64_t checksum = 0;
+
+        for (uint32_t offset = 0; offset < entry.size; offset += 64) {
+            checksum += entry.data[offset];
+        }
+
+        checksumSink = checksum;
+        static_cast<void>(checksumSink);
+        bytes += entry.size;
+
+        if (options.holdUs > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(options.holdUs));
+        }
+
+        if (!reader.isValid(entry)) overwritten++;
+
+        received++;
+    }
+
+    WriterResult writerResult;
+
+    if (writerPid > 0) {
+
+        if (read(resultPipe[0], &writerResult, sizeof(writerResult)) != sizeof(writerResult)) {
+            std::cerr << "Writer process has failed" << std::endl;
+        }
+
+        close(resultPipe[0]);
+        waitpid(writerPid, nullptr, 0);
+    }
+
+    auto elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ostringstream json;
+    json.precision(3);
+    json << std::fixed;
+
+    json << "{\n  \"config\": {\"stream\": \"" << options.stream << "\", \"kind\": \""
+         << (options.kind == LIRS::FRAME_BUS_FRAMES ? "frames" : "packets") << "\", \"duration_sec\": "
+         << options.durationSec << ", \"hold_us\": " << options.holdUs << ", \"self_test\": "
+         << (options.selfTest ? "true" : "false") << "},\n";
+
+    json << "  \"received\": " << received << ",\n  \"missed\": " << reader.getMissedCount()
+         << ",\n  \"overwritten_while_held\": " << overwritten
+         << ",\n  \"throughput_mbps\": " << (elapsedSec > 0 ? bytes * 8 / elapsedSec / 1e6 : 0.0)
+         << ",\n  \"latency_us\": {\"p50\": " << percentile(latenciesUs, 0.5)
+         << ", \"p90\": " << percentile(latenciesUs, 0.9) << ", \"p99\": " << percentile(latenciesUs, 0.99)
+         << ", \"max\": " << percentile(latenciesUs, 1.0) << "}";
+
+    if (options.selfTest) {
+        json << ",\n  \"writer\": {\"published\": " << writerResult.published
+             << ", \"publish_avg_us\": " << writerResult.publishAvgUs
+             << ", \"publish_max_us\": " << writerResult.publishMaxUs << "}";
+    }
+
+    json << "\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.output) << json.str();
+    }
+
+    return received > 0 ? 0 : 2;
+}
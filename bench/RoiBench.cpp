@@ -0,0 +1,393 @@
+/**
+ * Benchmark of the region of interest (ROI) encoding.
+ *
+ * Encodes the same input twice: with the fixed 'crf=32' only (baseline) and with the regions of interest, decodes
+ * both streams and reports bitrate and luma PSNR inside the static regions and in the rest of the frame as JSON.
+ *
+ * Usage: LiveVideoStreamRoiBench [--source testsrc2|<file.yuv>] [--size 640x480] [--fps 15] [--frames 300]
+ *                                [--roi x,y,w,h]... [--roi-offset -0.2] [--background-offset 0.1] [--motion-map]
+ *                                [--output <file.json>]
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+#include "Transcoder.hpp"
+
+namespace {
+
+    /**
+     * Benchmark parameters (see usage).
+     */
+    struct BenchOptions {
+        std::string source = "testsrc2";
+        size_t width = 640;
+        size_t height = 480;
+        size_t frameRate = 15;
+        size_t frames = 300;
+        std::vector<LIRS::RegionOfInterest> regions;
+        double regionOffset = -0.2;
+        double backgroundOffset = 0.1;
+        bool motionMap = false;
+        std::string output;
+    };
+
+    /**
+     * Results of the single encoding pass.
+     */
+    struct PassResult {
+        size_t frames = 0;
+        uint64_t encodedBytes = 0;
+        double regionSquaredError = 0.0, otherSquaredError = 0.0;
+        uint64_t regionPixels = 0, otherPixels = 0;
+
+        double bitrateKbps(size_t frameRate) const {
+            return frames ? encodedBytes * 8.0 * frameRate / frames / 1000 : 0.0;
+        }
+    };
+
+    bool parseOptions(int argc, char **argv, BenchOptions &options) {
+
+        for (int idx = 1; idx < argc; ++idx) {
+
+            std::string key = argv[idx];
+
+            if (key == "--motion-map") {
+                options.motionMap = true;
+                continue;
+            }
+
+            if (idx + 1 >= argc) {
+                std::cerr << "Missing value for " << key << std::endl;
+                return false;
+            }
+
+            std::string value = argv[++idx];
+
+            if (key == "--source") {
+                options.source = value;
+            } else if (key == "--size") {
+                if (sscanf(value.c_str(), "%zux%zu", &options.width, &options.height) != 2) return false;
+            } else if (key == "--fps") {
+                options.frameRate = std::stoul(value);
+            } else if (key == "--frames") {
+                options.frames = std::stoul(value);
+            } else if (key == "--roi") {
+                LIRS::RegionOfInterest region{};
+                if (sscanf(value.c_str(), "%d,%d,%d,%d", &region.x, &region.y, &region.width, &region.height) != 4) {
+                    return false;
+                }
+                options.regions.push_back(region);
+            } else if (key == "--roi-offset") {
+                options.regionOffset = std::stod(value);
+            } else if (key == "--background-offset") {
+                options.backgroundOffset = std::stod(value);
+            } else if (key == "--output") {
+                options.output = value;
+            } else {
+                std::cerr << "Unknown option: " << key << std::endl;
+                return false;
+            }
+        }
+
+        for (auto &region : options.regions) {
+            region.qualityOffset = options.regionOffset;
+        }
+
+        return options.frameRate > 0 && options.frames > 0;
+    }
+
+    /**
+     * Returns the url and the input format of the source (yuv420p frames).
+     */
+    std::pair<std::string, std::string> sourceOf(const BenchOptions &options) {
+
+        if (options.source != "testsrc2") return {options.source, "rawvideo"};
+
+        std::ostringstream graph;
+        graph << "testsrc2=size=" << options.width << "x" << options.height << ":rate=" << options.frameRate
+              << ":duration=" << static_cast<double>(options.frames) / options.frameRate << ",format=yuv420p";
+
+        return {graph.str(), "lavfi"};
+    }
+
+    /**
+     * Reads and decodes the frames of the source (reference frames for the quality measurement).
+     */
+    class SourceReader {
+
+    public:
+
+        explicit SourceReader(const BenchOptions &options) : formatContext(nullptr), codecContext(nullptr),
+                                                             streamIndex(-1), packet(av_packet_alloc()),
+                                                             frame(av_frame_alloc()), isEndOfStream(false) {
+
+            auto source = sourceOf(options);
+
+            AVDictionary *dictionary = nullptr;
+            av_dict_set(&dictionary, "video_size", (std::to_string(options.width) + "x" +
+                                                    std::to_string(options.height)).c_str(), 0);
+            av_dict_set(&dictionary, "pixel_format", "yuv420p", 0);
+            av_dict_set(&dictionary, "framerate", std::to_string(options.frameRate).c_str(), 0);
+
+            auto status = avformat_open_input(&formatContext, source.first.c_str(),
+                                              av_find_input_format(source.second.c_str()), &dictionary);
+            av_dict_free(&dictionary);
+            assert(status == 0);
+
+            status = avformat_find_stream_info(formatContext, nullptr);
+            assert(status >= 0);
+
+            AVCodec *codec = nullptr;
+            streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+            assert(streamIndex >= 0 && codec);
+
+            codecContext = avcodec_alloc_context3(codec);
+            avcodec_parameters_to_context(codecContext, formatContext->streams[streamIndex]->codecpar);
+
+            status = avcodec_open2(codecContext, codec, nullptr);
+            assert(status == 0);
+        }
+
+        ~SourceReader() {
+            av_frame_free(&frame);
+            av_packet_free(&packet);
+            avcodec_free_context(&codecContext);
+            avformat_close_input(&formatContext);
+        }
+
+        /**
+         * Returns the next source frame, nullptr if there are no more frames.
+         */
+        const AVFrame *next() {
+
+            while (true) {
+
+                if (avcodec_receive_frame(codecContext, frame) == 0) return frame;
+
+                if (isEndOfStream) return nullptr;
+
+                if (av_read_frame(formatContext, packet) < 0) {
+                    isEndOfStream = true;
+                    avcodec_send_packet(codecContext, nullptr); // drain
+                    continue;
+                }
+
+                if (packet->stream_index == streamIndex) {
+                    avcodec_send_packet(codecContext, packet);
+                }
+
+                av_packet_unref(packet);
+            }
+        }
+
+    private:
+        AVFormatContext *formatContext;
+        AVCodecContext *codecContext;
+        int streamIndex;
+        AVPacket *packet;
+        AVFrame *frame;
+        bool isEndOfStream;
+    };
+
+    /**
+     * Accumulates the squared luma error of the decoded frame inside and outside the static regions.
+     */
+    void accumulateError(const BenchOptions &options, const AVFrame *decoded, const AVFrame *reference,
+                         PassResult &result) {
+
+        for (int y = 0; y < decoded->height && y < reference->height; ++y) {
+
+            auto decodedRow = decoded->data[0] + y * decoded->linesize[0];
+            auto referenceRow = reference->data[0] + y * reference->linesize[0];
+
+            for (int x = 0; x < decoded->width && x < reference->width; ++x) {
+
+                auto isInRegion = false;
+
+                for (auto &region : options.regions) {
+                    if (x >= region.x && x < region.x + region.width && y >= region.y &&
+                        y < region.y + region.height) {
+                        isInRegion = true;
+                        break;
+                    }
+                }
+
+                double diff = static_cast<int>(decodedRow[x]) - static_cast<int>(referenceRow[x]);
+
+                if (isInRegion) {
+                    result.regionSquaredError += diff * diff;
+                    result.regionPixels++;
+                } else {
+                    result.otherSquaredError += diff * diff;
+                    result.otherPixels++;
+                }
+            }
+        }
+    }
+
+    /**
+     * Encodes the source with the specified regions of interest, decodes the result and measures the quality.
+     */
+    PassResult runPass(const BenchOptions &options, const LIRS::RegionOfInterestOptions &roiOptions) {
+
+        auto source = sourceOf(options);
+
+        std::unique_ptr<LIRS::Transcoder> transcoder(LIRS::Transcoder::newInstance(
+                source.first, "roi", options.width, options.height, "yuv420p", "yuv420p", options.frameRate,
+                options.frameRate, {}, source.second));
+
+        if (!transcoder) {
+            std::cerr << "Can't open the source " << source.first << std::endl;
+            exit(1);
+        }
+
+        std::vector<uint8_t> stream; // Annex B byte stream
+
+        transcoder->setOnEncodedDataCallback([&stream](std::vector<uint8_t> &&nalUnit, const struct timeval &) {
+            static const uint8_t START_CODE[] = {0, 0, 0, 1};
+            stream.insert(stream.end(), START_CODE, START_CODE + sizeof(START_CODE));
+            stream.insert(stream.end(), nalUnit.begin(), nalUnit.end());
+        });
+
+        transcoder->setRegionsOfInterest(roiOptions);
+
+        transcoder->run(); // until the end of the source
+
+        PassResult result;
+        result.encodedBytes = transcoder->getStatistics().encodedBytes.load();
+
+        // decode the encoded stream and compare with the source frames
+        auto decoder = avcodec_find_decoder(AV_CODEC_ID_HEVC);
+        auto decoderContext = avcodec_alloc_context3(decoder);
+        auto status = avcodec_open2(decoderContext, decoder, nullptr);
+        assert(status == 0);
+
+        auto parser = av_parser_init(AV_CODEC_ID_HEVC);
+        auto packet = av_packet_alloc();
+        auto decoded = av_frame_alloc();
+
+        SourceReader reader(options);
+
+        auto receiveFrames = [&]() {
+            while (avcodec_receive_frame(decoderContext, decoded) == 0) {
+                auto reference = reader.next();
+                if (!reference) break;
+                accumulateError(options, decoded, reference, result);
+                result.frames++;
+            }
+        };
+
+        auto data = stream.data();
+        auto remaining = static_cast<int>(stream.size());
+
+        while (remaining > 0) {
+
+            auto consumed = av_parser_parse2(parser, decoderContext, &packet->data, &packet->size, data, remaining,
+                                             AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            data += consumed;
+            remaining -= consumed;
+
+            if (packet->size > 0) {
+                avcodec_send_packet(decoderContext, packet);
+                receiveFrames();
+            }
+        }
+
+        // flush the parser and the decoder
+        av_parser_parse2(parser, decoderContext, &packet->data, &packet->size, nullptr, 0,
+                         AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+
+        if (packet->size > 0) {
+            avcodec_send_packet(decoderContext, packet);
+        }
+
+        avcodec_send_packet(decoderContext, nullptr);
+        receiveFrames();
+
+        av_parser_close(parser);
+        packet->data = nullptr; // owned by the parser
+        packet->size = 0;
+        av_packet_free(&packet);
+        av_frame_free(&decoded);
+        avcodec_free_context(&decoderContext);
+
+        return result;
+    }
+
+    double psnr(double squaredError, uint64_t pixels) {
+        if (!pixels) return 0.0;
+        auto mse = squaredError / pixels;
+        return mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : 99.0;
+    }
+
+    void writePass(std::ostringstream &json, const char *name, const PassResult &result, size_t frameRate) {
+        json << "  \"" << name << "\": {\"frames\": " << result.frames
+             << ", \"encoded_bytes\": " << result.encodedBytes
+             << ", \"bitrate_kbps\": " << result.bitrateKbps(frameRate)
+             << ", \"psnr_roi_db\": " << psnr(result.regionSquaredError, result.regionPixels)
+             << ", \"psnr_other_db\": " << psnr(result.otherSquaredError, result.otherPixels)
+             << ", \"psnr_all_db\": " << psnr(result.regionSquaredError + result.otherSquaredError,
+                                              result.regionPixels + result.otherPixels) << "}";
+    }
+}
+
+int main(int argc, char **argv) {
+
+    BenchOptions options;
+
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--source testsrc2|<file.yuv>] [--size WxH] [--fps N] [--frames N]"
+                  << " [--roi x,y,w,h]... [--roi-offset -0.2] [--background-offset 0.1] [--motion-map]"
+                  << " [--output file.json]" << std::endl;
+        return 1;
+    }
+
+    initLogger(log4cpp::Priority::WARN);
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    LIRS::RegionOfInterestOptions roiOptions;
+    roiOptions.regions = options.regions;
+    roiOptions.motionMap = options.motionMap;
+    roiOptions.backgroundQualityOffset = options.backgroundOffset;
+
+    auto baseline = runPass(options, LIRS::RegionOfInterestOptions());
+    auto roi = runPass(options, roiOptions);
+
+    auto baselineBitrate = baseline.bitrateKbps(options.frameRate);
+
+    std::ostringstream json;
+    json.precision(3);
+    json << std::fixed;
+
+    json << "{\n  \"config\": {\"source\": \"" << options.source << "\", \"width\": " << options.width
+         << ", \"height\": " << options.height << ", \"fps\": " << options.frameRate
+         << ", \"regions\": " << options.regions.size() << ", \"roi_offset\": " << options.regionOffset
+         << ", \"background_offset\": " << options.backgroundOffset
+         << ", \"motion_map\": " << (options.motionMap ? "true" : "false") << "},\n";
+
+    writePass(json, "baseline", baseline, options.frameRate);
+    json << ",\n";
+    writePass(json, "roi", roi, options.frameRate);
+
+    json << ",\n  \"bitrate_reduction_percent\": "
+         << (baselineBitrate > 0 ? (1 - roi.bitrateKbps(options.frameRate) / baselineBitrate) * 100 : 0.0)
+         << "\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.output) << json.str();
+    }
+
+    return 0;
+}
@@ -0,0 +1,530 @@
+/**
+ * Benchmark of the HEVC RTP packetization with and w/o aggregation packets (RFC 7798).
+ *
+ * Packetizes the same NAL units twice (single NAL unit and fragmentation unit packets only, then with aggregation
+ * packets), depacketizes every payload back and checks that the NAL units and the picture boundaries (marker bits)
+ * survive the round trip. The aggregated pass is repeated with every NAL unit stamped with its own presentation time
+ * (as sources stamping NAL units on arrival do), both aggregated passes must send the parameter sets of each keyframe
+ * (VPS, SPS, PPS) in one aggregation packet. Reports the number of packets, packets per second and the per-packet
+ * overhead as JSON.
+ *
+ * Usage: LiveVideoStreamRtpAggregationBench [--input <file.hevc>] [--frames 300] [--fps 25] [--gop 25]
+ *                                           [--frame-size 3000] [--keyframe-size 30000] [--sei-per-frame]
+ *                                           [--mtu 1456] [--output <file.json>]
+ */
+
+#include <BasicUsageEnvironment.hh>
+#include <H265VideoStreamDiscreteFramer.hh>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "HevcAggregatingRTPSink.hpp"
+#include "Logger.hpp"
+
+namespace {
+
+    /**
+     * Benchmark parameters (see usage).
+     */
+    struct BenchOptions {
+        std::string input;
+        size_t frames = 300;
+        size_t frameRate = 25;
+        size_t gop = 25;
+        size_t frameSize = 3000;
+        size_t keyframeSize = 30000;
+        bool seiPerFrame = false;
+        unsigned mtu = 1456;
+        std::string output;
+    };
+
+    /**
+     * NAL unit (w/o start code) of the picture.
+     */
+    struct NalUnit {
+        std::vector<uint8_t> data;
+        size_t picture;
+    };
+
+    /**
+     * Results of the single packetization pass.
+     */
+    struct PassResult {
+        uint64_t packets = 0;
+        uint64_t payloadBytes = 0;
+        uint64_t aggregationPackets = 0;
+        uint64_t fragmentationPackets = 0;
+        uint64_t markerPackets = 0;
+        uint64_t parameterSetPackets = 0;
+        bool isRoundTripValid = false;
+    };
+
+    /**
+     * IPv4 + UDP + RTP headers of each packet.
+     */
+    const unsigned PACKET_OVERHEAD = 20 + 8 + LIRS::HevcAggregatingRTPSink::RTP_HEADER_SIZE;
+
+    const unsigned INPUT_BUFFER_SIZE = 2 * 1000 * 1000;
+
+    bool parseOptions(int argc, char **argv, BenchOptions &options) {
+
+        for (int idx = 1; idx < argc; ++idx) {
+
+            std::string key = argv[idx];
+
+            if (key == "--sei-per-frame") {
+                options.seiPerFrame = true;
+                continue;
+            }
+
+            if (idx + 1 >= argc) {
+                std::cerr << "Missing value for " << key << std::endl;
+                return false;
+            }
+
+            std::string value = argv[++idx];
+
+            if (key == "--input") {
+                options.input = value;
+            } else if (key == "--frames") {
+                options.frames = std::stoul(value);
+            } else if (key == "--fps") {
+                options.frameRate = std::stoul(value);
+            } else if (key == "--gop") {
+                options.gop = std::stoul(value);
+            } else if (key == "--frame-size") {
+                options.frameSize = std::stoul(value);
+            } else if (key == "--keyframe-size") {
+                options.keyframeSize = std::stoul(value);
+            } else if (key == "--mtu") {
+                options.mtu = static_cast<unsigned>(std::stoul(value));
+            } else if (key == "--output") {
+                options.output = value;
+            } else {
+                std::cerr << "Unknown option: " << key << std::endl;
+                return false;
+            }
+        }
+
+        return options.frameRate > 0 && options.gop > 0 && options.mtu > 64;
+    }
+
+    uint8_t nalUnitType(const std::vector<uint8_t> &data) {
+        return static_cast<uint8_t>((data[0] >> 1) & 0x3F);
+    }
+
+    bool isVcl(uint8_t type) {
+        return type < 32;
+    }
+
+    /**
+     * Generates the GOP structure of the camera stream: VPS, SPS, PPS, SEI and IDR slice of each keyframe,
+     * a single slice of the other frames (optionally preceded by SEI).
+     */
+    std::vector<NalUnit> generateNalUnits(const BenchOptions &options) {
+
+        std::mt19937 random(42);
+        std::vector<NalUnit> nalUnits;
+
+        auto addNalUnit = [&](uint8_t type, size_t size, size_t picture) {
+
+            NalUnit nalUnit;
+            nalUnit.data.resize(std::max<size_t>(size, 3));
+            nalUnit.data[0] = static_cast<uint8_t>(type << 1);
+            nalUnit.data[1] = 1; // LayerId 0, TID 0
+
+            for (size_t idx = 2; idx < nalUnit.data.size(); idx++) {
+                nalUnit.data[idx] = static_cast<uint8_t>(random() | 0x01); // no start code emulation
+            }
+
+            if (isVcl(type)) nalUnit.data[2] |= 0x80; // first_slice_segment_in_pic_flag
+
+            nalUnit.picture = picture;
+            nalUnits.push_back(std::move(nalUnit));
+        };
+
+        std::uniform_real_distribution<double> sizeJitter(0.7, 1.3);
+
+        for (size_t picture = 0; picture < options.frames; picture++) {
+
+            if (picture % options.gop == 0) {
+                addNalUnit(32, 24, picture); // VPS
+                addNalUnit(33, 42, picture); // SPS
+                addNalUnit(34, 8, picture);  // PPS
+                addNalUnit(39, 30, picture); // SEI
+                addNalUnit(19, static_cast<size_t>(options.keyframeSize * sizeJitter(random)), picture); // IDR
+                continue;
+            }
+
+            if (options.seiPerFrame) addNalUnit(39, 20, picture);
+
+            addNalUnit(1, static_cast<size_t>(options.frameSize * sizeJitter(random)), picture); // TRAIL_R
+        }
+
+        return nalUnits;
+    }
+
+    /**
+     * Reads NAL units of the Annex B file, a picture starts with the first slice or the non-VCL NAL unit after VCL.
+     */
+    bool readNalUnits(const std::string &path, std::vector<NalUnit> &nalUnits) {
+
+        std::ifstream file(path, std::ios::binary);
+
+        if (!file) return false;
+
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        std::vector<std::pair<size_t, size_t>> ranges; // NAL units' [start, end)
+
+        for (size_t idx = 0; idx + 3 <= bytes.size(); idx++) {
+
+            if (bytes[idx] == 0 && bytes[idx + 1] == 0 && bytes[idx + 2] == 1) {
+
+                if (!ranges.empty()) {
+                    auto end = idx;
+                    while (end > ranges.back().first && bytes[end - 1] == 0) end--; // trailing zeros, 4-byte codes
+                    ranges.back().second = end;
+                }
+
+                ranges.emplace_back(idx + 3, bytes.size());
+                idx += 2;
+            }
+        }
+
+        size_t picture = 0;
+        bool hasVcl = false;
+
+        for (auto &range : ranges) {
+
+            if (range.second - range.first < 3) continue;
+
+            NalUnit nalUnit;
+            nalUnit.data.assign(bytes.begin() + range.first, bytes.begin() + range.second);
+
+            auto type = nalUnitType(nalUnit.data);
+
+            if (hasVcl && (!isVcl(type) || (nalUnit.data[2] & 0x80))) { // the next picture
+                picture++;
+                hasVcl = false;
+            }
+
+            hasVcl |= isVcl(type);
+
+            nalUnit.picture = picture;
+            nalUnits.push_back(std::move(nalUnit));
+        }
+
+        return !nalUnits.empty();
+    }
+
+    /**
+     * Delivers the NAL units one by one with the presentation time of their picture
+     * (or with the own presentation time of each NAL unit, 1 us apart within the picture).
+     */
+    class NalUnitSource : public FramedSource {
+
+    public:
+
+        static NalUnitSource *createNew(UsageEnvironment &env, const std::vector<NalUnit> &nalUnits,
+                                        size_t frameRate, bool isNalTimestamped) {
+            return new NalUnitSource(env, nalUnits, frameRate, isNalTimestamped);
+        }
+
+    protected:
+
+        NalUnitSource(UsageEnvironment &env, const std::vector<NalUnit> &nalUnits, size_t frameRate,
+                      bool isNalTimestamped)
+                : FramedSource(env), nalUnits(nalUnits), frameRate(frameRate), isNalTimestamped(isNalTimestamped),
+                  position(0), pictureNalUnits(0) {}
+
+        void doGetNextFrame() override {
+
+            if (position >= nalUnits.size()) {
+                handleClosure();
+                return;
+            }
+
+            auto &nalUnit = nalUnits[position];
+
+            pictureNalUnits = position > 0 && nalUnits[position - 1].picture == nalUnit.picture
+                              ? pictureNalUnits + 1 : 0;
+            position++;
+
+            fFrameSize = static_cast<unsigned>(std::min<size_t>(nalUnit.data.size(), fMaxSize));
+            fNumTruncatedBytes = static_cast<unsigned>(nalUnit.data.size() - fFrameSize);
+
+            memcpy(fTo, nalUnit.data.data(), fFrameSize);
+
+            auto timestampUs = static_cast<int64_t>(nalUnit.picture * 1000000 / frameRate);
+
+            if (isNalTimestamped) timestampUs += static_cast<int64_t>(pictureNalUnits);
+
+            fPresentationTime.tv_sec = static_cast<time_t>(timestampUs / 1000000);
+            fPresentationTime.tv_usec = static_cast<suseconds_t>(timestampUs % 1000000);
+            fDurationInMicroseconds = 0;
+
+            // delivered from the event loop, as the camera's frames are
+            nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc *) FramedSource::afterGetting,
+                                                                     this);
+        }
+
+    private:
+
+        const std::vector<NalUnit> &nalUnits;
+
+        size_t frameRate;
+
+        bool isNalTimestamped;
+
+        size_t position;
+
+        /**
+         * NAL units of the current picture delivered before the current one.
+         */
+        size_t pictureNalUnits;
+    };
+
+    /**
+     * Reassembles the NAL units of the RTP payloads.
+     */
+    struct Depacketizer {
+
+        const std::vector<NalUnit> *expected;
+        size_t position = 0;
+        std::vector<uint8_t> fragmented;
+        bool isValid = true;
+
+        void onNalUnit(const uint8_t *data, size_t size) {
+
+            if (position >= expected->size() || (*expected)[position].data.size() != size ||
+                memcmp((*expected)[position].data.data(), data, size) != 0) {
+                isValid = false;
+            }
+
+            position++;
+        }
+
+        void onPayload(const uint8_t *payload, size_t size, PassResult &result) {
+
+            if (size < LIRS::HevcNalPacketizer::NAL_HEADER_SIZE) {
+                isValid = false;
+                return;
+            }
+
+            auto type = (payload[0] >> 1) & 0x3F;
+
+            if (type == LIRS::HevcNalPacketizer::AGGREGATION_PACKET_TYPE) {
+
+                result.aggregationPackets++;
+
+                std::vector<uint8_t> types;
+
+                for (size_t offset = LIRS::HevcNalPacketizer::NAL_HEADER_SIZE; offset < size;) {
+
+                    if (offset + 2 > size) {
+                        isValid = false;
+                        return;
+                    }
+
+                    size_t nalUnitSize = (payload[offset] << 8) | payload[offset + 1];
+                    offset += 2;
+
+                    if (offset + nalUnitSize > size) {
+                        isValid = false;
+                        return;
+                    }
+
+                    if (nalUnitSize > 0) types.push_back(static_cast<uint8_t>((payload[offset] >> 1) & 0x3F));
+
+                    onNalUnit(payload + offset, nalUnitSize);
+                    offset += nalUnitSize;
+                }
+
+                if (std::find(types.begin(), types.end(), 32) != types.end() &&
+                    std::find(types.begin(), types.end(), 33) != types.end() &&
+                    std::find(types.begin(), types.end(), 34) != types.end()) {
+                    result.parameterSetPackets++;
+                }
+
+            } else if (type == LIRS::HevcNalPacketizer::FRAGMENTATION_UNIT_TYPE) {
+
+                result.fragmentationPackets++;
+
+                auto fuHeader = payload[2];
+
+                if (fuHeader & 0x80) { // start: restore the NAL unit's header
+                    fragmented.clear();
+                    fragmented.push_back(static_cast<uint8_t>((payload[0] & 0x81) | ((fuHeader & 0x3F) << 1)));
+                    fragmented.push_back(payload[1]);
+                }
+
+                fragmented.insert(fragmented.end(), payload + 3, payload + size);
+
+                if (fuHeader & 0x40) onNalUnit(fragmented.data(), fragmented.size());
+
+            } else {
+                onNalUnit(payload, size);
+            }
+        }
+    };
+
+    struct PassContext {
+        LIRS::HevcNalPacketizer *packetizer;
+        std::vector<uint8_t> buffer;
+        Depacketizer depacketizer;
+        PassResult result;
+        char watch;
+    };
+
+    void readPayload(PassContext &context);
+
+    void afterGettingPayload(void *clientData, unsigned frameSize, unsigned, struct timeval, unsigned) {
+
+        auto &context = *static_cast<PassContext *>(clientData);
+
+        context.result.packets++;
+        context.result.payloadBytes += frameSize;
+
+        if (context.packetizer->isPictureEnd()) context.result.markerPackets++;
+
+        context.depacketizer.onPayload(context.buffer.data(), frameSize, context.result);
+
+        readPayload(context);
+    }
+
+    void onClosure(void *clientData) {
+        static_cast<PassContext *>(clientData)->watch = 1;
+    }
+
+    void readPayload(PassContext &context) {
+        context.packetizer->getNextFrame(context.buffer.data(), static_cast<unsigned>(context.buffer.size()),
+                                         afterGettingPayload, &context, onClosure, &context);
+    }
+
+    PassResult runPass(const BenchOptions &options, const std::vector<NalUnit> &nalUnits, bool aggregate,
+                       bool isNalTimestamped) {
+
+        auto scheduler = BasicTaskScheduler::createNew();
+        auto env = BasicUsageEnvironment::createNew(*scheduler);
+
+        auto source = NalUnitSource::createNew(*env, nalUnits, options.frameRate, isNalTimestamped);
+        auto framer = H265VideoStreamDiscreteFramer::createNew(*env, source);
+
+        PassContext context;
+        context.packetizer = LIRS::HevcNalPacketizer::createNew(*env, framer, INPUT_BUFFER_SIZE,
+                                                                options.mtu - LIRS::HevcAggregatingRTPSink::RTP_HEADER_SIZE,
+                                                                aggregate);
+        context.buffer.resize(INPUT_BUFFER_SIZE);
+        context.depacketizer.expected = &nalUnits;
+        context.watch = 0;
+
+        readPayload(context);
+
+        env->taskScheduler().doEventLoop(&context.watch);
+
+        context.result.isRoundTripValid = context.depacketizer.isValid &&
+                                          context.depacketizer.position == nalUnits.size();
+
+        Medium::close(context.packetizer); // doesn't close its input
+        Medium::close(framer); // closes the source
+
+        env->reclaim();
+        delete scheduler;
+
+        return context.result;
+    }
+
+    void writePass(std::ostringstream &json, const char *name, const PassResult &result, double durationSec) {
+        json << "  \"" << name << "\": {\"packets\": " << result.packets
+             << ", \"packets_per_second\": " << (durationSec > 0 ? result.packets / durationSec : 0.0)
+             << ", \"payload_bytes\": " << result.payloadBytes
+             << ", \"overhead_bytes\": " << result.packets * PACKET_OVERHEAD
+             << ", \"aggregation_packets\": " << result.aggregationPackets
+             << ", \"fragmentation_packets\": " << result.fragmentationPackets
+             << ", \"marker_packets\": " << result.markerPackets
+             << ", \"parameter_set_packets\": " << result.parameterSetPackets
+             << ", \"round_trip\": " << (result.isRoundTripValid ? "true" : "false") << "}";
+    }
+}
+
+int main(int argc, char **argv) {
+
+    BenchOptions options;
+
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--input file.hevc] [--frames N] [--fps N] [--gop N]"
+                  << " [--frame-size bytes] [--keyframe-size bytes] [--sei-per-frame] [--mtu 1456]"
+                  << " [--output file.json]" << std::endl;
+        return 1;
+    }
+
+    initLogger(log4cpp::Priority::WARN);
+
+    std::vector<NalUnit> nalUnits;
+
+    if (options.input.empty()) {
+        nalUnits = generateNalUnits(options);
+    } else if (!readNalUnits(options.input, nalUnits)) {
+        std::cerr << "Can't read NAL units of " << options.input << std::endl;
+        return 1;
+    }
+
+    auto pictures = nalUnits.back().picture + 1;
+    auto durationSec = static_cast<double>(pictures) / options.frameRate;
+
+    auto keyframes = static_cast<uint64_t>(std::count_if(nalUnits.begin(), nalUnits.end(), [](const NalUnit &nalUnit) {
+        return nalUnitType(nalUnit.data) == 32; // VPS
+    }));
+
+    auto single = runPass(options, nalUnits, false, false);
+    auto aggregated = runPass(options, nalUnits, true, false);
+    auto nalTimestamped = runPass(options, nalUnits, true, true);
+
+    std::ostringstream json;
+    json.precision(3);
+    json << std::fixed;
+
+    json << "{\n  \"config\": {\"source\": \"" << (options.input.empty() ? "synthetic" : options.input)
+         << "\", \"nal_units\": " << nalUnits.size() << ", \"pictures\": " << pictures
+         << ", \"keyframes\": " << keyframes << ", \"fps\": " << options.frameRate << ", \"mtu\": " << options.mtu
+         << "},\n";
+
+    writePass(json, "single", single, durationSec);
+    json << ",\n";
+    writePass(json, "aggregated", aggregated, durationSec);
+    json << ",\n";
+    writePass(json, "aggregated_nal_timestamps", nalTimestamped, durationSec);
+
+    auto savedPackets = static_cast<double>(single.packets) - aggregated.packets;
+
+    json << ",\n  \"packet_reduction_percent\": " << (single.packets ? savedPackets / single.packets * 100 : 0.0)
+         << ",\n  \"saved_overhead_bytes_per_second\": " << savedPackets * PACKET_OVERHEAD / durationSec
+         << "\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.output) << json.str();
+    }
+
+    auto isValid = single.isRoundTripValid && aggregated.isRoundTripValid && nalTimestamped.isRoundTripValid;
+
+    // the parameter sets of each keyframe share one aggregation packet whatever the source's timestamps are
+    if (aggregated.parameterSetPackets != keyframes || nalTimestamped.parameterSetPackets != keyframes) {
+        std::cerr << "Parameter sets of " << keyframes << " keyframes have been aggregated "
+                  << aggregated.parameterSetPackets << " times (" << nalTimestamped.parameterSetPackets
+                  << " times with per NAL unit timestamps)" << std::endl;
+        isValid = false;
+    }
+
+    return isValid ? 0 : 2;
+}
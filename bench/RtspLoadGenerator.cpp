@@ -0,0 +1,492 @@
+/**
+ * RTSP load generator for fan-out scaling tests.
+ *
+ * Opens N concurrent RTSP sessions (UDP and/or TCP-interleaved) against the server and measures for each session
+ * DESCRIBE -> PLAY -> first frame time, inter-frame jitter, RTP sequence gaps and bitrate.
+ * Percentile summaries are printed at the end.
+ * Optionally starts an in-process server streaming the synthetic testsrc2 source, so it works fully offline.
+ *
+ * Usage: LiveVideoStreamLoadGen [--url rtsp://127.0.0.1:8554/synthetic] [--sessions 10] [--transport udp|tcp|mixed]
+ *                               [--duration 30] [--ramp-ms 50] [--serve-synthetic] [--size 640x480] [--fps 15]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Logger.hpp"
+#include "LiveCameraRTSPServer.hpp"
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Load test parameters (see usage).
+     */
+    struct LoadOptions {
+        std::string url;
+        size_t sessions = 10;
+        std::string transport = "udp";
+        double duration = 30.0;
+        unsigned rampMillis = 50;
+        bool serveSynthetic = false;
+        size_t width = 640;
+        size_t height = 480;
+        size_t frameRate = 15;
+        unsigned port = LIRS::LiveCameraRTSPServer::DEFAULT_RTSP_PORT_NUMBER;
+    };
+
+    /**
+     * Measurements of a single RTSP session.
+     */
+    struct SessionStats {
+        bool useTcp = false;
+        bool failed = false;
+        Clock::time_point started, described, playing, firstFrame, lastFrame;
+        bool hasFirstFrame = false;
+        uint64_t frames = 0;
+        uint64_t nalUnits = 0;
+        uint64_t bytes = 0;
+        unsigned packetsReceived = 0;
+        unsigned packetsExpected = 0;
+        struct timeval lastPresentationTime{};
+        std::vector<double> frameIntervals; // milliseconds
+    };
+
+    double millisBetween(const Clock::time_point &from, const Clock::time_point &to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    /**
+     * Sink consuming the received NAL units and collecting per-frame statistics.
+     */
+    class StatsSink : public MediaSink {
+    public:
+
+        static StatsSink *createNew(UsageEnvironment &env, SessionStats &stats) {
+            return new StatsSink(env, stats);
+        }
+
+    protected:
+
+        StatsSink(UsageEnvironment &env, SessionStats &stats) : MediaSink(env), stats(stats),
+                                                                 buffer(RECEIVE_BUFFER_SIZE) {}
+
+        Boolean continuePlaying() override {
+
+            if (!fSource) return False;
+
+            fSource->getNextFrame(buffer.data(), static_cast<unsigned>(buffer.size()), afterGettingFrame, this,
+                                  onSourceClosure, this);
+            return True;
+        }
+
+    private:
+
+        SessionStats &stats;
+
+        std::vector<unsigned char> buffer;
+
+        static const size_t RECEIVE_BUFFER_SIZE = 2 * 1000 * 1000;
+
+        static void afterGettingFrame(void *clientData, unsigned frameSize, unsigned, struct timeval presentationTime,
+                                      unsigned) {
+            static_cast<StatsSink *>(clientData)->afterGettingFrame(frameSize, presentationTime);
+        }
+
+        void afterGettingFrame(unsigned frameSize, struct timeval presentationTime) {
+
+            auto now = Clock::now();
+
+            stats.nalUnits++;
+            stats.bytes += frameSize;
+
+            // NAL units of the same picture share the presentation time
+            if (!stats.hasFirstFrame || presentationTime.tv_sec != stats.lastPresentationTime.tv_sec ||
+                presentationTime.tv_usec != stats.lastPresentationTime.tv_usec) {
+
+                if (!stats.hasFirstFrame) {
+                    stats.firstFrame = now;
+                    stats.hasFirstFrame = true;
+                } else {
+                    stats.frameIntervals.push_back(millisBetween(stats.lastFrame, now));
+                }
+
+                stats.lastFrame = now;
+                stats.lastPresentationTime = presentationTime;
+                stats.frames++;
+            }
+
+            continuePlaying();
+        }
+    };
+
+    /**
+     * RTSP client session: DESCRIBE -> SETUP (each subsession) -> PLAY.
+     */
+    class LoadSession : public RTSPClient {
+    public:
+
+        static LoadSession *createNew(UsageEnvironment &env, const std::string &url, SessionStats &stats) {
+            return new LoadSession(env, url, stats);
+        }
+
+        void start() {
+            stats.started = Clock::now();
+            sendDescribeCommand(continueAfterDESCRIBE);
+        }
+
+        /**
+         * Collects RTP reception statistics and tears the session down.
+         */
+        void shutdown() {
+
+            if (session) {
+
+                MediaSubsessionIterator iter(*session);
+                MediaSubsession *subsession;
+
+                while ((subsession = iter.next()) != nullptr) {
+
+                    if (subsession->rtpSource()) {
+
+                        RTPReceptionStatsDB::Iterator statsIter(subsession->rtpSource()->receptionStatsDB());
+                        RTPReceptionStats *receptionStats;
+
+                        while ((receptionStats = statsIter.next(True)) != nullptr) {
+                            stats.packetsReceived += receptionStats->totNumPacketsReceived();
+                            stats.packetsExpected += receptionStats->totNumPacketsExpected();
+                        }
+                    }
+
+                    if (subsession->sink) {
+                        subsession->sink->stopPlaying();
+                        Medium::close(subsession->sink);
+                        subsession->sink = nullptr;
+                    }
+                }
+
+                sendTeardownCommand(*session, nullptr);
+            }
+        }
+
+    protected:
+
+        LoadSession(UsageEnvironment &env, const std::string &url, SessionStats &stats)
+                : RTSPClient(env, url.c_str(), 0, "LiveVideoStreamLoadGen", 0, -1), stats(stats), session(nullptr),
+                  subsessionIter(nullptr), subsession(nullptr) {}
+
+        ~LoadSession() override {
+            delete subsessionIter;
+            Medium::close(session);
+        }
+
+    private:
+
+        SessionStats &stats;
+
+        MediaSession *session;
+
+        MediaSubsessionIterator *subsessionIter;
+
+        MediaSubsession *subsession;
+
+        void fail(const char *stage, char *resultString) {
+            LOG(WARN) << "Session " << url() << " failed on " << stage << ": " << (resultString ? resultString : "");
+            stats.failed = true;
+        }
+
+        static void continueAfterDESCRIBE(RTSPClient *client, int resultCode, char *resultString) {
+
+            auto self = static_cast<LoadSession *>(client);
+
+            if (resultCode != 0) {
+                self->fail("DESCRIBE", resultString);
+                delete[] resultString;
+                return;
+            }
+
+            self->stats.described = Clock::now();
+            self->session = MediaSession::createNew(self->envir(), resultString);
+            delete[] resultString;
+
+            if (!self->session) {
+                self->fail("SDP parsing", nullptr);
+                return;
+            }
+
+            self->subsessionIter = new MediaSubsessionIterator(*self->session);
+            self->setupNextSubsession();
+        }
+
+        void setupNextSubsession() {
+
+            while ((subsession = subsessionIter->next()) != nullptr) {
+
+                if (!subsession->initiate()) {
+                    fail("subsession initiation", nullptr);
+                    continue;
+                }
+
+                sendSetupCommand(*subsession, continueAfterSETUP, False, stats.useTcp ? True : False);
+                return;
+            }
+
+            // all subsessions have been set up
+            sendPlayCommand(*session, continueAfterPLAY);
+        }
+
+        static void continueAfterSETUP(RTSPClient *client, int resultCode, char *resultString) {
+
+            auto self = static_cast<LoadSession *>(client);
+            delete[] resultString;
+
+            if (resultCode != 0) {
+                self->fail("SETUP", nullptr);
+                return;
+            }
+
+            auto subsession = self->subsession;
+            subsession->sink = StatsSink::createNew(self->envir(), self->stats);
+            subsession->sink->startPlaying(*subsession->readSource(), nullptr, nullptr);
+
+            self->setupNextSubsession();
+        }
+
+        static void continueAfterPLAY(RTSPClient *client, int resultCode, char *resultString) {
+
+            auto self = static_cast<LoadSession *>(client);
+            delete[] resultString;
+
+            if (resultCode != 0) {
+                self->fail("PLAY", nullptr);
+                return;
+            }
+
+            self->stats.playing = Clock::now();
+        }
+    };
+
+    /**
+     * Prints percentiles (p50/p90/p99/max) of the values.
+     */
+    void printPercentiles(const std::string &name, std::vector<double> values, const std::string &unit) {
+
+        if (values.empty()) {
+            printf("%-24s n/a\n", name.c_str());
+            return;
+        }
+
+        std::sort(values.begin(), values.end());
+
+        auto percentile = [&values](double p) {
+            auto idx = static_cast<size_t>(std::ceil(p / 100.0 * values.size())) - 1;
+            return values[std::min(idx, values.size() - 1)];
+        };
+
+        printf("%-24s p50 %10.2f  p90 %10.2f  p99 %10.2f  max %10.2f %s\n", name.c_str(), percentile(50),
+               percentile(90), percentile(99), values.back(), unit.c_str());
+    }
+
+    double standardDeviation(const std::vector<double> &values) {
+
+        if (values.size() < 2) return 0.0;
+
+        double mean = 0.0;
+        for (auto value : values) mean += value;
+        mean /= values.size();
+
+        double sum = 0.0;
+        for (auto value : values) sum += (value - mean) * (value - mean);
+
+        return std::sqrt(sum / (values.size() - 1));
+    }
+
+    bool parseOptions(int argc, char **argv, LoadOptions &options) {
+
+        for (int idx = 1; idx < argc; ++idx) {
+
+            std::string key = argv[idx];
+
+            if (key == "--serve-synthetic") {
+                options.serveSynthetic = true;
+                continue;
+            }
+
+            if (idx + 1 >= argc) return false;
+
+            std::string value = argv[++idx];
+
+            if (key == "--url") {
+                options.url = value;
+            } else if (key == "--sessions") {
+                options.sessions = std::stoul(value);
+            } else if (key == "--transport") {
+                options.transport = value;
+            } else if (key == "--duration") {
+                options.duration = std::stod(value);
+            } else if (key == "--ramp-ms") {
+                options.rampMillis = static_cast<unsigned>(std::stoul(value));
+            } else if (key == "--size") {
+                if (sscanf(value.c_str(), "%zux%zu", &options.width, &options.height) != 2) return false;
+            } else if (key == "--fps") {
+                options.frameRate = std::stoul(value);
+            } else if (key == "--port") {
+                options.port = static_cast<unsigned>(std::stoul(value));
+            } else {
+                return false;
+            }
+        }
+
+        return options.transport == "udp" || options.transport == "tcp" || options.transport == "mixed";
+    }
+
+    void startSession(void *clientData) {
+        static_cast<LoadSession *>(clientData)->start();
+    }
+
+    char stopWatcher = 0;
+
+    void stopLoad(void *) {
+        stopWatcher = 's';
+    }
+}
+
+int main(int argc, char **argv) {
+
+    LoadOptions options;
+
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--url rtsp://...] [--sessions N] [--transport udp|tcp|mixed]"
+                  << " [--duration sec] [--ramp-ms ms] [--serve-synthetic] [--size WxH] [--fps N] [--port N]"
+                  << std::endl;
+        return 1;
+    }
+
+    initLogger(log4cpp::Priority::WARN);
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    LIRS::LiveCameraRTSPServer *server = nullptr;
+    std::thread serverThread;
+
+    if (options.serveSynthetic) { // in-process server on the loopback interface with the synthetic source
+
+        auto graph = "testsrc2=size=" + std::to_string(options.width) + "x" + std::to_string(options.height) +
+                     ":rate=" + std::to_string(options.frameRate);
+
+        auto transcoder = LIRS::Transcoder::newInstance(graph, "synthetic", options.width, options.height, "yuv420p",
+                                                        "yuv420p", options.frameRate, options.frameRate,
+                                                        "realtime,fps=fps=" + std::to_string(options.frameRate),
+                                                        "lavfi");
+
+        if (!transcoder) {
+            std::cerr << "Can't open the synthetic source " << graph << std::endl;
+            return 1;
+        }
+
+        server = new LIRS::LiveCameraRTSPServer(options.port);
+        server->addTranscoder(transcoder);
+
+        serverThread = std::thread([server]() { server->run(); });
+
+        if (options.url.empty()) {
+            options.url = "rtsp://127.0.0.1:" + std::to_string(options.port) + "/synthetic";
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(1)); // let the server start listening
+    }
+
+    if (options.url.empty()) {
+        std::cerr << "Either --url or --serve-synthetic should be specified" << std::endl;
+        return 1;
+    }
+
+    auto scheduler = BasicTaskScheduler::createNew();
+    auto env = BasicUsageEnvironment::createNew(*scheduler);
+
+    std::vector<SessionStats> stats(options.sessions);
+    std::vector<LoadSession *> sessions;
+
+    for (size_t idx = 0; idx < options.sessions; ++idx) {
+
+        stats[idx].useTcp = options.transport == "tcp" || (options.transport == "mixed" && idx % 2 == 1);
+
+        sessions.push_back(LoadSession::createNew(*env, options.url, stats[idx]));
+
+        // ramp up sessions gradually
+        env->taskScheduler().scheduleDelayedTask(static_cast<int64_t>(idx) * options.rampMillis * 1000,
+                                                 startSession, sessions.back());
+    }
+
+    env->taskScheduler().scheduleDelayedTask(static_cast<int64_t>(options.duration * 1e6), stopLoad, nullptr);
+    env->taskScheduler().doEventLoop(&stopWatcher);
+
+    auto finished = Clock::now();
+
+    for (auto session : sessions) {
+        session->shutdown();
+    }
+
+    // summary
+    std::vector<double> setupTimes, firstFrameTimes, jitters, lossRatios, bitrates, packetRates;
+    size_t failed = 0, tcpSessions = 0;
+
+    for (auto &session : stats) {
+
+        if (session.useTcp) tcpSessions++;
+
+        if (session.failed || !session.hasFirstFrame) {
+            failed++;
+            continue;
+        }
+
+        auto receiving = millisBetween(session.firstFrame, finished) / 1000.0;
+
+        setupTimes.push_back(millisBetween(session.started, session.playing));
+        firstFrameTimes.push_back(millisBetween(session.started, session.firstFrame));
+        jitters.push_back(standardDeviation(session.frameIntervals));
+        bitrates.push_back(receiving > 0 ? session.bytes * 8 / receiving / 1000 : 0.0);
+        packetRates.push_back(receiving > 0 ? session.packetsReceived / receiving : 0.0);
+
+        auto lost = session.packetsExpected > session.packetsReceived ?
+                    session.packetsExpected - session.packetsReceived : 0;
+        lossRatios.push_back(session.packetsExpected ? 100.0 * lost / session.packetsExpected : 0.0);
+    }
+
+    printf("url: %s, sessions: %zu (tcp: %zu), failed: %zu, duration: %.1f s\n", options.url.c_str(),
+           options.sessions, tcpSessions, failed, options.duration);
+
+    printPercentiles("DESCRIBE->PLAY", setupTimes, "ms");
+    printPercentiles("DESCRIBE->first frame", firstFrameTimes, "ms");
+    printPercentiles("inter-frame jitter", jitters, "ms");
+    printPercentiles("RTP sequence gaps", lossRatios, "%");
+    printPercentiles("bitrate", bitrates, "kbit/s");
+    printPercentiles("RTP packets", packetRates, "pkt/s");
+
+    // let the TEARDOWN requests go out
+    env->taskScheduler().scheduleDelayedTask(200 * 1000, stopLoad, nullptr);
+    stopWatcher = 0;
+    env->taskScheduler().doEventLoop(&stopWatcher);
+
+    for (auto session : sessions) {
+        Medium::close(session);
+    }
+
+    env->reclaim();
+    delete scheduler;
+
+    if (server) {
+        server->stopServer();
+        serverThread.join();
+        delete server;
+    }
+
+    return failed == 0 ? 0 : 2;
+}
@@ -0,0 +1,273 @@
+/**
+ * Benchmark of the event loop's overhead with many watched sockets (select() vs epoll schedulers).
+ *
+ * Creates N datagram socket pairs watched by the scheduler, each socket has a liveness timer rescheduled when
+ * the socket is read (as the RTSP client sessions do). Each round writes to a few random sockets and runs the loop
+ * until all of them are handled, so the round's time is the loop's cost of the idle sockets and timers. Reports
+ * the wall and CPU time per round as JSON, select() is skipped when the sockets exceed FD_SETSIZE.
+ *
+ * Usage: LiveVideoStreamSchedulerBench [--sockets 100,1000,5000] [--active 16] [--rounds 2000]
+ *                                      [--output <file.json>]
+ */
+
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <BasicUsageEnvironment.hh>
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "EpollTaskScheduler.hpp"
+#include "Logger.hpp"
+
+namespace {
+
+    /**
+     * Benchmark parameters (see usage).
+     */
+    struct BenchOptions {
+        std::vector<size_t> sockets = {100, 1000, 5000};
+        size_t active = 16;
+        size_t rounds = 2000;
+        std::string output;
+    };
+
+    struct PassResult {
+        bool isSupported = false;
+        double wallUsPerRound = 0;
+        double cpuUsPerRound = 0;
+        double wallUsPerEvent = 0;
+    };
+
+    /**
+     * Liveness timeout of the sockets (never expires during the benchmark).
+     */
+    const int64_t LIVENESS_TIMEOUT_US = 65 * 1000000LL;
+
+    struct BenchState;
+
+    /**
+     * Watched socket with its liveness timer.
+     */
+    struct WatchedSocket {
+        BenchState *state;
+        int readSocket;
+        int writeSocket;
+        TaskToken livenessTask;
+    };
+
+    struct BenchState {
+        TaskScheduler *scheduler;
+        std::vector<WatchedSocket> sockets;
+        size_t handled = 0;
+        size_t expected = 0;
+        char watchVariable = 0;
+    };
+
+    void onLivenessTimeout(void *) {}
+
+    void onReadable(void *clientData, int) {
+
+        auto socket = static_cast<WatchedSocket *>(clientData);
+        auto state = socket->state;
+
+        char byte;
+
+        if (recv(socket->readSocket, &byte, sizeof(byte), MSG_DONTWAIT) != 1) return;
+
+        state->scheduler->unscheduleDelayedTask(socket->livenessTask);
+        socket->livenessTask = state->scheduler->scheduleDelayedTask(LIVENESS_TIMEOUT_US, onLivenessTimeout,
+                                                                     socket);
+
+        if (++state->handled == state->expected) state->watchVariable = 1;
+    }
+
+    bool parseOptions(int argc, char **argv, BenchOptions &options) {
+
+        for (int idx = 1; idx + 1 < argc; idx += 2) {
+
+            std::string key = argv[idx];
+            std::string value = argv[idx + 1];
+
+            if (key == "--sockets") {
+
+                options.sockets.clear();
+
+                std::istringstream list(value);
+                std::string item;
+
+                while (std::getline(list, item, ',')) {
+                    options.sockets.push_back(std::stoul(item));
+                }
+
+            } else if (key == "--active") {
+                options.active = std::stoul(value);
+            } else if (key == "--rounds") {
+                options.rounds = std::stoul(value);
+            } else if (key == "--output") {
+                options.output = value;
+            } else {
+                std::cerr << "Unknown option: " << key << std::endl;
+                return false;
+            }
+        }
+
+        return argc % 2 == 1 && !options.sockets.empty() && options.active > 0 && options.rounds > 0;
+    }
+
+    PassResult runPass(TaskScheduler *scheduler, size_t numSockets, const BenchOptions &options, bool isSelect) {
+
+        PassResult result;
+
+        BenchState state;
+        state.scheduler = scheduler;
+        state.sockets.resize(numSockets);
+
+        size_t created = 0;
+
+        for (; created < numSockets; created++) {
+
+            int pair[2];
+
+            if (socketpair(AF_UNIX, SOCK_DGRAM, 0, pair) != 0) break;
+
+            state.sockets[created] = WatchedSocket{&state, pair[0], pair[1], nullptr};
+
+            if (isSelect && pair[1] >= FD_SETSIZE) { // select() can't watch it
+                close(pair[0]);
+                close(pair[1]);
+                break;
+            }
+        }
+
+        if (created == numSockets) {
+
+            for (auto &socket : state.sockets) {
+                scheduler->turnOnBackgroundReadHandling(socket.readSocket, onReadable, &socket);
+                socket.livenessTask = scheduler->scheduleDelayedTask(LIVENESS_TIMEOUT_US, onLivenessTimeout,
+                                                                     &socket);
+            }
+
+            std::mt19937 random(42);
+            std::uniform_int_distribution<size_t> pick(0, numSockets - 1);
+
+            auto wallStart = std::chrono::steady_clock::now();
+            auto cpuStart = std::clock();
+
+            for (size_t round = 0; round < options.rounds; round++) {
+
+                state.handled = 0;
+                state.expected = options.active;
+                state.watchVariable = 0;
+
+                for (size_t idx = 0; idx < options.active; idx++) {
+                    char byte = 1;
+                    auto written = send(state.sockets[pick(random)].writeSocket, &byte, sizeof(byte), 0);
+                    static_cast<void>(written);
+                }
+
+                scheduler->doEventLoop(&state.watchVariable);
+            }
+
+            auto wallUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                    wallStart).count();
+            auto cpuUs = (std::clock() - cpuStart) * 1e6 / CLOCKS_PER_SEC;
+
+            result.isSupported = true;
+            result.wallUsPerRound = wallUs / options.rounds;
+            result.cpuUsPerRound = cpuUs / options.rounds;
+            result.wallUsPerEvent = result.wallUsPerRound / options.active;
+
+            for (auto &socket : state.sockets) {
+                scheduler->unscheduleDelayedTask(socket.livenessTask);
+                scheduler->turnOffBackgroundReadHandling(socket.readSocket);
+            }
+        }
+
+        for (size_t idx = 0; idx < created; idx++) {
+            close(state.sockets[idx].readSocket);
+            close(state.sockets[idx].writeSocket);
+        }
+
+        return result;
+    }
+}
+
+int main(int argc, char **argv) {
+
+    BenchOptions options;
+
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--sockets 100,1000,5000] [--active 16] [--rounds 2000]"
+                  << " [--output file.json]" << std::endl;
+        return 1;
+    }
+
+    initLogger(log4cpp::Priority::WARN);
+
+    // two descriptors per watched socket
+    struct rlimit limit = {};
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    std::ostringstream json;
+    json.precision(3);
+    json << std::fixed;
+
+    json << "{\n  \"config\": {\"active\": " << options.active << ", \"rounds\": " << options.rounds
+         << ", \"fd_setsize\": " << FD_SETSIZE << "},\n  \"results\": [";
+
+    auto isFirst = true;
+
+    for (auto numSockets : options.sockets) {
+
+        for (auto isSelect : {true, false}) {
+
+            TaskScheduler *scheduler;
+
+            if (isSelect) {
+                scheduler = BasicTaskScheduler::createNew();
+            } else {
+                scheduler = LIRS::EpollTaskScheduler::createNew();
+            }
+
+            auto result = runPass(scheduler, numSockets, options, isSelect);
+
+            delete scheduler;
+
+            json << (isFirst ? "\n" : ",\n") << "    {\"sockets\": " << numSockets << ", \"scheduler\": \""
+                 << (isSelect ? "select" : "epoll") << "\", \"supported\": " << (result.isSupported ? "true" : "false");
+
+            if (result.isSupported) {
+                json << ", \"wall_us_per_round\": " << result.wallUsPerRound << ", \"cpu_us_per_round\": "
+                     << result.cpuUsPerRound << ", \"wall_us_per_event\": " << result.wallUsPerEvent;
+            }
+
+            json << "}";
+
+            isFirst = false;
+        }
+    }
+
+    json << "\n  ]\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.output) << json.str();
+    }
+
+    return 0;
+}
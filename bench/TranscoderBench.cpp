@@ -0,0 +1,318 @@
+/**
+ * Headless benchmark of the transcoding pipeline (decode -> filter -> sws_scale -> encode).
+ *
+ * Feeds the transcoders from the synthetic lavfi source (testsrc2) or recorded raw/YUV files and reports
+ * per-stream throughput, per-stage time, CPU and memory usage and the (parallel) startup time as JSON.
+ *
+ * Usage: LiveVideoStreamBench [--source testsrc2|<file>] [--format <input format>] [--size 640x480] [--fps 15]
+ *                             [--out-fps 15] [--pix-fmt yuv420p] [--cameras 1] [--duration 10] [--realtime]
+ *                             [--encoder-cores N] [--motion-gating] [--governor] [--output <file.json>]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Transcoder.hpp"
+
+namespace {
+
+    /**
+     * Benchmark parameters (see usage).
+     */
+    struct BenchOptions {
+        std::string source = "testsrc2";
+        std::string format;
+        size_t width = 640;
+        size_t height = 480;
+        size_t frameRate = 15;
+        size_t outputFrameRate = 15;
+        std::string pixelFormat = "yuv420p";
+        size_t cameras = 1;
+        double duration = 10.0;
+        bool realtime = false;
+        bool motionGating = false;
+        bool governor = false;
+        size_t encoderCores = 0;
+        std::string output;
+    };
+
+    /**
+     * Per stream results.
+     */
+    struct StreamResult {
+        std::string alias;
+        double wallTime = 0.0;
+    };
+
+    bool endsWith(const std::string &str, const std::string &suffix) {
+        return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    bool parseOptions(int argc, char **argv, BenchOptions &options) {
+
+        for (int idx = 1; idx < argc; ++idx) {
+
+            std::string key = argv[idx];
+
+            if (key == "--realtime") {
+                options.realtime = true;
+                continue;
+            }
+
+            if (key == "--motion-gating") {
+                options.motionGating = true;
+                continue;
+            }
+
+            if (key == "--governor") {
+                options.governor = true;
+                continue;
+            }
+
+            if (idx + 1 >= argc) {
+                std::cerr << "Missing value for " << key << std::endl;
+                return false;
+            }
+
+            std::string value = argv[++idx];
+
+            if (key == "--source") {
+                options.source = value;
+            } else if (key == "--format") {
+                options.format = value;
+            } else if (key == "--size") {
+                if (sscanf(value.c_str(), "%zux%zu", &options.width, &options.height) != 2) return false;
+            } else if (key == "--fps") {
+                options.frameRate = std::stoul(value);
+            } else if (key == "--out-fps") {
+                options.outputFrameRate = std::stoul(value);
+            } else if (key == "--pix-fmt") {
+                options.pixelFormat = value;
+            } else if (key == "--cameras") {
+                options.cameras = std::stoul(value);
+            } else if (key == "--duration") {
+                options.duration = std::stod(value);
+            } else if (key == "--encoder-cores") {
+                options.encoderCores = std::stoul(value);
+            } else if (key == "--output") {
+                options.output = value;
+            } else {
+                std::cerr << "Unknown option: " << key << std::endl;
+                return false;
+            }
+        }
+
+        return options.cameras > 0 && options.frameRate > 0 && options.outputFrameRate > 0;
+    }
+
+    /**
+     * Reads the value (in kB) of the specified field from /proc/self/status, e.g. VmRSS, VmHWM.
+     */
+    long readProcStatusKb(const std::string &field) {
+
+        std::ifstream status("/proc/self/status");
+        std::string line;
+
+        while (std::getline(status, line)) {
+            if (line.compare(0, field.size() + 1, field + ":") == 0) {
+                return std::stol(line.substr(field.size() + 1));
+            }
+        }
+
+        return -1;
+    }
+
+    /**
+     * Returns CPU time (user + system) consumed by the process in seconds.
+     */
+    double processCpuTime() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    double averageMillis(uint64_t totalNanos, uint64_t count) {
+        return count ? static_cast<double>(totalNanos) / count / 1e6 : 0.0;
+    }
+
+    LIRS::Transcoder *createTranscoder(const BenchOptions &options, size_t index) {
+
+        std::string url = options.source;
+        std::string format = options.format;
+
+        if (options.source == "testsrc2") { // synthetic source, the filter graph is the url
+            std::ostringstream graph;
+            graph << "testsrc2=size=" << options.width << "x" << options.height << ":rate=" << options.frameRate
+                  << ",format=" << options.pixelFormat;
+            url = graph.str();
+            if (format.empty()) format = "lavfi";
+        } else if (format.empty() && (endsWith(url, ".yuv") || endsWith(url, ".raw"))) {
+            format = "rawvideo";
+        }
+
+        // the realtime filter throttles the pipeline to the source's timestamps
+        std::string filterQuery = std::string(options.realtime ? "realtime," : "") + "fps=fps=" +
+                                  std::to_string(options.outputFrameRate);
+
+        return LIRS::Transcoder::newInstance(url, "bench" + std::to_string(index), options.width, options.height,
+                                             options.pixelFormat, "yuv420p", options.frameRate,
+                                             options.outputFrameRate, filterQuery, format);
+    }
+}
+
+int main(int argc, char **argv) {
+
+    BenchOptions options;
+
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--source testsrc2|<file>] [--format <input format>] [--size WxH]"
+                  << " [--fps N] [--out-fps N] [--pix-fmt yuv420p] [--cameras N] [--duration sec] [--realtime]"
+                  << " [--encoder-cores N] [--motion-gating] [--governor] [--output file.json]" << std::endl;
+        return 1;
+    }
+
+    initLogger(log4cpp::Priority::WARN);
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    // cores shared by the encoders (0 - all hardware threads)
+    LIRS::EncoderThreadBudget::getInstance().setCoreBudget(options.encoderCores);
+
+    auto rssAtStart = readProcStatusKb("VmRSS");
+
+    std::vector<std::unique_ptr<LIRS::Transcoder>> transcoders(options.cameras);
+    std::vector<StreamResult> results(options.cameras);
+
+    // sources are opened in parallel as by the server
+    auto startupStart = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> initializationThreads;
+
+    for (size_t idx = 0; idx < options.cameras; ++idx) {
+        initializationThreads.emplace_back([&options, &transcoders, idx]() {
+            transcoders[idx].reset(createTranscoder(options, idx));
+        });
+    }
+
+    for (auto &thread : initializationThreads) {
+        thread.join();
+    }
+
+    for (auto &transcoder : transcoders) {
+        if (!transcoder) {
+            std::cerr << "Can't open the source " << options.source << std::endl;
+            return 1;
+        }
+    }
+
+    auto startupTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startupStart).count();
+
+    for (size_t idx = 0; idx < options.cameras; ++idx) {
+        // drop encoded data
+        transcoders[idx]->setOnEncodedDataCallback([](std::vector<uint8_t> &&, const struct timeval &) {});
+
+        LIRS::MotionGatingOptions motionGating;
+        motionGating.enabled = options.motionGating;
+        transcoders[idx]->setMotionGating(motionGating);
+
+        LIRS::OverloadGovernorOptions governor;
+        governor.enabled = options.governor;
+        transcoders[idx]->setOverloadGovernor(governor);
+
+        results[idx].alias = transcoders[idx]->getAlias();
+    }
+
+    auto cpuAtStart = processCpuTime();
+    auto benchStart = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+
+    for (size_t idx = 0; idx < options.cameras; ++idx) {
+        threads.emplace_back([&transcoders, &results, idx]() {
+            auto start = std::chrono::steady_clock::now();
+            transcoders[idx]->run();
+            results[idx].wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+    }
+
+    // run for the specified duration (file inputs may finish earlier)
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+
+    auto rssAtEnd = readProcStatusKb("VmRSS");
+
+    for (auto &transcoder : transcoders) {
+        transcoder->stop();
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    auto benchTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchStart).count();
+    auto cpuTime = processCpuTime() - cpuAtStart;
+
+    std::ostringstream json;
+    json.precision(3);
+    json << std::fixed;
+
+    json << "{\n  \"config\": {\"source\": \"" << options.source << "\", \"width\": " << options.width
+         << ", \"height\": " << options.height << ", \"fps\": " << options.frameRate
+         << ", \"output_fps\": " << options.outputFrameRate << ", \"pixel_format\": \"" << options.pixelFormat
+         << "\", \"cameras\": " << options.cameras << ", \"realtime\": " << (options.realtime ? "true" : "false")
+         << ", \"motion_gating\": " << (options.motionGating ? "true" : "false")
+         << ", \"governor\": " << (options.governor ? "true" : "false")
+         << "},\n  \"streams\": [\n";
+
+    for (size_t idx = 0; idx < options.cameras; ++idx) {
+
+        const auto &stats = transcoders[idx]->getStatistics();
+        const auto &metrics = LIRS::Metrics::getInstance();
+        auto wallTime = results[idx].wallTime > 0 ? results[idx].wallTime : benchTime;
+
+        json << "    {\"alias\": \"" << results[idx].alias << "\""
+             << ", \"packets_read\": " << stats.packetsRead.load()
+             << ", \"frames_decoded\": " << stats.framesDecoded.load()
+             << ", \"frames_encoded\": " << stats.framesEncoded.load()
+             << ", \"frames_skipped\": " << stats.framesSkipped.load()
+             << ", \"encoder_delay_frames_max\": " << stats.maxEncoderDelayFrames.load()
+             << ", \"encoder_latency_avg_ms\": " << averageMillis(stats.encoderLatency, stats.packetsEncoded)
+             << ", \"init_ms\": " << transcoders[idx]->getInitializationTimeMs()
+             << ", \"governor_level\": " << metrics.get("governor." + results[idx].alias + ".level")
+             << ", \"wall_time_s\": " << wallTime
+             << ", \"fps\": " << stats.framesEncoded.load() / wallTime
+             << ", \"bitrate_kbps\": " << stats.encodedBytes.load() * 8 / wallTime / 1000
+             << ", \"stage_avg_ms\": {\"decode\": " << averageMillis(stats.decodeTime, stats.framesDecoded)
+             << ", \"filter\": " << averageMillis(stats.filterTime, stats.framesFiltered)
+             << ", \"scale\": " << averageMillis(stats.scaleTime, stats.framesFiltered)
+             << ", \"encode\": " << averageMillis(stats.encodeTime, stats.framesFiltered) << "}"
+             << ", \"thread_cpu_percent\": " << stats.threadCpuTime.load() / 1e9 / wallTime * 100
+             << "}" << (idx + 1 < options.cameras ? "," : "") << "\n";
+    }
+
+    json << "  ],\n  \"process\": {\"startup_ms\": " << startupTime * 1000
+         << ", \"cpu_percent\": " << cpuTime / benchTime * 100
+         << ", \"cpu_percent_per_stream\": " << cpuTime / benchTime * 100 / options.cameras
+         << ", \"rss_kb\": " << rssAtEnd << ", \"peak_rss_kb\": " << readProcStatusKb("VmHWM")
+         << ", \"rss_per_stream_kb\": " << (rssAtEnd - rssAtStart) / static_cast<long>(options.cameras)
+         << "}\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.output) << json.str();
+    }
+
+    return 0;
+}
@@ -0,0 +1,216 @@
+#ifndef LIVE_VIDEO_STREAM_ADMISSION_CONTROLLER_HPP
+#define LIVE_VIDEO_STREAM_ADMISSION_CONTROLLER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace LIRS {
+
+    /**
+     * Priority class of the clients from the network, e.g. operator consoles.
+     */
+    typedef struct PriorityNetwork {
+
+        /**
+         * IPv4 network in the CIDR notation, e.g. '10.0.1.0/24' (a single address w/o the prefix length).
+         */
+        std::string network;
+
+        unsigned priority;
+
+    } PriorityNetwork;
+
+    /**
+     * Budget of the server's host the clients' sessions are admitted within.
+     */
+    typedef struct AdmissionOptions {
+
+        /**
+         * Total bitrate sent to the clients in kbps (0 - unlimited).
+         */
+        uint64_t maxEgressKbps;
+
+        /**
+         * Share of all CPU cores used by the server's process, e.g. 0.8 (0 - unlimited).
+         */
+        double maxCpuLoad;
+
+        /**
+         * Clients' priority classes (the first matching network), other clients are viewers.
+         * The session of the higher class preempts the sessions of the lower ones when the budget is exceeded.
+         */
+        std::vector<PriorityNetwork> priorityNetworks;
+
+        AdmissionOptions() : maxEgressKbps(0), maxCpuLoad(0) {}
+
+    } AdmissionOptions;
+
+    /**
+     * Decides whether a new client's session fits into the host's egress and CPU budget (event loop's thread).
+     *
+     * The egress is the sum of the current bitrates of the admitted sessions' streams (each session receives its
+     * stream once), so the budget follows the measured bitrates instead of the bitrates at the admission.
+     * The CPU load is the process's CPU time over the wall time of all cores between two samples.
+     *
+     * The session exceeding the budget is rejected, unless it preempts the sessions of the lower priority classes:
+     * the lowest class first, the most recently admitted session first, until the egress fits (the CPU is assumed
+     * to be relieved by a single preempted session).
+     *
+     * Metrics: 'admission.sessions', 'admission.egress_kbps', 'admission.cpu_load_x1000', 'admission.rejected',
+     * 'admission.preempted'.
+     */
+    class AdmissionController {
+
+    public:
+
+        AdmissionController();
+
+        /**
+         * Sets the budget (the admitted sessions are kept).
+         */
+        void configure(const AdmissionOptions &options);
+
+        /**
+         * Returns whether any budget is limited.
+         */
+        bool isEnabled() const;
+
+        /**
+         * Adds the stream the sessions may be admitted to, its bitrate is estimated until it's measured.
+         *
+         * @param name - name of the stream (RTSP URL's suffix).
+         */
+        void addStream(const std::string &name);
+
+        /**
+         * Removes the stream (its sessions are released when they're closed).
+         */
+        void removeStream(const std::string &name);
+
+        bool hasStream(const std::string &name) const;
+
+        /**
+         * Updates the measured bitrate of the stream.
+         *
+         * @param name - name of the stream.
+         * @param bitrateKbps - bitrate in kbps (0 - not measured yet).
+         */
+        void setStreamBitrate(const std::string &name, unsigned bitrateKbps);
+
+        /**
+         * Measures the CPU load since the previous sample.
+         *
+         * @return the load (share of all cores).
+         */
+        double sampleCpuLoad();
+
+        /**
+         * Returns the priority class of the client.
+         *
+         * @param address - IPv4 address of the client (host byte order).
+         */
+        unsigned getPriority(uint32_t address) const;
+
+        /**
+         * Admits the session if it fits into the budget (possibly preempting the sessions of the lower classes).
+         *
+         * @param sessionId - RTSP session's identifier.
+         * @param stream - name of the requested stream.
+         * @param priority - client's priority class.
+         * @param preempted - sessions to be closed by the caller (already released).
+         * @return true if the session has been admitted, otherwise - false.
+         */
+        bool admit(uint32_t sessionId, const std::string &stream, unsigned priority, std::vector<uint32_t> &preempted);
+
+        /**
+         * Releases the admitted session (ignored if it isn't admitted).
+         */
+        void release(uint32_t sessionId);
+
+        /**
+         * Returns the egress of the admitted sessions in kbps.
+         */
+        uint64_t getEgressKbps() const;
+
+        /** Constants **/
+
+        /**
+         * Priority class of the clients from the networks not listed in the options.
+         */
+        static const unsigned PRIORITY_VIEWER = 0;
+
+        /**
+         * Priority class of the operator consoles (a suggested value, any greater class may be configured).
+         */
+        static const unsigned PRIORITY_OPERATOR = 10;
+
+        /**
+         * Bitrate of the stream assumed until it's measured in kbps.
+         */
+        static const unsigned DEFAULT_STREAM_BITRATE_KBPS = 400;
+
+    private:
+
+        typedef struct AdmittedSession {
+
+            std::string stream;
+
+            unsigned priority;
+
+            /**
+             * Order of the admission (the most recent sessions are preempted first).
+             */
+            uint64_t order;
+
+        } AdmittedSession;
+
+        typedef struct ParsedNetwork {
+
+            uint32_t address;
+
+            uint32_t mask;
+
+            unsigned priority;
+
+        } ParsedNetwork;
+
+        AdmissionOptions options;
+
+        std::vector<ParsedNetwork> networks;
+
+        std::map<uint32_t, AdmittedSession> sessions;
+
+        /**
+         * Bitrates of the streams in kbps (0 - not measured yet).
+         */
+        std::map<std::string, unsigned> streamBitrates;
+
+        uint64_t nextOrder;
+
+        double cpuLoad;
+
+        /**
+         * Process's CPU time and the wall time of the previous sample.
+         */
+        std::chrono::nanoseconds lastCpuTime;
+
+        std::chrono::steady_clock::time_point lastSampleTime;
+
+        /**
+         * Returns the bitrate of the stream in kbps (the default one if it isn't measured yet).
+         */
+        unsigned getStreamBitrate(const std::string &stream) const;
+
+        /**
+         * Returns the process's CPU time (all threads).
+         */
+        static std::chrono::nanoseconds getProcessCpuTime();
+
+        void updateMetrics() const;
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_ADMISSION_CONTROLLER_HPP
@@ -0,0 +1,113 @@
+#ifndef LIVE_VIDEO_STREAM_ADMISSION_RTSP_SERVER_HPP
+#define LIVE_VIDEO_STREAM_ADMISSION_RTSP_SERVER_HPP
+
+#include <RTSPServer.hh>
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "AdmissionController.hpp"
+
+namespace LIRS {
+
+    /**
+     * RTSP server admitting the clients' sessions within the budget of the admission controller.
+     *
+     * The first SETUP of the session is checked before it's handled: the session exceeding the budget is answered
+     * with "453 Not Enough Bandwidth" (no stream state is created), the sessions preempted by a client of a higher
+     * priority class are closed (their clients receive the RTCP BYE). The session is released when it's closed
+     * (TEARDOWN, liveness timeout, removal of the stream).
+     */
+    class AdmissionRTSPServer : public RTSPServer {
+
+    public:
+
+        /**
+         * Creates a new server listening on the port.
+         *
+         * @param env - environment (see Live555 docs).
+         * @param ourPort - RTSP port number.
+         * @param admission - admission controller (outlives the server).
+         * @return pointer to the created server or nullptr if the port can't be bound.
+         */
+        static AdmissionRTSPServer *createNew(UsageEnvironment &env, Port ourPort, AdmissionController &admission);
+
+        /** Constants **/
+
+        /**
+         * Time after which the session w/o the liveness indication (RTCP RR, RTSP command) is closed in seconds.
+         */
+        static const unsigned RECLAMATION_SECONDS = 65;
+
+    protected:
+
+        AdmissionRTSPServer(UsageEnvironment &env, int ourSocket, Port ourPort, AdmissionController &admission);
+
+        ClientConnection *createNewClientConnection(int clientSocket, struct sockaddr_in clientAddr) override;
+
+        ClientSession *createNewClientSession(uint32_t sessionId) override;
+
+    private:
+
+        /**
+         * Connection rejecting the session's SETUP on behalf of the session.
+         */
+        class AdmissionClientConnection : public RTSPClientConnection {
+
+        public:
+
+            AdmissionClientConnection(AdmissionRTSPServer &ourServer, int clientSocket, struct sockaddr_in clientAddr);
+
+            /**
+             * Returns the client's IPv4 address (host byte order).
+             */
+            uint32_t getClientAddress() const;
+
+            /**
+             * Sets the response of the current command to "453 Not Enough Bandwidth".
+             */
+            void rejectNotEnoughBandwidth();
+        };
+
+        /**
+         * Session checking its first SETUP and releasing the admission when it's closed.
+         */
+        class AdmissionClientSession : public RTSPClientSession {
+
+        public:
+
+            AdmissionClientSession(AdmissionRTSPServer &ourServer, uint32_t sessionId);
+
+            /**
+             * Releases the admitted session (public, so the preempted session can be closed by the server).
+             */
+            ~AdmissionClientSession() override;
+
+        protected:
+
+            void handleCmd_SETUP(RTSPClientConnection *ourClientConnection, char const *urlPreSuffix,
+                                 char const *urlSuffix, char const *fullRequestStr) override;
+
+        private:
+
+            AdmissionRTSPServer &ourAdmissionServer;
+
+            bool isAdmitted;
+
+            /**
+             * Returns the name of the stream the SETUP refers to (as looked up by Live555), empty if it's unknown.
+             */
+            std::string findStreamName(char const *urlPreSuffix, char const *urlSuffix) const;
+        };
+
+        AdmissionController &admission;
+
+        /**
+         * Admitted sessions by their identifiers (the preempted sessions are looked up).
+         */
+        std::map<uint32_t, AdmissionClientSession *> admittedSessions;
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_ADMISSION_RTSP_SERVER_HPP
@@ -2,11 +2,22 @@
 #define LIVE_VIDEO_STREAM_CUSTOM_SERVER_MEDIA_SUBSESSION_HPP
 
 #include <OnDemandServerMediaSubsession.hh>
-#include <StreamReplicator.hh>
+#include <H264VideoRTPSink.hh>
+#include <H264VideoStreamDiscreteFramer.hh>
 #include <H265VideoRTPSink.hh>
 #include <H265VideoStreamDiscreteFramer.hh>
 
 #include <Logger.hpp>
+#include "FrameFanout.hpp"
+#include "HevcAggregatingRTPSink.hpp"
+
+#include <functional>
+#include <map>
+#include <memory>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
 
 namespace LIRS {
 
@@ -16,19 +27,174 @@ namespace LIRS {
     class CameraUnicastServerMediaSubsession : public OnDemandServerMediaSubsession {
 
     public:
-        static CameraUnicastServerMediaSubsession *createNew(UsageEnvironment &env, StreamReplicator *replicator);
+        /**
+         * Creates a new subsession streaming the replicated encoded data.
+         *
+         * @param env - environment (see Live555 docs).
+         * @param fanout - source of the encoded data (NAL units w/o start codes) shared by the clients.
+         * @param codecId - codec of the encoded data (HEVC or H.264).
+         * @param isNalAggregationEnabled - whether small HEVC NAL units are sent in aggregation packets.
+         * @param pacingSpreadUs - time the packets of a picture are spread over in microseconds (0 - not paced),
+         *                         HEVC packets of the aggregating sink only.
+         * @param retransmissionCacheSize - number of the sent packets cached for the retransmission on NACK
+         *                                  (0 - disabled), HEVC packets of the aggregating sink only. The payloads
+         *                                  are stored once per stream, each client keeps their headers.
+         * @return pointer to the created subsession.
+         */
+        static CameraUnicastServerMediaSubsession *createNew(UsageEnvironment &env, FrameFanout *fanout,
+                                                             AVCodecID codecId = AV_CODEC_ID_HEVC,
+                                                             bool isNalAggregationEnabled = true,
+                                                             unsigned pacingSpreadUs = 0,
+                                                             size_t retransmissionCacheSize = 0);
+
+        /**
+         * Starts the stream sizing the packet buffers from the observed frame sizes.
+         * The fragmenter's buffer is allocated on the first PLAY using the global OutPacketBuffer::maxSize.
+         */
+        void startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler,
+                         void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp,
+                         ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler,
+                         void *serverRequestAlternativeByteHandlerClientData) override;
+
+        /**
+         * Sets callback function called (event loop's thread) when a client asks for a keyframe with
+         * the RTCP PLI or FIR, e.g. requesting it from the transcoder.
+         *
+         * @param callback - callback function.
+         */
+        void setOnKeyframeRequestCallback(std::function<void()> callback);
+
+        /** Constants **/
+
+        /**
+         * Upper bound of the packet buffers (the largest frame the fan-out can publish).
+         */
+        static const unsigned MAX_PACKET_BUFFER_SIZE = FrameFanout::INPUT_BUFFER_SIZE;
+
+        static const unsigned MIN_PACKET_BUFFER_SIZE = 100 * 1000;
+
+        /**
+         * Bitrate reported before the stream's bitrate has been measured (kbps).
+         */
+        static const unsigned DEFAULT_ESTIMATED_BITRATE = 400;
+
+        /**
+         * Safety margin applied to the observed frame sizes and bitrate.
+         */
+        static constexpr double SIZE_MARGIN = 1.5;
+
+        /**
+         * RTCP feedback packet types (transport layer, payload-specific) and their formats (RFC 4585, RFC 5104).
+         */
+        static const uint8_t RTCP_RTPFB_PACKET_TYPE = 205;
+
+        static const uint8_t RTCP_PSFB_PACKET_TYPE = 206;
+
+        static const uint8_t RTCP_GENERIC_NACK_FORMAT = 1;
+
+        static const uint8_t RTCP_PLI_FORMAT = 1;
+
+        static const uint8_t RTCP_FIR_FORMAT = 4;
 
     protected:
 
-        StreamReplicator *replicator;
+        FrameFanout *fanout;
+
+        /**
+         * Codec of the streamed data, defines the framer and RTP sink to be used.
+         */
+        AVCodecID codecId;
+
+        /**
+         * Whether the HEVC RTP sink aggregates small NAL units (otherwise the Live555's H265VideoRTPSink is used).
+         */
+        bool isNalAggregationEnabled;
 
-        CameraUnicastServerMediaSubsession(UsageEnvironment &env, StreamReplicator *replicator);
+        /**
+         * Time the packets of a picture are spread over (0 - sent back to back).
+         */
+        unsigned pacingSpreadUs;
+
+        /**
+         * Number of the sent packets cached for the retransmissions (0 - NACKs are ignored).
+         */
+        size_t retransmissionCacheSize;
+
+        /**
+         * Payloads of the sent packets shared by the clients' sinks (nullptr - not cached).
+         */
+        std::shared_ptr<RetransmissionPayloads> retransmissionPayloads;
+
+        CameraUnicastServerMediaSubsession(UsageEnvironment &env, FrameFanout *fanout, AVCodecID codecId,
+                                           bool isNalAggregationEnabled, unsigned pacingSpreadUs,
+                                           size_t retransmissionCacheSize);
 
         FramedSource *createNewStreamSource(unsigned clientSessionId, unsigned &estBitrate) override;
 
         RTPSink *createNewRTPSink(Groupsock *rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic,
                                   FramedSource *inputSource) override;
 
+        void closeStreamSource(FramedSource *inputSource) override;
+
+        /**
+         * Creates the RTCP instance handling the client's feedback (NACK, PLI, FIR).
+         */
+        RTCPInstance *createRTCP(Groupsock *rtcpGroupsock, unsigned totSessionBW, unsigned char const *cname,
+                                 RTPSink *sink) override;
+
+    private:
+
+        /**
+         * Whether the sinks are HevcAggregatingRTPSink (the packets can be paced and cached).
+         */
+        bool isAggregatingSink() const;
+
+        /**
+         * Memory saved by each stream source's packet buffers compared to the maximum size (bytes).
+         */
+        std::map<FramedSource *, unsigned> savedBufferSizes;
+
+        /**
+         * Size of each stream source's packet buffers (metric 'memory.<stream>.packet_buffers_bytes').
+         */
+        std::map<FramedSource *, unsigned> packetBufferSizes;
+
+        /**
+         * Fan-out replica of each stream source (its client's RTP sink is set to it for the layer selection).
+         */
+        std::map<FramedSource *, FanoutFramedSource *> replicas;
+
+        /**
+         * RTP sink of each stream source (the feedback is addressed by the sink's SSRC).
+         */
+        std::map<FramedSource *, RTPSink *> sinks;
+
+        std::function<void()> onKeyframeRequestCallback;
+
+        static void onRtcpPacket(void *clientData, unsigned char *packet, unsigned &packetSize);
+
+        /**
+         * Parses the compound RTCP packet of the client: retransmits the packets of the generic NACKs,
+         * requests a keyframe on PLI or FIR.
+         */
+        void handleRtcpPacket(const unsigned char *packet, unsigned packetSize);
+
+        /**
+         * Returns the sink sending the stream with the SSRC (nullptr - not a sink of this subsession).
+         */
+        RTPSink *findSink(uint32_t ssrc) const;
+
+        /**
+         * Returns the size of the packet buffers fitting the largest observed frame with the margin
+         * (the largest frame the fan-out can publish if the buffers can't grow).
+         */
+        unsigned packetBufferSize() const;
+
+        /**
+         * Whether the sinks grow their buffers for the larger frames (HEVC packetizer of the aggregating sink).
+         */
+        bool isBufferGrowable() const;
+
     };
 }
 
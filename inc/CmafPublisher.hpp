@@ -0,0 +1,293 @@
+#ifndef LIVE_VIDEO_STREAM_CMAF_PUBLISHER_HPP
+#define LIVE_VIDEO_STREAM_CMAF_PUBLISHER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+namespace LIRS {
+
+    /**
+     * Parameters of the low-latency HLS output.
+     */
+    typedef struct HlsOptions {
+
+        /**
+         * Minimal duration of the segment, segments are cut at the first keyframe after it (milliseconds).
+         */
+        unsigned segmentDurationMs;
+
+        /**
+         * Target duration of the partial segments (milliseconds), should not be shorter than the frame interval.
+         */
+        unsigned partDurationMs;
+
+        /**
+         * Number of complete segments listed in the playlist (and held in memory).
+         */
+        unsigned playlistSegments;
+
+        HlsOptions() : segmentDurationMs(2000), partDurationMs(500), playlistSegments(6) {}
+
+    } HlsOptions;
+
+    /**
+     * Immutable bytes of the muxed init segment, segment or partial segment shared by all viewers.
+     */
+    typedef std::shared_ptr<const std::vector<uint8_t>> CmafData;
+
+    /**
+     * Muxes the encoded packets of the stream into CMAF (fragmented MP4) partial segments and segments once,
+     * holds the recent ones in memory and generates the LL-HLS media playlist.
+     *
+     * Packets are published by the transcoding thread, the playlist and the muxed data can be read from any thread.
+     * Resources: 'init<N>.mp4' (changes with the parameter sets), 'seg<MSN>.m4s', 'part<MSN>.<index>.m4s'.
+     */
+    class CmafPublisher {
+
+    public:
+
+        /**
+         * Creates a new publisher.
+         *
+         * @param name - name of the stream (part of the URL).
+         * @param codecId - codec of the published packets (HEVC or H.264).
+         * @param options - segmentation parameters.
+         */
+        CmafPublisher(const std::string &name, AVCodecID codecId, const HlsOptions &options = {});
+
+        ~CmafPublisher();
+
+        CmafPublisher(const CmafPublisher &) = delete;
+
+        CmafPublisher &operator=(const CmafPublisher &) = delete;
+
+        /**
+         * Muxes the encoded packet (access unit in Annex B format), called by the transcoding thread.
+         * Nothing is published until the first keyframe with the parameter sets.
+         *
+         * @param packet - encoded packet.
+         * @param timeBase - time base of the packet's timestamps.
+         * @param parameters - parameters of the encoded stream (frame size).
+         */
+        void publish(const AVPacket *packet, AVRational timeBase, const AVCodecParameters *parameters);
+
+        /**
+         * Sets the function called (from the transcoding thread) when a new partial segment has been published,
+         * nullptr - no notification (the receiver is being destroyed).
+         */
+        void setOnPublishedCallback(std::function<void()> callback);
+
+        const std::string &getName() const;
+
+        /**
+         * Returns the media playlist.
+         */
+        std::string getPlaylist() const;
+
+        /**
+         * Returns the muxed data of the resource.
+         *
+         * @param resource - name of the resource, e.g. 'part12.3.m4s'.
+         * @return shared data, nullptr if the resource is absent.
+         */
+        CmafData getResource(const std::string &resource) const;
+
+        /**
+         * Whether the playlist contains the partial segment (or the complete segment if the part is negative).
+         *
+         * @param sequenceNumber - media sequence number of the segment.
+         * @param partIndex - index of the partial segment in the segment, negative - the whole segment.
+         */
+        bool contains(int64_t sequenceNumber, int partIndex) const;
+
+        /**
+         * Whether the resource is expected to be published soon (the current segment or the next ones),
+         * requests for it are held until it's available (preload hints, blocking playlist reload).
+         */
+        bool isUpcoming(const std::string &resource) const;
+
+        /**
+         * Returns the media sequence number of the segment in progress (-1 if nothing has been published yet).
+         */
+        int64_t getCurrentSequenceNumber() const;
+
+        /**
+         * Returns the target duration of the segments (seconds).
+         */
+        unsigned getTargetDuration() const;
+
+        /** Constants **/
+
+        /**
+         * Time base of the muxed stream (90 kHz).
+         */
+        static const int TIME_BASE = 90000;
+
+        /**
+         * Number of target durations from the end of the playlist the partial segments are listed for.
+         */
+        static const unsigned PART_LISTING_TARGET_DURATIONS = 3;
+
+        static const int MUXER_BUFFER_SIZE = 64 * 1024;
+
+    private:
+
+        typedef struct CmafPart {
+
+            CmafData data;
+
+            double duration;
+
+            /**
+             * Whether the part starts with a keyframe.
+             */
+            bool independent;
+
+        } CmafPart;
+
+        typedef struct CmafSegment {
+
+            int64_t sequenceNumber;
+
+            /**
+             * Index of the init segment the segment depends on.
+             */
+            unsigned initIndex;
+
+            /**
+             * Whether the segment follows the change of the encoding parameters (new init segment).
+             */
+            bool discontinuity;
+
+            std::vector<CmafPart> parts;
+
+            /**
+             * Concatenated parts of the complete segment (nullptr while in progress).
+             */
+            CmafData data;
+
+            double duration;
+
+        } CmafSegment;
+
+        std::string name;
+
+        AVCodecID codecId;
+
+        HlsOptions options;
+
+        /* state of the muxer (transcoding thread only) */
+
+        AVFormatContext *muxer;
+
+        /**
+         * Bytes written by the muxer since the last flush.
+         */
+        std::vector<uint8_t> muxedBytes;
+
+        /**
+         * The last received packet, written when the next one arrives (its duration is known then).
+         */
+        AVPacket *pendingPacket;
+
+        /**
+         * Parameter sets (Annex B) of the opened muxer.
+         */
+        std::vector<uint8_t> parameterSets;
+
+        /**
+         * Decoding timestamps of the current segment's and part's first packets and of the pending packet,
+         * duration of the last frame (90 kHz).
+         */
+        int64_t segmentStart, partStart, lastDts, frameDuration;
+
+        bool isPartIndependent;
+
+        /* published data (guarded by the mutex) */
+
+        mutable std::mutex publishedMutex;
+
+        std::deque<CmafSegment> segments;
+
+        int64_t nextSequenceNumber;
+
+        std::map<unsigned, CmafData> initSegments;
+
+        unsigned nextInitIndex;
+
+        /**
+         * Number of discontinuities removed from the playlist.
+         */
+        unsigned discontinuitySequence;
+
+        /**
+         * The longest segment's duration (seconds), defines the target duration.
+         */
+        double maxSegmentDuration;
+
+        std::function<void()> onPublishedCallback;
+
+        /**
+         * Guards the callback (cleared by the HLS server while the transcoding thread may publish).
+         */
+        std::mutex callbackMutex;
+
+        /**
+         * Opens the muxer with the parameter sets and publishes its init segment.
+         */
+        bool openMuxer(const std::vector<uint8_t> &newParameterSets, const AVCodecParameters *parameters);
+
+        void closeMuxer();
+
+        static int writeMuxedData(void *opaque, uint8_t *buffer, int size);
+
+        /**
+         * Writes the pending packet to the muxer.
+         */
+        void writePendingPacket();
+
+        /**
+         * Flushes the muxer's fragment and publishes it as the partial segment of the current segment.
+         *
+         * @param end - decoding timestamp the part ends at.
+         */
+        void finishPart(int64_t end);
+
+        /**
+         * Completes the current segment and removes the old ones.
+         */
+        void finishSegment();
+
+        /**
+         * Returns the size of the held segments, parts and init segments in bytes (the mutex should be locked).
+         */
+        size_t getPublishedBytes() const;
+
+        /**
+         * Starts the new segment.
+         */
+        void startSegment(int64_t start, bool discontinuity);
+
+        /**
+         * Returns the parameter sets (VPS/SPS/PPS) of the packet with start codes, whether the packet is a keyframe.
+         */
+        void parsePacket(const AVPacket *packet, std::vector<uint8_t> &packetParameterSets, bool &isKeyframe) const;
+
+        void notifyPublished();
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_CMAF_PUBLISHER_HPP
@@ -0,0 +1,125 @@
+#ifndef LIVE_VIDEO_STREAM_CONTROL_SERVER_HPP
+#define LIVE_VIDEO_STREAM_CONTROL_SERVER_HPP
+
+#include <UsageEnvironment.hh>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LIRS {
+
+    /**
+     * Local control socket (Unix domain, stream) handled by the event loop.
+     *
+     * Protocol: one command per line, words separated by spaces (e.g. "remove camera"), each command is answered
+     * with a single line starting with "OK" or "ERROR". Replies may be sent later (e.g. when the added stream
+     * is ready), the commands of the connection are answered in the order of their completion. The connection
+     * half-closed by the client is closed once all its commands have been answered.
+     *
+     * Usage: echo "list" | socat - UNIX-CONNECT:/tmp/lirs-control.sock
+     */
+    class ControlServer {
+
+    public:
+
+        /**
+         * Sends the reply line to the command's connection (dropped if the connection has been closed),
+         * should be called once per command.
+         */
+        typedef std::function<void(const std::string &)> Reply;
+
+        /**
+         * Handles the command (event loop's thread).
+         *
+         * @param args - words of the command line (non-empty).
+         * @param reply - sends the reply, may be stored and called later.
+         */
+        typedef std::function<void(const std::vector<std::string> &args, const Reply &reply)> CommandHandler;
+
+        /**
+         * Creates the socket (replacing the stale one) and starts accepting connections.
+         *
+         * @param env - environment of the event loop.
+         * @param socketPath - path of the socket (accessible to the owner only).
+         * @param handler - handler of the commands.
+         */
+        ControlServer(UsageEnvironment &env, const std::string &socketPath, CommandHandler handler);
+
+        ~ControlServer();
+
+        ControlServer(const ControlServer &) = delete;
+
+        ControlServer &operator=(const ControlServer &) = delete;
+
+        /**
+         * Returns whether the socket has been created.
+         */
+        bool isListening() const;
+
+        /** Constants **/
+
+        static constexpr const char *DEFAULT_SOCKET_PATH = "/tmp/lirs-control.sock";
+
+        /**
+         * Maximal length of the command line (the connection is closed if exceeded).
+         */
+        static const size_t MAX_LINE_LENGTH = 4096;
+
+    private:
+
+        typedef struct ControlConnection {
+
+            ControlServer *server;
+
+            int socket;
+
+            /**
+             * Unique id of the connection (socket numbers are reused), referenced by the pending replies.
+             */
+            uint64_t id;
+
+            /**
+             * Received data w/o complete line.
+             */
+            std::string buffer;
+
+            /**
+             * Number of the commands not answered yet and whether the client has closed its side.
+             */
+            size_t numPendingReplies;
+
+            bool isInputClosed;
+
+        } ControlConnection;
+
+        UsageEnvironment &env;
+
+        std::string socketPath;
+
+        CommandHandler handler;
+
+        int listenSocket;
+
+        std::map<uint64_t, std::unique_ptr<ControlConnection>> connections;
+
+        uint64_t nextConnectionId;
+
+        static void onAcceptable(void *clientData, int mask);
+
+        static void onReadable(void *clientData, int mask);
+
+        void acceptConnections();
+
+        void readCommands(ControlConnection *connection);
+
+        void closeConnection(uint64_t connectionId);
+
+        void sendReply(uint64_t connectionId, const std::string &line);
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_CONTROL_SERVER_HPP
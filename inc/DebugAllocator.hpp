@@ -0,0 +1,73 @@
+#ifndef LIVE_VIDEO_STREAM_DEBUG_ALLOCATOR_HPP
+#define LIVE_VIDEO_STREAM_DEBUG_ALLOCATOR_HPP
+
+#include <cstdint>
+
+namespace LIRS {
+
+    /**
+     * Part of the server the heap allocations are charged to.
+     */
+    enum MemorySubsystem {
+        MEMORY_SUBSYSTEM_OTHER, // event loop, control, initialization
+        MEMORY_SUBSYSTEM_TRANSCODER, // decoding, filtering, encoding, encoded data queues
+        MEMORY_SUBSYSTEM_FANOUT, // retained encoded frames
+        MEMORY_SUBSYSTEM_RTP, // clients' sinks, packet buffers, pacing and retransmission
+        MEMORY_SUBSYSTEM_HLS, // CMAF segments and HTTP responses
+        MEMORY_SUBSYSTEM_COUNT
+    };
+
+    /**
+     * Charges the heap allocations of the current thread to the subsystem while it's alive (nested scopes restore
+     * the previous subsystem). The deallocation is charged to the subsystem of the allocation.
+     */
+    class MemoryScope {
+
+    public:
+
+        explicit MemoryScope(MemorySubsystem subsystem);
+
+        ~MemoryScope();
+
+        MemoryScope(const MemoryScope &) = delete;
+
+        MemoryScope &operator=(const MemoryScope &) = delete;
+
+    private:
+
+        MemorySubsystem previousSubsystem;
+    };
+
+    /**
+     * Debug allocator replacing the global operator new/delete (built with -DDEBUG_ALLOCATOR, CMake option
+     * DEBUG_ALLOCATOR), including the allocations of Live555 and log4cpp. Each allocation is prefixed with its size
+     * and subsystem, the allocated bytes and their high-water mark are counted per subsystem (relaxed atomics).
+     *
+     * FFmpeg's buffers (av_malloc) aren't seen by the allocator, they're covered by the streams' memory metrics.
+     */
+    class DebugAllocator {
+
+    public:
+
+        /**
+         * Returns whether the allocator has been built in (otherwise nothing is counted).
+         */
+        static bool isEnabled();
+
+        /**
+         * Returns the bytes currently allocated by the subsystem and their high-water mark.
+         */
+        static int64_t getAllocatedBytes(MemorySubsystem subsystem);
+
+        static int64_t getHighWaterMark(MemorySubsystem subsystem);
+
+        static const char *getSubsystemName(MemorySubsystem subsystem);
+
+        /**
+         * Sets the metrics 'memory.allocator.<subsystem>_bytes' and 'memory.allocator.<subsystem>_high_water_bytes'.
+         */
+        static void updateMetrics();
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_DEBUG_ALLOCATOR_HPP
@@ -0,0 +1,141 @@
+#ifndef LIVE_VIDEO_STREAM_ENCODER_THREAD_BUDGET_HPP
+#define LIVE_VIDEO_STREAM_ENCODER_THREAD_BUDGET_HPP
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace LIRS {
+
+    /**
+     * Threading parameters assigned to the encoder (libx265).
+     */
+    typedef struct EncoderThreadAllocation {
+
+        /**
+         * Number of concurrently encoded frames (x265 'frame-threads').
+         */
+        size_t frameThreads;
+
+        /**
+         * Whether wavefront parallel processing is enabled (x265 'wpp').
+         */
+        bool wpp;
+
+        /**
+         * Number of worker threads in the encoder's thread pool (x265 'pools').
+         */
+        size_t poolThreads;
+
+        EncoderThreadAllocation() : frameThreads(1), wpp(false), poolThreads(1) {}
+
+        /**
+         * Returns the allocation as x265 parameters, e.g. 'frame-threads=1:wpp=1:pools=4'.
+         */
+        std::string toX265Params() const;
+
+        bool operator==(const EncoderThreadAllocation &other) const;
+
+        bool operator!=(const EncoderThreadAllocation &other) const;
+
+    } EncoderThreadAllocation;
+
+    /**
+     * Process-wide budget of the encoder threads.
+     *
+     * Distributes the available cores between all registered encoders proportionally to their resolutions,
+     * so the total number of worker threads does not exceed the number of cores.
+     * The budget is rebalanced each time an encoder is registered or unregistered,
+     * encoders whose allocation has changed are notified via their callbacks.
+     */
+    class EncoderThreadBudget {
+
+    public:
+
+        /**
+         * Callback notifying the encoder about the new allocation (called from the rebalancing thread).
+         */
+        typedef std::function<void(const EncoderThreadAllocation &)> AllocationCallback;
+
+        /**
+         * Returns the instance of the budget.
+         */
+        static EncoderThreadBudget &getInstance();
+
+        EncoderThreadBudget(const EncoderThreadBudget &) = delete;
+
+        EncoderThreadBudget &operator=(const EncoderThreadBudget &) = delete;
+
+        /**
+         * Sets the number of cores shared by the encoders and rebalances the budget.
+         *
+         * @param cores - number of cores, 0 - number of the hardware threads.
+         */
+        void setCoreBudget(size_t cores);
+
+        /**
+         * Registers the encoder and rebalances the budget.
+         *
+         * @param owner - key of the encoder (e.g. pointer to the transcoder).
+         * @param name - name of the encoder used in logs and metrics.
+         * @param width - frame width.
+         * @param height - frame height.
+         * @param callback - called when the allocation of this encoder is changed by the further rebalancing.
+         * @return allocation for the encoder.
+         */
+        EncoderThreadAllocation registerEncoder(const void *owner, const std::string &name, size_t width,
+                                                size_t height, AllocationCallback callback);
+
+        /**
+         * Unregisters the encoder (if registered) and rebalances the budget.
+         *
+         * @param owner - key of the encoder.
+         */
+        void unregisterEncoder(const void *owner);
+
+        /** Constants **/
+
+        /**
+         * Size of the x265 coding tree unit, used to estimate the parallelism of the wavefront.
+         */
+        static const size_t CTU_SIZE = 64;
+
+    private:
+
+        typedef struct EncoderEntry {
+            std::string name;
+            size_t width;
+            size_t height;
+            AllocationCallback callback;
+            EncoderThreadAllocation allocation;
+        } EncoderEntry;
+
+        EncoderThreadBudget();
+
+        std::mutex budgetMutex;
+
+        /**
+         * Number of cores shared by the encoders.
+         */
+        size_t cores;
+
+        /**
+         * Registered encoders.
+         */
+        std::map<const void *, EncoderEntry> encoders;
+
+        /**
+         * Recomputes allocations of all encoders, notifies the changed ones except the excluded one.
+         */
+        void rebalance(const void *excludedOwner);
+
+        /**
+         * Publishes the allocations to the metrics.
+         */
+        void updateMetrics() const;
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_ENCODER_THREAD_BUDGET_HPP
@@ -0,0 +1,202 @@
+#ifndef LIVE_VIDEO_STREAM_EPOLL_TASK_SCHEDULER_HPP
+#define LIVE_VIDEO_STREAM_EPOLL_TASK_SCHEDULER_HPP
+
+#include <UsageEnvironment.hh>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace LIRS {
+
+    /**
+     * Live555 task scheduler on epoll (drop-in replacement of the BasicTaskScheduler built on select()).
+     *
+     * Sockets aren't limited by FD_SETSIZE and the loop's cost depends on the number of the ready sockets only
+     * (select() copies and scans all fd sets on each iteration). Delayed tasks due within the wheel's span are kept
+     * in a timer wheel (constant time scheduling and cancelling instead of the sorted DelayQueue), the later ones
+     * (e.g. liveness timeouts) - in the ordered overflow queue moved into the wheel as the time advances. The loop
+     * sleeps until the earliest task using a timerfd (microsecond precision as select()).
+     *
+     * Sockets are watched level-triggered: Live555's handlers read a single packet or request per call, so an
+     * edge-triggered socket with the queued data wouldn't be reported again.
+     *
+     * Event triggers are supported as by the BasicTaskScheduler (up to 32, signaled through an eventfd),
+     * see EventNotifier for any number of events.
+     */
+    class EpollTaskScheduler : public TaskScheduler {
+
+    public:
+
+        static EpollTaskScheduler *createNew();
+
+        ~EpollTaskScheduler() override;
+
+        TaskToken scheduleDelayedTask(int64_t microseconds, TaskFunc *proc, void *clientData) override;
+
+        void unscheduleDelayedTask(TaskToken &prevTask) override;
+
+        void setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc *handlerProc,
+                                   void *clientData) override;
+
+        void moveSocketHandling(int oldSocketNum, int newSocketNum) override;
+
+        void doEventLoop(char volatile *watchVariable) override;
+
+        EventTriggerId createEventTrigger(TaskFunc *eventHandlerProc) override;
+
+        void deleteEventTrigger(EventTriggerId eventTriggerId) override;
+
+        void triggerEvent(EventTriggerId eventTriggerId, void *clientData) override;
+
+        /**
+         * Waits for the ready sockets or the due tasks and handles them (single iteration of the event loop).
+         *
+         * @param maxDelayTime - maximal waiting time in microseconds (0 - until the next event).
+         */
+        void singleStep(unsigned maxDelayTime = 0);
+
+        /**
+         * Returns the number of the watched sockets and of the scheduled tasks.
+         */
+        size_t numSockets() const;
+
+        size_t numDelayedTasks() const;
+
+        /** Constants **/
+
+        /**
+         * Duration of the wheel's slot (microseconds) and the number of the slots (the wheel's span).
+         */
+        static const int64_t WHEEL_TICK_US = 1000;
+
+        static const size_t WHEEL_SIZE = 1024;
+
+        /**
+         * Maximal number of the sockets' events handled per iteration.
+         */
+        static const int MAX_EPOLL_EVENTS = 256;
+
+        static const unsigned MAX_NUM_EVENT_TRIGGERS = 32;
+
+    protected:
+
+        EpollTaskScheduler();
+
+    private:
+
+        typedef struct SocketHandler {
+
+            int conditionSet;
+
+            BackgroundHandlerProc *handlerProc;
+
+            void *clientData;
+
+            /**
+             * Generation of the handler, events of the closed socket whose number was reused are discarded.
+             */
+            uint32_t generation;
+
+        } SocketHandler;
+
+        typedef struct DelayedTask {
+
+            intptr_t id;
+
+            /**
+             * Due time (monotonic clock, microseconds).
+             */
+            int64_t dueTimeUs;
+
+            TaskFunc *proc;
+
+            void *clientData;
+
+        } DelayedTask;
+
+        /**
+         * Position of the scheduled task in the wheel or in the overflow queue.
+         */
+        typedef struct TaskLocation {
+
+            bool isInWheel;
+
+            size_t slot;
+
+            std::list<DelayedTask>::iterator position;
+
+            std::multimap<int64_t, DelayedTask>::iterator overflowPosition;
+
+        } TaskLocation;
+
+        int epollFd, timerFd, triggerFd;
+
+        std::unordered_map<int, SocketHandler> socketHandlers;
+
+        uint32_t nextGeneration;
+
+        std::vector<std::list<DelayedTask>> wheel;
+
+        /**
+         * Tasks due beyond the wheel's span ordered by their due times.
+         */
+        std::multimap<int64_t, DelayedTask> overflowTasks;
+
+        std::unordered_map<intptr_t, TaskLocation> delayedTasks;
+
+        intptr_t nextTaskId;
+
+        /**
+         * Tick of the wheel handled last (the slots up to the current tick are handled on each iteration).
+         */
+        int64_t currentTick;
+
+        /**
+         * Due time the timerfd is armed for (0 - disarmed).
+         */
+        int64_t armedTimeUs;
+
+        /**
+         * Handlers of the event triggers, their client data and the mask of the triggered ones.
+         */
+        TaskFunc *triggerHandlers[MAX_NUM_EVENT_TRIGGERS];
+
+        void *triggerClientData[MAX_NUM_EVENT_TRIGGERS];
+
+        std::atomic<EventTriggerId> triggeredMask;
+
+        EventTriggerId usedTriggersMask;
+
+        static int64_t nowMicros();
+
+        /**
+         * Returns the due time of the earliest task (-1 if none).
+         */
+        int64_t earliestDueTime() const;
+
+        /**
+         * Arms the timerfd for the earliest task, returns the epoll's timeout (ms, 0 - a task is due, -1 - none).
+         */
+        int prepareTimeout(unsigned maxDelayTime);
+
+        /**
+         * Adds the task to the wheel's slot or to the overflow queue.
+         */
+        void insertTask(const DelayedTask &task);
+
+        /**
+         * Runs the due tasks in the order of their due times.
+         */
+        void handleDueTasks();
+
+        void handleTriggeredEvents();
+
+        static uint64_t packEventData(int socketNum, uint32_t generation);
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_EPOLL_TASK_SCHEDULER_HPP
@@ -0,0 +1,106 @@
+#ifndef LIVE_VIDEO_STREAM_EVENT_NOTIFIER_HPP
+#define LIVE_VIDEO_STREAM_EVENT_NOTIFIER_HPP
+
+#include <UsageEnvironment.hh>
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace LIRS {
+
+    /**
+     * Wakes up the event loop from the other threads (replaces the Live555's event triggers limited to 32 per
+     * scheduler). All events of the loop share a single eventfd watched by the scheduler as a socket: the signaled
+     * events are pushed into the ready queue and the eventfd is written only when the queue becomes non-empty,
+     * the loop handles exactly the queued events (no scan of all registered ones).
+     *
+     * An event signaled several times before being handled is handled once (as the Live555's triggers).
+     */
+    class EventNotifier {
+
+    public:
+
+        typedef uint32_t EventId;
+
+        /**
+         * Creates the eventfd and starts watching it.
+         *
+         * @param scheduler - scheduler of the event loop the handlers are called by.
+         */
+        explicit EventNotifier(TaskScheduler &scheduler);
+
+        ~EventNotifier();
+
+        EventNotifier(const EventNotifier &) = delete;
+
+        EventNotifier &operator=(const EventNotifier &) = delete;
+
+        /**
+         * Registers the event (thread-safe).
+         *
+         * @param handler - function called by the event loop when the event has been signaled.
+         * @param clientData - argument of the handler.
+         * @return id of the event (never 0).
+         */
+        EventId createEvent(TaskFunc *handler, void *clientData);
+
+        /**
+         * Unregisters the event, its pending signal is discarded (thread-safe).
+         */
+        void deleteEvent(EventId eventId);
+
+        /**
+         * Signals the event (thread-safe, doesn't block on the event loop).
+         */
+        void signal(EventId eventId);
+
+        /**
+         * Returns the number of the registered events.
+         */
+        size_t numEvents();
+
+    private:
+
+        typedef struct Registration {
+
+            TaskFunc *handler;
+
+            void *clientData;
+
+            /**
+             * Whether the event is in the ready queue (it's queued once until handled).
+             */
+            bool isPending;
+
+        } Registration;
+
+        TaskScheduler &scheduler;
+
+        int eventFd;
+
+        /**
+         * Guards the registrations and the ready queue.
+         */
+        std::mutex mutex;
+
+        std::unordered_map<EventId, Registration> registrations;
+
+        /**
+         * Signaled events not handled yet.
+         */
+        std::vector<EventId> readyEvents;
+
+        EventId nextEventId;
+
+        /**
+         * Handles the ready events (called by the scheduler when the eventfd is readable).
+         */
+        static void onReadable(void *clientData, int mask);
+
+        void handleReadyEvents();
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_EVENT_NOTIFIER_HPP
@@ -0,0 +1,176 @@
+#ifndef LIVE_VIDEO_STREAM_FRAME_BUS_HPP
+#define LIVE_VIDEO_STREAM_FRAME_BUS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace LIRS {
+
+    /**
+     * Shared memory frame bus: the decoded frames and the encoded packets of the stream are published into
+     * the named memory-mapped rings (/dev/shm/lirs.<stream>.frames, /dev/shm/lirs.<stream>.packets) read by
+     * the processes of the same host w/o copying (see FrameBusReader).
+     *
+     * Layout of the ring: FrameBusHeader, then 'slotCount' slots of 'slotStride' bytes (FrameBusSlot and the data).
+     * Entry N is written into the slot N % slotCount guarded by the slot's sequence (seqlock): 2N + 1 while
+     * the entry is written, 2N + 2 once it's complete. The writer never waits for the readers, a reader detects
+     * the overwritten entry by the changed sequence.
+     *
+     * The layout doesn't depend on FFmpeg (pixel formats and time bases are the FFmpeg's values).
+     */
+
+    /**
+     * Kind of the published entries.
+     */
+    enum FrameBusKind : uint32_t {
+        FRAME_BUS_FRAMES = 1, // decoded (and optionally downscaled) frames
+        FRAME_BUS_PACKETS = 2 // encoded packets (access units in Annex B format)
+    };
+
+    typedef struct FrameBusHeader {
+
+        uint32_t magic;
+
+        uint32_t version;
+
+        uint32_t kind;
+
+        uint32_t slotCount;
+
+        /**
+         * Maximal size of the entry's data and the distance between the slots (bytes).
+         */
+        uint64_t slotSize;
+
+        uint64_t slotStride;
+
+        /**
+         * Number of the published entries (the next entry's number).
+         */
+        std::atomic<uint64_t> publishedCount;
+
+        /**
+         * Futex word incremented on each publication and the number of the readers waiting on it.
+         */
+        std::atomic<uint32_t> publishedSignal;
+
+        std::atomic<uint32_t> numWaiters;
+
+        /**
+         * Set when the writer has replaced (larger entries) or removed the ring, readers should attach again.
+         */
+        std::atomic<uint32_t> isClosed;
+
+        int32_t writerPid;
+
+    } FrameBusHeader;
+
+    typedef struct FrameBusSlot {
+
+        /**
+         * Sequence of the slot (see the seqlock above), 0 - never written.
+         */
+        std::atomic<uint64_t> sequence;
+
+        /**
+         * Presentation timestamp and its time base.
+         */
+        int64_t pts;
+
+        int32_t timeBaseNum, timeBaseDen;
+
+        /**
+         * Time the entry has been published at (CLOCK_MONOTONIC, nanoseconds), comparable between the processes.
+         */
+        int64_t publishTimeNs;
+
+        uint32_t size;
+
+        /**
+         * FRAME_BUS_KEYFRAME for the keyframes.
+         */
+        uint32_t flags;
+
+        /**
+         * Frame's dimensions, pixel format (AVPixelFormat) and planes (offsets from the data), 0 for the packets.
+         */
+        int32_t width, height, format;
+
+        int32_t linesize[4];
+
+        uint32_t planeOffset[4];
+
+    } FrameBusSlot;
+
+    /**
+     * Helpers shared by the writer and the readers.
+     */
+    class FrameBus {
+
+    public:
+
+        /**
+         * Returns the name of the shared memory object of the stream's ring, e.g. '/lirs.camera_1.frames'.
+         *
+         * @param stream - name of the stream ('/' are replaced).
+         * @param kind - kind of the entries.
+         */
+        static std::string ringName(const std::string &stream, FrameBusKind kind);
+
+        /**
+         * Returns the distance between the slots fitting the entries of the specified size.
+         */
+        static uint64_t slotStride(uint64_t slotSize);
+
+        /**
+         * Returns the size of the ring's mapping.
+         */
+        static size_t mappingSize(uint32_t slotCount, uint64_t slotSize);
+
+        /**
+         * Returns the slot of the entry.
+         */
+        static FrameBusSlot *slotOf(FrameBusHeader *header, uint64_t entryNumber);
+
+        /**
+         * Returns the data of the slot.
+         */
+        static uint8_t *dataOf(FrameBusSlot *slot);
+
+        /**
+         * Returns CLOCK_MONOTONIC time in nanoseconds.
+         */
+        static int64_t nowNanos();
+
+        /**
+         * Blocks until the futex word differs from the expected value or the timeout expires (Linux futex,
+         * shared between the processes).
+         */
+        static void waitSignal(std::atomic<uint32_t> &signal, uint32_t expected, int timeoutMs);
+
+        /**
+         * Wakes up all processes waiting on the futex word.
+         */
+        static void wakeSignal(std::atomic<uint32_t> &signal);
+
+        /** Constants **/
+
+        static const uint32_t MAGIC = 0x4C495242; // 'LIRB'
+
+        static const uint32_t VERSION = 1;
+
+        /**
+         * Alignment of the slots (cache line).
+         */
+        static const uint64_t SLOT_ALIGNMENT = 64;
+
+        static const uint32_t FRAME_BUS_KEYFRAME = 1;
+    };
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+                  "Frame bus requires lock-free atomics shared between the processes");
+}
+
+#endif //LIVE_VIDEO_STREAM_FRAME_BUS_HPP
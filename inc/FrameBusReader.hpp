@@ -0,0 +1,149 @@
+#ifndef LIVE_VIDEO_STREAM_FRAME_BUS_READER_HPP
+#define LIVE_VIDEO_STREAM_FRAME_BUS_READER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "FrameBus.hpp"
+
+namespace LIRS {
+
+    /**
+     * Entry of the frame bus read w/o copying: the pointers refer to the shared memory and may be used
+     * until the next call of FrameBusReader::next(), the data is intact until the writer reuses the slot
+     * (see FrameBusReader::isValid()).
+     */
+    typedef struct FrameBusEntry {
+
+        /**
+         * Number of the entry since the ring has been created.
+         */
+        uint64_t number;
+
+        const uint8_t *data;
+
+        uint32_t size;
+
+        int64_t pts;
+
+        int32_t timeBaseNum, timeBaseDen;
+
+        int64_t publishTimeNs;
+
+        uint32_t flags;
+
+        /**
+         * Frame's dimensions, pixel format (AVPixelFormat) and planes, 0/nullptr for the packets.
+         */
+        int32_t width, height, format;
+
+        int32_t linesize[4];
+
+        const uint8_t *planes[4];
+
+        FrameBusEntry() : number(0), data(nullptr), size(0), pts(0), timeBaseNum(0), timeBaseDen(1),
+                          publishTimeNs(0), flags(0), width(0), height(0), format(-1), linesize(),
+                          planes() {}
+
+    } FrameBusEntry;
+
+    /**
+     * Reader of the stream's frame bus ring (no dependencies except POSIX shared memory, may be linked into
+     * the analytics processes as the LiveVideoStreamFrameBus library).
+     *
+     * The reader never blocks the writer: if it falls behind the ring, the overwritten entries are skipped
+     * and counted as missed. Usage:
+     *
+     *     FrameBusReader reader("camera", FRAME_BUS_FRAMES);
+     *     FrameBusEntry entry;
+     *     while (reader.next(entry, 1000)) {
+     *         process(entry.planes, entry.linesize, entry.width, entry.height);
+     *         if (!reader.isValid(entry)) discardResults(); // overwritten while processed
+     *     }
+     */
+    class FrameBusReader {
+
+    public:
+
+        /**
+         * Creates a new reader (attaches on the first call of next()).
+         *
+         * @param stream - name of the stream (alias of the transcoder).
+         * @param kind - kind of the entries.
+         */
+        FrameBusReader(const std::string &stream, FrameBusKind kind);
+
+        ~FrameBusReader();
+
+        FrameBusReader(const FrameBusReader &) = delete;
+
+        FrameBusReader &operator=(const FrameBusReader &) = delete;
+
+        /**
+         * Maps the ring if it has been created by the writer.
+         *
+         * @return true if attached, otherwise - false.
+         */
+        bool attach();
+
+        bool isAttached() const;
+
+        /**
+         * Returns the next published entry (the first one is the entry published after attaching).
+         *
+         * @param entry - entry pointing into the shared memory.
+         * @param timeoutMs - time to wait for the entry (0 - don't wait).
+         * @return false if there is no new entry.
+         */
+        bool next(FrameBusEntry &entry, int timeoutMs = 0);
+
+        /**
+         * Whether the entry's data hasn't been overwritten by the writer so far,
+         * the results computed from the data should be discarded otherwise.
+         */
+        bool isValid(const FrameBusEntry &entry) const;
+
+        /**
+         * Returns the number of the entries skipped because the reader has fallen behind.
+         */
+        uint64_t getMissedCount() const;
+
+        /** Constants **/
+
+        /**
+         * Interval of attaching attempts while the ring doesn't exist.
+         */
+        static const int ATTACH_INTERVAL_MS = 100;
+
+    private:
+
+        std::string name;
+
+        FrameBusKind kind;
+
+        int fd;
+
+        FrameBusHeader *header;
+
+        size_t mappingSize;
+
+        /**
+         * Number of the next entry to be read.
+         */
+        uint64_t cursor;
+
+        uint64_t missedCount;
+
+        void detach();
+
+        /**
+         * Reads the entry at the cursor.
+         *
+         * @return false if the entry has been overwritten.
+         */
+        bool readEntry(FrameBusEntry &entry);
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_FRAME_BUS_READER_HPP
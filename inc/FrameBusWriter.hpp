@@ -0,0 +1,160 @@
+#ifndef LIVE_VIDEO_STREAM_FRAME_BUS_WRITER_HPP
+#define LIVE_VIDEO_STREAM_FRAME_BUS_WRITER_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "FrameBus.hpp"
+#include "Logger.hpp"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+namespace LIRS {
+
+    /**
+     * Parameters of the frame bus of the stream (see FrameBus).
+     */
+    typedef struct FrameBusOptions {
+
+        /**
+         * Whether the decoded frames (the output of the filter graph) are published.
+         */
+        bool publishFrames;
+
+        /**
+         * Whether the encoded packets are published.
+         */
+        bool publishPackets;
+
+        /**
+         * Size of the published frames (0 - as filtered, one of them - keeping the aspect ratio),
+         * the frames are scaled by the separate branch of the filter graph.
+         */
+        size_t frameWidth, frameHeight;
+
+        /**
+         * Pixel format of the published frames, e.g. 'gray', 'bgr24' (empty - as filtered).
+         */
+        std::string pixelFormat;
+
+        /**
+         * Number of the slots of the frames' and packets' rings.
+         */
+        uint32_t frameSlots, packetSlots;
+
+        FrameBusOptions() : publishFrames(false), publishPackets(false), frameWidth(0), frameHeight(0),
+                            frameSlots(4), packetSlots(64) {}
+
+        bool isEnabled() const {
+            return publishFrames || publishPackets;
+        }
+
+        /**
+         * Whether the published frames differ from the encoded ones (a separate branch of the filter graph).
+         */
+        bool isFrameConversionRequired() const {
+            return publishFrames && (frameWidth != 0 || frameHeight != 0 || !pixelFormat.empty());
+        }
+
+    } FrameBusOptions;
+
+    /**
+     * Publishes the frames or packets of the stream into the shared memory ring (the only writer of the ring).
+     * Publishing never waits for the readers: the oldest slot is overwritten.
+     */
+    class FrameBusWriter {
+
+    public:
+
+        /**
+         * Creates a new writer (the ring is created with the first entry sized to fit it).
+         *
+         * @param stream - name of the stream (alias of the transcoder).
+         * @param kind - kind of the published entries.
+         * @param slotCount - number of the slots of the ring.
+         */
+        FrameBusWriter(const std::string &stream, FrameBusKind kind, uint32_t slotCount);
+
+        /**
+         * Removes the ring (the attached readers are notified).
+         */
+        ~FrameBusWriter();
+
+        FrameBusWriter(const FrameBusWriter &) = delete;
+
+        FrameBusWriter &operator=(const FrameBusWriter &) = delete;
+
+        /**
+         * Publishes the frame (the planes are packed w/o padding).
+         *
+         * @param frame - decoded frame.
+         * @param timeBase - time base of the frame's timestamp.
+         */
+        void publishFrame(const AVFrame *frame, AVRational timeBase);
+
+        /**
+         * Publishes the encoded packet.
+         *
+         * @param packet - encoded packet.
+         * @param timeBase - time base of the packet's timestamps.
+         */
+        void publishPacket(const AVPacket *packet, AVRational timeBase);
+
+        /**
+         * Returns the name of the shared memory object.
+         */
+        const std::string &getName() const;
+
+        /** Constants **/
+
+        /**
+         * Minimal size of the packets' slots, the ring is recreated with the doubled size for the larger packets.
+         */
+        static const uint64_t MIN_PACKET_SLOT_SIZE = 256 * 1024;
+
+    private:
+
+        std::string name;
+
+        FrameBusKind kind;
+
+        uint32_t slotCount;
+
+        int fd;
+
+        FrameBusHeader *header;
+
+        size_t mappingSize;
+
+        /**
+         * Whether the ring couldn't be created (publishing is disabled).
+         */
+        bool isFailed;
+
+        /**
+         * Makes sure the slots fit the entry recreating the ring if needed.
+         *
+         * @return false if the ring is unavailable.
+         */
+        bool reserve(uint64_t size);
+
+        bool createRing(uint64_t slotSize);
+
+        void removeRing();
+
+        /**
+         * Starts writing the next entry (marks the slot as being written).
+         */
+        FrameBusSlot *beginEntry();
+
+        /**
+         * Completes the entry and wakes up the waiting readers.
+         */
+        void endEntry(FrameBusSlot *slot);
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_FRAME_BUS_WRITER_HPP
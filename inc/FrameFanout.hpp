@@ -0,0 +1,430 @@
+#ifndef LIVE_VIDEO_STREAM_FRAME_FANOUT_HPP
+#define LIVE_VIDEO_STREAM_FRAME_FANOUT_HPP
+
+#include <FramedSource.hh>
+#include <RTPSink.hh>
+#include <UsageEnvironment.hh>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace LIRS {
+
+    class FanoutFramedSource;
+
+    /**
+     * Encoded frame (NAL unit) published once and shared by all replicas.
+     */
+    typedef struct SharedFrame {
+
+        /**
+         * Immutable reference counted frame data.
+         */
+        std::shared_ptr<const std::vector<uint8_t>> data;
+
+        /**
+         * Presentation time and duration reported by the input source.
+         */
+        struct timeval presentationTime;
+
+        unsigned durationInMicroseconds;
+
+        /**
+         * Whether a decoder can start from this frame (e.g. VPS/SPS of the keyframe).
+         */
+        bool isSyncPoint;
+
+        /**
+         * Temporal layer of the NAL unit (0 - base layer, always 0 for H.264).
+         */
+        int temporalId;
+
+        /**
+         * Whether the NAL unit is a slice of the base layer's picture (the temporal layers are switched at it).
+         */
+        bool isBaseLayerSlice;
+
+        /**
+         * Monotonically increasing sequence number of the frame.
+         */
+        uint64_t sequenceNumber;
+
+    } SharedFrame;
+
+    /**
+     * Fan-out of the framed source to multiple consumers (replacement of the Live555's StreamReplicator).
+     *
+     * Each frame is read from the input source once and published as an immutable reference counted buffer.
+     * Replicas read from the shared buffers using their own cursors, so slow readers never block others:
+     * when a replica falls behind the window of the retained frames it is moved to the most recent sync point.
+     * Frames back to the most recent sync point are always retained (the window grows to the GOP if needed),
+     * so new and fallen behind replicas never start in the middle of the GOP.
+     */
+    class FrameFanout : public Medium {
+
+    public:
+
+        /**
+         * Creates a new fan-out for the input source.
+         *
+         * @param env - environment (see Live555 docs).
+         * @param inputSource - source of the encoded frames (NAL units w/o start codes).
+         * @param codecId - codec of the frames (HEVC or H.264), used to detect sync points.
+         * @param name - name of the stream used in logs and metrics.
+         * @param capacity - minimal number of the most recent frames (NAL units) retained for the replicas,
+         *                   the frames back to the most recent sync point are retained beyond it.
+         * @return pointer to the created fan-out.
+         */
+        static FrameFanout *createNew(UsageEnvironment &env, FramedSource *inputSource, AVCodecID codecId,
+                                      const std::string &name, size_t capacity = DEFAULT_CAPACITY);
+
+        /**
+         * Creates a new replica reading the published frames.
+         * The replica starts from the most recent sync point (if any).
+         *
+         * @return pointer to the created replica (closed by the consumer).
+         */
+        FanoutFramedSource *createReplica();
+
+        /**
+         * Returns the number of the active replicas.
+         */
+        size_t numReplicas() const;
+
+        /**
+         * Returns the name of the stream.
+         */
+        const std::string &getName() const;
+
+        /**
+         * Returns the size of the largest published frame in bytes (0 if nothing has been published yet).
+         */
+        unsigned getMaxFrameSize() const;
+
+        /**
+         * Returns the average bitrate of the published frames in kbps (0 if not measured yet).
+         */
+        unsigned getAverageBitrateKbps() const;
+
+        /**
+         * Returns the highest temporal layer observed in the stream (0 - single layer).
+         */
+        int getMaxTemporalId() const;
+
+        /** Constants **/
+
+        static const size_t DEFAULT_CAPACITY = 64;
+
+        /**
+         * Initial size of the input buffer, it is grown for the larger frames (by the margin).
+         */
+        static const unsigned INPUT_BUFFER_SIZE = 2 * 1000 * 1000;
+
+        static constexpr double INPUT_BUFFER_GROWTH_MARGIN = 1.5;
+
+        /**
+         * Period of the bitrate measurement in microseconds.
+         */
+        static const int64_t BITRATE_WINDOW_US = 1000 * 1000;
+
+    protected:
+
+        FrameFanout(UsageEnvironment &env, FramedSource *inputSource, AVCodecID codecId, const std::string &name,
+                    size_t capacity);
+
+        ~FrameFanout() override;
+
+    private:
+
+        friend class FanoutFramedSource;
+
+        /**
+         * Source of the encoded frames.
+         */
+        FramedSource *inputSource;
+
+        /**
+         * Codec of the encoded frames.
+         */
+        AVCodecID codecId;
+
+        /**
+         * Name of the stream.
+         */
+        std::string name;
+
+        /**
+         * Names of the metrics updated with the published frames (built once).
+         */
+        const std::string memoryMetricName, maxFrameMetricName, bitrateMetricName;
+
+        /**
+         * Minimal number of retained frames (the older ones are dropped only after the most recent sync point).
+         */
+        size_t capacity;
+
+        /**
+         * Buffer the input source writes the next frame into (grown for the frames exceeding it).
+         */
+        std::vector<unsigned char> inputBuffer;
+
+        /**
+         * Whether the input frames are dropped until the next sync point (after the truncated frame).
+         */
+        bool isWaitingForSyncPoint;
+
+        /**
+         * The most recent published frames (ordered by sequence number).
+         */
+        std::deque<SharedFrame> frames;
+
+        /**
+         * Size of the retained frames in bytes (metric 'memory.<stream>.fanout_bytes' with the input buffer).
+         */
+        size_t retainedBytes;
+
+        /**
+         * Sequence number of the next published frame.
+         */
+        uint64_t nextSequenceNumber;
+
+        /**
+         * Whether a sync point has been published and the sequence number of the most recent one.
+         */
+        bool hasSyncPoint;
+
+        uint64_t latestSyncSequenceNumber;
+
+        /**
+         * Active replicas.
+         */
+        std::vector<FanoutFramedSource *> replicas;
+
+        /**
+         * Size of the largest published frame.
+         */
+        unsigned maxFrameSize;
+
+        /**
+         * Smoothed bitrate (bits per second) and the current measurement window.
+         */
+        double averageBitrate;
+
+        struct timeval bitrateWindowStart;
+
+        uint64_t bitrateWindowBytes;
+
+        /**
+         * Accounts the published frame in the bitrate measurement.
+         */
+        void updateBitrate(unsigned frameSize, const struct timeval &presentationTime);
+
+        /**
+         * Called by the replica whose consumer's buffer is smaller than the frame: the consumer grows its buffer
+         * or the frame is skipped.
+         */
+        void onOversizeFrame(unsigned frameSize, unsigned maxSize, bool isBufferGrowable);
+
+        /**
+         * Grows the input buffer to fit the frame of the size (with the margin).
+         * The input source delivers the frame exceeding the buffer as 0 bytes with the number of the truncated
+         * bytes set to its size, and delivers it again on the next read.
+         */
+        void growInputBuffer(unsigned frameSize);
+
+        /**
+         * Requests the next frame from the input source (if not requested yet).
+         */
+        void readInputFrame();
+
+        static void afterGettingInputFrame(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                           struct timeval presentationTime, unsigned durationInMicroseconds);
+
+        void afterGettingInputFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime,
+                                    unsigned durationInMicroseconds);
+
+        static void onInputClosure(void *clientData);
+
+        /**
+         * Type of the previously published NAL unit (-1 if none).
+         */
+        int previousNalUnitType;
+
+        /**
+         * Highest temporal layer observed in the stream.
+         */
+        int maxTemporalId;
+
+        /**
+         * Number of the replicas receiving the reduced number of the temporal layers.
+         */
+        int64_t numThinnedReplicas;
+
+        /**
+         * Parses the temporal layer of the NAL unit (HEVC NAL unit header), sets it to the frame.
+         */
+        void detectTemporalLayer(const unsigned char *nalUnit, unsigned size, SharedFrame &frame);
+
+        /**
+         * Whether a decoder can start decoding from the NAL unit.
+         * Parameter sets are the sync points, keyframes only if they are not preceded by parameter sets.
+         */
+        bool detectSyncPoint(const unsigned char *nalUnit, unsigned size);
+
+        /**
+         * Returns the frame with the specified sequence number.
+         *
+         * @return pointer to the frame, nullptr if it has not been published yet or has already been dropped.
+         */
+        const SharedFrame *frameAt(uint64_t sequenceNumber) const;
+
+        /**
+         * Returns the sequence number of the most recent sync point, or the next frame if there is no sync point.
+         */
+        uint64_t latestSyncPosition() const;
+
+        /**
+         * Returns the sequence number of the oldest retained frame.
+         */
+        uint64_t oldestPosition() const;
+
+        void removeReplica(FanoutFramedSource *replica);
+    };
+
+    /**
+     * Replica of the fan-out's input source (one per client).
+     *
+     * If the stream has temporal layers, the replica drops the upper layers (halving the framerate per layer)
+     * while its client falls behind (backlog of the unread frames) or reports losses (RTCP receiver reports),
+     * and restores them when the client recovers. Layers are switched at the base layer's pictures, so no frame
+     * is delivered w/o its references.
+     */
+    class FanoutFramedSource : public FramedSource {
+
+    public:
+
+        /**
+         * Sets the RTP sink sending the replica's frames, its receiver reports are used for the layer selection.
+         *
+         * @param rtpSink - RTP sink of the client (may be closed before the replica).
+         */
+        void setRtpSink(RTPSink *rtpSink);
+
+        /**
+         * Returns the number of the dropped upper temporal layers (0 - full framerate).
+         */
+        int getDroppedLayerCount() const;
+
+        /**
+         * Sets whether the consumer grows its buffer for the frame exceeding it: such frame is delivered as
+         * fully truncated (0 bytes, the number of the truncated bytes is the frame's size) and delivered again
+         * into the grown buffer by the next read. Otherwise the frame is skipped with its dependent frames.
+         */
+        void setBufferGrowable(bool isGrowable);
+
+        /** Constants **/
+
+        /**
+         * Reported fraction of the lost packets dropping the upper layer and the fraction allowing to restore it.
+         */
+        static constexpr double LOSS_DROP_THRESHOLD = 0.05;
+
+        static constexpr double LOSS_RESTORE_THRESHOLD = 0.01;
+
+        /**
+         * Backlog (fraction of the fan-out's capacity) dropping the upper layer and the backlog allowing
+         * to restore it.
+         */
+        static constexpr double BACKLOG_DROP_THRESHOLD = 0.25;
+
+        static constexpr double BACKLOG_RESTORE_THRESHOLD = 0.0625;
+
+        /**
+         * Minimal interval between dropping the layers and the interval of no congestion before restoring one
+         * (in microseconds).
+         */
+        static const int64_t LAYER_DROP_INTERVAL_US = 1000 * 1000;
+
+        static const int64_t LAYER_RESTORE_INTERVAL_US = 5 * 1000 * 1000;
+
+    protected:
+
+        friend class FrameFanout;
+
+        FanoutFramedSource(UsageEnvironment &env, FrameFanout *fanout);
+
+        ~FanoutFramedSource() override;
+
+        void doGetNextFrame() override;
+
+    private:
+
+        /**
+         * Fan-out the frames are read from (nullptr if closed).
+         */
+        FrameFanout *fanout;
+
+        /**
+         * Sequence number of the next frame to be delivered.
+         */
+        uint64_t cursor;
+
+        /**
+         * Whether the frames are skipped until the next sync point (after the oversize frame has been skipped).
+         */
+        bool isWaitingForSyncPoint;
+
+        bool isBufferGrowable;
+
+        /**
+         * Number of the dropped upper temporal layers.
+         */
+        int droppedLayerCount;
+
+        /**
+         * Name of the client's RTP sink (looked up, the sink may be closed before the replica).
+         */
+        std::string rtpSinkName;
+
+        /**
+         * Number of the last packet acknowledged by the client's receiver report (new reports are detected by it).
+         */
+        unsigned lastReportedPacketNumber;
+
+        /**
+         * Time of the last congestion (dropping or preventing from restoring the layer) and of the last drop.
+         */
+        struct timeval lastCongestionTime, lastLayerDropTime;
+
+        /**
+         * Selects the delivered temporal layers by the client's backlog and losses (called at the base layer's
+         * pictures).
+         */
+        void updateTemporalLayers(const SharedFrame &frame);
+
+        /**
+         * Returns the fraction of the lost packets from the new receiver report of the client (-1 if no new report).
+         */
+        double takeReportedLoss();
+
+        /**
+         * Delivers the frame at the cursor if it is available (skips to the latest sync point if fallen behind).
+         * Frames larger than the consumer's buffer are never truncated: they are skipped along with the frames
+         * depending on them (up to the next sync point).
+         *
+         * @return true if the frame has been delivered, otherwise - false.
+         */
+        bool resume();
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_FRAME_FANOUT_HPP
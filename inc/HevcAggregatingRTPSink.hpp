@@ -0,0 +1,273 @@
+#ifndef LIVE_VIDEO_STREAM_HEVC_AGGREGATING_RTP_SINK_HPP
+#define LIVE_VIDEO_STREAM_HEVC_AGGREGATING_RTP_SINK_HPP
+
+#include <FramedFilter.hh>
+#include <VideoRTPSink.hh>
+#include <H264or5VideoStreamFramer.hh>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+#include "RetransmissionCache.hpp"
+
+namespace LIRS {
+
+    /**
+     * Packetizer of the HEVC NAL units into RTP payloads (RFC 7798).
+     *
+     * Each delivered frame is the payload of one RTP packet: a single NAL unit, an aggregation packet (AP) of
+     * consecutive small NAL units of the same picture (e.g. VPS, SPS, PPS, SEI and a small slice), or a fragmentation
+     * unit (FU) of the NAL unit exceeding the payload size. NAL units are never aggregated past the end of the picture,
+     * so the last packet of the picture isn't delayed.
+     */
+    class HevcNalPacketizer : public FramedFilter {
+
+    public:
+
+        /**
+         * Creates a new packetizer.
+         *
+         * @param env - environment (see Live555 docs).
+         * @param inputSource - HEVC framer delivering discrete NAL units.
+         * @param inputBufferSize - initial size of the largest NAL unit (the buffer is grown for the larger one
+         * delivered as fully truncated, see FanoutFramedSource::setBufferGrowable()).
+         * @param maxPayloadSize - size of the largest RTP payload (w/o RTP header).
+         * @param isAggregationEnabled - whether small NAL units are aggregated, otherwise each one is sent alone.
+         * @param streamName - name of the stream (metric 'memory.<stream>.packet_buffers_bytes' of the growth).
+         * @return pointer to the created packetizer.
+         */
+        static HevcNalPacketizer *createNew(UsageEnvironment &env, H264or5VideoStreamFramer *inputSource,
+                                            unsigned inputBufferSize, unsigned maxPayloadSize,
+                                            bool isAggregationEnabled = true, const std::string &streamName = {});
+
+        /**
+         * Whether the last delivered payload completes the picture (RTP marker bit).
+         */
+        bool isPictureEnd() const;
+
+        /** Constants **/
+
+        static const uint8_t AGGREGATION_PACKET_TYPE = 48;
+
+        static const uint8_t FRAGMENTATION_UNIT_TYPE = 49;
+
+        /**
+         * Sizes of the NAL unit's header, the AP's size field and the FU's header.
+         */
+        static const unsigned NAL_HEADER_SIZE = 2;
+
+        static const unsigned AP_SIZE_FIELD_SIZE = 2;
+
+        static const unsigned FU_HEADER_SIZE = 1;
+
+        /**
+         * Margin of the grown NAL unit's buffer (the following keyframes are usually of a similar size).
+         */
+        static constexpr double BUFFER_GROWTH_MARGIN = 1.5;
+
+    protected:
+
+        HevcNalPacketizer(UsageEnvironment &env, H264or5VideoStreamFramer *inputSource, unsigned inputBufferSize,
+                          unsigned maxPayloadSize, bool isAggregationEnabled, const std::string &streamName);
+
+        ~HevcNalPacketizer() override;
+
+        void doGetNextFrame() override;
+
+        void doStopGettingFrames() override;
+
+    private:
+
+        unsigned maxPayloadSize;
+
+        bool isAggregationEnabled;
+
+        std::string streamName;
+
+        /**
+         * The NAL unit read from the framer and not packetized yet (or being fragmented).
+         */
+        std::vector<uint8_t> nalUnit;
+
+        /**
+         * Bytes the NAL unit's buffer has been grown by (accounted in the stream's packet buffers).
+         */
+        size_t grownBytes;
+
+        unsigned nalUnitSize;
+
+        /**
+         * Offset of the next fragment of the NAL unit (0 - not being fragmented).
+         */
+        unsigned fragmentOffset;
+
+        struct timeval nalUnitPresentationTime;
+
+        unsigned nalUnitDuration;
+
+        bool nalUnitEndsPicture;
+
+        /**
+         * State of the payload being assembled in the sink's buffer.
+         */
+        unsigned payloadSize;
+
+        unsigned numAggregatedNalUnits;
+
+        bool payloadEndsPicture;
+
+        bool lastPayloadEndsPicture;
+
+        void readNalUnit();
+
+        /**
+         * Grows the NAL unit's buffer to fit the NAL unit of the size (with the margin).
+         */
+        void growNalUnitBuffer(unsigned size);
+
+        static void afterGettingNalUnit(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                        struct timeval presentationTime, unsigned durationInMicroseconds);
+
+        void afterGettingNalUnit(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime,
+                                 unsigned durationInMicroseconds);
+
+        /**
+         * Puts the pending NAL unit into the payload or delivers the payload.
+         */
+        void packetize();
+
+        /**
+         * Whether the pending NAL unit can be appended to the aggregation packet being assembled.
+         */
+        bool canAggregate(unsigned limit) const;
+
+        /**
+         * Appends the pending NAL unit to the aggregation packet (w/o the AP's header).
+         */
+        void aggregate();
+
+        /**
+         * Delivers the next fragment of the pending NAL unit.
+         */
+        void deliverFragment(unsigned limit);
+
+        /**
+         * Delivers the assembled payload: the single NAL unit or the aggregation packet.
+         */
+        void deliverPayload();
+    };
+
+    class RtpPacer;
+
+    /**
+     * HEVC RTP sink sending small NAL units in aggregation packets (replacement of the Live555's H265VideoRTPSink).
+     *
+     * The parameter sets and SEI preceding each keyframe (a few dozen bytes each) are sent in one packet
+     * instead of one packet per NAL unit. The SDP is the same as of H265VideoRTPSink. Packets of each picture
+     * may be paced (see RtpPacer).
+     *
+     * Sent packets may be cached for the retransmission requested by the client's generic NACK (RFC 4585),
+     * the lost packet is sent again as is (same SSRC and sequence number). The sink keeps the packets' headers,
+     * their payloads are shared by the clients of the stream (see RetransmissionPayloads).
+     * Metrics: 'nack.<stream>.hits', 'nack.<stream>.misses' (requested packets found or not in the cache),
+     * 'nack.<stream>.retransmitted_bytes'.
+     * The SDP also advertises PLI and FIR (the RTCP feedback is parsed by the subsession).
+     */
+    class HevcAggregatingRTPSink : public VideoRTPSink {
+
+    public:
+
+        /**
+         * Creates a new sink.
+         *
+         * @param env - environment (see Live555 docs).
+         * @param rtpGroupsock - RTP socket.
+         * @param rtpPayloadFormat - dynamic payload type.
+         * @param pacingSpreadUs - time the packets of a picture are spread over in microseconds (0 - not paced).
+         * @param streamName - name of the stream (metrics).
+         * @param retransmissionPayloads - payloads of the sent packets shared by the stream's clients, as many
+         *                                 packets are cached for NACKs (nullptr - not cached).
+         * @return pointer to the created sink.
+         */
+        static HevcAggregatingRTPSink *createNew(UsageEnvironment &env, Groupsock *rtpGroupsock,
+                                                 unsigned char rtpPayloadFormat, unsigned pacingSpreadUs = 0,
+                                                 const std::string &streamName = {},
+                                                 const std::shared_ptr<RetransmissionPayloads>
+                                                 &retransmissionPayloads = nullptr);
+
+        char const *auxSDPLine() override;
+
+        /**
+         * Retransmits the cached packets of the client's generic NACK (ignored if the cache is disabled).
+         *
+         * @param packetId - sequence number of the lost packet.
+         * @param lostBitmask - bitmask of the lost packets among the 16 following ones.
+         */
+        void retransmit(uint16_t packetId, uint16_t lostBitmask);
+
+        /** Constants **/
+
+        static const unsigned RTP_HEADER_SIZE = 12;
+
+    protected:
+
+        HevcAggregatingRTPSink(UsageEnvironment &env, Groupsock *rtpGroupsock, unsigned char rtpPayloadFormat,
+                               unsigned pacingSpreadUs, const std::string &streamName,
+                               const std::shared_ptr<RetransmissionPayloads> &retransmissionPayloads);
+
+        ~HevcAggregatingRTPSink() override;
+
+        Boolean sourceIsCompatibleWithUs(MediaSource &source) override;
+
+        Boolean continuePlaying() override;
+
+        void doSpecialFrameHandling(unsigned fragmentationOffset, unsigned char *frameStart,
+                                    unsigned numBytesInFrame, struct timeval framePresentationTime,
+                                    unsigned numRemainingBytes) override;
+
+        Boolean frameCanAppearAfterPacketStart(unsigned char const *frameStart,
+                                               unsigned numBytesInFrame) const override;
+
+    private:
+
+        HevcNalPacketizer *packetizer;
+
+        /**
+         * Pacer of the packetizer's payloads (nullptr - not paced).
+         */
+        RtpPacer *pacer;
+
+        unsigned pacingSpreadUs;
+
+        std::string streamName;
+
+        /**
+         * Recently sent packets (created on the first play, nullptr - retransmissions are disabled)
+         * and their payloads shared by the stream's clients.
+         */
+        std::shared_ptr<RetransmissionPayloads> retransmissionPayloads;
+
+        std::unique_ptr<RetransmissionCache> retransmissionCache;
+
+        char *fmtpSdpLine;
+
+        std::string sdpLines;
+
+        /**
+         * Returns the fmtp line with the parameter sets (nullptr - not known yet).
+         */
+        char const *parameterSetsSdpLine();
+
+        /**
+         * Caches the packet being sent (its header is built as by MultiFramedRTPSink).
+         */
+        void cachePacket(const unsigned char *payload, unsigned payloadSize, bool isMarked);
+
+        void retransmit(uint16_t sequenceNumber);
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_HEVC_AGGREGATING_RTP_SINK_HPP
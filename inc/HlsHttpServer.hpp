@@ -0,0 +1,190 @@
+#ifndef LIVE_VIDEO_STREAM_HLS_HTTP_SERVER_HPP
+#define LIVE_VIDEO_STREAM_HLS_HTTP_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "CmafPublisher.hpp"
+#include "Logger.hpp"
+
+namespace LIRS {
+
+    /**
+     * HTTP server of the low-latency HLS streams (one thread, non-blocking sockets).
+     *
+     * URLs: /hls/<stream>/index.m3u8[?_HLS_msn=M[&_HLS_part=P]], /hls/<stream>/<resource> (see CmafPublisher).
+     * Playlist requests with _HLS_msn and requests for the upcoming parts (preload hints) are held until
+     * the publisher has the requested data, or 3 target durations have passed.
+     * The muxed data is shared between the connections, nothing is copied per viewer.
+     */
+    class HlsHttpServer {
+
+    public:
+
+        explicit HlsHttpServer(unsigned port = DEFAULT_HLS_PORT);
+
+        ~HlsHttpServer();
+
+        HlsHttpServer(const HlsHttpServer &) = delete;
+
+        HlsHttpServer &operator=(const HlsHttpServer &) = delete;
+
+        /**
+         * Adds the stream served as /hls/<publisher's name>/... (may be called while the server is running).
+         *
+         * @param publisher - publisher of the stream (shared with the requests being served).
+         */
+        void addPublisher(const std::shared_ptr<CmafPublisher> &publisher);
+
+        /**
+         * Removes the stream (may be called while the server is running), its requests are answered with 404.
+         *
+         * @param name - name of the publisher.
+         */
+        void removePublisher(const std::string &name);
+
+        /**
+         * Starts listening in a new thread.
+         *
+         * @return true if the server has been started, otherwise - false.
+         */
+        bool start();
+
+        /**
+         * Stops the server closing all connections.
+         */
+        void stop();
+
+        /** Constants **/
+
+        static const unsigned DEFAULT_HLS_PORT = 8080;
+
+        /**
+         * Period of checking the deadlines of the held requests.
+         */
+        static const int POLL_INTERVAL_MS = 100;
+
+        static const size_t MAX_REQUEST_SIZE = 8 * 1024;
+
+        static const size_t MAX_CONNECTIONS = 1024;
+
+    private:
+
+        typedef struct HttpConnection {
+
+            int fd;
+
+            /**
+             * Received bytes of the requests.
+             */
+            std::string input;
+
+            /**
+             * Response being sent: the header and the shared body.
+             */
+            std::string header;
+
+            CmafData body;
+
+            size_t sent;
+
+            /**
+             * Whether the request is held until the data is available.
+             */
+            bool isHeld;
+
+            /**
+             * Target of the current request.
+             */
+            std::string target;
+
+            bool isHead;
+
+            bool isClosing;
+
+            std::chrono::steady_clock::time_point deadline;
+
+            HttpConnection() : fd(-1), sent(0), isHeld(false), isHead(false), isClosing(false) {}
+
+        } HttpConnection;
+
+        unsigned port;
+
+        int listenFd;
+
+        /**
+         * Pipe waking up the server's thread when new data has been published.
+         */
+        int wakeupPipe[2];
+
+        std::atomic_bool isRunning;
+
+        std::thread serverThread;
+
+        /**
+         * Publishers by the stream name (may be added while the server is running).
+         */
+        std::map<std::string, std::shared_ptr<CmafPublisher>> publishers;
+
+        std::mutex publishersMutex;
+
+        /**
+         * Open connections by socket (server's thread only).
+         */
+        std::map<int, HttpConnection> connections;
+
+        void loop();
+
+        /**
+         * Returns the publisher of the stream or nullptr (kept while the request is handled).
+         */
+        std::shared_ptr<CmafPublisher> findPublisher(const std::string &name);
+
+        void acceptConnections();
+
+        /**
+         * Reads available bytes of the connection.
+         *
+         * @return false if the connection has been closed by the client.
+         */
+        bool readRequest(HttpConnection &connection);
+
+        /**
+         * Parses the next complete request and responds to it (unless it's held).
+         *
+         * @return false if the request is malformed and the connection should be closed.
+         */
+        bool processRequest(HttpConnection &connection);
+
+        /**
+         * Responds to the current request if possible.
+         *
+         * @return false if the request is held.
+         */
+        bool handleRequest(HttpConnection &connection);
+
+        void respond(HttpConnection &connection, int status, const std::string &contentType, CmafData body,
+                     const std::string &cacheControl = "no-cache");
+
+        /**
+         * Sends the response.
+         *
+         * @return false if the connection has failed.
+         */
+        bool writeResponse(HttpConnection &connection);
+
+        void closeConnection(int fd);
+
+        /**
+         * Wakes up the server's thread (called by the publishers).
+         */
+        void wakeup();
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_HLS_HTTP_SERVER_HPP
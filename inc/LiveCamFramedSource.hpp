@@ -4,20 +4,35 @@
 #include <FramedSource.hh>
 #include <UsageEnvironment.hh>
 
+#include <deque>
 #include <mutex>
+#include <string>
 #include <thread>
 
+#include "EventNotifier.hpp"
 #include "Transcoder.hpp"
 
 namespace LIRS {
 
     /**
      * Implementation of the framed source for live camera.
+     *
+     * NAL units are never truncated: the NAL unit larger than the consumer's buffer is delivered as 0 bytes with
+     * the number of the truncated bytes set to its size and stays queued, so the consumer grows its buffer and
+     * reads it again (see FrameFanout).
      */
     class LiveCamFramedSource : public FramedSource {
     public:
 
-        static LiveCamFramedSource *createNew(UsageEnvironment &env, Transcoder *transcoder);
+        static LiveCamFramedSource *createNew(UsageEnvironment &env, Transcoder *transcoder,
+                                              EventNotifier *eventNotifier);
+
+        /** Constants **/
+
+        /**
+         * Maximum number of the pending NAL units, the oldest ones are dropped on overflow.
+         */
+        static const size_t MAX_ENCODED_DATA_BUFFER_SIZE = 256;
 
     protected:
 
@@ -26,8 +41,10 @@ namespace LIRS {
          *
          * @param env - environment (see Live555 docs).
          * @param transcoder - providing with encoded data.
+         * @param eventNotifier - wakes up the event loop of the environment when the encoded data is available
+         *                        (shared by the sources of the loop).
          */
-        LiveCamFramedSource(UsageEnvironment &env, Transcoder *transcoder);
+        LiveCamFramedSource(UsageEnvironment &env, Transcoder *transcoder, EventNotifier *eventNotifier);
 
         ~LiveCamFramedSource() override;
 
@@ -42,10 +59,17 @@ namespace LIRS {
          */
         Transcoder *transcoder;
 
+        /**
+         * Thread running the transcoder (joined on destruction).
+         */
+        std::thread transcodingThread;
+
+        EventNotifier *eventNotifier;
+
         /*
          * Indicating an event invoking deliver frame method.
          */
-        EventTriggerId eventTriggerId;
+        EventNotifier::EventId eventId;
 
         /**
          * Mutex to access encoded data.
@@ -55,9 +79,27 @@ namespace LIRS {
         std::mutex encodedDataMutex;
 
         /**
-         * Encoded data buffer.
+         * NAL unit with the presentation time of its access unit.
+         */
+        typedef struct EncodedNalUnit {
+
+            std::vector<uint8_t> data;
+
+            struct timeval presentationTime;
+
+        } EncodedNalUnit;
+
+        /**
+         * Encoded data buffer (FIFO of the NAL units).
          */
-        std::vector<std::vector<uint8_t>> encodedDataBuffer;
+        std::deque<EncodedNalUnit> encodedDataBuffer;
+
+        /**
+         * Size of the buffered NAL units in bytes (guarded by the mutex) and the name of its memory metric.
+         */
+        size_t encodedDataBufferBytes;
+
+        std::string encodedQueueMetricName;
 
         /**
          * Encoded data.
@@ -67,7 +109,7 @@ namespace LIRS {
         /**
          * Function to be called when the video source has a new available encoded data.
          */
-        void onEncodedData(std::vector<uint8_t> &&data);
+        void onEncodedData(std::vector<uint8_t> &&data, const struct timeval &presentationTime);
 
         /**
          * Delivers encoded data.
@@ -75,8 +117,8 @@ namespace LIRS {
         void deliverData();
 
         /**
-         * Trigger function.
-         * It will be called by the trigger.
+         * Event handler function.
+         * It will be called by the event loop when the event is signaled.
          */
         static void deliverFrame0(void *);
     };
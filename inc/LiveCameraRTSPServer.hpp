@@ -1,43 +1,119 @@
 #ifndef LIVE_VIDEO_STREAM_LIVE_RTSP_SERVER_HPP
 #define LIVE_VIDEO_STREAM_LIVE_RTSP_SERVER_HPP
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
 #include <UsageEnvironment.hh>
 #include <BasicUsageEnvironment.hh>
 #include <GroupsockHelper.hh>
 #include <liveMedia.hh>
+#include "AdmissionRTSPServer.hpp"
 #include "LiveCamFramedSource.hpp"
 #include "CameraUnicastServerMediaSubsession.hpp"
+#include "ControlServer.hpp"
+#include "DebugAllocator.hpp"
+#include "EpollTaskScheduler.hpp"
+#include "EventNotifier.hpp"
+#include "FrameFanout.hpp"
+#include "HlsHttpServer.hpp"
+#include "Metrics.hpp"
 
 namespace LIRS {
 
+    /**
+     * Implementation of the server's event loop.
+     */
+    enum TaskSchedulerType {
+        TASK_SCHEDULER_SELECT, // Live555's BasicTaskScheduler (up to FD_SETSIZE sockets)
+        TASK_SCHEDULER_EPOLL // EpollTaskScheduler (thousands of sockets)
+    };
+
     class LiveCameraRTSPServer {
 
     public:
 
-        explicit LiveCameraRTSPServer(unsigned int port = DEFAULT_RTSP_PORT_NUMBER, int httpPort = -1) :
+        /**
+         * Creates the server's environment (the server is started by run()).
+         *
+         * @param port - RTSP port number.
+         * @param httpPort - HTTP tunneling port number (-1 - disabled).
+         * @param schedulerType - implementation of the event loop.
+         */
+        explicit LiveCameraRTSPServer(unsigned int port = DEFAULT_RTSP_PORT_NUMBER, int httpPort = -1,
+                                      TaskSchedulerType schedulerType = TASK_SCHEDULER_SELECT) :
                 rtspPort(port), httpTunnelingPort(httpPort), watcher(0),
-                scheduler(nullptr), env(nullptr), server(nullptr) {
+                scheduler(nullptr), env(nullptr), server(nullptr), metricsLogTask(nullptr), admissionTask(nullptr),
+                hlsPort(0),
+                isNalAggregationEnabled(true), pacingFraction(DEFAULT_PACING_FRACTION),
+                retransmissionCacheSize(DEFAULT_RETRANSMISSION_CACHE_SIZE),
+                startTime(std::chrono::steady_clock::now()), nextInitializationNumber(0), sourcesReadyEvent(0),
+                numStartedStreams(0), numExpectedStreams(0) {
 
             // create scheduler and environment
-            scheduler = BasicTaskScheduler::createNew();
+            if (schedulerType == TASK_SCHEDULER_EPOLL) {
+                scheduler = EpollTaskScheduler::createNew();
+            } else {
+                scheduler = BasicTaskScheduler::createNew();
+            }
+
             env = BasicUsageEnvironment::createNew(*scheduler);
+
+            eventNotifier.reset(new EventNotifier(*scheduler));
         }
 
         ~LiveCameraRTSPServer() {
 
+            // sources still being initialized
+            for (auto &thread : initializationThreads) {
+                if (thread.second.joinable()) thread.second.join();
+            }
+
+            if (sourcesReadyEvent != 0) {
+                eventNotifier->deleteEvent(sourcesReadyEvent);
+            }
+
+            env->taskScheduler().unscheduleDelayedTask(metricsLogTask);
+            env->taskScheduler().unscheduleDelayedTask(admissionTask);
+
+            // replies of the pending operations are dropped with the control connections
+            pendingOperations.clear();
+            controlServer.reset();
+
             Medium::close(server); // deletes all server media sessions
 
+            // delete all fan-outs (before their input sources)
+            for (auto &stream : streams) {
+                Medium::close(stream.second.fanout);
+            }
+
             // delete all framed sources
-            for (auto &src : allocatedVideoSources) {
-                if (src) Medium::close(src);
+            for (auto &stream : streams) {
+                Medium::close(stream.second.framedSource);
             }
 
+            // transcoders are stopped, nothing is published anymore
+            hlsServer.reset();
+
+            // the sources have deleted their events
+            eventNotifier.reset();
+
             env->reclaim();
 
             delete scheduler;
 
             transcoders.clear();
-            allocatedVideoSources.clear();
+            streams.clear();
             watcher = 0;
 
             LOG(INFO) << "RTSP server has been destructed";
@@ -56,7 +132,88 @@ namespace LIRS {
          * @param transcoder - a reference to the transcoder.
          */
         void addTranscoder(Transcoder *transcoder) {
-            transcoders.push_back(transcoder);
+            if (transcoder) transcoders.push_back(transcoder); // nullptr - the transcoder couldn't be initialized
+        }
+
+        /**
+         * Adds a video source initialized in parallel with the others when the server is started,
+         * its stream is announced as soon as the transcoder has been created.
+         *
+         * @param factory - function creating the transcoder (called in a separate thread, nullptr - the source
+         * can't be opened, its stream isn't served).
+         */
+        void addSource(std::function<Transcoder *()> factory) {
+            sourceFactories.push_back(std::move(factory));
+        }
+
+        /**
+         * Enables the low-latency HLS output of all streams served over HTTP (should be called before run()).
+         *
+         * @param port - HTTP port number.
+         * @param options - segmentation parameters.
+         */
+        void enableHls(unsigned int port = HlsHttpServer::DEFAULT_HLS_PORT, const HlsOptions &options = {}) {
+            hlsPort = port;
+            hlsOptions = options;
+        }
+
+        /**
+         * Enables the local control socket adding, removing and reconfiguring the streams at runtime
+         * (should be called before run()). Commands (one per line, answered with "OK ..." or "ERROR ..."):
+         *
+         *     add <alias> <device> <width>x<height> <raw format> <fps> [output_fps=N] [pixel_format=F] [input=F]
+         *     reconfigure <alias> <device> <width>x<height> <raw format> <fps> [...] (viewers of the stream reconnect)
+         *     remove <alias>
+         *     list
+         *
+         * Added stream is answered when it's ready, the replies report the operation's latency. The source that
+         * can't be opened is answered with "ERROR": the reconfigured stream keeps running if the new source is
+         * another device, the stream of the same device (released first) is reopened with its previous parameters.
+         *
+         * @param socketPath - path of the Unix domain socket.
+         */
+        void enableControl(const std::string &socketPath = ControlServer::DEFAULT_SOCKET_PATH) {
+            controlSocketPath = socketPath;
+        }
+
+        /**
+         * Sets whether small HEVC NAL units (parameter sets, SEI) are sent in RTP aggregation packets
+         * (enabled by default, should be called before run()).
+         */
+        void setNalAggregation(bool isEnabled) {
+            isNalAggregationEnabled = isEnabled;
+        }
+
+        /**
+         * Sets the part of the frame interval the RTP packets of each picture are spread over, so the keyframes
+         * aren't sent as bursts (HEVC streams with the NAL aggregation, should be called before run()).
+         *
+         * @param fraction - part of the interval in (0, 1], 0 - packets are sent back to back.
+         */
+        void setPacing(double fraction) {
+            pacingFraction = std::min(std::max(fraction, 0.0), 1.0);
+        }
+
+        /**
+         * Sets the number of the recently sent RTP packets cached for the retransmission requested by the client's
+         * NACKs (HEVC streams with the NAL aggregation, should be called before run()). The payloads are stored once
+         * per stream, each client keeps the packets' headers (about 8 KB per client for the default size).
+         *
+         * @param numPackets - number of the packets (rounded up to a power of two), 0 - disabled.
+         */
+        void setRetransmissionCache(size_t numPackets) {
+            retransmissionCacheSize = numPackets;
+        }
+
+        /**
+         * Sets the egress and CPU budget the clients' sessions are admitted within, the sessions exceeding it
+         * are rejected with "453 Not Enough Bandwidth" unless they preempt the sessions of the lower priority
+         * classes (unlimited by default, should be called before run()).
+         *
+         * @param options - budget and the clients' priority classes.
+         */
+        void setAdmissionControl(const AdmissionOptions &options) {
+            admission.configure(options);
         }
 
         /*
@@ -67,7 +224,7 @@ namespace LIRS {
             if (server) return; // already running
 
             // create server listening on the specified RTSP port
-            server = RTSPServer::createNew(*env, rtspPort);
+            server = AdmissionRTSPServer::createNew(*env, rtspPort, admission);
 
             if (!server) {
                 *env << "Failed to create RTSP server: " << env->getResultMsg() << "\n";
@@ -81,9 +238,35 @@ namespace LIRS {
                 }
             }
 
-            // create media session for each video source (transcoder)
+            if (hlsPort != 0) {
+                hlsServer.reset(new HlsHttpServer(hlsPort));
+                hlsServer->start();
+            }
+
+            numExpectedStreams = transcoders.size() + sourceFactories.size();
+
+            // the sources are opened in parallel (each may take seconds), the streams are started as they're ready
+            sourcesReadyEvent = eventNotifier->createEvent(LiveCameraRTSPServer::onSourcesReady, this);
+
+            for (auto &factory : sourceFactories) {
+                initializeSource(factory);
+            }
+
+            if (!controlSocketPath.empty()) {
+                controlServer.reset(new ControlServer(*env, controlSocketPath,
+                                                      std::bind(&LiveCameraRTSPServer::handleControlCommand, this,
+                                                                std::placeholders::_1, std::placeholders::_2)));
+            }
+
+            // create media session for each video source created in advance
             for (auto &transcoder : transcoders) {
-                addMediaSession(transcoder, transcoder->getAlias(), "stream description");
+                startStream(transcoder);
+            }
+
+            logMetrics(this); // periodically
+
+            if (admission.isEnabled()) {
+                updateAdmission(this); // periodically
             }
 
             env->taskScheduler().doEventLoop(&watcher); // do not return
@@ -93,7 +276,27 @@ namespace LIRS {
 
         static const unsigned int DEFAULT_RTSP_PORT_NUMBER = 8554;
 
-        static const unsigned int OUT_PACKET_BUFFER_MAX_SIZE = 2 * 1000 * 1000;
+        static const unsigned int METRICS_LOG_INTERVAL_SEC = 30;
+
+        /**
+         * Interval of updating the streams' bitrates and the CPU load of the admission control.
+         */
+        static const unsigned int ADMISSION_UPDATE_INTERVAL_MS = 1000;
+
+        /**
+         * Name of the metric of the time between the server's construction and all streams being announced.
+         */
+        static constexpr const char *STARTUP_METRIC_NAME = "startup.all_ready_ms";
+
+        /**
+         * Default part of the frame interval the packets of a picture are spread over.
+         */
+        static constexpr double DEFAULT_PACING_FRACTION = 0.5;
+
+        /**
+         * Default number of the packets cached for the retransmissions (about 370 KB per stream).
+         */
+        static const size_t DEFAULT_RETRANSMISSION_CACHE_SIZE = 256;
 
     private:
 
@@ -115,18 +318,678 @@ namespace LIRS {
         TaskScheduler *scheduler;
         UsageEnvironment *env;
 
+        /**
+         * Wakes up the event loop from the transcoding and initialization threads (a single eventfd for all
+         * sources, the number of the Live555's event triggers is limited).
+         */
+        std::unique_ptr<EventNotifier> eventNotifier;
+
         RTSPServer *server;
 
         /**
-         * Pointers to video sources (transcoders).
+         * Delayed task logging the metrics.
+         */
+        TaskToken metricsLogTask;
+
+        /**
+         * Admission control of the clients' sessions and the delayed task updating it.
+         */
+        AdmissionController admission;
+
+        TaskToken admissionTask;
+
+        /**
+         * HTTP port of the HLS output (0 - disabled) and its segmentation parameters.
+         */
+        unsigned int hlsPort;
+
+        HlsOptions hlsOptions;
+
+        std::unique_ptr<HlsHttpServer> hlsServer;
+
+        /**
+         * Whether the HEVC streams are sent using the aggregation packets.
+         */
+        bool isNalAggregationEnabled;
+
+        /**
+         * Part of the frame interval the packets of a picture are spread over (0 - not paced).
+         */
+        double pacingFraction;
+
+        /**
+         * Number of the sent packets cached per client for the retransmissions (0 - disabled).
+         */
+        size_t retransmissionCacheSize;
+
+        /**
+         * Objects of the started stream (closed together when the stream is removed).
+         */
+        typedef struct ServedStream {
+
+            /**
+             * Framed source owning the transcoder and the fan-out of its frames.
+             */
+            LiveCamFramedSource *framedSource;
+
+            FrameFanout *fanout;
+
+            ServerMediaSession *session;
+
+            /**
+             * Publisher of the HLS stream (shared with the HLS server's requests).
+             */
+            std::shared_ptr<CmafPublisher> publisher;
+
+            /**
+             * Video source of the transcoder (the device can't be opened twice).
+             */
+            std::string device;
+
+            /**
+             * Function creating the transcoder again (empty - the transcoder has been added directly).
+             */
+            std::function<Transcoder *()> factory;
+
+        } ServedStream;
+
+        /**
+         * Started streams by alias.
+         */
+        std::map<std::string, ServedStream> streams;
+
+        /**
+         * Video sources (transcoders) added before the server has been started.
          */
         std::vector<Transcoder *> transcoders;
 
         /**
-         * Pointers to framed sources (Live555).
-         * Hold in order to cleanup.
+         * Path of the control socket (empty - disabled) and its server.
+         */
+        std::string controlSocketPath;
+
+        std::unique_ptr<ControlServer> controlServer;
+
+        /**
+         * Control operation waiting for its stream to be ready (answered by startStream()).
+         */
+        typedef struct PendingOperation {
+
+            std::string command;
+
+            ControlServer::Reply reply;
+
+            std::chrono::steady_clock::time_point startTime;
+
+            /**
+             * Time of closing the previous stream (reconfiguration).
+             */
+            int64_t removeTimeMs;
+
+            /**
+             * Function creating the transcoder of the stream closed before the new one has been opened
+             * (reconfiguration of the same device), the stream is restored if the new source can't be opened.
+             */
+            std::function<Transcoder *()> restoreFactory;
+
+        } PendingOperation;
+
+        std::map<std::string, PendingOperation> pendingOperations;
+
+        /**
+         * Time of the server's construction (the cold start is measured from it).
+         */
+        std::chrono::steady_clock::time_point startTime;
+
+        /**
+         * Factories of the sources initialized in parallel and their threads (by the initialization's number,
+         * joined when their sources are started).
+         */
+        std::vector<std::function<Transcoder *()>> sourceFactories;
+
+        std::map<unsigned, std::thread> initializationThreads;
+
+        unsigned nextInitializationNumber;
+
+        /**
+         * Source initialized by a thread.
+         */
+        typedef struct ReadySource {
+
+            /**
+             * Alias of the stream added at runtime (empty - the source has been added before the start).
+             */
+            std::string alias;
+
+            std::function<Transcoder *()> factory;
+
+            /**
+             * Created transcoder, nullptr - the source can't be opened.
+             */
+            Transcoder *transcoder;
+
+            /**
+             * Number of the initialization (its thread is joined by the event loop).
+             */
+            unsigned initializationNumber;
+
+        } ReadySource;
+
+        /**
+         * Sources initialized by the threads, not started yet (guarded by the mutex).
+         */
+        std::vector<ReadySource> readySources;
+
+        std::mutex readySourcesMutex;
+
+        /**
+         * Event signaled by the initialization threads when a transcoder has been created.
+         */
+        EventNotifier::EventId sourcesReadyEvent;
+
+        /**
+         * Number of the started streams and of all configured ones.
+         */
+        size_t numStartedStreams, numExpectedStreams;
+
+        /**
+         * Logs all metrics and reschedules itself.
+         */
+        static void logMetrics(void *clientData) {
+
+            auto rtspServer = static_cast<LiveCameraRTSPServer *>(clientData);
+
+            rtspServer->logMemoryFootprint();
+
+            LOG(INFO) << "Metrics:\n" << Metrics::getInstance().dump();
+
+            rtspServer->metricsLogTask = rtspServer->env->taskScheduler().scheduleDelayedTask(
+                    METRICS_LOG_INTERVAL_SEC * 1000000LL, logMetrics, rtspServer);
+        }
+
+        /**
+         * Logs the memory footprint of each stream (sum of its 'memory.<stream>.*' metrics), the total and the resident
+         * set size of the process, and the subsystems' allocations of the debug allocator if it's built in.
+         */
+        void logMemoryFootprint() {
+
+            std::stringstream summary;
+            int64_t totalBytes = 0;
+
+            for (auto &stream : streams) {
+
+                int64_t streamBytes = 0;
+                std::stringstream components;
+
+                for (auto &metric : Metrics::getInstance().getByPrefix("memory." + stream.first + ".")) {
+                    if (components.tellp() > 0) components << ", ";
+
+                    streamBytes += metric.second;
+                    components << metric.first.substr(stream.first.size() + 8) << "=" << metric.second;
+                }
+
+                totalBytes += streamBytes;
+
+                summary << "\n  " << stream.first << ": " << streamBytes << " bytes (" << components.str() << ")";
+            }
+
+            Metrics::getInstance().set("memory.total_bytes", totalBytes);
+
+            auto residentBytes = getResidentBytes();
+
+            if (residentBytes >= 0) Metrics::getInstance().set("memory.rss_bytes", residentBytes);
+
+            summary << "\n  total: " << totalBytes << " bytes, resident: " << residentBytes << " bytes";
+
+            if (DebugAllocator::isEnabled()) {
+
+                DebugAllocator::updateMetrics();
+
+                for (int subsystem = 0; subsystem < MEMORY_SUBSYSTEM_COUNT; subsystem++) {
+
+                    auto memorySubsystem = static_cast<MemorySubsystem>(subsystem);
+
+                    summary << "\n  allocator " << DebugAllocator::getSubsystemName(memorySubsystem) << ": "
+                            << DebugAllocator::getAllocatedBytes(memorySubsystem) << " bytes (high-water "
+                            << DebugAllocator::getHighWaterMark(memorySubsystem) << ")";
+                }
+            }
+
+            LOG(INFO) << "Memory footprint:" << summary.str();
+        }
+
+        /**
+         * Returns the resident set size of the process in bytes (-1 if it's unavailable).
+         */
+        static int64_t getResidentBytes() {
+
+            auto statm = fopen("/proc/self/statm", "r");
+
+            if (!statm) return -1;
+
+            long long totalPages = 0, residentPages = 0;
+
+            auto numRead = fscanf(statm, "%lld %lld", &totalPages, &residentPages);
+
+            fclose(statm);
+
+            return numRead == 2 ? residentPages * sysconf(_SC_PAGESIZE) : -1;
+        }
+
+        /**
+         * Updates the measured bitrates of the streams and the CPU load of the admission control,
+         * reschedules itself.
+         */
+        static void updateAdmission(void *clientData) {
+
+            auto rtspServer = static_cast<LiveCameraRTSPServer *>(clientData);
+
+            for (auto &stream : rtspServer->streams) {
+                rtspServer->admission.setStreamBitrate(stream.first, stream.second.fanout->getAverageBitrateKbps());
+            }
+
+            rtspServer->admission.sampleCpuLoad();
+
+            rtspServer->admissionTask = rtspServer->env->taskScheduler().scheduleDelayedTask(
+                    ADMISSION_UPDATE_INTERVAL_MS * 1000LL, updateAdmission, rtspServer);
+        }
+
+        /**
+         * Starts the streams of the transcoders created by the initialization threads (event loop's thread).
+         */
+        static void onSourcesReady(void *clientData) {
+
+            auto rtspServer = static_cast<LiveCameraRTSPServer *>(clientData);
+
+            std::vector<ReadySource> sources;
+
+            {
+                std::lock_guard<std::mutex> lock(rtspServer->readySourcesMutex);
+                sources.swap(rtspServer->readySources);
+            }
+
+            for (auto &source : sources) {
+
+                // the thread has finished its work (at most unlocking the mutex is left)
+                auto thread = rtspServer->initializationThreads.find(source.initializationNumber);
+
+                if (thread != rtspServer->initializationThreads.end()) {
+                    thread->second.join();
+                    rtspServer->initializationThreads.erase(thread);
+                }
+
+                if (source.transcoder) {
+                    rtspServer->startStream(source.transcoder, source.factory);
+                } else {
+                    rtspServer->onSourceFailed(source.alias);
+                }
+            }
+        }
+
+        /**
+         * Creates the transcoder in a new thread, its stream is started by the event loop when it's ready.
+         *
+         * @param factory - function creating the transcoder.
+         * @param alias - alias of the stream added at runtime (empty - the source is added before the start).
+         */
+        void initializeSource(const std::function<Transcoder *()> &factory, const std::string &alias = {}) {
+
+            auto number = nextInitializationNumber++;
+
+            // the ready source is handled by the event loop, i.e. after the thread has been stored
+            initializationThreads[number] = std::thread([this, factory, alias, number]() {
+
+                auto transcoder = factory();
+
+                std::lock_guard<std::mutex> lock(readySourcesMutex);
+
+                readySources.push_back(ReadySource{alias, factory, transcoder, number});
+
+                eventNotifier->signal(sourcesReadyEvent);
+            });
+        }
+
+        /**
+         * Answers the control operation whose source can't be opened with "ERROR" (the stream of the same device
+         * closed by the reconfiguration is reopened with its previous parameters).
+         *
+         * @param alias - alias of the stream added at runtime (empty - the source has been added before the start).
+         */
+        void onSourceFailed(const std::string &alias) {
+
+            auto operation = pendingOperations.find(alias);
+
+            if (operation == pendingOperations.end()) {
+
+                LOG(ERROR) << "Source hasn't been opened, its stream isn't served";
+
+                numExpectedStreams--;
+                return;
+            }
+
+            auto failedOperation = operation->second;
+
+            pendingOperations.erase(operation);
+
+            if (failedOperation.command == "restore") {
+                LOG(ERROR) << "Stream \"" << alias << "\" couldn't be restored, it has been removed";
+                return;
+            }
+
+            LOG(ERROR) << "Source of \"" << alias << "\" hasn't been opened by \"" << failedOperation.command << "\"";
+
+            if (failedOperation.restoreFactory) {
+
+                // the reply isn't delayed by the restoration
+                pendingOperations[alias] = PendingOperation{"restore", nullptr, std::chrono::steady_clock::now(), 0,
+                                                            nullptr};
+
+                initializeSource(failedOperation.restoreFactory, alias);
+            }
+
+            failedOperation.reply("ERROR " + alias + ": source can't be opened" +
+                                  (failedOperation.restoreFactory ? ", restoring the previous configuration" : ""));
+        }
+
+        /**
+         * Creates the HLS publisher and the media session of the transcoder, reports the startup time
+         * (or answers the control operation waiting for the stream). The reconfigured stream of another device
+         * is replaced now that the new source has been opened.
+         *
+         * @param transcoder - created video source.
+         * @param factory - function that has created the transcoder (empty - it has been added directly).
+         */
+        void startStream(Transcoder *transcoder, const std::function<Transcoder *()> &factory = nullptr) {
+
+            auto alias = transcoder->getAlias();
+
+            auto operation = pendingOperations.find(alias);
+
+            if (operation != pendingOperations.end() && operation->second.command == "reconfigure" &&
+                streams.count(alias)) {
+                operation->second.removeTimeMs = removeStream(alias);
+            }
+
+            std::shared_ptr<CmafPublisher> publisher;
+
+            // encoded packets are segmented for HLS by the transcoding thread (before it's started)
+            if (hlsServer) {
+
+                publisher = std::make_shared<CmafPublisher>(alias, transcoder->getOutputCodecId(), hlsOptions);
+
+                transcoder->setOnEncodedPacketCallback(std::bind(&CmafPublisher::publish, publisher.get(),
+                                                                 std::placeholders::_1, std::placeholders::_2,
+                                                                 std::placeholders::_3));
+
+                hlsServer->addPublisher(publisher);
+            }
+
+            addMediaSession(transcoder, alias, "stream description", publisher);
+
+            streams[alias].factory = factory;
+
+            if (operation != pendingOperations.end() && operation->second.command == "restore") {
+
+                LOG(WARN) << "Stream \"" << alias << "\" has been restored with its previous configuration";
+
+                pendingOperations.erase(operation);
+                return;
+            }
+
+            if (operation != pendingOperations.end()) { // added at runtime
+
+                auto addTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - operation->second.startTime).count();
+
+                Metrics::getInstance().set("control." + operation->second.command + "_ms",
+                                           operation->second.removeTimeMs + addTimeMs);
+
+                LOG(INFO) << "Stream \"" << alias << "\" has been started by \"" << operation->second.command
+                          << "\" in " << addTimeMs << " ms";
+
+                std::ostringstream reply;
+                reply << "OK " << operation->second.command << " " << alias;
+
+                if (operation->second.command == "reconfigure") {
+                    reply << " remove_ms=" << operation->second.removeTimeMs << " add_ms=" << addTimeMs;
+                }
+
+                reply << " total_ms=" << operation->second.removeTimeMs + addTimeMs;
+
+                auto replyFunc = operation->second.reply;
+
+                pendingOperations.erase(operation);
+
+                replyFunc(reply.str());
+                return;
+            }
+
+            auto readyTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - startTime).count();
+
+            Metrics::getInstance().set("startup." + alias + ".ready_ms", readyTimeMs);
+
+            LOG(INFO) << "Stream \"" << alias << "\" is ready in " << readyTimeMs
+                      << " ms (initialization: " << transcoder->getInitializationTimeMs() << " ms)";
+
+            if (++numStartedStreams == numExpectedStreams) {
+
+                Metrics::getInstance().set(STARTUP_METRIC_NAME, readyTimeMs);
+
+                LOG(INFO) << "All " << numExpectedStreams << " streams are ready in " << readyTimeMs
+                          << " ms since the start";
+            }
+        }
+
+        /**
+         * Closes the stream: its media session (and the clients' sessions), the fan-out, the framed source with
+         * the transcoder and the HLS publisher.
+         *
+         * @param alias - name of the stream.
+         * @return time of closing in milliseconds (-1 - the stream doesn't exist).
+         */
+        int64_t removeStream(const std::string &alias) {
+
+            auto it = streams.find(alias);
+
+            if (it == streams.end()) return -1;
+
+            auto removeStart = std::chrono::steady_clock::now();
+
+            // the clients' sessions are closed with the media session (before their source), releasing admission
+            server->deleteServerMediaSession(it->second.session);
+
+            admission.removeStream(alias);
+
+            Medium::close(it->second.fanout);
+
+            // stops the transcoding thread and deletes the transcoder
+            Medium::close(it->second.framedSource);
+
+            if (hlsServer) hlsServer->removePublisher(alias);
+
+            streams.erase(it);
+
+            // all per stream metrics (<prefix>.<alias>.*): the transcoder has been stopped, the one replacing it
+            // publishes its metrics when it starts running
+            for (auto prefix : {"startup", "encoder", "governor", "keyframes", "motion", "fanout", "pacing", "nack",
+                                "hls", "memory"}) {
+                Metrics::getInstance().removeByPrefix(std::string(prefix) + "." + alias + ".");
+            }
+
+            auto removeTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - removeStart).count();
+
+            LOG(INFO) << "Stream \"" << alias << "\" has been removed in " << removeTimeMs << " ms";
+
+            return removeTimeMs;
+        }
+
+        /**
+         * Parses the arguments of the "add" command and creates the factory of the transcoder (nothing is opened),
+         * the arguments are validated to answer at once, the source failing to open is reported by the factory.
+         *
+         * @param args - command's words: add <alias> <device> <width>x<height> <raw format> <fps> [key=value...].
+         * @param factory - created factory.
+         * @return error message (empty - success).
+         */
+        static std::string parseStreamArgs(const std::vector<std::string> &args,
+                                           std::function<Transcoder *()> &factory) {
+
+            if (args.size() < 6) return "usage: " + args[0] + " <alias> <device> <width>x<height> <raw format> <fps>"
+                                        " [output_fps=N] [pixel_format=F] [input=F]";
+
+            auto alias = args[1];
+            auto device = args[2];
+            auto rawFormat = args[4];
+
+            unsigned width = 0, height = 0;
+            char tail = 0;
+
+            if (sscanf(args[3].c_str(), "%ux%u%c", &width, &height, &tail) != 2 || width == 0 || height == 0) {
+                return "invalid frame size: " + args[3];
+            }
+
+            auto frameRate = strtoul(args[5].c_str(), nullptr, 10);
+            auto outputFrameRate = frameRate;
+
+            std::string pixelFormat = "yuv420p";
+            std::string inputFormat = "v4l2";
+
+            for (size_t idx = 6; idx < args.size(); idx++) {
+
+                auto separator = args[idx].find('=');
+                auto key = args[idx].substr(0, separator);
+                auto value = separator == std::string::npos ? std::string() : args[idx].substr(separator + 1);
+
+                if (key == "output_fps") {
+                    outputFrameRate = strtoul(value.c_str(), nullptr, 10);
+                } else if (key == "pixel_format") {
+                    pixelFormat = value;
+                } else if (key == "input") {
+                    inputFormat = value; // empty - detected
+                } else {
+                    return "unknown option: " + args[idx];
+                }
+            }
+
+            if (frameRate == 0 || outputFrameRate == 0 || outputFrameRate > frameRate) {
+                return "invalid frame rates: " + args[5] + " -> " + std::to_string(outputFrameRate);
+            }
+
+            Transcoder::registerAll();
+
+            if (av_get_pix_fmt(rawFormat.c_str()) == AV_PIX_FMT_NONE &&
+                !avcodec_find_decoder_by_name(rawFormat.c_str())) {
+                return "unknown raw format: " + rawFormat;
+            }
+
+            if (av_get_pix_fmt(pixelFormat.c_str()) == AV_PIX_FMT_NONE) {
+                return "unknown pixel format: " + pixelFormat;
+            }
+
+            if (!inputFormat.empty() && !av_find_input_format(inputFormat.c_str())) {
+                return "unknown input format: " + inputFormat;
+            }
+
+            if (inputFormat == "v4l2" && access(device.c_str(), R_OK) != 0) {
+                return "device isn't accessible: " + device;
+            }
+
+            factory = [=]() {
+                return Transcoder::newInstance(device, alias, width, height, rawFormat, pixelFormat, frameRate,
+                                               outputFrameRate, {}, inputFormat);
+            };
+
+            return {};
+        }
+
+        /**
+         * Handles the command of the control socket (see enableControl()).
+         *
+         * @param args - command's words.
+         * @param reply - sends the reply (once per command).
          */
-        std::vector<FramedSource *> allocatedVideoSources;
+        void handleControlCommand(const std::vector<std::string> &args, const ControlServer::Reply &reply) {
+
+            auto &command = args[0];
+
+            if (command == "list") {
+
+                std::ostringstream list;
+                list << "OK " << streams.size();
+
+                for (auto &stream : streams) {
+                    list << " " << stream.first;
+                }
+
+                reply(list.str());
+                return;
+            }
+
+            if ((command != "add" && command != "remove" && command != "reconfigure") || args.size() < 2) {
+                reply("ERROR unknown command, expected: add, remove, reconfigure <alias> ... or list");
+                return;
+            }
+
+            auto &alias = args[1];
+
+            if (pendingOperations.count(alias)) {
+                reply("ERROR " + alias + ": " + pendingOperations[alias].command + " is in progress");
+                return;
+            }
+
+            if (command == "remove") {
+
+                auto removeTimeMs = removeStream(alias);
+
+                if (removeTimeMs < 0) {
+                    reply("ERROR " + alias + ": no such stream");
+                    return;
+                }
+
+                Metrics::getInstance().set("control.remove_ms", removeTimeMs);
+
+                reply("OK remove " + alias + " total_ms=" + std::to_string(removeTimeMs));
+                return;
+            }
+
+            auto isStreamPresent = streams.count(alias) != 0;
+
+            if (command == "add" && isStreamPresent) {
+                reply("ERROR " + alias + ": stream exists (use reconfigure)");
+                return;
+            }
+
+            if (command == "reconfigure" && !isStreamPresent) {
+                reply("ERROR " + alias + ": no such stream");
+                return;
+            }
+
+            std::function<Transcoder *()> factory;
+
+            auto error = parseStreamArgs(args, factory);
+
+            if (!error.empty()) {
+                reply("ERROR " + error);
+                return;
+            }
+
+            PendingOperation operation{command, reply, std::chrono::steady_clock::now(), 0, nullptr};
+
+            if (command == "reconfigure" && streams[alias].device == args[2]) {
+
+                // the device is released before it's opened with the new parameters (restored on failure)
+                operation.restoreFactory = streams[alias].factory;
+                operation.removeTimeMs = removeStream(alias);
+
+            } // otherwise the stream is replaced once the new source has been opened
+
+            pendingOperations[alias] = operation;
+
+            // answered by startStream() or onSourceFailed()
+            initializeSource(factory, alias);
+        }
 
         /**
          * Announce new create media session.
@@ -146,28 +1009,46 @@ namespace LIRS {
          * @param transcoder - video source.
          * @param streamName - the name of the stream (part of the URL), e.g. rtsp://.../<camera/1>.
          * @param streamDesc -description of the stream.
+         * @param publisher - HLS publisher of the stream (nullptr - HLS is disabled).
          */
-        void addMediaSession(Transcoder *transcoder, const std::string &streamName, const std::string &streamDesc) {
+        void addMediaSession(Transcoder *transcoder, const std::string &streamName, const std::string &streamDesc,
+                             const std::shared_ptr<CmafPublisher> &publisher) {
 
             // create framed source based on transcoder
-            auto framedSource = LiveCamFramedSource::createNew(*env, transcoder);
-
-            allocatedVideoSources.push_back(framedSource);
+            auto framedSource = LiveCamFramedSource::createNew(*env, transcoder, eventNotifier.get());
 
-            // create stream replicator for the framed source
-            auto replicator = StreamReplicator::createNew(*env, framedSource, False);
+            // create fan-out of the framed source sharing the encoded frames between the clients
+            auto fanout = FrameFanout::createNew(*env, framedSource, transcoder->getOutputCodecId(), streamName);
 
             // create media session with the specified path and description
             auto sms = ServerMediaSession::createNew(*env, streamName.c_str(), "stream information", streamDesc.c_str(), False,
                                                      "a=fmtp:96\n");
 
-            OutPacketBuffer::maxSize = OUT_PACKET_BUFFER_MAX_SIZE;
+            auto frameRate = transcoder->getOutputFrameRate();
+            auto pacingSpreadUs = frameRate.num > 0 ?
+                                  static_cast<unsigned>(pacingFraction * 1e6 * frameRate.den / frameRate.num) : 0;
+
+            // add unicast subsession using fan-out (sizes the packet buffers per client)
+            auto subsession = CameraUnicastServerMediaSubsession::createNew(*env, fanout,
+                                                                            transcoder->getOutputCodecId(),
+                                                                            isNalAggregationEnabled, pacingSpreadUs,
+                                                                            retransmissionCacheSize);
 
-            // add unicast subsession using replicator
-            sms->addSubsession(CameraUnicastServerMediaSubsession::createNew(*env, replicator));
+            // clients' PLI/FIR are passed to the transcoding thread (coalesced by the transcoder)
+            subsession->setOnKeyframeRequestCallback([transcoder]() {
+                transcoder->requestKeyframe();
+            });
+
+            sms->addSubsession(subsession);
 
             server->addServerMediaSession(sms);
 
+            streams[streamName] = ServedStream{framedSource, fanout, sms, publisher, transcoder->getDeviceName(),
+                                               nullptr};
+
+            // bitrate is estimated until it's measured
+            admission.addStream(streamName);
+
             // announce stream
             announceStream(sms, transcoder->getDeviceName());
         }
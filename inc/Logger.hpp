@@ -5,11 +5,209 @@
 
 #ifdef HAVE_LOG4CPP
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
 #include "log4cpp/Category.hh"
 #include "log4cpp/FileAppender.hh"
 #include "log4cpp/PatternLayout.hh"
 
-#define LOG(__level)  log4cpp::Category::getRoot() << log4cpp::Priority::__level << __FILE__ << ":" << __LINE__ << "\n\t"
+/**
+ * The least severe level compiled in (log4cpp priority name, e.g. -DLOG_COMPILED_LEVEL=INFO).
+ * Records of the less severe levels are removed by the compiler along with their arguments.
+ */
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL DEBUG
+#endif
+
+/**
+ * Call site's rate limiting state (a static per LOG statement).
+ */
+#define LOG_CALL_SITE() ([]() -> LIRS::LogCallSite & { static LIRS::LogCallSite site; return site; }())
+
+/**
+ * Formats the record only if its level is compiled in and enabled and the call site is not rate limited.
+ * The formatted record is written asynchronously (see AsyncLogger).
+ */
+#define LOG(__level) \
+    if (!(log4cpp::Priority::__level <= log4cpp::Priority::LOG_COMPILED_LEVEL)) {} \
+    else for (LIRS::LogCallSite *logCallSite = LIRS::acquireLogCallSite(LOG_CALL_SITE(), log4cpp::Priority::__level); \
+              logCallSite; logCallSite = nullptr) \
+        LIRS::LogRecord(*logCallSite, log4cpp::Priority::__level) << __FILE__ << ":" << __LINE__ << "\n\t"
+
+namespace LIRS {
+
+    /**
+     * Rate limiter of the records emitted by the single LOG statement: at most RATE_LIMIT_BURST records
+     * per RATE_LIMIT_INTERVAL_MS, the number of the suppressed records is appended to the next emitted one.
+     */
+    class LogCallSite {
+
+    public:
+
+        LogCallSite();
+
+        /**
+         * Returns whether the record can be emitted, otherwise accounts it as suppressed.
+         */
+        bool acquire();
+
+        /**
+         * Returns the number of the records suppressed since the last call and resets it.
+         */
+        uint64_t takeSuppressed();
+
+        /** Constants **/
+
+        static const unsigned RATE_LIMIT_BURST = 10;
+
+        static const int64_t RATE_LIMIT_INTERVAL_MS = 1000;
+
+    private:
+
+        std::atomic<int64_t> intervalStart;
+
+        std::atomic<unsigned> emitted;
+
+        std::atomic<uint64_t> suppressed;
+    };
+
+    /**
+     * Background writer of the log records.
+     *
+     * Producers put the formatted records into the bounded lock-free ring (never blocking, records are dropped
+     * and counted if the ring is full), the drain thread writes them through log4cpp.
+     * Records of the ERROR and more severe levels are flushed before returning, so they are not lost on abort.
+     * Until started the records are written synchronously.
+     */
+    class AsyncLogger {
+
+    public:
+
+        static AsyncLogger &getInstance();
+
+        /**
+         * Starts the drain thread.
+         *
+         * @param level - the least severe level to be written.
+         */
+        void start(log4cpp::Priority::Value level);
+
+        /**
+         * Whether the records of the level are written.
+         */
+        bool isEnabled(log4cpp::Priority::Value priority) const;
+
+        /**
+         * Enqueues the record.
+         */
+        void push(log4cpp::Priority::Value priority, std::string &&message);
+
+        /**
+         * Waits until the records enqueued so far are written.
+         */
+        void flush();
+
+        /** Constants **/
+
+        /**
+         * Capacity of the ring (power of two).
+         */
+        static const size_t RING_CAPACITY = 1024;
+
+        /**
+         * Sleep period of the drain thread if the ring is empty.
+         */
+        static const unsigned DRAIN_INTERVAL_MS = 5;
+
+    private:
+
+        typedef struct Slot {
+
+            /**
+             * Position the slot is ready for: to be written by the producer (= position),
+             * to be read by the drain thread (= position + 1).
+             */
+            std::atomic<uint64_t> sequence;
+
+            log4cpp::Priority::Value priority;
+
+            std::string message;
+
+        } Slot;
+
+        std::unique_ptr<Slot[]> ring;
+
+        std::atomic<uint64_t> enqueuePosition;
+
+        /**
+         * Position of the next record to be written (modified by the drain thread only).
+         */
+        std::atomic<uint64_t> dequeuePosition;
+
+        std::atomic<uint64_t> droppedRecords;
+
+        std::atomic<log4cpp::Priority::Value> level;
+
+        std::atomic<bool> isRunning;
+
+        std::thread drainThread;
+
+        AsyncLogger();
+
+        ~AsyncLogger();
+
+        AsyncLogger(const AsyncLogger &) = delete;
+
+        AsyncLogger &operator=(const AsyncLogger &) = delete;
+
+        /**
+         * Writes the available records.
+         *
+         * @return number of the written records.
+         */
+        size_t drain();
+
+        void drainLoop();
+    };
+
+    /**
+     * Record being formatted by the LOG statement, enqueued on destruction.
+     */
+    class LogRecord {
+
+    public:
+
+        LogRecord(LogCallSite &site, log4cpp::Priority::Value priority);
+
+        ~LogRecord();
+
+        template<typename T>
+        LogRecord &operator<<(const T &value) {
+            stream << value;
+            return *this;
+        }
+
+    private:
+
+        LogCallSite &site;
+
+        log4cpp::Priority::Value priority;
+
+        std::ostringstream stream;
+    };
+
+    /**
+     * Returns the call site if the record of the level should be formatted, otherwise - nullptr.
+     */
+    inline LogCallSite *acquireLogCallSite(LogCallSite &site, log4cpp::Priority::Value priority) {
+        return AsyncLogger::getInstance().isEnabled(priority) && site.acquire() ? &site : nullptr;
+    }
+}
 
 inline void initLogger(log4cpp::Priority::PriorityLevel level)
 {
@@ -23,9 +221,11 @@ inline void initLogger(log4cpp::Priority::PriorityLevel level)
     log.addAppender(app);
 
     log.setPriority(level);
+
+    // write the records in the background from now on
+    LIRS::AsyncLogger::getInstance().start(level);
 }
 
 #endif
 
 #endif // LOGGER_HPP
-
@@ -0,0 +1,74 @@
+#ifndef LIVE_VIDEO_STREAM_METRICS_HPP
+#define LIVE_VIDEO_STREAM_METRICS_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace LIRS {
+
+    /**
+     * Process-wide registry of named integer metrics (gauges and counters), e.g. 'encoder_threads.camera.pools'.
+     * Can be accessed from any thread.
+     */
+    class Metrics {
+
+    public:
+
+        /**
+         * Returns the instance of the registry.
+         */
+        static Metrics &getInstance();
+
+        Metrics(const Metrics &) = delete;
+
+        Metrics &operator=(const Metrics &) = delete;
+
+        /**
+         * Sets the value of the metric (creates it if absent).
+         *
+         * @param name - name of the metric.
+         * @param value - new value.
+         */
+        void set(const std::string &name, int64_t value);
+
+        /**
+         * Adds the delta to the value of the metric (creates it if absent).
+         *
+         * @param name - name of the metric.
+         * @param delta - value to be added.
+         */
+        void add(const std::string &name, int64_t delta);
+
+        /**
+         * Returns the value of the metric, 0 if absent.
+         */
+        int64_t get(const std::string &name) const;
+
+        /**
+         * Removes all metrics which names start with the prefix, e.g. metrics of the removed stream.
+         */
+        void removeByPrefix(const std::string &prefix);
+
+        /**
+         * Returns the metrics which names start with the prefix, e.g. 'memory.camera.'.
+         */
+        std::map<std::string, int64_t> getByPrefix(const std::string &prefix) const;
+
+        /**
+         * Returns all metrics sorted by name, one 'name value' pair per line.
+         */
+        std::string dump() const;
+
+    private:
+
+        Metrics() = default;
+
+        mutable std::mutex metricsMutex;
+
+        std::map<std::string, int64_t> metrics;
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_METRICS_HPP
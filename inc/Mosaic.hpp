@@ -0,0 +1,207 @@
+#ifndef LIVE_VIDEO_STREAM_MOSAIC_HPP
+#define LIVE_VIDEO_STREAM_MOSAIC_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "RawFrameSource.hpp"
+#include "Transcoder.hpp"
+
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libswscale/swscale.h>
+}
+
+namespace LIRS {
+
+    /**
+     * Parameters of the mosaic (grid of the tiles).
+     */
+    typedef struct MosaicOptions {
+
+        /**
+         * Number of the grid's columns (0 - square grid fitting all tiles).
+         */
+        size_t columns;
+
+        /**
+         * Size of each tile (the tiles' frames are scaled to it).
+         */
+        size_t tileWidth, tileHeight;
+
+        /**
+         * Framerate of the composed frames.
+         */
+        unsigned frameRate;
+
+        /**
+         * Pixel format of the composed frames (8-bit YUV with the planar luma, e.g. 'yuv420p', 'nv12').
+         */
+        std::string pixelFormat;
+
+        /**
+         * Time since the tile's last frame after which the tile is shown black (in milliseconds),
+         * the last frame is repeated until then.
+         */
+        unsigned staleTileTimeoutMs;
+
+        MosaicOptions() : columns(0), tileWidth(480), tileHeight(270), frameRate(15), pixelFormat("yuv420p"),
+                          staleTileTimeoutMs(2000) {}
+
+    } MosaicOptions;
+
+    /**
+     * Composes the filtered frames of several transcoders into a grid (xstack filter) at the fixed framerate,
+     * the composed frames are encoded by a single transcoder (see Transcoder::newInstance(RawFrameSource *, ...))
+     * and served as a separate stream. Composing never waits for the tiles: the last frame of the late tile
+     * is repeated, the missing tile is black.
+     *
+     * Usage:
+     *
+     *     auto mosaic = new Mosaic("wall", {camera1, camera2, camera3, camera4});
+     *     server->addTranscoder(Transcoder::newInstance(mosaic, "wall", "yuv420p", 15));
+     */
+    class Mosaic : public RawFrameSource {
+
+    public:
+
+        /**
+         * Creates a new mosaic and starts receiving the frames of the tiles (should be called before
+         * the tiles are started). The tiles may outlive the mosaic: their frames are ignored after its destruction.
+         *
+         * @param name - name of the mosaic.
+         * @param tiles - transcoders of the tiles in the grid's order (the passthrough ones are shown black).
+         * @param options - grid parameters.
+         */
+        Mosaic(const std::string &name, const std::vector<Transcoder *> &tiles,
+               const MosaicOptions &options = MosaicOptions());
+
+        ~Mosaic() override;
+
+        Mosaic(const Mosaic &) = delete;
+
+        Mosaic &operator=(const Mosaic &) = delete;
+
+        std::string getName() const override;
+
+        size_t getWidth() const override;
+
+        size_t getHeight() const override;
+
+        AVPixelFormat getPixelFormat() const override;
+
+        AVRational getFrameRate() const override;
+
+        /**
+         * Waits for the next frame time and composes the current frames of the tiles.
+         */
+        bool readFrame(AVFrame *frame) override;
+
+        /** Constants **/
+
+        /**
+         * Luma and chroma values of the black frame (limited range YUV).
+         */
+        static const uint8_t BLACK_LUMA = 16;
+
+        static const uint8_t BLACK_CHROMA = 128;
+
+    private:
+
+        /**
+         * Latest frame of the tile scaled to the tile's size.
+         */
+        typedef struct Tile {
+
+            /**
+             * Frame read by the composing thread and the frame being scaled by the tile's thread (swapped).
+             */
+            AVFrame *latest, *scratch;
+
+            SwsContext *scaler;
+
+            std::chrono::steady_clock::time_point updateTime;
+
+            bool hasFrame;
+
+            Tile() : latest(nullptr), scratch(nullptr), scaler(nullptr), hasFrame(false) {}
+
+        } Tile;
+
+        std::string name;
+
+        MosaicOptions options;
+
+        AVPixelFormat pixelFormat;
+
+        size_t columns, rows;
+
+        /**
+         * Tiles of the transcoders (the remaining cells of the grid are black).
+         */
+        std::vector<Tile> tiles;
+
+        /**
+         * Guards the tiles' latest frames.
+         */
+        std::mutex tilesMutex;
+
+        /**
+         * Frame of the missing tiles and of the empty cells.
+         */
+        AVFrame *blankFrame;
+
+        AVFilterGraph *filterGraph;
+
+        /**
+         * Buffer source of each cell of the grid and the buffer sink of the composed frames.
+         */
+        std::vector<AVFilterContext *> cellSources;
+
+        AVFilterContext *bufferSinkCtx;
+
+        /**
+         * Number of the composed frames (timestamp of the next one).
+         */
+        int64_t framesComposed;
+
+        std::chrono::steady_clock::time_point nextFrameTime;
+
+        std::string staleTilesMetricName, lateFramesMetricName;
+
+        /**
+         * Mosaic receiving the frames of the tile, shared with the tile's callback (per tile, so the tiles are
+         * scaled in parallel). The destructor detaches the mosaic, waiting for the call in progress.
+         */
+        typedef struct TileReceiver {
+
+            std::mutex mutex;
+
+            Mosaic *mosaic;
+
+        } TileReceiver;
+
+        std::vector<std::shared_ptr<TileReceiver>> tileReceivers;
+
+        /**
+         * Scales the tile's filtered frame (called by the tile's transcoding thread).
+         */
+        void onTileFrame(size_t index, const AVFrame *frame);
+
+        /**
+         * Creates the filter graph stacking the cells of the grid.
+         */
+        void initFilters();
+
+        /**
+         * Allocates the frame of the tile's size.
+         */
+        AVFrame *allocateTileFrame() const;
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_MOSAIC_HPP
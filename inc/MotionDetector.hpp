@@ -0,0 +1,87 @@
+#ifndef LIVE_VIDEO_STREAM_MOTION_DETECTOR_HPP
+#define LIVE_VIDEO_STREAM_MOTION_DETECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace LIRS {
+
+    /**
+     * Detects changes between the frames using downsampled luma planes.
+     *
+     * The luma plane is reduced to the averages of BLOCK_SIZE x BLOCK_SIZE blocks (suppressing the sensor noise),
+     * the motion score is the mean absolute difference (SAD per block) between the current and the reference planes.
+     * Both steps are vectorized (SSE2) if available.
+     */
+    class MotionDetector {
+
+    public:
+
+        MotionDetector();
+
+        /**
+         * Computes the motion score of the frame relative to the reference frame.
+         *
+         * @param luma - pointer to the 8-bit luma plane.
+         * @param linesize - size of the luma plane's line in bytes.
+         * @param width - frame width.
+         * @param height - frame height.
+         * @return mean absolute difference of the block averages [0, 255], negative if there is no reference frame.
+         */
+        double computeScore(const uint8_t *luma, int linesize, size_t width, size_t height);
+
+        /**
+         * Makes the last analyzed frame the reference one.
+         */
+        void updateReference();
+
+        /**
+         * Drops the reference frame.
+         */
+        void reset();
+
+        /**
+         * Marks the blocks of the last analyzed frame which differ from the reference frame by more than the threshold.
+         * Should be called after computeScore() and before updateReference().
+         *
+         * @param threshold - minimal absolute difference of the block averages.
+         * @param mask - resulting mask (blocksX x blocksY, row by row), 1 - changed block, 0 - otherwise.
+         */
+        void getChangedBlocks(unsigned threshold, std::vector<uint8_t> &mask) const;
+
+        size_t getBlocksX() const;
+
+        size_t getBlocksY() const;
+
+        /** Constants **/
+
+        static const size_t BLOCK_SIZE = 8;
+
+    private:
+
+        /**
+         * Number of blocks in the row and column of the downsampled plane.
+         */
+        size_t blocksX, blocksY;
+
+        /**
+         * Downsampled luma planes of the last analyzed and the reference frames.
+         */
+        std::vector<uint8_t> currentPlane, referencePlane;
+
+        bool hasReference;
+
+        /**
+         * Computes averages of the luma blocks.
+         */
+        void downsample(const uint8_t *luma, int linesize);
+
+        /**
+         * Returns the sum of absolute differences of two buffers.
+         */
+        static uint64_t sumOfAbsoluteDifferences(const uint8_t *lhs, const uint8_t *rhs, size_t size);
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_MOTION_DETECTOR_HPP
@@ -0,0 +1,153 @@
+#ifndef LIVE_VIDEO_STREAM_OVERLOAD_GOVERNOR_HPP
+#define LIVE_VIDEO_STREAM_OVERLOAD_GOVERNOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace LIRS {
+
+    /**
+     * Step of the degradation ladder.
+     */
+    typedef struct QualityLevel {
+
+        /**
+         * Output framerate relative to the stream's output framerate, e.g. 0.5 - half of the framerate.
+         */
+        double frameRateFactor;
+
+        /**
+         * Frame size relative to the source's frame size, e.g. 0.5 - half of the width and height.
+         */
+        double scale;
+
+        /**
+         * Encoder's preset, e.g. 'ultrafast'.
+         */
+        std::string preset;
+
+        QualityLevel(double frameRateFactor = 1.0, double scale = 1.0, const std::string &preset = "ultrafast")
+                : frameRateFactor(frameRateFactor), scale(scale), preset(preset) {}
+
+        bool operator==(const QualityLevel &other) const {
+            return frameRateFactor == other.frameRateFactor && scale == other.scale && preset == other.preset;
+        }
+
+    } QualityLevel;
+
+    /**
+     * Parameters of the overload governor.
+     */
+    typedef struct OverloadGovernorOptions {
+
+        /**
+         * Whether the governor is enabled.
+         */
+        bool enabled;
+
+        /**
+         * Degradation ladder, the first level is the nominal one (lower fps, then smaller frames, then faster preset).
+         */
+        std::vector<QualityLevel> ladder;
+
+        /**
+         * Load (processing time / frame interval) considered as an overload.
+         */
+        double overloadThreshold;
+
+        /**
+         * Maximum load expected at the upper level to step back up.
+         */
+        double recoveryThreshold;
+
+        /**
+         * Number of consecutive overloaded frames to step down.
+         */
+        unsigned overloadFrames;
+
+        /**
+         * Number of consecutive frames with the headroom to step up.
+         */
+        unsigned recoveryFrames;
+
+        OverloadGovernorOptions() : enabled(false), ladder({QualityLevel(1.0, 1.0), QualityLevel(0.5, 1.0),
+                                                            QualityLevel(0.5, 0.5)}),
+                                    overloadThreshold(0.9), recoveryThreshold(0.7), overloadFrames(15),
+                                    recoveryFrames(150) {}
+
+    } OverloadGovernorOptions;
+
+    /**
+     * Chooses the level of the degradation ladder from the time spent on processing the frames.
+     *
+     * The load is the smoothed ratio of the processing time to the frame interval (budget) of the current level.
+     * Sustained overload moves the stream one level down, the level is moved up only if the load predicted
+     * for the upper level (scaled by its framerate and frame area) stays below the recovery threshold.
+     */
+    class OverloadGovernor {
+
+    public:
+
+        OverloadGovernor();
+
+        /**
+         * Resets the governor to the nominal level with the new parameters.
+         */
+        void configure(const OverloadGovernorOptions &options);
+
+        /**
+         * Accounts the processed frame.
+         *
+         * @param processingTime - time spent on the frame (nanoseconds).
+         * @param budget - frame interval of the current level (nanoseconds).
+         * @return true if the level has been changed, otherwise - false.
+         */
+        bool update(uint64_t processingTime, uint64_t budget);
+
+        /**
+         * Returns the index of the current level.
+         */
+        size_t getLevelIndex() const;
+
+        /**
+         * Returns the current level.
+         */
+        const QualityLevel &getLevel() const;
+
+        /**
+         * Returns the smoothed load.
+         */
+        double getLoad() const;
+
+        bool isEnabled() const;
+
+        /** Constants **/
+
+        /**
+         * Smoothing factor of the load (exponential moving average).
+         */
+        static constexpr double LOAD_SMOOTHING = 0.1;
+
+    private:
+
+        OverloadGovernorOptions options;
+
+        size_t levelIndex;
+
+        double load;
+
+        /**
+         * Number of consecutive overloaded frames and frames with the headroom.
+         */
+        unsigned overloadedFrames, headroomFrames;
+
+        /**
+         * Moves to the level resetting the counters.
+         */
+        void moveTo(size_t newLevelIndex);
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_OVERLOAD_GOVERNOR_HPP
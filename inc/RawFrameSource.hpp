@@ -0,0 +1,57 @@
+#ifndef LIVE_VIDEO_STREAM_RAW_FRAME_SOURCE_HPP
+#define LIVE_VIDEO_STREAM_RAW_FRAME_SOURCE_HPP
+
+#include <cstddef>
+#include <string>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+}
+
+namespace LIRS {
+
+    /**
+     * Source of the raw frames produced in the process (e.g. composed from the other streams) instead of
+     * being read from a device, the frames are filtered and encoded by the transcoder as the decoded ones.
+     */
+    class RawFrameSource {
+
+    public:
+
+        virtual ~RawFrameSource() = default;
+
+        /**
+         * Returns the name of the source (used as the device name of the transcoder).
+         */
+        virtual std::string getName() const = 0;
+
+        /**
+         * Returns the size of the produced frames.
+         */
+        virtual size_t getWidth() const = 0;
+
+        virtual size_t getHeight() const = 0;
+
+        /**
+         * Returns the pixel format of the produced frames.
+         */
+        virtual AVPixelFormat getPixelFormat() const = 0;
+
+        /**
+         * Returns the framerate of the source (the frames' timestamps are in its inverse units).
+         */
+        virtual AVRational getFrameRate() const = 0;
+
+        /**
+         * Waits for the next frame (called by the transcoding thread).
+         *
+         * @param frame - frame to be referenced to the produced one (unreferenced by the caller).
+         * @return false if the source has ended.
+         */
+        virtual bool readFrame(AVFrame *frame) = 0;
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_RAW_FRAME_SOURCE_HPP
@@ -0,0 +1,210 @@
+#ifndef LIVE_VIDEO_STREAM_RETRANSMISSION_CACHE_HPP
+#define LIVE_VIDEO_STREAM_RETRANSMISSION_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace LIRS {
+
+    /**
+     * Ring of the recently sent RTP payloads shared by the clients of the stream (see RetransmissionCache).
+     *
+     * The clients packetize the same NAL units, so their payloads are mostly identical: the payload already stored
+     * by another client is referenced instead of being copied again, the memory doesn't grow with the viewers.
+     * It is allocated on the first store: a slot of the maximal payload size per payload, the oldest payload is
+     * overwritten (the references to it become invalid). Used by the event loop's thread only.
+     */
+    class RetransmissionPayloads {
+
+    public:
+
+        /**
+         * Reference to the stored payload (valid until its slot is overwritten).
+         */
+        typedef struct Reference {
+
+            uint32_t slot;
+
+            /**
+             * Number of the slot's overwrites at the time of the store.
+             */
+            uint32_t generation;
+
+        } Reference;
+
+        /**
+         * Creates the ring (nothing is allocated).
+         *
+         * @param numPayloads - number of the stored payloads.
+         * @param streamName - name of the stream (memory metrics).
+         */
+        RetransmissionPayloads(size_t numPayloads, const std::string &streamName);
+
+        ~RetransmissionPayloads();
+
+        RetransmissionPayloads(const RetransmissionPayloads &) = delete;
+
+        RetransmissionPayloads &operator=(const RetransmissionPayloads &) = delete;
+
+        /**
+         * Stores the payload or finds the identical one stored before.
+         *
+         * @param payload - RTP payload.
+         * @param size - size of the payload.
+         * @param maxSize - size of the largest payload (allocates the slots on the first store).
+         * @param reference - reference to the stored payload.
+         * @return false if the payload exceeds the slot and hasn't been stored, otherwise - true.
+         */
+        bool store(const uint8_t *payload, size_t size, size_t maxSize, Reference &reference);
+
+        /**
+         * Looks up the payload.
+         *
+         * @param reference - reference returned by store().
+         * @param size - size of the found payload.
+         * @return the payload or nullptr if it has been overwritten.
+         */
+        const uint8_t *find(const Reference &reference, size_t &size) const;
+
+        /**
+         * Returns the number of the slots and the size of the allocated memory in bytes.
+         */
+        size_t getNumPayloads() const;
+
+        size_t getMemorySize() const;
+
+    private:
+
+        typedef struct Slot {
+
+            uint32_t generation;
+
+            /**
+             * Size of the stored payload (0 - empty).
+             */
+            uint16_t size;
+
+            uint64_t hash;
+
+        } Slot;
+
+        std::string streamName;
+
+        size_t numSlots;
+
+        size_t slotSize;
+
+        /**
+         * Slot overwritten by the next new payload.
+         */
+        size_t nextSlot;
+
+        std::vector<Slot> slots;
+
+        std::vector<uint8_t> storage;
+
+        /**
+         * Slots of the stored payloads by their hashes.
+         */
+        std::unordered_map<uint64_t, uint32_t> slotsByHash;
+
+        /**
+         * Hash of the payload's size and of its first and last bytes (the identical payloads are compared).
+         */
+        static uint64_t hashPayload(const uint8_t *payload, size_t size);
+    };
+
+    /**
+     * Recently sent RTP packets of the client indexed by the sequence number (retransmission on NACK).
+     *
+     * Only the index is per client: a slot per packet with the packet's RTP header (the client's sequence number,
+     * timestamp and SSRC) and the reference to its payload in the ring shared by the stream's clients.
+     * The packet is stored in the slot of its sequence number modulo the number of slots (a power of two,
+     * so the slots stay consistent when the 16-bit numbers wrap), overwriting the packet sent a ring ago.
+     */
+    class RetransmissionCache {
+
+    public:
+
+        /**
+         * Creates the cache.
+         *
+         * @param numPackets - number of the cached packets (rounded up to a power of two).
+         * @param maxPacketSize - size of the largest packet (RTP header included).
+         * @param payloads - payloads shared by the stream's clients.
+         */
+        RetransmissionCache(size_t numPackets, size_t maxPacketSize,
+                            const std::shared_ptr<RetransmissionPayloads> &payloads);
+
+        /**
+         * Stores the sent packet.
+         *
+         * @param sequenceNumber - packet's sequence number.
+         * @param header - RTP header.
+         * @param headerSize - size of the header (up to MAX_HEADER_SIZE).
+         * @param payload - RTP payload.
+         * @param payloadSize - size of the payload (the packet exceeding the maximal size isn't stored).
+         */
+        void store(uint16_t sequenceNumber, const uint8_t *header, size_t headerSize, const uint8_t *payload,
+                   size_t payloadSize);
+
+        /**
+         * Looks up the packet.
+         *
+         * @param sequenceNumber - packet's sequence number.
+         * @param size - size of the found packet.
+         * @return the packet (valid until the next call) or nullptr if it has been overwritten or hasn't been stored.
+         */
+        const uint8_t *find(uint16_t sequenceNumber, size_t &size);
+
+        /**
+         * Returns the number of the slots and the size of the client's memory in bytes (w/o the shared payloads).
+         */
+        size_t getNumPackets() const;
+
+        size_t getMemorySize() const;
+
+        /** Constants **/
+
+        static const size_t MAX_HEADER_SIZE = 12;
+
+    private:
+
+        typedef struct Slot {
+
+            uint16_t sequenceNumber;
+
+            /**
+             * Size of the stored header (0 - empty).
+             */
+            uint8_t headerSize;
+
+            uint8_t header[MAX_HEADER_SIZE];
+
+            RetransmissionPayloads::Reference payload;
+
+        } Slot;
+
+        std::shared_ptr<RetransmissionPayloads> payloads;
+
+        size_t maxPayloadSize;
+
+        /**
+         * Mask of the slot's index (the number of the slots minus one).
+         */
+        size_t indexMask;
+
+        std::vector<Slot> slots;
+
+        /**
+         * The found packet (header and payload).
+         */
+        std::vector<uint8_t> packet;
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_RETRANSMISSION_CACHE_HPP
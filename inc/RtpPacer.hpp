@@ -0,0 +1,167 @@
+#ifndef LIVE_VIDEO_STREAM_RTP_PACER_HPP
+#define LIVE_VIDEO_STREAM_RTP_PACER_HPP
+
+#include <FramedFilter.hh>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "HevcAggregatingRTPSink.hpp"
+
+namespace LIRS {
+
+    /**
+     * Paces the RTP payloads of the packetizer, so a large keyframe isn't sent as a burst at line rate
+     * (overflowing the queues of Wi-Fi and LTE links).
+     *
+     * Payloads are read ahead into the queue. When the picture is complete, its payloads are scheduled evenly
+     * over the spread (part of the frame interval): the first one is due immediately, the next picture starts after
+     * the previous one's spread. The sink is answered by a delayed task of the event loop when the payload is due
+     * (the sink sends each delivered payload right away).
+     *
+     * Metrics: 'pacing.<stream>.queued_packets' (all clients of the stream), 'pacing.<stream>.delay_us'
+     * (queueing time of the last picture's last payload). The queue's metrics are updated per picture.
+     */
+    class RtpPacer : public FramedFilter {
+
+    public:
+
+        /**
+         * Creates a new pacer.
+         *
+         * @param env - environment (see Live555 docs).
+         * @param inputSource - packetizer delivering a single RTP payload per frame.
+         * @param maxPayloadSize - size of the largest RTP payload.
+         * @param spreadUs - time the payloads of a picture are spread over in microseconds.
+         * @param streamName - name of the stream (metrics).
+         * @return pointer to the created pacer.
+         */
+        static RtpPacer *createNew(UsageEnvironment &env, HevcNalPacketizer *inputSource, unsigned maxPayloadSize,
+                                   unsigned spreadUs, const std::string &streamName);
+
+        /**
+         * Whether the last delivered payload completes the picture (RTP marker bit).
+         */
+        bool isPictureEnd() const;
+
+        /** Constants **/
+
+        /**
+         * Maximal number of the queued payloads, the incomplete picture is scheduled when it's reached.
+         */
+        static const size_t MAX_QUEUED_PACKETS = 2048;
+
+    protected:
+
+        RtpPacer(UsageEnvironment &env, HevcNalPacketizer *inputSource, unsigned maxPayloadSize, unsigned spreadUs,
+                 const std::string &streamName);
+
+        ~RtpPacer() override;
+
+        void doGetNextFrame() override;
+
+        void doStopGettingFrames() override;
+
+    private:
+
+        typedef struct PacedPacket {
+
+            std::vector<uint8_t> payload;
+
+            struct timeval presentationTime;
+
+            bool endsPicture;
+
+            /**
+             * Time of queueing and the due time (steady clock, microseconds, -1 - the picture isn't complete).
+             */
+            int64_t queueTimeUs;
+
+            int64_t dueTimeUs;
+
+        } PacedPacket;
+
+        unsigned spreadUs;
+
+        /**
+         * Names of the metrics (built once, updated per picture).
+         */
+        const std::string queuedPacketsMetricName, delayMetricName, queuedBytesMetricName;
+
+        /**
+         * Changes of the queue not reported to the metrics yet.
+         */
+        int64_t unreportedPackets, unreportedBytes;
+
+        std::vector<uint8_t> readBuffer;
+
+        std::deque<PacedPacket> queue;
+
+        /**
+         * Size of the queued payloads in bytes (metric 'memory.<stream>.pacing_bytes').
+         */
+        size_t queuedBytes;
+
+        /**
+         * Number of the payloads at the queue's end w/o the due time (the picture being read).
+         */
+        size_t numUnscheduled;
+
+        /**
+         * Time the spread of the last scheduled picture ends (the next picture isn't started earlier).
+         */
+        int64_t spreadEndUs;
+
+        bool isReading;
+
+        /**
+         * Whether the read-ahead loop is running (the payloads delivered synchronously are read by the loop,
+         * not recursively) and whether the sink has stopped reading.
+         */
+        bool isReadingAhead, isStopped;
+
+        bool lastPacketEndsPicture;
+
+        TaskToken deliveryTask;
+
+        static int64_t nowMicros();
+
+        void readPacket();
+
+        /**
+         * Reads the payloads while they're delivered synchronously and the queue isn't full.
+         */
+        void readAhead();
+
+        /**
+         * Adds the unreported changes of the queue to the metrics.
+         */
+        void reportQueue();
+
+        static void afterGettingPacket(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime, unsigned durationInMicroseconds);
+
+        void afterGettingPacket(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+
+        /**
+         * Sets the due times of the unscheduled payloads spreading them evenly.
+         */
+        void schedulePackets();
+
+        /**
+         * Delivers the queued payload if it's due, otherwise schedules the delivery.
+         */
+        void deliverPacket();
+
+        static void onDeliveryTime(void *clientData);
+
+        /**
+         * Empties the queue (the stream is stopped).
+         */
+        void clearQueue();
+    };
+}
+
+#endif //LIVE_VIDEO_STREAM_RTP_PACER_HPP
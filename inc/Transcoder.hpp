@@ -1,11 +1,24 @@
 #ifndef LIVE_VIDEO_STREAM_TRANSCODER_HPP
 #define LIVE_VIDEO_STREAM_TRANSCODER_HPP
 
+#include <sys/time.h>
+
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include "EncoderThreadBudget.hpp"
+#include "FrameBusWriter.hpp"
 #include "Logger.hpp"
+#include "MotionDetector.hpp"
+#include "OverloadGovernor.hpp"
+#include "RawFrameSource.hpp"
 #include "Utils.hpp"
 
 #ifdef __cplusplus
@@ -58,6 +71,155 @@ namespace LIRS {
 
     } TranscoderContext;
 
+    /**
+     * Counters of the transcoding process (updated by the transcoding thread, can be read from any thread).
+     * Time is measured in nanoseconds.
+     */
+    typedef struct TranscoderStatistics {
+
+        /**
+         * Number of video packets read from the source.
+         */
+        std::atomic<uint64_t> packetsRead;
+
+        /**
+         * Number of decoded, filtered (passed through the filter graph) and encoded (accepted by the encoder) frames.
+         */
+        std::atomic<uint64_t> framesDecoded, framesFiltered, framesEncoded;
+
+        /**
+         * Number of packets emitted by the encoder.
+         */
+        std::atomic<uint64_t> packetsEncoded;
+
+        /**
+         * Number of frames inside the encoder after the last encoded frame (current and maximal).
+         */
+        std::atomic<uint64_t> encoderDelayFrames, maxEncoderDelayFrames;
+
+        /**
+         * Total time between sending the frames to the encoder and receiving their packets.
+         */
+        std::atomic<uint64_t> encoderLatency;
+
+        /**
+         * Number of filtered frames not encoded because of the static scene (motion gating).
+         */
+        std::atomic<uint64_t> framesSkipped;
+
+        /**
+         * Number of encoded bytes passed to the consumer.
+         */
+        std::atomic<uint64_t> encodedBytes;
+
+        /**
+         * Time spent in each stage of the pipeline: decoding, filtering, pixel format conversion and encoding.
+         */
+        std::atomic<uint64_t> decodeTime, filterTime, scaleTime, encodeTime;
+
+        /**
+         * CPU time consumed by the transcoding thread (w/o codec's worker threads).
+         */
+        std::atomic<uint64_t> threadCpuTime;
+
+        TranscoderStatistics() : packetsRead(0), framesDecoded(0), framesFiltered(0), framesEncoded(0),
+                                 packetsEncoded(0), encoderDelayFrames(0), maxEncoderDelayFrames(0),
+                                 encoderLatency(0), framesSkipped(0), encodedBytes(0), decodeTime(0), filterTime(0),
+                                 scaleTime(0), encodeTime(0), threadCpuTime(0) {}
+
+    } TranscoderStatistics;
+
+    /**
+     * Parameters of the motion gating: frames of the static scene are not encoded (except the keep-alive ones).
+     */
+    typedef struct MotionGatingOptions {
+
+        /**
+         * Whether the motion gating is enabled.
+         */
+        bool enabled;
+
+        /**
+         * Motion score (mean absolute difference of the downsampled luma) considered as a motion.
+         */
+        double threshold;
+
+        /**
+         * Interval of encoding frames while the scene is static (in milliseconds).
+         */
+        unsigned keepAliveIntervalMs;
+
+        /**
+         * Number of frames encoded at the full rate after the motion has stopped.
+         */
+        unsigned hangoverFrames;
+
+        MotionGatingOptions() : enabled(false), threshold(1.0), keepAliveIntervalMs(1000), hangoverFrames(5) {}
+
+    } MotionGatingOptions;
+
+    /**
+     * Rectangular region of the frame encoded with the specified quality offset.
+     */
+    typedef struct RegionOfInterest {
+
+        /**
+         * Position and size of the region in pixels.
+         */
+        int x, y, width, height;
+
+        /**
+         * Quality offset in [-1, 1], negative - better quality (see AVRegionOfInterest::qoffset),
+         * e.g. -0.1 corresponds to about -5 QP for x265.
+         */
+        double qualityOffset;
+
+    } RegionOfInterest;
+
+    /**
+     * Parameters of the region of interest (ROI) encoding.
+     * Regions are passed to the encoder in the following order (earlier regions take precedence on overlapping):
+     * static regions, moving areas (motion map), the whole frame (background).
+     */
+    typedef struct RegionOfInterestOptions {
+
+        /**
+         * Static regions, e.g. doorways, plates.
+         */
+        std::vector<RegionOfInterest> regions;
+
+        /**
+         * Whether the moving areas (coding tree units with the changed blocks) are regions of interest.
+         */
+        bool motionMap;
+
+        /**
+         * Quality offset of the moving areas.
+         */
+        double motionQualityOffset;
+
+        /**
+         * Minimal difference of the block averages considered as a motion.
+         */
+        unsigned motionThreshold;
+
+        /**
+         * Quality offset of the rest of the frame (0 - not changed), e.g. 0.1 for the sky.
+         */
+        double backgroundQualityOffset;
+
+        RegionOfInterestOptions() : motionMap(false), motionQualityOffset(-0.1), motionThreshold(4),
+                                    backgroundQualityOffset(0.0) {}
+
+        /**
+         * Whether any of the regions is specified.
+         */
+        bool isEnabled() const {
+            return !regions.empty() || motionMap || backgroundQualityOffset != 0.0;
+        }
+
+    } RegionOfInterestOptions;
+
     /**
      * Transcoder decodes some video resource and encodes it.
      * The encoded data can be passed to the consumer.
@@ -73,17 +235,44 @@ namespace LIRS {
          * @param devAlias - alias name for the device.
          * @param frameWidth - width of the frame used for decoding and encoding process (could be changed if not supported).
          * @param frameHeight - height of the frame used for decoding and encoding process (could be changed if not supported).
-         * @param rawPixelFormatStr - pixel format of the raw video data, e.g. 'yuyv422' (could be changed if not supported).
+         * @param rawPixelFormatStr - pixel format of the raw video data, e.g. 'yuyv422' (could be changed if not supported),
+         * or the name of the compressed input format, e.g. 'mjpeg', 'h264', 'hevc'.
+         * H.264/HEVC input is passed through to the consumer w/o decoding and encoding.
          * @param encoderPixelFormatStr - pixel format of the encoded data (see supported formats).
          * @param frameRate - hardware's framerate (could be changed if not supported by the device).
          * @param outputFrameRate - output framerate of the video stream.
          * @param filterQuery - filter query to create filter graph.
-         * @return pointer to the created instance of the transcoder class.
+         * @param inputFormatName - input format of the video source, e.g. 'v4l2', 'lavfi' (sourceUrl is a filter
+         * graph, e.g. 'testsrc2=size=640x480:rate=15'), 'rawvideo' (sourceUrl is a raw YUV file), empty - detect.
+         * @return pointer to the created instance of the transcoder class, nullptr if the source, the encoder or
+         * the filters can't be opened (e.g. unreachable URL, busy device, unsupported mode; the error is logged).
          */
         static Transcoder *
         newInstance(const std::string &sourceUrl, const std::string &devAlias, size_t frameWidth, size_t frameHeight,
                     const std::string &rawPixelFormatStr, const std::string &encoderPixelFormatStr,
-                    size_t frameRate, size_t outputFrameRate, const std::string &filterQuery = {});
+                    size_t frameRate, size_t outputFrameRate, const std::string &filterQuery = {},
+                    const std::string &inputFormatName = "v4l2");
+
+        /**
+         * Creates a new instance encoding the frames produced in the process, e.g. the mosaic of the other streams.
+         *
+         * @param source - source of the raw frames (not owned, should outlive the transcoder).
+         * @param devAlias - alias name of the stream.
+         * @param encoderPixelFormatStr - pixel format of the encoded data (see supported formats).
+         * @param outputFrameRate - output framerate of the video stream.
+         * @param filterQuery - filter query to create filter graph.
+         * @return pointer to the created instance of the transcoder class, nullptr if the source, the encoder or
+         * the filters can't be opened (e.g. unreachable URL, busy device, unsupported mode; the error is logged).
+         */
+        static Transcoder *
+        newInstance(RawFrameSource *source, const std::string &devAlias, const std::string &encoderPixelFormatStr,
+                    size_t outputFrameRate, const std::string &filterQuery = {});
+
+        /**
+         * Registers ffmpeg codecs, etc. (once per process, called by the constructor, should be called before
+         * looking up the codecs and formats w/o a transcoder).
+         */
+        static void registerAll();
 
         /**
          * Prohibit copy constructor.
@@ -108,12 +297,90 @@ namespace LIRS {
          */
         void run();
 
+        /**
+         * Signals the transcoding process to stop, run() returns after the current packet is processed.
+         */
+        void stop();
+
+        /**
+         * Enables or disables the motion gating (should be called before run()).
+         *
+         * @param options - motion gating parameters.
+         */
+        void setMotionGating(const MotionGatingOptions &options);
+
+        /**
+         * Sets the regions of interest attached to each encoded frame (should be called before run()).
+         * Requires FFmpeg with the AV_FRAME_DATA_REGIONS_OF_INTEREST support (libavutil 56.25+).
+         *
+         * @param options - regions of interest.
+         */
+        void setRegionsOfInterest(const RegionOfInterestOptions &options);
+
+        /**
+         * Enables or disables the overload governor (should be called before run()).
+         *
+         * @param options - governor parameters including the degradation ladder.
+         */
+        void setOverloadGovernor(const OverloadGovernorOptions &options);
+
         /**
          * Sets callback function which indicates that a new encoded video data is available.
          *
-         * @param callback - callback function.
+         * @param callback - callback function (NAL unit, presentation time of its access unit).
+         */
+        void setOnEncodedDataCallback(std::function<void(std::vector<uint8_t> &&, const struct timeval &)> callback);
+
+        /**
+         * Sets the number of the encoder's temporal layers (should be called before run()), the frames of the upper
+         * layers aren't referenced by the lower ones and may be dropped per client (see FanoutFramedSource).
+         * The layers are built of B-frames adding the reordering delay: 1 frame for 2 layers, 3 frames for 3 layers
+         * (requires x265 3.6+, limited to 2 layers with older or unknown versions of x265).
+         *
+         * @param numLayers - number of the layers (1 - disabled, up to MAX_TEMPORAL_LAYERS).
+         */
+        void setTemporalLayers(unsigned numLayers);
+
+        /**
+         * Requests a keyframe (IDR) on the next encoded frame, e.g. on the client's PLI/FIR (any thread).
+         * Requests are coalesced: at most one keyframe is forced per the minimal interval, the requests within it
+         * are deferred until it elapses. Ignored in the passthrough mode.
+         */
+        void requestKeyframe();
+
+        /**
+         * Sets the minimal interval between the forced keyframes (should be called before run()).
+         *
+         * @param milliseconds - interval in milliseconds.
+         */
+        void setMinKeyframeInterval(unsigned milliseconds);
+
+        /**
+         * Sets callback function receiving each encoded packet as a whole (access unit with the timestamps),
+         * e.g. for the segmented HTTP output (should be called before run()).
+         *
+         * @param callback - callback function (packet, time base of its timestamps, parameters of the stream).
+         */
+        void setOnEncodedPacketCallback(
+                std::function<void(const AVPacket *, AVRational, const AVCodecParameters *)> callback);
+
+        /**
+         * Publishes the decoded frames and/or the encoded packets into the shared memory rings read by
+         * the local processes (should be called before run()).
+         * Frames are unavailable in the passthrough mode.
+         *
+         * @param options - frame bus parameters.
+         */
+        void setFrameBus(const FrameBusOptions &options);
+
+        /**
+         * Sets callback function receiving each filtered frame before it's converted and encoded, e.g. a tile of
+         * the mosaic (called by the transcoding thread, may be replaced or reset while running: the previous
+         * callback isn't called after this method returns).
+         *
+         * @param callback - callback function (the frame is valid during the call only, nullptr - reset).
          */
-        void setOnEncodedDataCallback(std::function<void(std::vector<uint8_t> &&)> callback);
+        void setOnFilteredFrameCallback(std::function<void(const AVFrame *)> callback);
 
         /**
          * Returns path to the device, e.g. /dev/video0.
@@ -136,11 +403,63 @@ namespace LIRS {
          */
         const bool isReadable() const;
 
+        /**
+         * Returns the time of the transcoder's initialization in milliseconds.
+         */
+        uint64_t getInitializationTimeMs() const;
+
+        /**
+         * Returns the codec of the produced encoded data, e.g. HEVC or H.264 (passthrough).
+         *
+         * @return codec identifier.
+         */
+        AVCodecID getOutputCodecId() const;
+
+        /**
+         * Returns the nominal output framerate (the overload governor may lower the encoded one).
+         *
+         * @return frames per second.
+         */
+        AVRational getOutputFrameRate() const;
+
+        /**
+         * Whether the compressed video data from the source is forwarded as is (no decoding, filtering, encoding).
+         *
+         * @return true if in passthrough mode, otherwise - false.
+         */
+        bool isPassthrough() const;
+
+        /**
+         * Returns counters of the transcoding process.
+         *
+         * @return statistics (updated while the transcoder is running).
+         */
+        const TranscoderStatistics &getStatistics() const;
+
+        /** Constants **/
+
+        /**
+         * Maximal number of the temporal layers (each one halves the framerate of the lower layers).
+         */
+        static const unsigned MAX_TEMPORAL_LAYERS = 3;
+
+        /**
+         * Default minimal interval between the keyframes forced by the requests (milliseconds).
+         */
+        static const unsigned DEFAULT_MIN_KEYFRAME_INTERVAL_MS = 1000;
+
+        /**
+         * Pictures kept by the encoder besides the delayed input ones (reconstructed and reference pictures
+         * at the zero latency tune), used for the memory estimate.
+         */
+        static const unsigned ENCODER_REFERENCE_PICTURES = 2;
+
     private:
 
         Transcoder(const std::string &url, const std::string &alias, size_t w, size_t h,
                    const std::string &rawPixFmtStr, const std::string &encPixFmtStr, size_t frameRate,
-                   size_t outFrameRate, const std::string &filterQuery);
+                   size_t outFrameRate, const std::string &filterQuery, const std::string &inputFormatName,
+                   RawFrameSource *frameSource = nullptr);
 
         /* parameters */
 
@@ -154,6 +473,16 @@ namespace LIRS {
          */
         std::string deviceAlias;
 
+        /**
+         * Input format name, e.g. 'v4l2', 'lavfi', 'rawvideo'.
+         */
+        std::string inputFormatName;
+
+        /**
+         * Source of the raw frames produced in the process (nullptr - frames are read from the device).
+         */
+        RawFrameSource *frameSource;
+
         /**
          * Frame width.
          */
@@ -164,11 +493,26 @@ namespace LIRS {
          */
         size_t frameHeight;
 
+        /**
+         * Size of the encoded frames (frame size scaled by the current quality level).
+         */
+        size_t outputWidth, outputHeight;
+
         /**
          * Raw video data's pixel format.
          */
         AVPixelFormat rawPixFormat;
 
+        /**
+         * Codec of the video source's data (raw video or compressed, e.g. MJPEG, H.264).
+         */
+        AVCodecID inputCodecId;
+
+        /**
+         * Flag indicating that the source's packets are forwarded to the consumer as is.
+         */
+        bool passthrough;
+
         /**
          * Encoded video data pixel format.
          */
@@ -189,6 +533,11 @@ namespace LIRS {
          */
         size_t sourceBitRate;
 
+        /**
+         * Time base and the sample aspect ratio of the raw frames.
+         */
+        AVRational inputTimeBase, inputAspectRatio;
+
         /**
          * Decoder video context.
          * Used for decoding.
@@ -254,74 +603,361 @@ namespace LIRS {
          */
         AVFilterContext *bufferSinkCtx;
 
+        /**
+         * Filter context for the frame bus' buffer sink (the branch converting the published frames, if required).
+         */
+        AVFilterContext *busSinkCtx;
+
+        /**
+         * Frame retrieved from the frame bus' branch of the filter graph.
+         */
+        AVFrame *busFrame;
+
+        /**
+         * Frame bus parameters and the writers of the frames' and packets' rings (nullptr - not published).
+         */
+        FrameBusOptions frameBusOptions;
+
+        std::unique_ptr<FrameBusWriter> frameBusFrames, frameBusPackets;
+
         /**
          * Flag indicating whether the streaming source is accessible or not.
          * @note used to handle the destruction of the transcoder.
          */
         std::atomic_bool isPlayingFlag;
 
+        /**
+         * Flag indicating that the transcoding process should be stopped.
+         * @see stop()
+         */
+        std::atomic_bool isStopRequested;
+
         /**
          * Callback function called when new encoded video data is available.
          */
-        std::function<void(std::vector<uint8_t> &&)> onEncodedDataCallback;
+        std::function<void(std::vector<uint8_t> &&, const struct timeval &)> onEncodedDataCallback;
+
+        /**
+         * Callback function called with each encoded packet.
+         */
+        std::function<void(const AVPacket *, AVRational, const AVCodecParameters *)> onEncodedPacketCallback;
+
+        /**
+         * Callback function called with each filtered frame (guarded by the mutex, held during the call).
+         */
+        std::function<void(const AVFrame *)> onFilteredFrameCallback;
+
+        std::mutex filteredFrameCallbackMutex;
+
+        /**
+         * Counters of the transcoding process.
+         */
+        TranscoderStatistics statistics;
+
+        /**
+         * Encoder threads assigned by the global budget.
+         * @see EncoderThreadBudget
+         */
+        EncoderThreadAllocation encoderThreads;
+
+        /**
+         * Mutex to access the encoder threads allocation (changed by the budget from another thread).
+         */
+        std::mutex encoderThreadsMutex;
+
+        /**
+         * Flag indicating that the encoder should be reopened with the new threads allocation.
+         */
+        std::atomic_bool isEncoderReconfigurationRequested;
+
+        /**
+         * Motion gating parameters.
+         */
+        MotionGatingOptions motionGating;
+
+        /**
+         * Detects the changes between the filtered and the last encoded frames.
+         */
+        MotionDetector motionDetector;
+
+        /**
+         * Number of frames since the last detected motion.
+         */
+        unsigned framesSinceMotion;
+
+        /**
+         * Time the last frame was passed to the encoder.
+         */
+        std::chrono::steady_clock::time_point lastEncodedFrameTime;
+
+        /**
+         * Whether the motion is detected on the raw frame (planar 8-bit luma) before the pixel format conversion.
+         */
+        bool isRawLumaPlanar;
+
+        /**
+         * Name of the motion score metric.
+         */
+        std::string motionScoreMetricName;
+
+        /**
+         * Regions of interest parameters.
+         */
+        RegionOfInterestOptions roiOptions;
+
+        /**
+         * Number of the encoder's temporal layers (1 - single layer w/o B-frames).
+         */
+        unsigned numTemporalLayers;
+
+        /**
+         * Detects the moving areas for the regions of interest (frame to frame).
+         */
+        MotionDetector roiMotionDetector;
+
+        /**
+         * Mask of the changed blocks.
+         * @see MotionDetector::getChangedBlocks()
+         */
+        std::vector<uint8_t> roiMotionMask;
+
+        /**
+         * Chooses the quality level in accordance with the processing time of the frames.
+         */
+        OverloadGovernor governor;
+
+        /**
+         * Flag indicating that the quality level has been changed and should be applied after the current packet.
+         */
+        bool isQualityLevelChangePending;
+
+        /**
+         * Processing time (sum of all stages) at the moment of the last filtered frame (nanoseconds).
+         */
+        uint64_t processingTimeAtLastFrame;
+
+        /**
+         * Names of the governor's load (updated per filtered frame) and quality level metrics.
+         */
+        std::string governorLoadMetricName, governorLevelMetricName;
+
+        /**
+         * Time spent in the constructor (opening the source, creating the codecs and the filter graph).
+         */
+        uint64_t initializationTimeMs;
+
+        /**
+         * Preset of the opened encoder.
+         */
+        std::string encoderPreset;
+
+        /**
+         * Time the frames inside the encoder have been sent to it (by pts).
+         */
+        std::map<int64_t, std::chrono::steady_clock::time_point> encoderInputTimes;
+
+        /**
+         * Names of the encoder's delay (frames) and latency (microseconds) metrics.
+         */
+        std::string encoderDelayMetricName, encoderLatencyMetricName;
+
+        /**
+         * Names of the memory metrics of the frame buffers and of the pictures held by the encoder (bytes).
+         */
+        std::string framePoolMetricName, encoderMemoryMetricName;
+
+        /**
+         * Size of the encoder's input picture in bytes.
+         */
+        int64_t encoderPictureSize;
+
+        /**
+         * Whether a keyframe has been requested and not forced yet (set by any thread).
+         */
+        std::atomic_bool isKeyframeRequested;
+
+        unsigned minKeyframeIntervalMs;
+
+        /**
+         * Names of the requested (counted per client's request) and forced keyframes metrics.
+         */
+        std::string keyframeRequestsMetricName, forcedKeyframesMetricName;
+
+        /**
+         * Time the last requested keyframe has been forced (transcoding thread).
+         */
+        std::chrono::steady_clock::time_point lastForcedKeyframeTime;
+
+        /**
+         * Returns whether the frame being encoded should be a keyframe (transcoding thread).
+         */
+        bool isKeyframeForced();
+
+        /**
+         * Whether the source, the encoder and the filters have been opened by the constructor.
+         */
+        bool isInitialized;
+
+        /**
+         * Returns the transcoder if it has been initialized, otherwise deletes it and returns nullptr.
+         */
+        static Transcoder *initializedOrNull(Transcoder *transcoder);
 
         /** constants **/
 
         /**
-         * NALU start code bytes number (first 4 bytes, {0x0, 0x0, 0x0, 0x1}).
-         * Used to truncate start codes from the encoded data.
+         * Size of the motion map cell (x265 coding tree unit).
          */
-        constexpr static unsigned int NALU_START_CODE_BYTES_NUMBER = 4U;
+        static const int ROI_MOTION_CELL_SIZE = 64;
 
         /* Methods */
 
         /**
-         * Registers ffmpeg codecs, etc.
+         * Initializes decoder in order to capture raw frames from the video source.
+         *
+         * @return false if the source can't be opened (the error is logged), the contexts are released by cleanup().
          */
-        void registerAll();
+        bool initializeDecoder();
 
         /**
-         * Initializes decoder in order to capture raw frames from the video source.
+         * Initializes reading the frames from the frame source instead of the decoder.
          */
-        void initializeDecoder();
+        void initializeFrameSource();
+
+        /**
+         * Whether the demuxer has reported the size and the pixel format of the video stream w/o probing.
+         */
+        bool isStreamInfoAvailable() const;
 
         /**
          * Initializes encoder in order to encode raw frames.
          * Tune encoder here using different profiles, tune options.
+         *
+         * @return false if the encoder can't be opened (the error is logged).
+         */
+        bool initializeEncoder();
+
+        /**
+         * Creates and opens the encoder's codec context using the current threads allocation.
+         *
+         * @return false if the encoder can't be opened (the error is logged).
+         */
+        bool openEncoder();
+
+        /**
+         * Reopens the encoder applying the new threads allocation (the stream restarts with a keyframe).
+         */
+        void reopenEncoder();
+
+        /**
+         * Called by the encoder threads budget when the allocation has been changed.
+         *
+         * @param allocation - new threads allocation.
          */
-        void initializeEncoder();
+        void onEncoderThreadsChanged(const EncoderThreadAllocation &allocation);
 
         /**
          * Initializes converter from raw pixel format to the encoder supported pixel format.
+         *
+         * @return false if the conversion isn't supported (the error is logged).
          */
-        void initializeConverter();
+        bool initializeConverter();
 
         /**
          * Initializes filters, e.g. 'framestep', 'fps'.
+         * Framerate and scale of the current quality level are added to the filter graph.
          * See filter docs.
+         *
+         * @return false if the filter graph can't be created (the error is logged).
+         */
+        bool initFilters();
+
+        /**
+         * Updates the estimate of the frame buffers held by the decoder, the filter graph and the converter
+         * (metric 'memory.<alias>.frame_pool_bytes').
+         */
+        void updateFramePoolMetric();
+
+        /**
+         * Returns the output framerate of the current quality level.
+         */
+        AVRational getLevelFrameRate() const;
+
+        /**
+         * Updates the output frame size in accordance with the current quality level.
          */
-        void initFilters();
+        void updateOutputSize();
 
         /**
-         * Captures raw video frame from the device.
+         * Applies the current quality level: rebuilds the filter graph (the capture device is not reopened),
+         * recreates the converter and reopens the encoder if the frame size or the preset has been changed.
+         */
+        void applyQualityLevel();
+
+        /**
+         * Decodes the packet and passes all decoded frames to processRawFrame().
          *
          * @param codecContext - codec context (for decoding).
-         * @param frame - captured raw video frame.
-         * @param packet - packet to be sent to the decoder in order to get frame.
+         * @param frame - frame the decoded raw video data is received into.
+         * @param packet - packet to be sent to the decoder, nullptr - flush the decoder.
          * @return >= 0 if success, otherwise error occurred.
          */
         int decode(AVCodecContext *codecContext, AVFrame *frame, AVPacket *packet);
 
         /**
-         * Encodes raw frame and stores encode data in packet.
+         * Filters the raw frame, converts and encodes the filtered frames (motion gating and the overload
+         * governor are applied here).
+         *
+         * @param frame - decoded raw frame, nullptr - flush the filter graph.
+         */
+        void processRawFrame(AVFrame *frame);
+
+        /**
+         * Encodes the frame and delivers all packets available from the encoder.
          *
          * @param codecContext - codec context (for encoding).
-         * @param frame - raw frame to be sent to the encoder.
-         * @param packet - packet with encoded data set by the encoder.
+         * @param frame - frame to be sent to the encoder, nullptr - flush the encoder.
+         * @param packet - packet the encoded data is received into.
          * @return >= 0 - success, othwerwise error occurred.
          */
         int encode(AVCodecContext *codecContext, AVFrame *frame, AVPacket *packet);
 
+        /**
+         * Receives and delivers the packets until the encoder needs more input (or is fully flushed).
+         *
+         * @return >= 0 - success, othwerwise error occurred.
+         */
+        int receiveEncodedPackets(AVCodecContext *codecContext, AVPacket *packet);
+
+        /**
+         * Flushes the decoder, the filter graph and the encoder delivering the rest of the encoded data.
+         */
+        void flush();
+
+        /**
+         * Splits the encoded packet into NAL units and passes them to the consumer (w/o start codes).
+         *
+         * @param packet - packet with encoded data (Annex B byte stream).
+         */
+        void deliverEncodedData(const AVPacket *packet);
+
+        /**
+         * Decides whether the frame should be encoded in accordance with the motion gating.
+         * Frames with the motion, the hangover and the keep-alive frames are encoded.
+         *
+         * @param frame - frame with the 8-bit luma in the first plane.
+         * @param isKeyframe - whether the frame is a forced keyframe (encoded anyway, becomes the reference).
+         * @return true if the frame should be encoded, otherwise - false.
+         */
+        bool isEncodingRequired(const AVFrame *frame, bool isKeyframe);
+
+        /**
+         * Attaches the regions of interest to the frame as side data (replacing the previous ones).
+         *
+         * @param frame - frame to be encoded.
+         */
+        void attachRegionsOfInterest(AVFrame *frame);
+
         /**
          * Close all resources, free allocated memory, etc.
          */
@@ -1,6 +1,9 @@
 #ifndef LIVE_VIDEO_STREAM_UTILS_HPP
 #define LIVE_VIDEO_STREAM_UTILS_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <initializer_list>
 
@@ -21,6 +24,17 @@ namespace LIRS {
          * @return resulting concatenated string.
          */
         std::string concatParams(std::initializer_list<size_t> args, std::string delimiter = {}, std::string tail = {});
+
+        /**
+         * Splits Annex B byte stream into NAL units.
+         * Start codes (3 or 4 bytes) and trailing zero bytes are not included into the NAL units.
+         *
+         * @param data - pointer to the byte stream.
+         * @param size - size of the byte stream in bytes.
+         * @param callback - function called for each found NAL unit (pointer to the first byte and size).
+         */
+        void forEachNalUnit(const uint8_t *data, size_t size,
+                            const std::function<void(const uint8_t *, size_t)> &callback);
     }
 }
 
@@ -0,0 +1,204 @@
+#include "AdmissionController.hpp"
+
+#include <arpa/inet.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+namespace LIRS {
+
+    AdmissionController::AdmissionController()
+            : nextOrder(0), cpuLoad(0.0), lastCpuTime(getProcessCpuTime()),
+              lastSampleTime(std::chrono::steady_clock::now()) {}
+
+    void AdmissionController::configure(const AdmissionOptions &newOptions) {
+
+        options = newOptions;
+        networks.clear();
+
+        for (auto &priorityNetwork : options.priorityNetworks) {
+
+            auto separator = priorityNetwork.network.find('/');
+            auto prefixLength = separator == std::string::npos ?
+                                32 : atoi(priorityNetwork.network.c_str() + separator + 1);
+
+            in_addr address{};
+
+            if (inet_pton(AF_INET, priorityNetwork.network.substr(0, separator).c_str(), &address) != 1 ||
+                prefixLength < 0 || prefixLength > 32) {
+                LOG(WARN) << "Invalid priority network: " << priorityNetwork.network;
+                continue;
+            }
+
+            auto mask = prefixLength == 0 ? 0u : ~0u << (32 - prefixLength);
+
+            networks.push_back(ParsedNetwork{ntohl(address.s_addr) & mask, mask, priorityNetwork.priority});
+        }
+    }
+
+    bool AdmissionController::isEnabled() const {
+        return options.maxEgressKbps > 0 || options.maxCpuLoad > 0;
+    }
+
+    void AdmissionController::addStream(const std::string &name) {
+        streamBitrates[name] = 0;
+    }
+
+    void AdmissionController::removeStream(const std::string &name) {
+        streamBitrates.erase(name);
+    }
+
+    bool AdmissionController::hasStream(const std::string &name) const {
+        return streamBitrates.count(name) != 0;
+    }
+
+    void AdmissionController::setStreamBitrate(const std::string &name, unsigned bitrateKbps) {
+
+        auto it = streamBitrates.find(name);
+
+        if (it != streamBitrates.end()) it->second = bitrateKbps;
+
+        updateMetrics();
+    }
+
+    unsigned AdmissionController::getStreamBitrate(const std::string &stream) const {
+
+        auto it = streamBitrates.find(stream);
+
+        return it != streamBitrates.end() && it->second > 0 ? it->second : DEFAULT_STREAM_BITRATE_KBPS;
+    }
+
+    std::chrono::nanoseconds AdmissionController::getProcessCpuTime() {
+
+        timespec time{};
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+
+        return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+    }
+
+    double AdmissionController::sampleCpuLoad() {
+
+        auto cpuTime = getProcessCpuTime();
+        auto now = std::chrono::steady_clock::now();
+
+        auto wallTime = std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastSampleTime);
+        auto numCores = std::max(std::thread::hardware_concurrency(), 1u);
+
+        if (wallTime.count() > 0) {
+            cpuLoad = static_cast<double>((cpuTime - lastCpuTime).count()) / (wallTime.count() * numCores);
+        }
+
+        lastCpuTime = cpuTime;
+        lastSampleTime = now;
+
+        Metrics::getInstance().set("admission.cpu_load_x1000", static_cast<int64_t>(cpuLoad * 1000));
+
+        return cpuLoad;
+    }
+
+    unsigned AdmissionController::getPriority(uint32_t address) const {
+
+        for (auto &network : networks) {
+            if ((address & network.mask) == network.address) return network.priority;
+        }
+
+        return PRIORITY_VIEWER;
+    }
+
+    uint64_t AdmissionController::getEgressKbps() const {
+
+        uint64_t egressKbps = 0;
+
+        for (auto &session : sessions) {
+            egressKbps += getStreamBitrate(session.second.stream);
+        }
+
+        return egressKbps;
+    }
+
+    bool AdmissionController::admit(uint32_t sessionId, const std::string &stream, unsigned priority,
+                                    std::vector<uint32_t> &preempted) {
+
+        preempted.clear();
+
+        auto bitrateKbps = getStreamBitrate(stream);
+        auto currentEgressKbps = getEgressKbps();
+        auto egressKbps = currentEgressKbps;
+
+        auto exceedsEgress = [this, bitrateKbps](uint64_t egress) {
+            return options.maxEgressKbps > 0 && egress + bitrateKbps > options.maxEgressKbps;
+        };
+
+        auto isCpuOverloaded = options.maxCpuLoad > 0 && cpuLoad > options.maxCpuLoad;
+
+        if (exceedsEgress(egressKbps) || isCpuOverloaded) {
+
+            typedef std::pair<uint32_t, const AdmittedSession *> Candidate;
+
+            std::vector<Candidate> candidates;
+
+            for (auto &session : sessions) {
+                if (session.second.priority < priority) candidates.emplace_back(session.first, &session.second);
+            }
+
+            // the lowest class first, the most recent session first
+            std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+                return a.second->priority != b.second->priority ? a.second->priority < b.second->priority :
+                       a.second->order > b.second->order;
+            });
+
+            for (auto &candidate : candidates) {
+
+                if (!exceedsEgress(egressKbps) && (!isCpuOverloaded || !preempted.empty())) break;
+
+                egressKbps -= getStreamBitrate(candidate.second->stream);
+                preempted.push_back(candidate.first);
+            }
+
+            if (exceedsEgress(egressKbps) || (isCpuOverloaded && preempted.empty())) {
+
+                preempted.clear();
+
+                Metrics::getInstance().add("admission.rejected", 1);
+
+                LOG(WARN) << "Session " << sessionId << " of \"" << stream << "\" (priority " << priority
+                          << ") has been rejected: egress " << currentEgressKbps << " + " << bitrateKbps
+                          << " kbps, CPU load " << cpuLoad;
+
+                return false;
+            }
+
+            for (auto &sessionToPreempt : preempted) {
+                sessions.erase(sessionToPreempt);
+            }
+
+            Metrics::getInstance().add("admission.preempted", static_cast<int64_t>(preempted.size()));
+
+            LOG(INFO) << "Session " << sessionId << " of \"" << stream << "\" (priority " << priority
+                      << ") preempts " << preempted.size() << " session(s)";
+        }
+
+        sessions[sessionId] = AdmittedSession{stream, priority, nextOrder++};
+
+        updateMetrics();
+
+        return true;
+    }
+
+    void AdmissionController::release(uint32_t sessionId) {
+
+        if (sessions.erase(sessionId) > 0) updateMetrics();
+    }
+
+    void AdmissionController::updateMetrics() const {
+
+        Metrics::getInstance().set("admission.sessions", static_cast<int64_t>(sessions.size()));
+        Metrics::getInstance().set("admission.egress_kbps", static_cast<int64_t>(getEgressKbps()));
+    }
+}
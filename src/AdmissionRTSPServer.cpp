@@ -0,0 +1,131 @@
+#include "AdmissionRTSPServer.hpp"
+
+#include <arpa/inet.h>
+
+#include <vector>
+
+#include "Logger.hpp"
+
+namespace LIRS {
+
+    AdmissionRTSPServer *AdmissionRTSPServer::createNew(UsageEnvironment &env, Port ourPort,
+                                                        AdmissionController &admission) {
+
+        auto ourSocket = setUpOurSocket(env, ourPort);
+
+        if (ourSocket == -1) return nullptr;
+
+        return new AdmissionRTSPServer(env, ourSocket, ourPort, admission);
+    }
+
+    AdmissionRTSPServer::AdmissionRTSPServer(UsageEnvironment &env, int ourSocket, Port ourPort,
+                                             AdmissionController &admission)
+            : RTSPServer(env, ourSocket, ourPort, nullptr, RECLAMATION_SECONDS), admission(admission) {}
+
+    GenericMediaServer::ClientConnection *
+    AdmissionRTSPServer::createNewClientConnection(int clientSocket, struct sockaddr_in clientAddr) {
+        return new AdmissionClientConnection(*this, clientSocket, clientAddr);
+    }
+
+    GenericMediaServer::ClientSession *AdmissionRTSPServer::createNewClientSession(uint32_t sessionId) {
+        return new AdmissionClientSession(*this, sessionId);
+    }
+
+    AdmissionRTSPServer::AdmissionClientConnection::AdmissionClientConnection(AdmissionRTSPServer &ourServer,
+                                                                              int clientSocket,
+                                                                              struct sockaddr_in clientAddr)
+            : RTSPClientConnection(ourServer, clientSocket, clientAddr) {}
+
+    uint32_t AdmissionRTSPServer::AdmissionClientConnection::getClientAddress() const {
+        return ntohl(fClientAddr.sin_addr.s_addr);
+    }
+
+    void AdmissionRTSPServer::AdmissionClientConnection::rejectNotEnoughBandwidth() {
+        setRTSPResponse("453 Not Enough Bandwidth");
+    }
+
+    AdmissionRTSPServer::AdmissionClientSession::AdmissionClientSession(AdmissionRTSPServer &ourServer,
+                                                                        uint32_t sessionId)
+            : RTSPClientSession(ourServer, sessionId), ourAdmissionServer(ourServer), isAdmitted(false) {}
+
+    AdmissionRTSPServer::AdmissionClientSession::~AdmissionClientSession() {
+
+        if (!isAdmitted) return;
+
+        ourAdmissionServer.admission.release(fOurSessionId);
+        ourAdmissionServer.admittedSessions.erase(fOurSessionId);
+    }
+
+    std::string AdmissionRTSPServer::AdmissionClientSession::findStreamName(char const *urlPreSuffix,
+                                                                            char const *urlSuffix) const {
+
+        auto &admission = ourAdmissionServer.admission;
+
+        // "<stream>/<track>", "<stream>" or "<stream with slashes>" (see RTSPClientSession::handleCmd_SETUP)
+        std::string streamName = urlPreSuffix;
+
+        if (admission.hasStream(streamName)) return streamName;
+
+        streamName = urlPreSuffix[0] == '\0' ? std::string(urlSuffix) : streamName + "/" + urlSuffix;
+
+        return admission.hasStream(streamName) ? streamName : std::string();
+    }
+
+    void AdmissionRTSPServer::AdmissionClientSession::handleCmd_SETUP(RTSPClientConnection *ourClientConnection,
+                                                                     char const *urlPreSuffix, char const *urlSuffix,
+                                                                     char const *fullRequestStr) {
+
+        auto &admission = ourAdmissionServer.admission;
+
+        // the session is admitted by its first SETUP (unknown streams are answered by Live555)
+        if (!isAdmitted && fOurServerMediaSession == nullptr && admission.isEnabled()) {
+
+            auto streamName = findStreamName(urlPreSuffix, urlSuffix);
+
+            if (!streamName.empty()) {
+
+                auto connection = static_cast<AdmissionClientConnection *>(ourClientConnection);
+                auto priority = admission.getPriority(connection->getClientAddress());
+
+                std::vector<uint32_t> preempted;
+
+                if (!admission.admit(fOurSessionId, streamName, priority, preempted)) {
+                    connection->rejectNotEnoughBandwidth();
+                    return;
+                }
+
+                isAdmitted = true;
+                ourAdmissionServer.admittedSessions[fOurSessionId] = this;
+
+                // released by the controller already, closing sends the RTCP BYE to the clients
+                for (auto &sessionId : preempted) {
+
+                    auto session = ourAdmissionServer.admittedSessions.find(sessionId);
+
+                    if (session == ourAdmissionServer.admittedSessions.end()) continue;
+
+                    auto preemptedSession = session->second;
+
+                    ourAdmissionServer.admittedSessions.erase(session);
+
+                    preemptedSession->isAdmitted = false;
+
+                    LOG(INFO) << "Session " << sessionId << " has been preempted by the session " << fOurSessionId;
+
+                    delete preemptedSession;
+                }
+            }
+        }
+
+        RTSPClientSession::handleCmd_SETUP(ourClientConnection, urlPreSuffix, urlSuffix, fullRequestStr);
+
+        // the stream hasn't been set up (e.g. invalid track), nothing is sent to the client
+        if (isAdmitted && fOurServerMediaSession == nullptr) {
+
+            isAdmitted = false;
+
+            admission.release(fOurSessionId);
+            ourAdmissionServer.admittedSessions.erase(fOurSessionId);
+        }
+    }
+}
@@ -1,36 +1,269 @@
 #include <CameraUnicastServerMediaSubsession.hpp>
 
+#include <algorithm>
+
+#include "DebugAllocator.hpp"
+#include "Metrics.hpp"
+
 namespace LIRS {
 
+    constexpr double CameraUnicastServerMediaSubsession::SIZE_MARGIN;
+
     CameraUnicastServerMediaSubsession *CameraUnicastServerMediaSubsession::createNew(UsageEnvironment &env,
-                                                                                      StreamReplicator *replicator) {
-        return new CameraUnicastServerMediaSubsession(env, replicator);
+                                                                                      FrameFanout *fanout,
+                                                                                      AVCodecID codecId,
+                                                                                      bool isNalAggregationEnabled,
+                                                                                      unsigned pacingSpreadUs,
+                                                                                      size_t retransmissionCacheSize) {
+        return new CameraUnicastServerMediaSubsession(env, fanout, codecId, isNalAggregationEnabled, pacingSpreadUs,
+                                                      retransmissionCacheSize);
     }
 
     CameraUnicastServerMediaSubsession::CameraUnicastServerMediaSubsession(UsageEnvironment &env,
-                                                                           StreamReplicator *replicator)
-            : OnDemandServerMediaSubsession(env, False), replicator(replicator) {}
+                                                                           FrameFanout *fanout,
+                                                                           AVCodecID codecId,
+                                                                           bool isNalAggregationEnabled,
+                                                                           unsigned pacingSpreadUs,
+                                                                           size_t retransmissionCacheSize)
+            : OnDemandServerMediaSubsession(env, False), fanout(fanout), codecId(codecId),
+              isNalAggregationEnabled(isNalAggregationEnabled), pacingSpreadUs(pacingSpreadUs),
+              retransmissionCacheSize(retransmissionCacheSize) {
+
+        // Live555's sinks fragment the NAL units internally and send the fragments back to back
+        if ((pacingSpreadUs > 0 || retransmissionCacheSize > 0) && !isAggregatingSink()) {
+            LOG(WARN) << "Packets of the stream \"" << fanout->getName() << "\" aren't paced and retransmitted"
+                      << " (HEVC with the NAL aggregation only)";
+        }
+
+        // allocated by the first playing client
+        if (retransmissionCacheSize > 0 && isAggregatingSink()) {
+            retransmissionPayloads = std::make_shared<RetransmissionPayloads>(retransmissionCacheSize,
+                                                                              fanout->getName());
+        }
+    }
+
+    bool CameraUnicastServerMediaSubsession::isAggregatingSink() const {
+        return codecId == AV_CODEC_ID_HEVC && isNalAggregationEnabled;
+    }
 
     FramedSource *
     CameraUnicastServerMediaSubsession::createNewStreamSource(unsigned clientSessionId, unsigned &estBitrate) {
 
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_RTP);
+
         LOG(INFO) << "Create new stream source for client: " << clientSessionId;
 
-        estBitrate = 400;
+        auto bitrate = fanout->getAverageBitrateKbps();
+
+        estBitrate = bitrate > 0 ? static_cast<unsigned>(bitrate * SIZE_MARGIN) : DEFAULT_ESTIMATED_BITRATE;
 
-        auto source = replicator->createStreamReplica();
+        auto source = fanout->createReplica();
+
+        FramedSource *framer;
 
         // only discrete frames are being sent (w/o start code bytes)
-        return H265VideoStreamDiscreteFramer::createNew(envir(), source);
+        if (codecId == AV_CODEC_ID_H264) {
+            framer = H264VideoStreamDiscreteFramer::createNew(envir(), source);
+        } else {
+            framer = H265VideoStreamDiscreteFramer::createNew(envir(), source);
+        }
+
+        replicas[framer] = source;
+
+        return framer;
     }
 
     RTPSink *
     CameraUnicastServerMediaSubsession::createNewRTPSink(Groupsock *rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic,
                                                          FramedSource *inputSource) {
 
-        return H265VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_RTP);
+
+        auto bufferSize = packetBufferSize();
+
+        // the sink allocates its output buffer right away
+        OutPacketBuffer::maxSize = bufferSize;
+
+        // sink's output buffer and fragmenter's input buffer
+        auto savedSize = 2 * (MAX_PACKET_BUFFER_SIZE - bufferSize);
+
+        savedBufferSizes[inputSource] = savedSize;
+        Metrics::getInstance().add("packet_buffers.saved_bytes", savedSize);
+
+        packetBufferSizes[inputSource] = 2 * bufferSize;
+        Metrics::getInstance().add("memory." + fanout->getName() + ".packet_buffers_bytes", 2 * bufferSize);
+
+        LOG(INFO) << "Packet buffers of the stream \"" << fanout->getName() << "\": " << bufferSize
+                  << " bytes (max frame: " << fanout->getMaxFrameSize() << " bytes), saved " << savedSize << " bytes";
+
+        RTPSink *sink;
+
+        if (codecId == AV_CODEC_ID_H264) {
+            sink = H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+        } else if (isNalAggregationEnabled) {
+            sink = HevcAggregatingRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, pacingSpreadUs,
+                                                     fanout->getName(), retransmissionPayloads);
+        } else {
+            sink = H265VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+        }
+
+        // the client's receiver reports select the temporal layers of its replica
+        auto replica = replicas.find(inputSource);
+
+        if (replica != replicas.end()) {
+            replica->second->setRtpSink(sink);
+            replica->second->setBufferGrowable(isBufferGrowable());
+        }
+
+        sinks[inputSource] = sink;
+
+        return sink;
     }
 
-}
+    void CameraUnicastServerMediaSubsession::closeStreamSource(FramedSource *inputSource) {
+
+        auto it = savedBufferSizes.find(inputSource);
+
+        if (it != savedBufferSizes.end()) {
+            Metrics::getInstance().add("packet_buffers.saved_bytes", -static_cast<int64_t>(it->second));
+            savedBufferSizes.erase(it);
+        }
+
+        auto packetBuffers = packetBufferSizes.find(inputSource);
+
+        if (packetBuffers != packetBufferSizes.end()) {
+            Metrics::getInstance().add("memory." + fanout->getName() + ".packet_buffers_bytes",
+                                       -static_cast<int64_t>(packetBuffers->second));
+            packetBufferSizes.erase(packetBuffers);
+        }
+
+        replicas.erase(inputSource);
+        sinks.erase(inputSource);
+
+        OnDemandServerMediaSubsession::closeStreamSource(inputSource);
+    }
+
+    RTCPInstance *CameraUnicastServerMediaSubsession::createRTCP(Groupsock *rtcpGroupsock, unsigned totSessionBW,
+                                                                 unsigned char const *cname, RTPSink *sink) {
+
+        auto rtcp = OnDemandServerMediaSubsession::createRTCP(rtcpGroupsock, totSessionBW, cname, sink);
+
+        // the RTCP instance is closed before the sink (and the subsession)
+        if (rtcp) {
+            rtcp->setAuxilliaryReadHandler(onRtcpPacket, this);
+        }
+
+        return rtcp;
+    }
+
+    void CameraUnicastServerMediaSubsession::setOnKeyframeRequestCallback(std::function<void()> callback) {
+        onKeyframeRequestCallback = std::move(callback);
+    }
 
+    void CameraUnicastServerMediaSubsession::onRtcpPacket(void *clientData, unsigned char *packet,
+                                                          unsigned &packetSize) {
+        static_cast<CameraUnicastServerMediaSubsession *>(clientData)->handleRtcpPacket(packet, packetSize);
+    }
+
+    RTPSink *CameraUnicastServerMediaSubsession::findSink(uint32_t ssrc) const {
+
+        for (auto &sink : sinks) {
+            if (sink.second->SSRC() == ssrc) return sink.second;
+        }
+
+        return nullptr;
+    }
+
+    void CameraUnicastServerMediaSubsession::handleRtcpPacket(const unsigned char *packet, unsigned packetSize) {
+
+        auto readWord = [](const unsigned char *data) {
+            return static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+        };
+
+        auto isKeyframeRequested = false;
+
+        // compound packet: header (V, P, FMT, PT, length in words - 1), sender's SSRC, media source's SSRC, FCI
+        for (unsigned offset = 0; offset + 4 <= packetSize;) {
+
+            auto header = packet + offset;
+            auto size = 4 * ((static_cast<unsigned>(header[2]) << 8 | header[3]) + 1);
+
+            if ((header[0] >> 6) != 2 || offset + size > packetSize) break; // malformed
+
+            offset += size;
+
+            if (size < 12) continue; // not a feedback message
+
+            auto format = header[0] & 0x1F;
+            auto packetType = header[1];
+            auto mediaSsrc = readWord(header + 8);
+
+            if (packetType == RTCP_RTPFB_PACKET_TYPE && format == RTCP_GENERIC_NACK_FORMAT) {
+
+                auto sink = findSink(mediaSsrc);
+
+                if (!sink || !isAggregatingSink()) continue; // Live555's sinks don't cache the packets
+
+                // each FCI: sequence number of the lost packet and the bitmask of the following lost ones
+                for (unsigned fci = 12; fci + 4 <= size; fci += 4) {
+                    static_cast<HevcAggregatingRTPSink *>(sink)->retransmit(
+                            static_cast<uint16_t>(header[fci] << 8 | header[fci + 1]),
+                            static_cast<uint16_t>(header[fci + 2] << 8 | header[fci + 3]));
+                }
+
+            } else if (packetType == RTCP_PSFB_PACKET_TYPE && format == RTCP_PLI_FORMAT) {
+
+                isKeyframeRequested |= findSink(mediaSsrc) != nullptr;
 
+            } else if (packetType == RTCP_PSFB_PACKET_TYPE && format == RTCP_FIR_FORMAT) {
+
+                // each FCI: SSRC of the media sender, command's sequence number (the header's SSRC isn't used)
+                for (unsigned fci = 12; fci + 8 <= size; fci += 8) {
+                    isKeyframeRequested |= findSink(readWord(header + fci)) != nullptr;
+                }
+            }
+        }
+
+        if (isKeyframeRequested && onKeyframeRequestCallback) {
+
+            LOG(DEBUG) << "Keyframe of the stream \"" << fanout->getName() << "\" has been requested by a client";
+
+            onKeyframeRequestCallback();
+        }
+    }
+
+    void CameraUnicastServerMediaSubsession::startStream(unsigned clientSessionId, void *streamToken,
+                                                         TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData,
+                                                         unsigned short &rtpSeqNum, unsigned &rtpTimestamp,
+                                                         ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler,
+                                                         void *serverRequestAlternativeByteHandlerClientData) {
+
+        // the fragmenter's buffer and the retransmission cache are allocated by the first PLAY
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_RTP);
+
+        OutPacketBuffer::maxSize = packetBufferSize();
+
+        OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler,
+                                                   rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp,
+                                                   serverRequestAlternativeByteHandler,
+                                                   serverRequestAlternativeByteHandlerClientData);
+    }
+
+    bool CameraUnicastServerMediaSubsession::isBufferGrowable() const {
+        return codecId != AV_CODEC_ID_H264 && isNalAggregationEnabled;
+    }
+
+    unsigned CameraUnicastServerMediaSubsession::packetBufferSize() const {
+
+        // Live555's fragmenters can't grow their buffers, any published frame should fit
+        if (!isBufferGrowable()) return MAX_PACKET_BUFFER_SIZE;
+
+        auto maxFrameSize = fanout->getMaxFrameSize();
+
+        if (maxFrameSize == 0) return MAX_PACKET_BUFFER_SIZE; // nothing has been observed yet
+
+        auto size = static_cast<unsigned>(maxFrameSize * SIZE_MARGIN);
+
+        return std::min(std::max(size, MIN_PACKET_BUFFER_SIZE), MAX_PACKET_BUFFER_SIZE);
+    }
+}
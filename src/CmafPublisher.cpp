@@ -0,0 +1,564 @@
+#include "CmafPublisher.hpp"
+#include "DebugAllocator.hpp"
+#include "Metrics.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace LIRS {
+
+    /**
+     * Parses the name of the segment ('seg<MSN>.m4s') or the partial segment ('part<MSN>.<index>.m4s').
+     *
+     * @return true if the name is valid, the part index is negative for the segment.
+     */
+    static bool parseMediaResource(const std::string &resource, int64_t &sequenceNumber, int &partIndex) {
+
+        int consumed = 0;
+
+        partIndex = -1;
+
+        if (sscanf(resource.c_str(), "part%" SCNd64 ".%d.m4s%n", &sequenceNumber, &partIndex, &consumed) == 2 &&
+            static_cast<size_t>(consumed) == resource.size()) {
+            return sequenceNumber >= 0 && partIndex >= 0;
+        }
+
+        consumed = 0;
+
+        return sscanf(resource.c_str(), "seg%" SCNd64 ".m4s%n", &sequenceNumber, &consumed) == 1 &&
+               static_cast<size_t>(consumed) == resource.size() && sequenceNumber >= 0;
+    }
+
+    CmafPublisher::CmafPublisher(const std::string &name, AVCodecID codecId, const HlsOptions &options)
+            : name(name), codecId(codecId), options(options), muxer(nullptr), pendingPacket(av_packet_alloc()),
+              segmentStart(AV_NOPTS_VALUE), partStart(AV_NOPTS_VALUE), lastDts(AV_NOPTS_VALUE), frameDuration(0),
+              isPartIndependent(false), nextSequenceNumber(0), nextInitIndex(0), discontinuitySequence(0),
+              maxSegmentDuration(0.0) {
+
+        this->options.playlistSegments = std::max(this->options.playlistSegments, 1u);
+    }
+
+    CmafPublisher::~CmafPublisher() {
+
+        if (muxer) { // publish the rest of the frames
+            writePendingPacket();
+            finishPart(lastDts + frameDuration);
+        }
+
+        closeMuxer();
+
+        av_packet_free(&pendingPacket);
+
+        Metrics::getInstance().removeByPrefix("hls." + name + ".");
+        Metrics::getInstance().removeByPrefix("memory." + name + ".hls_bytes");
+
+        LOG(DEBUG) << "CMAF publisher of \"" << name << "\" has been destructed";
+    }
+
+    void CmafPublisher::publish(const AVPacket *packet, AVRational timeBase, const AVCodecParameters *parameters) {
+
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_HLS);
+
+        std::vector<uint8_t> packetParameterSets;
+        bool isKeyframe = false;
+
+        parsePacket(packet, packetParameterSets, isKeyframe);
+
+        auto isNewInit = isKeyframe && !packetParameterSets.empty() && packetParameterSets != parameterSets;
+
+        if (!muxer && !isNewInit) return; // waiting for the keyframe with the parameter sets
+
+        auto dts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+        auto pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+        dts = dts != AV_NOPTS_VALUE ? av_rescale_q(dts, timeBase, AVRational{1, TIME_BASE}) : AV_NOPTS_VALUE;
+        pts = pts != AV_NOPTS_VALUE ? av_rescale_q(pts, timeBase, AVRational{1, TIME_BASE}) : dts;
+
+        if (lastDts != AV_NOPTS_VALUE) {
+
+            // the timestamps must be monotonic (e.g. the encoder has been reopened), keep the last frame duration
+            if (dts == AV_NOPTS_VALUE || dts <= lastDts) {
+                auto correctedDts = lastDts + std::max<int64_t>(frameDuration, 1);
+                pts = pts != AV_NOPTS_VALUE ? pts + (correctedDts - (dts != AV_NOPTS_VALUE ? dts : pts)) : correctedDts;
+                dts = correctedDts;
+            } else {
+                frameDuration = dts - lastDts;
+            }
+
+            // duration of the pending packet is known now
+            pendingPacket->duration = frameDuration;
+
+            writePendingPacket();
+
+        } else if (dts == AV_NOPTS_VALUE) {
+            dts = pts = 0;
+        }
+
+        if (isKeyframe && (isNewInit || dts - segmentStart >= av_rescale(options.segmentDurationMs, TIME_BASE, 1000))) {
+
+            auto hasSegments = segmentStart != AV_NOPTS_VALUE;
+
+            if (hasSegments) {
+                finishPart(dts);
+                finishSegment();
+            }
+
+            if (isNewInit) {
+
+                closeMuxer();
+
+                if (!openMuxer(packetParameterSets, parameters)) {
+
+                    // no segment is in progress until the muxer has been reopened by the next keyframe
+                    segmentStart = AV_NOPTS_VALUE;
+                    partStart = AV_NOPTS_VALUE;
+
+                    return;
+                }
+            }
+
+            // the segments published before follow the previous init segment
+            startSegment(dts, isNewInit && nextSequenceNumber > 0);
+
+        } else if (dts + frameDuration - partStart > av_rescale(options.partDurationMs, TIME_BASE, 1000)) {
+
+            // the next frame would exceed the part's target duration
+            finishPart(dts);
+
+            partStart = dts;
+            isPartIndependent = isKeyframe;
+        }
+
+        av_packet_unref(pendingPacket);
+        av_packet_ref(pendingPacket, packet);
+
+        pendingPacket->dts = dts;
+        pendingPacket->pts = std::max(pts, dts);
+        pendingPacket->stream_index = 0;
+
+        lastDts = dts;
+    }
+
+    void CmafPublisher::setOnPublishedCallback(std::function<void()> callback) {
+
+        std::lock_guard<std::mutex> lock(callbackMutex);
+
+        onPublishedCallback = std::move(callback);
+    }
+
+    const std::string &CmafPublisher::getName() const {
+        return name;
+    }
+
+    std::string CmafPublisher::getPlaylist() const {
+
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        std::ostringstream playlist;
+        playlist.setf(std::ios::fixed);
+        playlist.precision(3);
+
+        auto targetDuration = static_cast<unsigned>(std::ceil(std::max(options.segmentDurationMs / 1000.0,
+                                                                       maxSegmentDuration)));
+        auto partTarget = options.partDurationMs / 1000.0;
+
+        playlist << "#EXTM3U\n"
+                 << "#EXT-X-VERSION:6\n"
+                 << "#EXT-X-TARGETDURATION:" << targetDuration << "\n"
+                 << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" << 3 * partTarget << "\n"
+                 << "#EXT-X-PART-INF:PART-TARGET=" << partTarget << "\n"
+                 << "#EXT-X-MEDIA-SEQUENCE:" << (segments.empty() ? 0 : segments.front().sequenceNumber) << "\n"
+                 << "#EXT-X-DISCONTINUITY-SEQUENCE:" << discontinuitySequence << "\n";
+
+        // partial segments are listed only close to the live edge
+        size_t firstListedParts = segments.size();
+        double durationFromEnd = 0.0;
+
+        while (firstListedParts > 0 && durationFromEnd < PART_LISTING_TARGET_DURATIONS * targetDuration) {
+
+            auto &segment = segments[--firstListedParts];
+
+            for (auto &part : segment.parts) {
+                durationFromEnd += part.duration;
+            }
+        }
+
+        for (size_t index = 0; index < segments.size(); index++) {
+
+            auto &segment = segments[index];
+
+            if (segment.discontinuity) {
+                playlist << "#EXT-X-DISCONTINUITY\n";
+            }
+
+            if (index == 0 || segment.discontinuity) {
+                playlist << "#EXT-X-MAP:URI=\"init" << segment.initIndex << ".mp4\"\n";
+            }
+
+            if (index >= firstListedParts) {
+
+                for (size_t partIndex = 0; partIndex < segment.parts.size(); partIndex++) {
+
+                    auto &part = segment.parts[partIndex];
+
+                    playlist << "#EXT-X-PART:DURATION=" << part.duration << ",URI=\"part" << segment.sequenceNumber
+                             << "." << partIndex << ".m4s\"" << (part.independent ? ",INDEPENDENT=YES" : "") << "\n";
+                }
+            }
+
+            if (segment.data) {
+                playlist << "#EXTINF:" << segment.duration << ",\nseg" << segment.sequenceNumber << ".m4s\n";
+            }
+        }
+
+        if (!segments.empty()) {
+            playlist << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part" << segments.back().sequenceNumber << "."
+                     << segments.back().parts.size() << ".m4s\"\n";
+        }
+
+        return playlist.str();
+    }
+
+    CmafData CmafPublisher::getResource(const std::string &resource) const {
+
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        unsigned initIndex = 0;
+        int consumed = 0;
+
+        if (sscanf(resource.c_str(), "init%u.mp4%n", &initIndex, &consumed) == 1 &&
+            static_cast<size_t>(consumed) == resource.size()) {
+
+            auto init = initSegments.find(initIndex);
+
+            return init != initSegments.end() ? init->second : nullptr;
+        }
+
+        int64_t sequenceNumber;
+        int partIndex;
+
+        if (!parseMediaResource(resource, sequenceNumber, partIndex)) return nullptr;
+
+        for (auto &segment : segments) {
+
+            if (segment.sequenceNumber != sequenceNumber) continue;
+
+            if (partIndex < 0) return segment.data;
+
+            return static_cast<size_t>(partIndex) < segment.parts.size() ? segment.parts[partIndex].data : nullptr;
+        }
+
+        return nullptr;
+    }
+
+    bool CmafPublisher::contains(int64_t sequenceNumber, int partIndex) const {
+
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        if (segments.empty()) return false;
+
+        // the later segment is listed as well
+        if (segments.back().sequenceNumber > sequenceNumber) return true;
+
+        if (segments.back().sequenceNumber < sequenceNumber) return false;
+
+        auto &segment = segments.back();
+
+        return segment.data || (partIndex >= 0 && static_cast<size_t>(partIndex) < segment.parts.size());
+    }
+
+    bool CmafPublisher::isUpcoming(const std::string &resource) const {
+
+        int64_t sequenceNumber;
+        int partIndex;
+
+        if (!parseMediaResource(resource, sequenceNumber, partIndex)) return false;
+
+        auto current = getCurrentSequenceNumber();
+
+        return current >= 0 && sequenceNumber >= current && sequenceNumber <= current + 1;
+    }
+
+    int64_t CmafPublisher::getCurrentSequenceNumber() const {
+
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        return segments.empty() ? -1 : segments.back().sequenceNumber;
+    }
+
+    unsigned CmafPublisher::getTargetDuration() const {
+
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        return static_cast<unsigned>(std::ceil(std::max(options.segmentDurationMs / 1000.0, maxSegmentDuration)));
+    }
+
+    bool CmafPublisher::openMuxer(const std::vector<uint8_t> &newParameterSets, const AVCodecParameters *parameters) {
+
+        auto statCode = avformat_alloc_output_context2(&muxer, nullptr, "mp4", nullptr);
+
+        if (statCode < 0 || !muxer) {
+            LOG(ERROR) << "Failed to create the MP4 muxer for \"" << name << "\"";
+            muxer = nullptr;
+            return false;
+        }
+
+        // the fragments are written into memory
+        auto buffer = static_cast<unsigned char *>(av_malloc(MUXER_BUFFER_SIZE));
+        muxer->pb = avio_alloc_context(buffer, MUXER_BUFFER_SIZE, 1, this, nullptr, writeMuxedData, nullptr);
+
+        auto stream = avformat_new_stream(muxer, nullptr);
+
+        stream->time_base = AVRational{1, TIME_BASE};
+        stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+        stream->codecpar->codec_id = codecId;
+        stream->codecpar->width = parameters ? parameters->width : 0;
+        stream->codecpar->height = parameters ? parameters->height : 0;
+
+        if (codecId == AV_CODEC_ID_HEVC) { // required by Apple devices
+            stream->codecpar->codec_tag = MKTAG('h', 'v', 'c', '1');
+        }
+
+        // Annex B parameter sets are converted into hvcC/avcC by the muxer
+        stream->codecpar->extradata = static_cast<uint8_t *>(av_mallocz(newParameterSets.size() +
+                                                                        AV_INPUT_BUFFER_PADDING_SIZE));
+        stream->codecpar->extradata_size = static_cast<int>(newParameterSets.size());
+        memcpy(stream->codecpar->extradata, newParameterSets.data(), newParameterSets.size());
+
+        AVDictionary *muxerOptions = nullptr;
+
+        // fragments are flushed manually (partial segments), tfdt follows the stream's timestamps
+        av_dict_set(&muxerOptions, "movflags", "frag_custom+empty_moov+default_base_moof+frag_discont", 0);
+
+        statCode = avformat_write_header(muxer, &muxerOptions);
+        av_dict_free(&muxerOptions);
+
+        if (statCode < 0) {
+            LOG(ERROR) << "Failed to write the init segment of \"" << name << "\"";
+            closeMuxer();
+            return false;
+        }
+
+        avio_flush(muxer->pb);
+
+        parameterSets = newParameterSets;
+
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        initSegments[nextInitIndex++] = std::make_shared<const std::vector<uint8_t>>(std::move(muxedBytes));
+
+        muxedBytes.clear();
+
+        LOG(INFO) << "HLS stream \"" << name << "\": init segment " << nextInitIndex - 1 << " has been published ("
+                  << stream->codecpar->width << "x" << stream->codecpar->height << ")";
+
+        return true;
+    }
+
+    void CmafPublisher::closeMuxer() {
+
+        if (!muxer) return;
+
+        // releases the muxer's state, the trailer isn't used (nothing to release if the header hasn't been written)
+        if (!parameterSets.empty()) av_write_trailer(muxer);
+
+        av_freep(&muxer->pb->buffer);
+        avio_context_free(&muxer->pb);
+
+        avformat_free_context(muxer);
+        muxer = nullptr;
+
+        muxedBytes.clear();
+        parameterSets.clear();
+    }
+
+    int CmafPublisher::writeMuxedData(void *opaque, uint8_t *buffer, int size) {
+
+        auto publisher = static_cast<CmafPublisher *>(opaque);
+
+        publisher->muxedBytes.insert(publisher->muxedBytes.end(), buffer, buffer + size);
+
+        return size;
+    }
+
+    void CmafPublisher::writePendingPacket() {
+
+        if (!pendingPacket->data) return;
+
+        av_packet_rescale_ts(pendingPacket, AVRational{1, TIME_BASE}, muxer->streams[0]->time_base);
+
+        if (av_write_frame(muxer, pendingPacket) < 0) {
+            LOG(WARN) << "Failed to mux the packet of \"" << name << "\"";
+        }
+
+        av_packet_unref(pendingPacket);
+    }
+
+    void CmafPublisher::finishPart(int64_t end) {
+
+        if (!muxer) return;
+
+        av_write_frame(muxer, nullptr); // flush the fragment (moof + mdat)
+        avio_flush(muxer->pb);
+
+        if (muxedBytes.empty()) return;
+
+        CmafPart part;
+        part.data = std::make_shared<const std::vector<uint8_t>>(std::move(muxedBytes));
+        part.duration = static_cast<double>(end - partStart) / TIME_BASE;
+        part.independent = isPartIndependent;
+
+        muxedBytes.clear();
+
+        size_t publishedBytes;
+
+        {
+            std::lock_guard<std::mutex> lock(publishedMutex);
+
+            if (segments.empty()) return;
+
+            segments.back().parts.push_back(part);
+
+            publishedBytes = getPublishedBytes();
+        }
+
+        Metrics::getInstance().add("hls." + name + ".parts", 1);
+        Metrics::getInstance().set("memory." + name + ".hls_bytes", static_cast<int64_t>(publishedBytes));
+
+        notifyPublished();
+    }
+
+    void CmafPublisher::finishSegment() {
+
+        size_t publishedBytes;
+
+        {
+            std::lock_guard<std::mutex> lock(publishedMutex);
+
+            if (segments.empty()) return;
+
+            auto &segment = segments.back();
+
+            // the segment is served as a whole as well
+            size_t size = 0;
+            segment.duration = 0.0;
+
+            for (auto &part : segment.parts) {
+                size += part.data->size();
+                segment.duration += part.duration;
+            }
+
+            auto data = std::make_shared<std::vector<uint8_t>>();
+            data->reserve(size);
+
+            for (auto &part : segment.parts) {
+                data->insert(data->end(), part.data->begin(), part.data->end());
+            }
+
+            segment.data = data;
+
+            maxSegmentDuration = std::max(maxSegmentDuration, segment.duration);
+
+            while (segments.size() > options.playlistSegments) {
+
+                if (segments.front().discontinuity) {
+                    discontinuitySequence++;
+                }
+
+                segments.pop_front();
+            }
+
+            // init segments not referenced by the listed segments
+            while (!initSegments.empty() && initSegments.begin()->first < segments.front().initIndex) {
+                initSegments.erase(initSegments.begin());
+            }
+
+            publishedBytes = getPublishedBytes();
+        }
+
+        Metrics::getInstance().set("memory." + name + ".hls_bytes", static_cast<int64_t>(publishedBytes));
+
+        notifyPublished();
+    }
+
+    size_t CmafPublisher::getPublishedBytes() const {
+
+        size_t size = 0;
+
+        for (auto &segment : segments) {
+
+            for (auto &part : segment.parts) {
+                size += part.data->size();
+            }
+
+            if (segment.data) size += segment.data->size();
+        }
+
+        for (auto &initSegment : initSegments) {
+            size += initSegment.second->size();
+        }
+
+        return size;
+    }
+
+    void CmafPublisher::startSegment(int64_t start, bool discontinuity) {
+
+        segmentStart = start;
+        partStart = start;
+        isPartIndependent = true;
+
+        CmafSegment segment;
+        segment.sequenceNumber = nextSequenceNumber++;
+        segment.initIndex = nextInitIndex - 1;
+        segment.discontinuity = discontinuity;
+        segment.duration = 0.0;
+
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        segments.push_back(std::move(segment));
+    }
+
+    void CmafPublisher::parsePacket(const AVPacket *packet, std::vector<uint8_t> &packetParameterSets,
+                                    bool &isKeyframe) const {
+
+        static const uint8_t START_CODE[] = {0, 0, 0, 1};
+
+        isKeyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+
+        auto isHevc = codecId == AV_CODEC_ID_HEVC;
+
+        utils::forEachNalUnit(packet->data, static_cast<size_t>(packet->size),
+                              [&](const uint8_t *nalUnit, size_t size) {
+
+                                  auto type = isHevc ? (nalUnit[0] >> 1) & 0x3f : nalUnit[0] & 0x1f;
+
+                                  // VPS, SPS, PPS (HEVC) or SPS, PPS (H.264)
+                                  auto isParameterSet = isHevc ? (type >= 32 && type <= 34) : (type == 7 || type == 8);
+
+                                  if (isParameterSet) {
+                                      packetParameterSets.insert(packetParameterSets.end(), START_CODE,
+                                                                 START_CODE + sizeof(START_CODE));
+                                      packetParameterSets.insert(packetParameterSets.end(), nalUnit, nalUnit + size);
+                                  }
+
+                                  // IRAP (HEVC) or IDR (H.264)
+                                  if (isHevc ? (type >= 16 && type <= 21) : type == 5) {
+                                      isKeyframe = true;
+                                  }
+                              });
+    }
+
+    void CmafPublisher::notifyPublished() {
+
+        std::lock_guard<std::mutex> lock(callbackMutex);
+
+        if (onPublishedCallback) {
+            onPublishedCallback();
+        }
+    }
+}
@@ -0,0 +1,189 @@
+#include "ControlServer.hpp"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "Logger.hpp"
+
+namespace LIRS {
+
+    ControlServer::ControlServer(UsageEnvironment &env, const std::string &socketPath, CommandHandler handler)
+            : env(env), socketPath(socketPath), handler(std::move(handler)), listenSocket(-1), nextConnectionId(1) {
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            LOG(ERROR) << "Control socket path is too long: " << socketPath;
+            return;
+        }
+
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+        unlink(socketPath.c_str()); // left by the previous process
+
+        listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        // the commands aren't authenticated, only the owner may connect
+        auto previousMask = umask(0077);
+
+        auto isBound = listenSocket >= 0 &&
+                       bind(listenSocket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 &&
+                       listen(listenSocket, 16) == 0;
+
+        umask(previousMask);
+
+        if (!isBound) {
+            LOG(ERROR) << "Failed to listen on the control socket " << socketPath << ": " << strerror(errno);
+            if (listenSocket >= 0) close(listenSocket);
+            listenSocket = -1;
+            return;
+        }
+
+        env.taskScheduler().turnOnBackgroundReadHandling(listenSocket, onAcceptable, this);
+
+        LOG(INFO) << "Control socket: " << socketPath;
+    }
+
+    ControlServer::~ControlServer() {
+
+        while (!connections.empty()) {
+            closeConnection(connections.begin()->first);
+        }
+
+        if (listenSocket >= 0) {
+            env.taskScheduler().turnOffBackgroundReadHandling(listenSocket);
+            close(listenSocket);
+            unlink(socketPath.c_str());
+        }
+
+        LOG(DEBUG) << "Control server has been destructed";
+    }
+
+    bool ControlServer::isListening() const {
+        return listenSocket >= 0;
+    }
+
+    void ControlServer::onAcceptable(void *clientData, int) {
+        static_cast<ControlServer *>(clientData)->acceptConnections();
+    }
+
+    void ControlServer::onReadable(void *clientData, int) {
+
+        auto connection = static_cast<ControlConnection *>(clientData);
+
+        connection->server->readCommands(connection);
+    }
+
+    void ControlServer::acceptConnections() {
+
+        while (true) {
+
+            auto socket = accept4(listenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (socket < 0) return; // no more pending connections
+
+            auto connection = new ControlConnection{this, socket, nextConnectionId++, {}, 0, false};
+
+            connections[connection->id].reset(connection);
+
+            env.taskScheduler().turnOnBackgroundReadHandling(socket, onReadable, connection);
+        }
+    }
+
+    void ControlServer::readCommands(ControlConnection *connection) {
+
+        auto connectionId = connection->id;
+
+        char buffer[1024];
+        auto isClosed = false;
+
+        while (true) {
+
+            auto size = recv(connection->socket, buffer, sizeof(buffer), 0);
+
+            if (size > 0) {
+                connection->buffer.append(buffer, static_cast<size_t>(size));
+                continue;
+            }
+
+            isClosed = size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+            break;
+        }
+
+        size_t lineEnd;
+
+        // the handler doesn't close connections, so the connection stays valid
+        while ((lineEnd = connection->buffer.find('\n')) != std::string::npos) {
+
+            std::istringstream line(connection->buffer.substr(0, lineEnd));
+            connection->buffer.erase(0, lineEnd + 1);
+
+            std::vector<std::string> args;
+            std::string word;
+
+            while (line >> word) {
+                args.push_back(word);
+            }
+
+            if (args.empty()) continue;
+
+            connection->numPendingReplies++;
+
+            handler(args, [this, connectionId](const std::string &reply) {
+                sendReply(connectionId, reply);
+            });
+        }
+
+        if (connection->buffer.size() > MAX_LINE_LENGTH) {
+            LOG(WARN) << "Control command exceeds " << MAX_LINE_LENGTH << " bytes, the connection is closed";
+            closeConnection(connectionId);
+            return;
+        }
+
+        if (!isClosed) return;
+
+        // the client may still wait for the replies of the pending commands
+        connection->isInputClosed = true;
+        env.taskScheduler().turnOffBackgroundReadHandling(connection->socket);
+
+        if (connection->numPendingReplies == 0) closeConnection(connectionId);
+    }
+
+    void ControlServer::closeConnection(uint64_t connectionId) {
+
+        auto it = connections.find(connectionId);
+
+        if (it == connections.end()) return;
+
+        env.taskScheduler().turnOffBackgroundReadHandling(it->second->socket);
+        close(it->second->socket);
+
+        connections.erase(it);
+    }
+
+    void ControlServer::sendReply(uint64_t connectionId, const std::string &line) {
+
+        auto it = connections.find(connectionId);
+
+        if (it == connections.end()) return; // closed by the client
+
+        auto data = line + "\n";
+
+        // replies are short, a client not reading them loses the rest
+        if (send(it->second->socket, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT) !=
+            static_cast<ssize_t>(data.size())) {
+            LOG(WARN) << "Control reply hasn't been sent: " << line;
+        }
+
+        if (it->second->numPendingReplies > 0) it->second->numPendingReplies--;
+
+        if (it->second->isInputClosed && it->second->numPendingReplies == 0) closeConnection(connectionId);
+    }
+}
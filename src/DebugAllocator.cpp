@@ -0,0 +1,160 @@
+#include "DebugAllocator.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "Metrics.hpp"
+
+namespace LIRS {
+
+    namespace {
+
+        /**
+         * Subsystem of the current thread's allocations (plain integer, no dynamic initialization of the TLS).
+         */
+        thread_local int currentSubsystem = MEMORY_SUBSYSTEM_OTHER;
+
+        std::atomic<int64_t> allocatedBytes[MEMORY_SUBSYSTEM_COUNT];
+
+        std::atomic<int64_t> highWaterMarks[MEMORY_SUBSYSTEM_COUNT];
+
+        const char *const SUBSYSTEM_NAMES[MEMORY_SUBSYSTEM_COUNT] = {"other", "transcoder", "fanout", "rtp", "hls"};
+    }
+
+    MemoryScope::MemoryScope(MemorySubsystem subsystem)
+            : previousSubsystem(static_cast<MemorySubsystem>(currentSubsystem)) {
+        currentSubsystem = subsystem;
+    }
+
+    MemoryScope::~MemoryScope() {
+        currentSubsystem = previousSubsystem;
+    }
+
+    bool DebugAllocator::isEnabled() {
+#ifdef DEBUG_ALLOCATOR
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    int64_t DebugAllocator::getAllocatedBytes(MemorySubsystem subsystem) {
+        return allocatedBytes[subsystem].load(std::memory_order_relaxed);
+    }
+
+    int64_t DebugAllocator::getHighWaterMark(MemorySubsystem subsystem) {
+        return highWaterMarks[subsystem].load(std::memory_order_relaxed);
+    }
+
+    const char *DebugAllocator::getSubsystemName(MemorySubsystem subsystem) {
+        return SUBSYSTEM_NAMES[subsystem];
+    }
+
+    void DebugAllocator::updateMetrics() {
+
+        if (!isEnabled()) return;
+
+        for (int subsystem = 0; subsystem < MEMORY_SUBSYSTEM_COUNT; subsystem++) {
+
+            auto prefix = std::string("memory.allocator.") + SUBSYSTEM_NAMES[subsystem];
+
+            Metrics::getInstance().set(prefix + "_bytes", getAllocatedBytes(static_cast<MemorySubsystem>(subsystem)));
+            Metrics::getInstance().set(prefix + "_high_water_bytes",
+                                       getHighWaterMark(static_cast<MemorySubsystem>(subsystem)));
+        }
+    }
+}
+
+#ifdef DEBUG_ALLOCATOR
+
+namespace {
+
+    /**
+     * Prefix of each allocation (keeps the malloc's alignment of the returned memory).
+     */
+    struct alignas(16) AllocationHeader {
+
+        size_t size;
+
+        int subsystem;
+    };
+
+    void *allocate(size_t size) noexcept {
+
+        auto header = static_cast<AllocationHeader *>(malloc(sizeof(AllocationHeader) + size));
+
+        if (!header) return nullptr;
+
+        header->size = size;
+        header->subsystem = LIRS::currentSubsystem;
+
+        auto allocated = LIRS::allocatedBytes[header->subsystem].fetch_add(static_cast<int64_t>(size),
+                                                                           std::memory_order_relaxed) +
+                         static_cast<int64_t>(size);
+
+        auto &highWaterMark = LIRS::highWaterMarks[header->subsystem];
+        auto previousMark = highWaterMark.load(std::memory_order_relaxed);
+
+        while (allocated > previousMark &&
+               !highWaterMark.compare_exchange_weak(previousMark, allocated, std::memory_order_relaxed)) {}
+
+        return header + 1;
+    }
+
+    void deallocate(void *pointer) noexcept {
+
+        if (!pointer) return;
+
+        auto header = static_cast<AllocationHeader *>(pointer) - 1;
+
+        LIRS::allocatedBytes[header->subsystem].fetch_sub(static_cast<int64_t>(header->size),
+                                                          std::memory_order_relaxed);
+
+        free(header);
+    }
+
+    void *allocateOrThrow(size_t size) {
+
+        auto pointer = allocate(size);
+
+        if (!pointer) throw std::bad_alloc();
+
+        return pointer;
+    }
+}
+
+void *operator new(size_t size) {
+    return allocateOrThrow(size);
+}
+
+void *operator new[](size_t size) {
+    return allocateOrThrow(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void *pointer) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+    deallocate(pointer);
+}
+
+#endif
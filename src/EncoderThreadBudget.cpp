@@ -0,0 +1,177 @@
+#include "EncoderThreadBudget.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+namespace LIRS {
+
+    std::string EncoderThreadAllocation::toX265Params() const {
+        std::stringstream params;
+        params << "frame-threads=" << frameThreads << ":wpp=" << (wpp ? 1 : 0) << ":pools=" << poolThreads;
+        return params.str();
+    }
+
+    bool EncoderThreadAllocation::operator==(const EncoderThreadAllocation &other) const {
+        return frameThreads == other.frameThreads && wpp == other.wpp && poolThreads == other.poolThreads;
+    }
+
+    bool EncoderThreadAllocation::operator!=(const EncoderThreadAllocation &other) const {
+        return !(*this == other);
+    }
+
+    EncoderThreadBudget &EncoderThreadBudget::getInstance() {
+        static EncoderThreadBudget instance;
+        return instance;
+    }
+
+    EncoderThreadBudget::EncoderThreadBudget() : cores(std::max(1u, std::thread::hardware_concurrency())) {}
+
+    void EncoderThreadBudget::setCoreBudget(size_t cores) {
+
+        std::lock_guard<std::mutex> lock(budgetMutex);
+
+        this->cores = cores > 0 ? cores : std::max(1u, std::thread::hardware_concurrency());
+
+        LOG(INFO) << "Encoder thread budget: " << this->cores << " cores";
+
+        rebalance(nullptr);
+    }
+
+    EncoderThreadAllocation EncoderThreadBudget::registerEncoder(const void *owner, const std::string &name,
+                                                                 size_t width, size_t height,
+                                                                 AllocationCallback callback) {
+
+        std::lock_guard<std::mutex> lock(budgetMutex);
+
+        auto &entry = encoders[owner];
+        entry.name = name;
+        entry.width = width;
+        entry.height = height;
+        entry.callback = std::move(callback);
+
+        rebalance(owner); // the registering encoder takes the returned allocation
+
+        return entry.allocation;
+    }
+
+    void EncoderThreadBudget::unregisterEncoder(const void *owner) {
+
+        std::lock_guard<std::mutex> lock(budgetMutex);
+
+        auto it = encoders.find(owner);
+
+        if (it == encoders.end()) return; // not registered or already unregistered
+
+        Metrics::getInstance().removeByPrefix("encoder_threads." + it->second.name + ".");
+
+        LOG(INFO) << "Encoder \"" << it->second.name << "\" has left the thread budget";
+
+        encoders.erase(it);
+
+        rebalance(nullptr);
+    }
+
+    void EncoderThreadBudget::rebalance(const void *excludedOwner) {
+
+        if (!encoders.empty()) {
+
+            auto numEncoders = encoders.size();
+
+            uint64_t totalPixels = 0;
+
+            for (auto &encoder : encoders) {
+                totalPixels += std::max<uint64_t>(1, encoder.second.width * encoder.second.height);
+            }
+
+            // each encoder gets at least one thread, the spare cores are shared proportionally to the resolution
+            auto spareCores = cores > numEncoders ? cores - numEncoders : 0;
+
+            std::vector<std::pair<uint64_t, EncoderEntry *>> remainders; // largest remainder method
+            size_t distributedCores = 0;
+
+            std::vector<size_t> shares;
+
+            for (auto &encoder : encoders) {
+
+                auto pixels = std::max<uint64_t>(1, encoder.second.width * encoder.second.height);
+                auto share = spareCores * pixels / totalPixels;
+
+                shares.push_back(1 + share);
+                distributedCores += share;
+
+                remainders.emplace_back(spareCores * pixels % totalPixels, &encoder.second);
+            }
+
+            std::stable_sort(remainders.begin(), remainders.end(),
+                             [](const std::pair<uint64_t, EncoderEntry *> &lhs,
+                                const std::pair<uint64_t, EncoderEntry *> &rhs) {
+                                 return lhs.first > rhs.first;
+                             });
+
+            size_t idx = 0;
+
+            for (auto &encoder : encoders) {
+
+                auto share = shares[idx++];
+
+                // the leftover cores go to the encoders with the largest remainders
+                for (size_t pos = 0; pos < spareCores - distributedCores; ++pos) {
+                    if (remainders[pos].second == &encoder.second) share++;
+                }
+
+                // wavefront can't keep more threads busy than about a half of the CTU rows
+                auto ctuRows = (encoder.second.height + CTU_SIZE - 1) / CTU_SIZE;
+                auto maxUsefulThreads = std::max<size_t>(1, (ctuRows + 1) / 2);
+
+                EncoderThreadAllocation allocation;
+
+                // frame threading adds a frame of latency per thread (and is disabled by 'zerolatency' anyway)
+                allocation.frameThreads = 1;
+                allocation.poolThreads = std::min(share, maxUsefulThreads);
+                allocation.wpp = allocation.poolThreads > 1;
+
+                if (allocation != encoder.second.allocation || encoder.first == excludedOwner) {
+
+                    LOG(INFO) << "Encoder \"" << encoder.second.name << "\" (" << encoder.second.width << "x"
+                              << encoder.second.height << ") threads: " << allocation.toX265Params() << " ("
+                              << numEncoders << " encoders, " << cores << " cores)";
+
+                    encoder.second.allocation = allocation;
+
+                    if (encoder.first != excludedOwner && encoder.second.callback) {
+                        encoder.second.callback(allocation);
+                    }
+                }
+            }
+        }
+
+        updateMetrics();
+    }
+
+    void EncoderThreadBudget::updateMetrics() const {
+
+        auto &metrics = Metrics::getInstance();
+
+        size_t allocatedThreads = 0;
+
+        for (auto &encoder : encoders) {
+
+            auto prefix = "encoder_threads." + encoder.second.name + ".";
+
+            metrics.set(prefix + "pools", static_cast<int64_t>(encoder.second.allocation.poolThreads));
+            metrics.set(prefix + "frame_threads", static_cast<int64_t>(encoder.second.allocation.frameThreads));
+            metrics.set(prefix + "wpp", encoder.second.allocation.wpp ? 1 : 0);
+
+            allocatedThreads += encoder.second.allocation.poolThreads;
+        }
+
+        metrics.set("encoder_threads.cores", static_cast<int64_t>(cores));
+        metrics.set("encoder_threads.encoders", static_cast<int64_t>(encoders.size()));
+        metrics.set("encoder_threads.allocated", static_cast<int64_t>(allocatedThreads));
+    }
+}
@@ -0,0 +1,433 @@
+#include "EpollTaskScheduler.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+#include "Logger.hpp"
+
+namespace LIRS {
+
+    EpollTaskScheduler *EpollTaskScheduler::createNew() {
+        return new EpollTaskScheduler();
+    }
+
+    EpollTaskScheduler::EpollTaskScheduler()
+            : epollFd(epoll_create1(EPOLL_CLOEXEC)),
+              timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+              triggerFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), nextGeneration(1), wheel(WHEEL_SIZE), nextTaskId(1),
+              currentTick(nowMicros() / WHEEL_TICK_US), armedTimeUs(0), triggerHandlers(), triggerClientData(),
+              triggeredMask(0), usedTriggersMask(0) {
+
+        if (epollFd < 0 || timerFd < 0 || triggerFd < 0) {
+            LOG(ERROR) << "Can't create the epoll scheduler's descriptors: " << strerror(errno);
+        }
+
+        assert(epollFd >= 0 && timerFd >= 0 && triggerFd >= 0);
+
+        // the timer and the triggers are watched as the sockets w/o handlers (generation 0)
+        for (auto fd : {timerFd, triggerFd}) {
+
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = packEventData(fd, 0);
+
+            auto status = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+            assert(status == 0);
+        }
+    }
+
+    EpollTaskScheduler::~EpollTaskScheduler() {
+
+        close(triggerFd);
+        close(timerFd);
+        close(epollFd);
+
+        LOG(DEBUG) << "Epoll task scheduler has been destructed (sockets: " << socketHandlers.size() << ", tasks: "
+                   << delayedTasks.size() << ")";
+    }
+
+    TaskToken EpollTaskScheduler::scheduleDelayedTask(int64_t microseconds, TaskFunc *proc, void *clientData) {
+
+        auto id = nextTaskId++;
+
+        insertTask(DelayedTask{id, nowMicros() + std::max<int64_t>(microseconds, 0), proc, clientData});
+
+        return reinterpret_cast<TaskToken>(id);
+    }
+
+    void EpollTaskScheduler::unscheduleDelayedTask(TaskToken &prevTask) {
+
+        // the token of the handled task is ignored (as by the DelayQueue)
+        auto it = delayedTasks.find(reinterpret_cast<intptr_t>(prevTask));
+
+        if (it != delayedTasks.end()) {
+
+            if (it->second.isInWheel) {
+                wheel[it->second.slot].erase(it->second.position);
+            } else {
+                overflowTasks.erase(it->second.overflowPosition);
+            }
+
+            delayedTasks.erase(it);
+        }
+
+        prevTask = nullptr;
+    }
+
+    void EpollTaskScheduler::setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc *handlerProc,
+                                                   void *clientData) {
+
+        if (socketNum < 0) return;
+
+        auto it = socketHandlers.find(socketNum);
+
+        if (conditionSet == 0 || !handlerProc) {
+
+            if (it != socketHandlers.end()) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, socketNum, nullptr); // fails if the socket is already closed
+                socketHandlers.erase(it);
+            }
+
+            return;
+        }
+
+        epoll_event event = {};
+        event.events = ((conditionSet & SOCKET_READABLE) ? EPOLLIN : 0u) |
+                       ((conditionSet & SOCKET_WRITABLE) ? EPOLLOUT : 0u) |
+                       ((conditionSet & SOCKET_EXCEPTION) ? EPOLLPRI : 0u);
+
+        auto status = -1;
+
+        if (it != socketHandlers.end()) {
+
+            event.data.u64 = packEventData(socketNum, it->second.generation);
+            status = epoll_ctl(epollFd, EPOLL_CTL_MOD, socketNum, &event);
+        }
+
+        // new socket, or the closed one (removed from the epoll's set) whose number has been reused
+        if (status != 0) {
+
+            it = socketHandlers.insert(std::make_pair(socketNum, SocketHandler())).first;
+            it->second.generation = nextGeneration++;
+
+            event.data.u64 = packEventData(socketNum, it->second.generation);
+            status = epoll_ctl(epollFd, EPOLL_CTL_ADD, socketNum, &event);
+        }
+
+        if (status != 0) {
+            LOG(ERROR) << "Can't watch socket " << socketNum << ": " << strerror(errno);
+            socketHandlers.erase(it);
+            return;
+        }
+
+        it->second.conditionSet = conditionSet;
+        it->second.handlerProc = handlerProc;
+        it->second.clientData = clientData;
+    }
+
+    void EpollTaskScheduler::moveSocketHandling(int oldSocketNum, int newSocketNum) {
+
+        auto it = socketHandlers.find(oldSocketNum);
+
+        if (it == socketHandlers.end()) return;
+
+        auto handler = it->second;
+
+        setBackgroundHandling(oldSocketNum, 0, nullptr, nullptr);
+        setBackgroundHandling(newSocketNum, handler.conditionSet, handler.handlerProc, handler.clientData);
+    }
+
+    void EpollTaskScheduler::doEventLoop(char volatile *watchVariable) {
+
+        while (!watchVariable || *watchVariable == 0) {
+            singleStep();
+        }
+    }
+
+    EventTriggerId EpollTaskScheduler::createEventTrigger(TaskFunc *eventHandlerProc) {
+
+        for (unsigned idx = 0; idx < MAX_NUM_EVENT_TRIGGERS; idx++) {
+
+            EventTriggerId mask = 1u << idx;
+
+            if (usedTriggersMask & mask) continue;
+
+            usedTriggersMask |= mask;
+            triggerHandlers[idx] = eventHandlerProc;
+            triggerClientData[idx] = nullptr;
+
+            return mask;
+        }
+
+        LOG(ERROR) << "No event triggers are left (use EventNotifier)";
+
+        return 0;
+    }
+
+    void EpollTaskScheduler::deleteEventTrigger(EventTriggerId eventTriggerId) {
+
+        usedTriggersMask &= ~eventTriggerId;
+        triggeredMask.fetch_and(~eventTriggerId);
+
+        for (unsigned idx = 0; idx < MAX_NUM_EVENT_TRIGGERS; idx++) {
+            if (eventTriggerId & (1u << idx)) triggerHandlers[idx] = nullptr;
+        }
+    }
+
+    void EpollTaskScheduler::triggerEvent(EventTriggerId eventTriggerId, void *clientData) {
+
+        // called by the other threads (the client data isn't synchronized, as by the BasicTaskScheduler)
+        for (unsigned idx = 0; idx < MAX_NUM_EVENT_TRIGGERS; idx++) {
+            if (eventTriggerId & (1u << idx)) triggerClientData[idx] = clientData;
+        }
+
+        // the loop is woken up once until it takes the triggered mask
+        if (triggeredMask.fetch_or(eventTriggerId) == 0) {
+
+            uint64_t value = 1;
+
+            auto written = write(triggerFd, &value, sizeof(value));
+            static_cast<void>(written);
+        }
+    }
+
+    void EpollTaskScheduler::singleStep(unsigned maxDelayTime) {
+
+        epoll_event events[MAX_EPOLL_EVENTS];
+
+        auto numEvents = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, prepareTimeout(maxDelayTime));
+
+        if (numEvents < 0 && errno != EINTR) {
+            LOG(ERROR) << "epoll_wait has failed: " << strerror(errno);
+            internalError();
+        }
+
+        for (int idx = 0; idx < numEvents; idx++) {
+
+            auto socketNum = static_cast<int>(events[idx].data.u64 & 0xFFFFFFFFu);
+            auto generation = static_cast<uint32_t>(events[idx].data.u64 >> 32);
+            auto revents = events[idx].events;
+
+            if (socketNum == timerFd) {
+
+                uint64_t expirations;
+
+                auto numRead = read(timerFd, &expirations, sizeof(expirations));
+                static_cast<void>(numRead);
+
+                armedTimeUs = 0;
+                continue;
+            }
+
+            if (socketNum == triggerFd) {
+                handleTriggeredEvents();
+                continue;
+            }
+
+            // the socket may be closed or changed by the previous handlers
+            auto it = socketHandlers.find(socketNum);
+
+            if (it == socketHandlers.end() || it->second.generation != generation) continue;
+
+            auto handler = it->second;
+
+            // errors and hang-ups are reported as select() does: the socket is readable/writable
+            int resultConditionSet = 0;
+
+            if ((handler.conditionSet & SOCKET_READABLE) && (revents & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                resultConditionSet |= SOCKET_READABLE;
+            }
+
+            if ((handler.conditionSet & SOCKET_WRITABLE) && (revents & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+                resultConditionSet |= SOCKET_WRITABLE;
+            }
+
+            if ((handler.conditionSet & SOCKET_EXCEPTION) && (revents & EPOLLPRI)) {
+                resultConditionSet |= SOCKET_EXCEPTION;
+            }
+
+            if (resultConditionSet != 0) {
+                handler.handlerProc(handler.clientData, resultConditionSet);
+            }
+        }
+
+        handleDueTasks();
+    }
+
+    size_t EpollTaskScheduler::numSockets() const {
+        return socketHandlers.size();
+    }
+
+    size_t EpollTaskScheduler::numDelayedTasks() const {
+        return delayedTasks.size();
+    }
+
+    int64_t EpollTaskScheduler::nowMicros() {
+
+        struct timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+    }
+
+    int64_t EpollTaskScheduler::earliestDueTime() const {
+
+        // the wheel's tasks are due before the overflow queue's ones
+        if (delayedTasks.size() == overflowTasks.size()) {
+            return overflowTasks.empty() ? -1 : overflowTasks.begin()->first;
+        }
+
+        // the first non-empty slot from the current tick
+        for (size_t offset = 0; offset < WHEEL_SIZE; offset++) {
+
+            auto &slot = wheel[static_cast<size_t>(currentTick + static_cast<int64_t>(offset)) % WHEEL_SIZE];
+
+            if (slot.empty()) continue;
+
+            int64_t earliest = slot.front().dueTimeUs;
+
+            for (auto &task : slot) {
+                earliest = std::min(earliest, task.dueTimeUs);
+            }
+
+            return earliest;
+        }
+
+        return -1;
+    }
+
+    int EpollTaskScheduler::prepareTimeout(unsigned maxDelayTime) {
+
+        auto now = nowMicros();
+        auto wakeupTimeUs = earliestDueTime();
+
+        if (wakeupTimeUs >= 0 && wakeupTimeUs <= now) return 0;
+
+        if (maxDelayTime > 0 && (wakeupTimeUs < 0 || now + maxDelayTime < wakeupTimeUs)) {
+            wakeupTimeUs = now + maxDelayTime;
+        }
+
+        if (wakeupTimeUs < 0) return -1; // only the sockets and the triggers wake up the loop
+
+        // epoll_wait's timeout is in milliseconds, the timerfd wakes up the loop at the exact time
+        if (wakeupTimeUs != armedTimeUs) {
+
+            struct itimerspec timerValue = {};
+            timerValue.it_value.tv_sec = wakeupTimeUs / 1000000;
+            timerValue.it_value.tv_nsec = (wakeupTimeUs % 1000000) * 1000;
+
+            timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timerValue, nullptr);
+
+            armedTimeUs = wakeupTimeUs;
+        }
+
+        return -1;
+    }
+
+    void EpollTaskScheduler::handleDueTasks() {
+
+        if (delayedTasks.empty()) {
+            currentTick = nowMicros() / WHEEL_TICK_US;
+            return;
+        }
+
+        auto now = nowMicros();
+        auto nowTick = now / WHEEL_TICK_US;
+
+        // each slot is visited once even if the loop has been blocked for more than a revolution
+        auto firstTick = std::max(currentTick, nowTick - static_cast<int64_t>(WHEEL_SIZE) + 1);
+
+        std::vector<std::pair<int64_t, intptr_t>> dueTasks;
+
+        for (auto tick = firstTick; tick <= nowTick; tick++) {
+            for (auto &task : wheel[static_cast<size_t>(tick) % WHEEL_SIZE]) {
+                if (task.dueTimeUs <= now) dueTasks.emplace_back(task.dueTimeUs, task.id);
+            }
+        }
+
+        currentTick = nowTick;
+
+        // the wheel covers the next span now
+        auto wheelEndUs = (currentTick + static_cast<int64_t>(WHEEL_SIZE)) * WHEEL_TICK_US;
+
+        while (!overflowTasks.empty() && overflowTasks.begin()->first < wheelEndUs) {
+
+            auto task = overflowTasks.begin()->second;
+
+            overflowTasks.erase(overflowTasks.begin());
+
+            if (task.dueTimeUs <= now) dueTasks.emplace_back(task.dueTimeUs, task.id);
+
+            insertTask(task);
+        }
+
+        std::sort(dueTasks.begin(), dueTasks.end());
+
+        for (auto &dueTask : dueTasks) {
+
+            // may be unscheduled by the previous task
+            auto it = delayedTasks.find(dueTask.second);
+
+            if (it == delayedTasks.end()) continue;
+
+            auto task = *it->second.position; // due tasks are in the wheel
+
+            wheel[it->second.slot].erase(it->second.position);
+            delayedTasks.erase(it);
+
+            task.proc(task.clientData);
+        }
+    }
+
+    void EpollTaskScheduler::insertTask(const DelayedTask &task) {
+
+        auto &location = delayedTasks[task.id];
+
+        // the wheel holds a single revolution from the current tick
+        if (task.dueTimeUs < (currentTick + static_cast<int64_t>(WHEEL_SIZE)) * WHEEL_TICK_US) {
+
+            location.isInWheel = true;
+            location.slot = static_cast<size_t>(std::max(task.dueTimeUs / WHEEL_TICK_US, currentTick)) % WHEEL_SIZE;
+
+            wheel[location.slot].push_front(task);
+            location.position = wheel[location.slot].begin();
+
+        } else {
+
+            location.isInWheel = false;
+            location.overflowPosition = overflowTasks.insert(std::make_pair(task.dueTimeUs, task));
+        }
+    }
+
+    void EpollTaskScheduler::handleTriggeredEvents() {
+
+        uint64_t value;
+
+        // reset before taking the mask, so the events triggered after that wake up the loop again
+        auto numRead = read(triggerFd, &value, sizeof(value));
+        static_cast<void>(numRead);
+
+        auto mask = triggeredMask.exchange(0);
+
+        for (unsigned idx = 0; idx < MAX_NUM_EVENT_TRIGGERS; idx++) {
+
+            // the handler may delete the other triggers
+            if ((mask & (1u << idx)) && triggerHandlers[idx]) {
+                triggerHandlers[idx](triggerClientData[idx]);
+            }
+        }
+    }
+
+    uint64_t EpollTaskScheduler::packEventData(int socketNum, uint32_t generation) {
+        return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(socketNum);
+    }
+}
@@ -0,0 +1,134 @@
+#include "EventNotifier.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include "Logger.hpp"
+
+namespace LIRS {
+
+    EventNotifier::EventNotifier(TaskScheduler &scheduler)
+            : scheduler(scheduler), eventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), nextEventId(1) {
+
+        if (eventFd < 0) {
+            LOG(ERROR) << "Can't create eventfd: " << strerror(errno);
+        }
+
+        assert(eventFd >= 0);
+
+        scheduler.turnOnBackgroundReadHandling(eventFd, onReadable, this);
+    }
+
+    EventNotifier::~EventNotifier() {
+
+        scheduler.turnOffBackgroundReadHandling(eventFd);
+
+        close(eventFd);
+
+        if (!registrations.empty()) {
+            LOG(WARN) << "Event notifier has been destructed with " << registrations.size() << " events";
+        }
+    }
+
+    EventNotifier::EventId EventNotifier::createEvent(TaskFunc *handler, void *clientData) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto eventId = nextEventId++;
+
+        registrations[eventId] = Registration{handler, clientData, false};
+
+        return eventId;
+    }
+
+    void EventNotifier::deleteEvent(EventId eventId) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // the queued id is skipped by the loop
+        registrations.erase(eventId);
+    }
+
+    void EventNotifier::signal(EventId eventId) {
+
+        bool isWakeupRequired;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = registrations.find(eventId);
+
+            if (it == registrations.end() || it->second.isPending) return; // deleted or already queued
+
+            it->second.isPending = true;
+
+            // the loop is woken up once per batch of the events
+            isWakeupRequired = readyEvents.empty();
+
+            readyEvents.push_back(eventId);
+        }
+
+        if (isWakeupRequired) {
+
+            uint64_t value = 1;
+
+            // fails only on the counter's overflow (the loop is woken up anyway)
+            auto written = write(eventFd, &value, sizeof(value));
+            static_cast<void>(written);
+        }
+    }
+
+    size_t EventNotifier::numEvents() {
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return registrations.size();
+    }
+
+    void EventNotifier::onReadable(void *clientData, int) {
+        static_cast<EventNotifier *>(clientData)->handleReadyEvents();
+    }
+
+    void EventNotifier::handleReadyEvents() {
+
+        uint64_t value;
+
+        // reset the counter before taking the queue, so the events queued after that wake up the loop again
+        auto numRead = read(eventFd, &value, sizeof(value));
+        static_cast<void>(numRead);
+
+        std::vector<EventId> events;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.swap(readyEvents);
+        }
+
+        for (auto eventId : events) {
+
+            TaskFunc *handler;
+            void *clientData;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                // may be deleted by the handler of the previous event
+                auto it = registrations.find(eventId);
+
+                if (it == registrations.end()) continue;
+
+                // signals from now on are queued again
+                it->second.isPending = false;
+
+                handler = it->second.handler;
+                clientData = it->second.clientData;
+            }
+
+            handler(clientData);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#include "FrameBus.hpp"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <climits>
+
+namespace LIRS {
+
+    std::string FrameBus::ringName(const std::string &stream, FrameBusKind kind) {
+
+        std::string name = "/lirs." + stream;
+
+        for (size_t idx = 1; idx < name.size(); idx++) {
+            if (name[idx] == '/') name[idx] = '_';
+        }
+
+        return name + (kind == FRAME_BUS_FRAMES ? ".frames" : ".packets");
+    }
+
+    uint64_t FrameBus::slotStride(uint64_t slotSize) {
+        auto size = sizeof(FrameBusSlot) + slotSize;
+        return (size + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+    }
+
+    size_t FrameBus::mappingSize(uint32_t slotCount, uint64_t slotSize) {
+        auto headerSize = (sizeof(FrameBusHeader) + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+        return static_cast<size_t>(headerSize + slotCount * slotStride(slotSize));
+    }
+
+    FrameBusSlot *FrameBus::slotOf(FrameBusHeader *header, uint64_t entryNumber) {
+
+        auto headerSize = (sizeof(FrameBusHeader) + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+        auto base = reinterpret_cast<uint8_t *>(header) + headerSize;
+
+        return reinterpret_cast<FrameBusSlot *>(base + (entryNumber % header->slotCount) * header->slotStride);
+    }
+
+    uint8_t *FrameBus::dataOf(FrameBusSlot *slot) {
+        return reinterpret_cast<uint8_t *>(slot) + sizeof(FrameBusSlot);
+    }
+
+    int64_t FrameBus::nowNanos() {
+
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+
+        return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+    }
+
+    void FrameBus::waitSignal(std::atomic<uint32_t> &signal, uint32_t expected, int timeoutMs) {
+
+        struct timespec timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+        // returns right away if the value has already changed
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&signal), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    }
+
+    void FrameBus::wakeSignal(std::atomic<uint32_t> &signal) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&signal), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
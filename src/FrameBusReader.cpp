@@ -0,0 +1,186 @@
+#include "FrameBusReader.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace LIRS {
+
+    FrameBusReader::FrameBusReader(const std::string &stream, FrameBusKind kind)
+            : name(FrameBus::ringName(stream, kind)), kind(kind), fd(-1), header(nullptr), mappingSize(0),
+              cursor(0), missedCount(0) {}
+
+    FrameBusReader::~FrameBusReader() {
+        detach();
+    }
+
+    bool FrameBusReader::attach() {
+
+        if (header) return true;
+
+        // read-write: the readers register themselves as the futex waiters
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+
+        if (fd < 0) return false;
+
+        struct stat status;
+
+        if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(FrameBusHeader)) {
+            detach();
+            return false;
+        }
+
+        mappingSize = static_cast<size_t>(status.st_size);
+
+        auto mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (mapping == MAP_FAILED) {
+            mappingSize = 0;
+            detach();
+            return false;
+        }
+
+        header = static_cast<FrameBusHeader *>(mapping);
+
+        // the magic is written last by the writer
+        auto magic = header->magic;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (magic != FrameBus::MAGIC || header->version != FrameBus::VERSION || header->kind != kind ||
+            header->slotCount == 0 || FrameBus::mappingSize(header->slotCount, header->slotSize) > mappingSize ||
+            header->isClosed.load(std::memory_order_acquire)) {
+            detach();
+            return false;
+        }
+
+        cursor = header->publishedCount.load(std::memory_order_acquire);
+
+        return true;
+    }
+
+    bool FrameBusReader::isAttached() const {
+        return header != nullptr;
+    }
+
+    void FrameBusReader::detach() {
+
+        if (header) munmap(header, mappingSize);
+        if (fd >= 0) close(fd);
+
+        header = nullptr;
+        mappingSize = 0;
+        fd = -1;
+    }
+
+    bool FrameBusReader::next(FrameBusEntry &entry, int timeoutMs) {
+
+        auto deadline = FrameBus::nowNanos() + static_cast<int64_t>(timeoutMs) * 1000000;
+
+        while (true) {
+
+            if (header && header->isClosed.load(std::memory_order_acquire)) {
+                detach(); // replaced by the ring of the larger entries or the writer has gone
+            }
+
+            auto remainingNs = deadline - FrameBus::nowNanos();
+
+            if (!header && !attach()) {
+
+                if (remainingNs <= 0) return false;
+
+                auto sleepMs = std::min<int64_t>(ATTACH_INTERVAL_MS, (remainingNs + 999999) / 1000000);
+                std::this_thread::sleep_for(std::chrono::milliseconds(sleepMs));
+                continue;
+            }
+
+            auto signal = header->publishedSignal.load(std::memory_order_acquire);
+            auto count = header->publishedCount.load(std::memory_order_acquire);
+
+            if (cursor < count) {
+
+                // the oldest slot may be being overwritten by the next entry, skip to the latest one
+                if (count - cursor >= header->slotCount) {
+                    missedCount += count - 1 - cursor;
+                    cursor = count - 1;
+                }
+
+                if (readEntry(entry)) return true;
+
+                continue;
+            }
+
+            if (remainingNs <= 0) return false;
+
+            // the writer wakes up the waiters after each entry
+            header->numWaiters.fetch_add(1);
+
+            if (header->publishedCount.load(std::memory_order_acquire) == count) {
+                FrameBus::waitSignal(header->publishedSignal, signal,
+                                     static_cast<int>((remainingNs + 999999) / 1000000));
+            }
+
+            header->numWaiters.fetch_sub(1);
+        }
+    }
+
+    bool FrameBusReader::readEntry(FrameBusEntry &entry) {
+
+        auto slot = FrameBus::slotOf(header, cursor);
+        auto expectedSequence = 2 * cursor + 2;
+
+        if (slot->sequence.load(std::memory_order_acquire) != expectedSequence) { // overwritten
+            missedCount++;
+            cursor++;
+            return false;
+        }
+
+        entry.number = cursor;
+        entry.size = std::min<uint32_t>(slot->size, static_cast<uint32_t>(header->slotSize));
+        entry.pts = slot->pts;
+        entry.timeBaseNum = slot->timeBaseNum;
+        entry.timeBaseDen = slot->timeBaseDen;
+        entry.publishTimeNs = slot->publishTimeNs;
+        entry.flags = slot->flags;
+        entry.width = slot->width;
+        entry.height = slot->height;
+        entry.format = slot->format;
+        entry.data = FrameBus::dataOf(slot);
+
+        for (int plane = 0; plane < 4; plane++) {
+            entry.linesize[plane] = slot->linesize[plane];
+            entry.planes[plane] = slot->linesize[plane] > 0 ? entry.data + slot->planeOffset[plane] : nullptr;
+        }
+
+        // the metadata is consistent if the sequence hasn't changed while it was read
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        cursor++;
+
+        if (slot->sequence.load(std::memory_order_relaxed) != expectedSequence) {
+            missedCount++;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool FrameBusReader::isValid(const FrameBusEntry &entry) const {
+
+        if (!header) return false;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        auto slot = FrameBus::slotOf(header, entry.number);
+
+        return slot->sequence.load(std::memory_order_relaxed) == 2 * entry.number + 2;
+    }
+
+    uint64_t FrameBusReader::getMissedCount() const {
+        return missedCount;
+    }
+}
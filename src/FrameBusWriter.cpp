@@ -0,0 +1,206 @@
+#include "FrameBusWriter.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+namespace LIRS {
+
+    FrameBusWriter::FrameBusWriter(const std::string &stream, FrameBusKind kind, uint32_t slotCount)
+            : name(FrameBus::ringName(stream, kind)), kind(kind), slotCount(std::max<uint32_t>(2, slotCount)),
+              fd(-1), header(nullptr), mappingSize(0), isFailed(false) {}
+
+    FrameBusWriter::~FrameBusWriter() {
+        removeRing();
+    }
+
+    const std::string &FrameBusWriter::getName() const {
+        return name;
+    }
+
+    void FrameBusWriter::publishFrame(const AVFrame *frame, AVRational timeBase) {
+
+        auto format = static_cast<AVPixelFormat>(frame->format);
+
+        auto size = av_image_get_buffer_size(format, frame->width, frame->height, 1);
+
+        if (size <= 0 || !reserve(static_cast<uint64_t>(size))) return;
+
+        auto slot = beginEntry();
+        auto data = FrameBus::dataOf(slot);
+
+        av_image_copy_to_buffer(data, size, frame->data, frame->linesize, format, frame->width, frame->height, 1);
+
+        // planes of the packed buffer
+        int linesizes[4] = {};
+        uint8_t *planes[4] = {};
+
+        av_image_fill_linesizes(linesizes, format, frame->width);
+        av_image_fill_pointers(planes, format, frame->height, data, linesizes);
+
+        for (int plane = 0; plane < 4; plane++) {
+            slot->linesize[plane] = planes[plane] ? linesizes[plane] : 0;
+            slot->planeOffset[plane] = planes[plane] ? static_cast<uint32_t>(planes[plane] - data) : 0;
+        }
+
+        slot->pts = frame->pts;
+        slot->timeBaseNum = timeBase.num;
+        slot->timeBaseDen = timeBase.den;
+        slot->size = static_cast<uint32_t>(size);
+        slot->flags = frame->key_frame ? FrameBus::FRAME_BUS_KEYFRAME : 0;
+        slot->width = frame->width;
+        slot->height = frame->height;
+        slot->format = frame->format;
+
+        endEntry(slot);
+    }
+
+    void FrameBusWriter::publishPacket(const AVPacket *packet, AVRational timeBase) {
+
+        if (packet->size <= 0 || !reserve(static_cast<uint64_t>(packet->size))) return;
+
+        auto slot = beginEntry();
+
+        memcpy(FrameBus::dataOf(slot), packet->data, static_cast<size_t>(packet->size));
+
+        slot->pts = packet->pts;
+        slot->timeBaseNum = timeBase.num;
+        slot->timeBaseDen = timeBase.den;
+        slot->size = static_cast<uint32_t>(packet->size);
+        slot->flags = (packet->flags & AV_PKT_FLAG_KEY) ? FrameBus::FRAME_BUS_KEYFRAME : 0;
+        slot->width = slot->height = 0;
+        slot->format = -1;
+
+        memset(slot->linesize, 0, sizeof(slot->linesize));
+        memset(slot->planeOffset, 0, sizeof(slot->planeOffset));
+
+        endEntry(slot);
+    }
+
+    bool FrameBusWriter::reserve(uint64_t size) {
+
+        if (header && size <= header->slotSize) return true;
+
+        if (isFailed) return false;
+
+        // frames keep their size (the governor only reduces it), packets vary
+        auto slotSize = kind == FRAME_BUS_FRAMES ? size : std::max(MIN_PACKET_SLOT_SIZE, 2 * size);
+
+        removeRing(); // the readers attach to the new one
+
+        if (!createRing(slotSize)) {
+            isFailed = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool FrameBusWriter::createRing(uint64_t slotSize) {
+
+        shm_unlink(name.c_str()); // left by the crashed process
+
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+
+        if (fd < 0) {
+            LOG(ERROR) << "Can't create frame bus \"" << name << "\": " << strerror(errno);
+            return false;
+        }
+
+        mappingSize = FrameBus::mappingSize(slotCount, slotSize);
+
+        void *mapping = MAP_FAILED;
+
+        if (ftruncate(fd, static_cast<off_t>(mappingSize)) == 0) {
+            mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+
+        if (mapping == MAP_FAILED) {
+
+            LOG(ERROR) << "Can't map frame bus \"" << name << "\" of " << mappingSize << " bytes: " << strerror(errno);
+
+            close(fd);
+            shm_unlink(name.c_str());
+
+            fd = -1;
+            mappingSize = 0;
+            return false;
+        }
+
+        header = static_cast<FrameBusHeader *>(mapping); // zeroed by ftruncate
+
+        header->version = FrameBus::VERSION;
+        header->kind = kind;
+        header->slotCount = slotCount;
+        header->slotSize = slotSize;
+        header->slotStride = FrameBus::slotStride(slotSize);
+        header->writerPid = getpid();
+
+        // readers check the magic first
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = FrameBus::MAGIC;
+
+        LOG(INFO) << "Frame bus \"" << name << "\" has been created: " << slotCount << " slots of " << slotSize
+                  << " bytes";
+
+        return true;
+    }
+
+    void FrameBusWriter::removeRing() {
+
+        if (header) {
+
+            header->isClosed.store(1, std::memory_order_release);
+            header->publishedSignal.fetch_add(1, std::memory_order_release);
+
+            FrameBus::wakeSignal(header->publishedSignal);
+
+            munmap(header, mappingSize);
+            shm_unlink(name.c_str());
+        }
+
+        if (fd >= 0) close(fd);
+
+        header = nullptr;
+        mappingSize = 0;
+        fd = -1;
+    }
+
+    FrameBusSlot *FrameBusWriter::beginEntry() {
+
+        auto number = header->publishedCount.load(std::memory_order_relaxed);
+        auto slot = FrameBus::slotOf(header, number);
+
+        slot->sequence.store(2 * number + 1, std::memory_order_relaxed);
+
+        // the odd sequence is visible before any byte of the entry
+        std::atomic_thread_fence(std::memory_order_release);
+
+        return slot;
+    }
+
+    void FrameBusWriter::endEntry(FrameBusSlot *slot) {
+
+        auto number = header->publishedCount.load(std::memory_order_relaxed);
+
+        slot->publishTimeNs = FrameBus::nowNanos();
+
+        slot->sequence.store(2 * number + 2, std::memory_order_release);
+
+        header->publishedCount.store(number + 1, std::memory_order_release);
+        header->publishedSignal.fetch_add(1, std::memory_order_release);
+
+        if (header->numWaiters.load() > 0) {
+            FrameBus::wakeSignal(header->publishedSignal);
+        }
+    }
+}
@@ -0,0 +1,530 @@
+#include "FrameFanout.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "DebugAllocator.hpp"
+#include "Metrics.hpp"
+
+namespace LIRS {
+
+    constexpr double FrameFanout::INPUT_BUFFER_GROWTH_MARGIN;
+    constexpr double FanoutFramedSource::LOSS_DROP_THRESHOLD;
+    constexpr double FanoutFramedSource::LOSS_RESTORE_THRESHOLD;
+    constexpr double FanoutFramedSource::BACKLOG_DROP_THRESHOLD;
+    constexpr double FanoutFramedSource::BACKLOG_RESTORE_THRESHOLD;
+
+    FrameFanout *FrameFanout::createNew(UsageEnvironment &env, FramedSource *inputSource, AVCodecID codecId,
+                                        const std::string &name, size_t capacity) {
+
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_FANOUT); // input buffer
+
+        return new FrameFanout(env, inputSource, codecId, name, capacity);
+    }
+
+    FrameFanout::FrameFanout(UsageEnvironment &env, FramedSource *inputSource, AVCodecID codecId,
+                             const std::string &name, size_t capacity)
+            : Medium(env), inputSource(inputSource), codecId(codecId), name(name),
+              memoryMetricName("memory." + name + ".fanout_bytes"),
+              maxFrameMetricName("fanout." + name + ".max_frame_bytes"),
+              bitrateMetricName("fanout." + name + ".bitrate_kbps"),
+              capacity(std::max<size_t>(capacity, 1)), inputBuffer(INPUT_BUFFER_SIZE),
+              isWaitingForSyncPoint(false), retainedBytes(0),
+              nextSequenceNumber(0), hasSyncPoint(false), latestSyncSequenceNumber(0),
+              maxFrameSize(0), averageBitrate(0.0), bitrateWindowStart({0, 0}), bitrateWindowBytes(0),
+              previousNalUnitType(-1), maxTemporalId(0), numThinnedReplicas(0) {
+
+        // read continuously, so new replicas could start from the recent sync point
+        readInputFrame();
+    }
+
+    FrameFanout::~FrameFanout() {
+
+        inputSource->stopGettingFrames();
+
+        // detach remaining replicas (they are closed by their consumers)
+        for (auto replica : replicas) {
+            replica->fanout = nullptr;
+        }
+
+        replicas.clear();
+        frames.clear();
+
+        Metrics::getInstance().removeByPrefix("fanout." + name + ".");
+
+        LOG(DEBUG) << "Frame fan-out has been destructed";
+    }
+
+    FanoutFramedSource *FrameFanout::createReplica() {
+
+        auto replica = new FanoutFramedSource(envir(), this);
+
+        replica->cursor = latestSyncPosition();
+        replicas.push_back(replica);
+
+        LOG(DEBUG) << "New replica, total: " << replicas.size() << ", starting "
+                   << (nextSequenceNumber - replica->cursor) << " frames behind";
+
+        return replica;
+    }
+
+    size_t FrameFanout::numReplicas() const {
+        return replicas.size();
+    }
+
+    const std::string &FrameFanout::getName() const {
+        return name;
+    }
+
+    unsigned FrameFanout::getMaxFrameSize() const {
+        return maxFrameSize;
+    }
+
+    unsigned FrameFanout::getAverageBitrateKbps() const {
+        return static_cast<unsigned>(averageBitrate / 1000);
+    }
+
+    int FrameFanout::getMaxTemporalId() const {
+        return maxTemporalId;
+    }
+
+    void FrameFanout::readInputFrame() {
+
+        if (inputSource->isCurrentlyAwaitingData()) return; // already requested
+
+        inputSource->getNextFrame(inputBuffer.data(), static_cast<unsigned>(inputBuffer.size()),
+                                  afterGettingInputFrame, this, onInputClosure, this);
+    }
+
+    void FrameFanout::afterGettingInputFrame(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                             struct timeval presentationTime, unsigned durationInMicroseconds) {
+        static_cast<FrameFanout *>(clientData)->afterGettingInputFrame(frameSize, numTruncatedBytes,
+                                                                      presentationTime, durationInMicroseconds);
+    }
+
+    void FrameFanout::afterGettingInputFrame(unsigned frameSize, unsigned numTruncatedBytes,
+                                             struct timeval presentationTime, unsigned durationInMicroseconds) {
+
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_FANOUT);
+
+        if (frameSize == 0 && numTruncatedBytes > 0) { // the frame is delivered again into the grown buffer
+            growInputBuffer(numTruncatedBytes);
+            readInputFrame();
+            return;
+        }
+
+        if (numTruncatedBytes > 0) { // truncated frame can't be decoded, skip it along with the dependent ones
+
+            LOG(WARN) << "Input frame of \"" << name << "\" has been truncated by " << numTruncatedBytes
+                      << " bytes, skipping to the next sync point";
+
+            detectSyncPoint(inputBuffer.data(), frameSize); // keeps the type of the previous NAL unit
+            growInputBuffer(frameSize + numTruncatedBytes);
+
+            isWaitingForSyncPoint = true;
+            readInputFrame();
+            return;
+        }
+
+        auto isSyncPoint = detectSyncPoint(inputBuffer.data(), frameSize);
+
+        if (isWaitingForSyncPoint && !isSyncPoint) { // depends on the skipped frame
+            readInputFrame();
+            return;
+        }
+
+        isWaitingForSyncPoint = false;
+
+        // publish the frame once, replicas share the same buffer
+        SharedFrame frame;
+        frame.data = std::make_shared<const std::vector<uint8_t>>(inputBuffer.begin(), inputBuffer.begin() + frameSize);
+        frame.presentationTime = presentationTime;
+        frame.durationInMicroseconds = durationInMicroseconds;
+        frame.isSyncPoint = isSyncPoint;
+        detectTemporalLayer(inputBuffer.data(), frameSize, frame);
+        frame.sequenceNumber = nextSequenceNumber++;
+
+        if (frame.isSyncPoint) {
+            hasSyncPoint = true;
+            latestSyncSequenceNumber = frame.sequenceNumber;
+        }
+
+        frames.push_back(std::move(frame));
+        retainedBytes += frameSize;
+
+        if (frameSize > maxFrameSize) {
+            maxFrameSize = frameSize;
+            Metrics::getInstance().set(maxFrameMetricName, maxFrameSize);
+        }
+
+        updateBitrate(frameSize, presentationTime);
+
+        // the most recent sync point is never dropped, so replicas always have a point to start decoding from
+        while (frames.size() > capacity &&
+               (!hasSyncPoint || frames.front().sequenceNumber < latestSyncSequenceNumber)) {
+            retainedBytes -= frames.front().data->size();
+            frames.pop_front();
+        }
+
+        Metrics::getInstance().set(memoryMetricName, static_cast<int64_t>(inputBuffer.size() + retainedBytes));
+
+        // deliver to the replicas waiting for the data (delivery may close replicas, so iterate over a copy)
+        auto waitingReplicas = replicas;
+
+        for (auto replica : waitingReplicas) {
+
+            if (std::find(replicas.begin(), replicas.end(), replica) == replicas.end()) continue; // closed
+
+            if (replica->isCurrentlyAwaitingData()) {
+                replica->resume();
+            }
+        }
+
+        readInputFrame();
+    }
+
+    void FrameFanout::growInputBuffer(unsigned frameSize) {
+
+        auto size = static_cast<size_t>(frameSize * INPUT_BUFFER_GROWTH_MARGIN);
+
+        if (size <= inputBuffer.size()) return;
+
+        inputBuffer.resize(size);
+
+        Metrics::getInstance().set(memoryMetricName, static_cast<int64_t>(inputBuffer.size() + retainedBytes));
+
+        LOG(INFO) << "Input buffer of the fan-out \"" << name << "\" has been grown to " << inputBuffer.size()
+                  << " bytes for the frame of " << frameSize << " bytes";
+    }
+
+    void FrameFanout::onInputClosure(void *clientData) {
+
+        auto fanout = static_cast<FrameFanout *>(clientData);
+
+        LOG(WARN) << "Input source of the frame fan-out has been closed";
+
+        auto activeReplicas = fanout->replicas;
+
+        for (auto replica : activeReplicas) {
+            FramedSource::handleClosure(replica);
+        }
+    }
+
+    void FrameFanout::updateBitrate(unsigned frameSize, const struct timeval &presentationTime) {
+
+        if (bitrateWindowStart.tv_sec == 0 && bitrateWindowStart.tv_usec == 0) {
+            bitrateWindowStart = presentationTime;
+        }
+
+        bitrateWindowBytes += frameSize;
+
+        auto elapsed = (presentationTime.tv_sec - bitrateWindowStart.tv_sec) * 1000000LL +
+                       (presentationTime.tv_usec - bitrateWindowStart.tv_usec);
+
+        if (elapsed < BITRATE_WINDOW_US) return;
+
+        auto bitrate = bitrateWindowBytes * 8.0 * 1000000 / elapsed;
+
+        // smooth out the keyframes
+        averageBitrate = averageBitrate > 0.0 ? 0.7 * averageBitrate + 0.3 * bitrate : bitrate;
+
+        bitrateWindowStart = presentationTime;
+        bitrateWindowBytes = 0;
+
+        Metrics::getInstance().set(bitrateMetricName, getAverageBitrateKbps());
+    }
+
+    void FrameFanout::onOversizeFrame(unsigned frameSize, unsigned maxSize, bool isBufferGrowable) {
+
+        if (isBufferGrowable) {
+
+            LOG(INFO) << "Frame of " << frameSize << " bytes exceeds the consumer's buffer of " << maxSize
+                      << " bytes (\"" << name << "\"), the buffer is grown";
+
+            Metrics::getInstance().add("fanout." + name + ".grown_buffers", 1);
+            return;
+        }
+
+        LOG(WARN) << "Frame of " << frameSize << " bytes exceeds the consumer's buffer of " << maxSize
+                  << " bytes (\"" << name << "\"), skipping to the next sync point";
+
+        Metrics::getInstance().add("fanout." + name + ".oversize_frames", 1);
+    }
+
+    bool FrameFanout::detectSyncPoint(const unsigned char *nalUnit, unsigned size) {
+
+        if (size == 0) return false;
+
+        bool isSync;
+        int type;
+
+        if (codecId == AV_CODEC_ID_H264) {
+
+            type = nalUnit[0] & 0x1F;
+
+            // SPS, or IDR w/o preceding parameter sets (SEI, AUD, SPS, PPS)
+            isSync = type == 7 || (type == 5 && (previousNalUnitType < 6 || previousNalUnitType > 9));
+
+        } else {
+
+            type = (nalUnit[0] & 0x7E) >> 1;
+
+            // VPS, or IRAP w/o preceding parameter sets (VPS, SPS, PPS, AUD, prefix SEI)
+            isSync = type == 32 || (type >= 16 && type <= 21 && (previousNalUnitType < 32 || previousNalUnitType > 39));
+        }
+
+        previousNalUnitType = type;
+
+        return isSync;
+    }
+
+    void FrameFanout::detectTemporalLayer(const unsigned char *nalUnit, unsigned size, SharedFrame &frame) {
+
+        frame.temporalId = 0;
+        frame.isBaseLayerSlice = false;
+
+        if (size < 2) return;
+
+        if (codecId == AV_CODEC_ID_H264) { // single layer
+            auto type = nalUnit[0] & 0x1F;
+            frame.isBaseLayerSlice = type >= 1 && type <= 5;
+            return;
+        }
+
+        auto type = (nalUnit[0] & 0x7E) >> 1;
+
+        // nuh_temporal_id_plus1 of the NAL unit header
+        frame.temporalId = std::max((nalUnit[1] & 0x07) - 1, 0);
+        frame.isBaseLayerSlice = type < 32 && frame.temporalId == 0;
+
+        if (frame.temporalId > maxTemporalId) {
+
+            maxTemporalId = frame.temporalId;
+
+            LOG(INFO) << "Stream \"" << name << "\" has " << (maxTemporalId + 1) << " temporal layers";
+        }
+    }
+
+    const SharedFrame *FrameFanout::frameAt(uint64_t sequenceNumber) const {
+
+        if (frames.empty() || sequenceNumber < frames.front().sequenceNumber ||
+            sequenceNumber > frames.back().sequenceNumber) {
+            return nullptr;
+        }
+
+        return &frames[static_cast<size_t>(sequenceNumber - frames.front().sequenceNumber)];
+    }
+
+    uint64_t FrameFanout::latestSyncPosition() const {
+        return hasSyncPoint ? latestSyncSequenceNumber : nextSequenceNumber; // no sync points, wait for the next frame
+    }
+
+    uint64_t FrameFanout::oldestPosition() const {
+        return frames.empty() ? nextSequenceNumber : frames.front().sequenceNumber;
+    }
+
+    void FrameFanout::removeReplica(FanoutFramedSource *replica) {
+
+        replicas.erase(std::remove(replicas.begin(), replicas.end(), replica), replicas.end());
+
+        LOG(DEBUG) << "Replica has been removed, total: " << replicas.size();
+    }
+
+    /* FanoutFramedSource */
+
+    FanoutFramedSource::FanoutFramedSource(UsageEnvironment &env, FrameFanout *fanout)
+            : FramedSource(env), fanout(fanout), cursor(0), isWaitingForSyncPoint(false), isBufferGrowable(false),
+              droppedLayerCount(0),
+              lastReportedPacketNumber(0), lastCongestionTime({0, 0}), lastLayerDropTime({0, 0}) {}
+
+    FanoutFramedSource::~FanoutFramedSource() {
+
+        if (!fanout) return;
+
+        if (droppedLayerCount > 0) {
+            Metrics::getInstance().set("fanout." + fanout->name + ".thinned_replicas", --fanout->numThinnedReplicas);
+        }
+
+        fanout->removeReplica(this);
+    }
+
+    void FanoutFramedSource::setRtpSink(RTPSink *rtpSink) {
+        rtpSinkName = rtpSink ? rtpSink->name() : "";
+    }
+
+    int FanoutFramedSource::getDroppedLayerCount() const {
+        return droppedLayerCount;
+    }
+
+    void FanoutFramedSource::setBufferGrowable(bool isGrowable) {
+        isBufferGrowable = isGrowable;
+    }
+
+    void FanoutFramedSource::doGetNextFrame() {
+
+        if (!fanout) { // fan-out has been closed
+            handleClosure(this);
+            return;
+        }
+
+        if (!resume()) {
+            fanout->readInputFrame(); // wait for the next published frame
+        }
+    }
+
+    bool FanoutFramedSource::resume() {
+
+        // slow reader has fallen behind the retained frames, skip to the most recent sync point
+        if (cursor < fanout->oldestPosition()) {
+
+            auto position = fanout->latestSyncPosition();
+
+            LOG(DEBUG) << "Replica has fallen behind, skipping " << (position - cursor) << " frames";
+
+            cursor = position;
+        }
+
+        const SharedFrame *frame;
+
+        while ((frame = fanout->frameAt(cursor))) {
+
+            if (isWaitingForSyncPoint && !frame->isSyncPoint) { // depends on the skipped frame
+                cursor++;
+                continue;
+            }
+
+            isWaitingForSyncPoint = false;
+
+            // the upper layers are referenced only by the upper ones, so they are switched at the base pictures
+            if (frame->isBaseLayerSlice && fanout->maxTemporalId > 0) {
+                updateTemporalLayers(*frame);
+            }
+
+            if (frame->temporalId > fanout->maxTemporalId - droppedLayerCount) { // thinned out
+                cursor++;
+                continue;
+            }
+
+            auto size = static_cast<unsigned>(frame->data->size());
+
+            if (size > fMaxSize && isBufferGrowable) { // the frame is delivered again into the grown buffer
+
+                fanout->onOversizeFrame(size, fMaxSize, true);
+
+                fFrameSize = 0;
+                fNumTruncatedBytes = size;
+                fPresentationTime = frame->presentationTime;
+                fDurationInMicroseconds = 0;
+
+                FramedSource::afterGetting(this);
+
+                return true;
+            }
+
+            if (size > fMaxSize) { // truncated frame can't be decoded, skip it instead
+                fanout->onOversizeFrame(size, fMaxSize, false);
+                isWaitingForSyncPoint = true;
+                cursor++;
+                continue;
+            }
+
+            break;
+        }
+
+        if (!frame) return false;
+
+        cursor++;
+
+        fFrameSize = static_cast<unsigned>(frame->data->size());
+        fNumTruncatedBytes = 0;
+
+        fPresentationTime = frame->presentationTime;
+        fDurationInMicroseconds = frame->durationInMicroseconds;
+
+        memcpy(fTo, frame->data->data(), fFrameSize); // the only per-client copy: into the sink's buffer
+
+        FramedSource::afterGetting(this);
+
+        return true;
+    }
+
+    void FanoutFramedSource::updateTemporalLayers(const SharedFrame &frame) {
+
+        auto backlog = static_cast<double>(fanout->nextSequenceNumber - cursor) / fanout->capacity;
+        auto loss = takeReportedLoss();
+
+        auto elapsedUs = [&frame](const struct timeval &since) {
+            return (frame.presentationTime.tv_sec - since.tv_sec) * 1000000LL +
+                   (frame.presentationTime.tv_usec - since.tv_usec);
+        };
+
+        auto isCongested = backlog > BACKLOG_DROP_THRESHOLD || loss > LOSS_DROP_THRESHOLD;
+        auto isRecovering = backlog > BACKLOG_RESTORE_THRESHOLD || loss > LOSS_RESTORE_THRESHOLD;
+
+        auto previousCount = droppedLayerCount;
+
+        if (isCongested && droppedLayerCount < fanout->maxTemporalId &&
+            elapsedUs(lastLayerDropTime) >= LAYER_DROP_INTERVAL_US) { // the effect of the last drop is awaited
+
+            droppedLayerCount++;
+            lastLayerDropTime = frame.presentationTime;
+
+        } else if (!isCongested && !isRecovering && droppedLayerCount > 0 &&
+                   elapsedUs(lastCongestionTime) >= LAYER_RESTORE_INTERVAL_US) {
+
+            droppedLayerCount--;
+            lastCongestionTime = frame.presentationTime; // restored one by one
+        }
+
+        if (isCongested || isRecovering) {
+            lastCongestionTime = frame.presentationTime;
+        }
+
+        if (droppedLayerCount == previousCount) return;
+
+        auto prefix = "fanout." + fanout->name + ".";
+
+        if ((previousCount == 0) != (droppedLayerCount == 0)) {
+            fanout->numThinnedReplicas += droppedLayerCount > 0 ? 1 : -1;
+            Metrics::getInstance().set(prefix + "thinned_replicas", fanout->numThinnedReplicas);
+        }
+
+        Metrics::getInstance().add(prefix + "layer_switches", 1);
+
+        LOG(INFO) << "Replica of \"" << fanout->name << "\" receives "
+                  << (fanout->maxTemporalId - droppedLayerCount + 1) << " of " << (fanout->maxTemporalId + 1)
+                  << " temporal layers (backlog: "
+                  << static_cast<int>(backlog * 100) << "%, loss: " << static_cast<int>(std::max(loss, 0.0) * 100)
+                  << "%)";
+    }
+
+    double FanoutFramedSource::takeReportedLoss() {
+
+        if (rtpSinkName.empty()) return -1;
+
+        Medium *medium = nullptr;
+
+        // the sink is closed with the client's session, possibly before the replica
+        if (!Medium::lookupByName(envir(), rtpSinkName.c_str(), medium) || !medium->isSink() ||
+            !static_cast<MediaSink *>(medium)->isRTPSink()) {
+            rtpSinkName.clear();
+            return -1;
+        }
+
+        RTPTransmissionStatsDB::Iterator statsIterator(static_cast<RTPSink *>(medium)->transmissionStatsDB());
+
+        double loss = -1;
+
+        while (auto stats = statsIterator.next()) {
+
+            if (stats->lastPacketNumReceived() == lastReportedPacketNumber) continue; // the same report
+
+            lastReportedPacketNumber = stats->lastPacketNumReceived();
+
+            // 8-bit fixed point fraction of the packets lost since the previous report
+            loss = std::max(loss, stats->packetLossRatio() / 256.0);
+        }
+
+        return loss;
+    }
+}
@@ -0,0 +1,503 @@
+#include "HevcAggregatingRTPSink.hpp"
+
+#include <Base64.hh>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "Metrics.hpp"
+#include "RtpPacer.hpp"
+
+namespace LIRS {
+
+    /* HevcNalPacketizer */
+
+    HevcNalPacketizer *HevcNalPacketizer::createNew(UsageEnvironment &env, H264or5VideoStreamFramer *inputSource,
+                                                    unsigned inputBufferSize, unsigned maxPayloadSize,
+                                                    bool isAggregationEnabled, const std::string &streamName) {
+        return new HevcNalPacketizer(env, inputSource, inputBufferSize, maxPayloadSize, isAggregationEnabled,
+                                     streamName);
+    }
+
+    HevcNalPacketizer::HevcNalPacketizer(UsageEnvironment &env, H264or5VideoStreamFramer *inputSource,
+                                         unsigned inputBufferSize, unsigned maxPayloadSize,
+                                         bool isAggregationEnabled, const std::string &streamName)
+            : FramedFilter(env, inputSource), maxPayloadSize(maxPayloadSize),
+              isAggregationEnabled(isAggregationEnabled), streamName(streamName), nalUnit(inputBufferSize),
+              grownBytes(0), nalUnitSize(0), fragmentOffset(0),
+              nalUnitPresentationTime({0, 0}), nalUnitDuration(0), nalUnitEndsPicture(false), payloadSize(0),
+              numAggregatedNalUnits(0), payloadEndsPicture(false), lastPayloadEndsPicture(false) {
+
+        assert(maxPayloadSize > NAL_HEADER_SIZE + FU_HEADER_SIZE);
+    }
+
+    HevcNalPacketizer::~HevcNalPacketizer() {
+
+        detachInputSource(); // the framer is closed by the subsession
+
+        if (grownBytes > 0 && !streamName.empty()) {
+            Metrics::getInstance().add("memory." + streamName + ".packet_buffers_bytes",
+                                       -static_cast<int64_t>(grownBytes));
+        }
+    }
+
+    bool HevcNalPacketizer::isPictureEnd() const {
+        return lastPayloadEndsPicture;
+    }
+
+    void HevcNalPacketizer::doGetNextFrame() {
+
+        payloadSize = 0;
+        numAggregatedNalUnits = 0;
+        payloadEndsPicture = false;
+
+        if (nalUnitSize == 0) {
+            readNalUnit();
+        } else {
+            packetize(); // the NAL unit left from the previous payload
+        }
+    }
+
+    void HevcNalPacketizer::doStopGettingFrames() {
+
+        nalUnitSize = 0;
+        fragmentOffset = 0;
+        payloadSize = 0;
+        numAggregatedNalUnits = 0;
+
+        FramedFilter::doStopGettingFrames();
+    }
+
+    void HevcNalPacketizer::readNalUnit() {
+        fInputSource->getNextFrame(nalUnit.data(), static_cast<unsigned>(nalUnit.size()), afterGettingNalUnit, this,
+                                   FramedSource::handleClosure, this);
+    }
+
+    void HevcNalPacketizer::afterGettingNalUnit(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                                struct timeval presentationTime, unsigned durationInMicroseconds) {
+        static_cast<HevcNalPacketizer *>(clientData)->afterGettingNalUnit(frameSize, numTruncatedBytes,
+                                                                          presentationTime, durationInMicroseconds);
+    }
+
+    void HevcNalPacketizer::afterGettingNalUnit(unsigned frameSize, unsigned numTruncatedBytes,
+                                                struct timeval presentationTime, unsigned durationInMicroseconds) {
+
+        auto framer = static_cast<H264or5VideoStreamFramer *>(fInputSource);
+
+        // the NAL unit exceeding the buffer is delivered again into the grown one (see FanoutFramedSource)
+        if (frameSize == 0 && numTruncatedBytes > 0) {
+
+            framer->pictureEndMarker() = False;
+
+            growNalUnitBuffer(numTruncatedBytes);
+            readNalUnit();
+            return;
+        }
+
+        if (numTruncatedBytes > 0) {
+            LOG(WARN) << "NAL unit of " << (frameSize + numTruncatedBytes) << " bytes has been truncated to "
+                      << frameSize << " bytes";
+        }
+
+        if (frameSize < NAL_HEADER_SIZE) { // nothing to packetize
+            if (numAggregatedNalUnits > 0) {
+                deliverPayload();
+            } else {
+                readNalUnit();
+            }
+            return;
+        }
+
+        nalUnitSize = frameSize;
+        nalUnitPresentationTime = presentationTime;
+        nalUnitDuration = durationInMicroseconds;
+
+        nalUnitEndsPicture = framer->pictureEndMarker() != False;
+        framer->pictureEndMarker() = False;
+
+        packetize();
+    }
+
+    void HevcNalPacketizer::growNalUnitBuffer(unsigned size) {
+
+        auto previousSize = nalUnit.size();
+
+        nalUnit.resize(std::max(previousSize, static_cast<size_t>(size * BUFFER_GROWTH_MARGIN)));
+
+        grownBytes += nalUnit.size() - previousSize;
+
+        if (!streamName.empty()) {
+            Metrics::getInstance().add("memory." + streamName + ".packet_buffers_bytes",
+                                       static_cast<int64_t>(nalUnit.size() - previousSize));
+        }
+
+        LOG(INFO) << "NAL unit buffer of the stream \"" << streamName << "\" has been grown to " << nalUnit.size()
+                  << " bytes";
+    }
+
+    void HevcNalPacketizer::packetize() {
+
+        auto limit = std::min(fMaxSize, maxPayloadSize);
+
+        if (numAggregatedNalUnits > 0) {
+
+            if (!canAggregate(limit)) { // the NAL unit is left for the next payload
+                deliverPayload();
+                return;
+            }
+
+            aggregate();
+
+            if (payloadEndsPicture) {
+                deliverPayload(); // don't wait for the next picture
+            } else {
+                readNalUnit();
+            }
+            return;
+        }
+
+        if (fragmentOffset > 0 || nalUnitSize > limit) {
+            deliverFragment(limit);
+            return;
+        }
+
+        if (isAggregationEnabled && !nalUnitEndsPicture && canAggregate(limit)) {
+            aggregate();
+            readNalUnit();
+            return;
+        }
+
+        // single NAL unit packet
+        memcpy(fTo, nalUnit.data(), nalUnitSize);
+
+        payloadSize = nalUnitSize;
+        payloadEndsPicture = nalUnitEndsPicture;
+        fPresentationTime = nalUnitPresentationTime;
+        fDurationInMicroseconds = nalUnitDuration;
+        nalUnitSize = 0;
+
+        fFrameSize = payloadSize;
+        fNumTruncatedBytes = 0;
+        lastPayloadEndsPicture = payloadEndsPicture;
+
+        FramedSource::afterGetting(this);
+    }
+
+    bool HevcNalPacketizer::canAggregate(unsigned limit) const {
+
+        if (numAggregatedNalUnits == 0) {
+            // AP's header, the NAL unit and at least the header of the next one
+            return NAL_HEADER_SIZE + 2 * AP_SIZE_FIELD_SIZE + nalUnitSize + NAL_HEADER_SIZE <= limit;
+        }
+
+        // the payload is delivered when the framer marks the end of the picture, so the NAL units aggregated so far
+        // belong to the same picture as the pending one whatever presentation times the source has stamped them with
+
+        return payloadSize + AP_SIZE_FIELD_SIZE + nalUnitSize <= limit;
+    }
+
+    void HevcNalPacketizer::aggregate() {
+
+        if (numAggregatedNalUnits == 0) {
+            payloadSize = NAL_HEADER_SIZE; // AP's header is written on delivery
+            fPresentationTime = nalUnitPresentationTime;
+        }
+
+        fTo[payloadSize++] = static_cast<uint8_t>(nalUnitSize >> 8);
+        fTo[payloadSize++] = static_cast<uint8_t>(nalUnitSize & 0xFF);
+
+        memcpy(fTo + payloadSize, nalUnit.data(), nalUnitSize);
+
+        payloadSize += nalUnitSize;
+        payloadEndsPicture = nalUnitEndsPicture;
+        fDurationInMicroseconds = nalUnitDuration;
+
+        numAggregatedNalUnits++;
+        nalUnitSize = 0;
+    }
+
+    void HevcNalPacketizer::deliverFragment(unsigned limit) {
+
+        bool isStart = fragmentOffset == 0;
+
+        if (isStart) fragmentOffset = NAL_HEADER_SIZE; // the NAL unit's header is carried by the FU's headers
+
+        auto chunkSize = std::min(nalUnitSize - fragmentOffset, limit - NAL_HEADER_SIZE - FU_HEADER_SIZE);
+
+        bool isEnd = fragmentOffset + chunkSize == nalUnitSize;
+
+        // payload header (F, LayerId and TID of the NAL unit), FU header (S, E, type of the NAL unit)
+        fTo[0] = static_cast<uint8_t>((nalUnit[0] & 0x81) | (FRAGMENTATION_UNIT_TYPE << 1));
+        fTo[1] = nalUnit[1];
+        fTo[2] = static_cast<uint8_t>((isStart ? 0x80 : 0) | (isEnd ? 0x40 : 0) | ((nalUnit[0] >> 1) & 0x3F));
+
+        memcpy(fTo + NAL_HEADER_SIZE + FU_HEADER_SIZE, nalUnit.data() + fragmentOffset, chunkSize);
+
+        fragmentOffset += chunkSize;
+
+        fPresentationTime = nalUnitPresentationTime;
+        fDurationInMicroseconds = isEnd ? nalUnitDuration : 0;
+
+        if (isEnd) {
+            nalUnitSize = 0;
+            fragmentOffset = 0;
+        }
+
+        fFrameSize = NAL_HEADER_SIZE + FU_HEADER_SIZE + chunkSize;
+        fNumTruncatedBytes = 0;
+        lastPayloadEndsPicture = isEnd && nalUnitEndsPicture;
+
+        FramedSource::afterGetting(this);
+    }
+
+    void HevcNalPacketizer::deliverPayload() {
+
+        if (numAggregatedNalUnits == 1) { // nothing to aggregate with, send as a single NAL unit packet
+
+            payloadSize -= NAL_HEADER_SIZE + AP_SIZE_FIELD_SIZE;
+            memmove(fTo, fTo + NAL_HEADER_SIZE + AP_SIZE_FIELD_SIZE, payloadSize);
+
+        } else {
+
+            // AP's header: F bit set if any NAL unit has it, the lowest LayerId and TID of the NAL units
+            uint8_t forbiddenBit = 0, layerId = 0x3F, temporalId = 0x07;
+
+            for (unsigned offset = NAL_HEADER_SIZE; offset < payloadSize;) {
+
+                auto size = static_cast<unsigned>((fTo[offset] << 8) | fTo[offset + 1]);
+                auto header = fTo + offset + AP_SIZE_FIELD_SIZE;
+
+                forbiddenBit |= header[0] & 0x80;
+                layerId = std::min(layerId, static_cast<uint8_t>(((header[0] & 0x01) << 5) | (header[1] >> 3)));
+                temporalId = std::min(temporalId, static_cast<uint8_t>(header[1] & 0x07));
+
+                offset += AP_SIZE_FIELD_SIZE + size;
+            }
+
+            fTo[0] = static_cast<uint8_t>(forbiddenBit | (AGGREGATION_PACKET_TYPE << 1) | (layerId >> 5));
+            fTo[1] = static_cast<uint8_t>(((layerId & 0x1F) << 3) | temporalId);
+
+            Metrics::getInstance().add("rtp.aggregation_packets", 1);
+            Metrics::getInstance().add("rtp.aggregated_nal_units", numAggregatedNalUnits);
+        }
+
+        fFrameSize = payloadSize;
+        fNumTruncatedBytes = 0;
+        lastPayloadEndsPicture = payloadEndsPicture;
+
+        FramedSource::afterGetting(this);
+    }
+
+    /* HevcAggregatingRTPSink */
+
+    HevcAggregatingRTPSink *HevcAggregatingRTPSink::createNew(UsageEnvironment &env, Groupsock *rtpGroupsock,
+                                                              unsigned char rtpPayloadFormat,
+                                                              unsigned pacingSpreadUs,
+                                                              const std::string &streamName,
+                                                              const std::shared_ptr<RetransmissionPayloads>
+                                                              &retransmissionPayloads) {
+        return new HevcAggregatingRTPSink(env, rtpGroupsock, rtpPayloadFormat, pacingSpreadUs, streamName,
+                                          retransmissionPayloads);
+    }
+
+    HevcAggregatingRTPSink::HevcAggregatingRTPSink(UsageEnvironment &env, Groupsock *rtpGroupsock,
+                                                   unsigned char rtpPayloadFormat, unsigned pacingSpreadUs,
+                                                   const std::string &streamName,
+                                                   const std::shared_ptr<RetransmissionPayloads>
+                                                   &retransmissionPayloads)
+            : VideoRTPSink(env, rtpGroupsock, rtpPayloadFormat, 90000, "H265"), packetizer(nullptr), pacer(nullptr),
+              pacingSpreadUs(pacingSpreadUs), streamName(streamName), retransmissionPayloads(retransmissionPayloads),
+              fmtpSdpLine(nullptr) {}
+
+    HevcAggregatingRTPSink::~HevcAggregatingRTPSink() {
+
+        // stop reading now, the pacer and the packetizer are closed before the base class' destructor
+        fSource = pacer ? static_cast<FramedSource *>(pacer) : packetizer;
+        stopPlaying();
+
+        Medium::close(pacer);
+        Medium::close(packetizer);
+        fSource = nullptr;
+
+        if (retransmissionCache) {
+            Metrics::getInstance().add("nack." + streamName + ".cache_bytes",
+                                       -static_cast<int64_t>(retransmissionCache->getMemorySize()));
+            Metrics::getInstance().add("memory." + streamName + ".retransmission_bytes",
+                                       -static_cast<int64_t>(retransmissionCache->getMemorySize()));
+        }
+
+        delete[] fmtpSdpLine;
+    }
+
+    Boolean HevcAggregatingRTPSink::sourceIsCompatibleWithUs(MediaSource &source) {
+        return source.isH265VideoStreamFramer();
+    }
+
+    Boolean HevcAggregatingRTPSink::continuePlaying() {
+
+        if (!packetizer) {
+            packetizer = HevcNalPacketizer::createNew(envir(), static_cast<H264or5VideoStreamFramer *>(fSource),
+                                                      OutPacketBuffer::maxSize, ourMaxPacketSize() - RTP_HEADER_SIZE,
+                                                      true, streamName);
+
+            if (pacingSpreadUs > 0) {
+                pacer = RtpPacer::createNew(envir(), packetizer, ourMaxPacketSize() - RTP_HEADER_SIZE, pacingSpreadUs,
+                                            streamName);
+            }
+
+            // allocated for the playing clients only (not for the SDP's sink), the payloads by the first one
+            if (retransmissionPayloads) {
+                retransmissionCache.reset(new RetransmissionCache(retransmissionPayloads->getNumPayloads(),
+                                                                  ourMaxPacketSize(), retransmissionPayloads));
+                Metrics::getInstance().add("nack." + streamName + ".cache_bytes",
+                                           static_cast<int64_t>(retransmissionCache->getMemorySize()));
+                Metrics::getInstance().add("memory." + streamName + ".retransmission_bytes",
+                                           static_cast<int64_t>(retransmissionCache->getMemorySize()));
+            }
+
+        } else {
+            packetizer->reassignInputSource(fSource);
+        }
+
+        fSource = pacer ? static_cast<FramedSource *>(pacer) : packetizer;
+
+        return MultiFramedRTPSink::continuePlaying();
+    }
+
+    void HevcAggregatingRTPSink::doSpecialFrameHandling(unsigned, unsigned char *frameStart, unsigned numBytesInFrame,
+                                                        struct timeval framePresentationTime, unsigned) {
+
+        auto isPictureEnd = pacer ? pacer->isPictureEnd() : packetizer && packetizer->isPictureEnd();
+
+        if (isPictureEnd) {
+            setMarkerBit();
+        }
+
+        setTimestamp(framePresentationTime);
+
+        // each frame is a complete packet, the payload is sent right after this call
+        if (retransmissionCache) {
+            cachePacket(frameStart, numBytesInFrame, isPictureEnd);
+        }
+    }
+
+    void HevcAggregatingRTPSink::cachePacket(const unsigned char *payload, unsigned payloadSize, bool isMarked) {
+
+        uint8_t header[RTP_HEADER_SIZE];
+
+        auto ssrc = SSRC();
+
+        header[0] = 0x80; // version 2, no padding, extensions and CSRCs
+        header[1] = static_cast<uint8_t>((isMarked ? 0x80 : 0) | rtpPayloadType());
+        header[2] = static_cast<uint8_t>(fSeqNo >> 8);
+        header[3] = static_cast<uint8_t>(fSeqNo & 0xFF);
+        header[4] = static_cast<uint8_t>(fCurrentTimestamp >> 24);
+        header[5] = static_cast<uint8_t>(fCurrentTimestamp >> 16);
+        header[6] = static_cast<uint8_t>(fCurrentTimestamp >> 8);
+        header[7] = static_cast<uint8_t>(fCurrentTimestamp & 0xFF);
+        header[8] = static_cast<uint8_t>(ssrc >> 24);
+        header[9] = static_cast<uint8_t>(ssrc >> 16);
+        header[10] = static_cast<uint8_t>(ssrc >> 8);
+        header[11] = static_cast<uint8_t>(ssrc & 0xFF);
+
+        retransmissionCache->store(fSeqNo, header, sizeof(header), payload, payloadSize);
+    }
+
+    void HevcAggregatingRTPSink::retransmit(uint16_t packetId, uint16_t lostBitmask) {
+
+        if (!retransmissionCache) return;
+
+        retransmit(packetId);
+
+        for (unsigned bit = 0; bit < 16; bit++) {
+            if (lostBitmask & (1u << bit)) retransmit(static_cast<uint16_t>(packetId + bit + 1));
+        }
+    }
+
+    void HevcAggregatingRTPSink::retransmit(uint16_t sequenceNumber) {
+
+        size_t size = 0;
+        auto data = retransmissionCache->find(sequenceNumber, size);
+
+        if (!data) {
+            Metrics::getInstance().add("nack." + streamName + ".misses", 1);
+            return;
+        }
+
+        fRTPInterface.sendPacket(const_cast<unsigned char *>(data), static_cast<unsigned>(size));
+
+        Metrics::getInstance().add("nack." + streamName + ".hits", 1);
+        Metrics::getInstance().add("nack." + streamName + ".retransmitted_bytes", static_cast<int64_t>(size));
+    }
+
+    Boolean HevcAggregatingRTPSink::frameCanAppearAfterPacketStart(unsigned char const *, unsigned) const {
+        return False; // each payload is a complete packet
+    }
+
+    char const *HevcAggregatingRTPSink::auxSDPLine() {
+
+        auto parameterSets = parameterSetsSdpLine();
+        auto feedback = "a=rtcp-fb:" + std::to_string(rtpPayloadType());
+
+        sdpLines = parameterSets ? parameterSets : "";
+
+        // generic NACKs are accepted if the packets are cached, PLI and FIR force a keyframe
+        if (retransmissionPayloads) sdpLines += feedback + " nack\r\n";
+
+        sdpLines += feedback + " nack pli\r\n" + feedback + " ccm fir\r\n";
+
+        return sdpLines.c_str();
+    }
+
+    char const *HevcAggregatingRTPSink::parameterSetsSdpLine() {
+
+        if (!packetizer || !packetizer->inputSource()) return nullptr; // not playing yet
+
+        auto framer = static_cast<H264or5VideoStreamFramer *>(packetizer->inputSource());
+
+        uint8_t *vps, *sps, *pps;
+        unsigned vpsSize, spsSize, ppsSize;
+
+        framer->getVPSandSPSandPPS(vps, vpsSize, sps, spsSize, pps, ppsSize);
+
+        if (!vps || !sps || !pps) return nullptr; // parameter sets are sent in-band only
+
+        // profile_tier_level() follows the NAL unit's header and 4 bytes of the VPS
+        std::vector<uint8_t> vpsPayload(vpsSize);
+
+        auto vpsPayloadSize = removeH264or5EmulationBytes(vpsPayload.data(), vpsSize, vps, vpsSize);
+
+        if (vpsPayloadSize < 6 + 12) return nullptr;
+
+        const uint8_t *profileTierLevel = &vpsPayload[6];
+
+        char interopConstraints[16];
+        snprintf(interopConstraints, sizeof(interopConstraints), "%02X%02X%02X%02X%02X%02X",
+                 profileTierLevel[5], profileTierLevel[6], profileTierLevel[7], profileTierLevel[8],
+                 profileTierLevel[9], profileTierLevel[10]);
+
+        auto vpsBase64 = base64Encode(reinterpret_cast<char *>(vps), vpsSize);
+        auto spsBase64 = base64Encode(reinterpret_cast<char *>(sps), spsSize);
+        auto ppsBase64 = base64Encode(reinterpret_cast<char *>(pps), ppsSize);
+
+        auto lineSize = strlen(vpsBase64) + strlen(spsBase64) + strlen(ppsBase64) + 256;
+
+        delete[] fmtpSdpLine;
+        fmtpSdpLine = new char[lineSize];
+
+        snprintf(fmtpSdpLine, lineSize,
+                 "a=fmtp:%d profile-space=%u;profile-id=%u;tier-flag=%u;level-id=%u;interop-constraints=%s"
+                 ";sprop-vps=%s;sprop-sps=%s;sprop-pps=%s\r\n",
+                 rtpPayloadType(), profileTierLevel[0] >> 6, profileTierLevel[0] & 0x1F,
+                 (profileTierLevel[0] >> 5) & 0x01, profileTierLevel[11], interopConstraints,
+                 vpsBase64, spsBase64, ppsBase64);
+
+        delete[] vpsBase64;
+        delete[] spsBase64;
+        delete[] ppsBase64;
+
+        return fmtpSdpLine;
+    }
+}
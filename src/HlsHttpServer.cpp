@@ -0,0 +1,498 @@
+#include "HlsHttpServer.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace LIRS {
+
+    /**
+     * Returns the integer value of the query parameter.
+     *
+     * @return true if the parameter is present, otherwise - false.
+     */
+    static bool getQueryParameter(const std::string &query, const std::string &key, int64_t &value) {
+
+        std::istringstream parameters(query);
+        std::string parameter;
+
+        while (std::getline(parameters, parameter, '&')) {
+
+            auto separator = parameter.find('=');
+
+            if (separator == std::string::npos || parameter.compare(0, separator, key) != 0) continue;
+
+            char *end = nullptr;
+            auto text = parameter.c_str() + separator + 1;
+
+            value = strtoll(text, &end, 10);
+
+            return end != text && *end == '\0';
+        }
+
+        return false;
+    }
+
+    static const char *reasonPhrase(int status) {
+        switch (status) {
+            case 200:
+                return "OK";
+            case 400:
+                return "Bad Request";
+            case 404:
+                return "Not Found";
+            case 405:
+                return "Method Not Allowed";
+            case 503:
+                return "Service Unavailable";
+            default:
+                return "Internal Server Error";
+        }
+    }
+
+    HlsHttpServer::HlsHttpServer(unsigned port) : port(port), listenFd(-1), wakeupPipe{-1, -1}, isRunning(false) {}
+
+    HlsHttpServer::~HlsHttpServer() {
+
+        stop();
+
+        // the publishers may outlive the server (held by the streams), they mustn't wake it up anymore
+        {
+            std::lock_guard<std::mutex> lock(publishersMutex);
+
+            for (auto &publisher : publishers) {
+                publisher.second->setOnPublishedCallback(nullptr);
+            }
+        }
+
+        // the pipe outlives the thread, publishers may still wake up the stopped server
+        if (wakeupPipe[0] >= 0) close(wakeupPipe[0]);
+        if (wakeupPipe[1] >= 0) close(wakeupPipe[1]);
+
+        LOG(INFO) << "HLS server has been destructed";
+    }
+
+    void HlsHttpServer::addPublisher(const std::shared_ptr<CmafPublisher> &publisher) {
+
+        publisher->setOnPublishedCallback(std::bind(&HlsHttpServer::wakeup, this));
+
+        std::lock_guard<std::mutex> lock(publishersMutex);
+
+        publishers[publisher->getName()] = publisher;
+
+        if (isRunning.load()) { // added to the running server (the stream has started later)
+            LOG(INFO) << "Play the HLS stream \"" << publisher->getName() << "\" using the URL: http://<host>:"
+                      << port << "/hls/" << publisher->getName() << "/index.m3u8";
+        }
+    }
+
+    void HlsHttpServer::removePublisher(const std::string &name) {
+
+        std::lock_guard<std::mutex> lock(publishersMutex);
+
+        auto publisher = publishers.find(name);
+
+        if (publisher != publishers.end()) {
+
+            // the publisher may outlive the server (held by the stream)
+            publisher->second->setOnPublishedCallback(nullptr);
+
+            publishers.erase(publisher);
+
+            LOG(INFO) << "HLS stream \"" << name << "\" has been removed";
+        }
+    }
+
+    std::shared_ptr<CmafPublisher> HlsHttpServer::findPublisher(const std::string &name) {
+
+        std::lock_guard<std::mutex> lock(publishersMutex);
+
+        auto publisher = publishers.find(name);
+
+        return publisher != publishers.end() ? publisher->second : nullptr;
+    }
+
+    bool HlsHttpServer::start() {
+
+        if (isRunning.load()) return true;
+
+        if (wakeupPipe[0] < 0 && pipe2(wakeupPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            LOG(ERROR) << "Failed to create the wakeup pipe: " << strerror(errno);
+            return false;
+        }
+
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(static_cast<uint16_t>(port));
+
+        if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listenFd, 128) != 0) {
+            LOG(ERROR) << "Failed to listen on HTTP port " << port << ": " << strerror(errno);
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+
+        isRunning.store(true);
+
+        serverThread = std::thread(&HlsHttpServer::loop, this);
+
+        std::lock_guard<std::mutex> lock(publishersMutex);
+
+        for (auto &publisher : publishers) {
+            LOG(INFO) << "Play the HLS stream \"" << publisher.first << "\" using the URL: http://<host>:" << port
+                      << "/hls/" << publisher.first << "/index.m3u8";
+        }
+
+        return true;
+    }
+
+    void HlsHttpServer::stop() {
+
+        if (!isRunning.exchange(false)) return;
+
+        wakeup();
+
+        serverThread.join();
+
+        while (!connections.empty()) {
+            closeConnection(connections.begin()->first);
+        }
+
+        close(listenFd);
+        listenFd = -1;
+    }
+
+    void HlsHttpServer::loop() {
+
+        std::vector<pollfd> descriptors;
+        std::vector<int> closedConnections;
+
+        while (isRunning.load()) {
+
+            descriptors.clear();
+            descriptors.push_back(pollfd{listenFd, POLLIN, 0});
+            descriptors.push_back(pollfd{wakeupPipe[0], POLLIN, 0});
+
+            for (auto &entry : connections) {
+                auto events = static_cast<short>(entry.second.header.empty() ? POLLIN : POLLIN | POLLOUT);
+                descriptors.push_back(pollfd{entry.first, events, 0});
+            }
+
+            if (poll(descriptors.data(), descriptors.size(), POLL_INTERVAL_MS) < 0 && errno != EINTR) {
+                LOG(ERROR) << "HLS server's poll has failed: " << strerror(errno);
+                break;
+            }
+
+            if (descriptors[1].revents & POLLIN) {
+                char buffer[256];
+                while (read(wakeupPipe[0], buffer, sizeof(buffer)) > 0) {}
+            }
+
+            if (descriptors[0].revents & POLLIN) {
+                acceptConnections();
+            }
+
+            closedConnections.clear();
+
+            for (size_t index = 2; index < descriptors.size(); index++) {
+
+                auto entry = connections.find(descriptors[index].fd);
+
+                if (entry == connections.end()) continue;
+
+                auto &connection = entry->second;
+                auto events = descriptors[index].revents;
+
+                auto isAlive = !(events & (POLLERR | POLLNVAL));
+
+                if (isAlive && (events & (POLLIN | POLLHUP))) {
+                    isAlive = readRequest(connection);
+                }
+
+                if (isAlive && (events & POLLOUT)) {
+                    isAlive = writeResponse(connection);
+                }
+
+                // the next request is processed once the previous response has been sent
+                if (isAlive && connection.header.empty() && !connection.isHeld) {
+                    isAlive = !connection.isClosing && processRequest(connection);
+                }
+
+                if (!isAlive) {
+                    closedConnections.push_back(entry->first);
+                }
+            }
+
+            // held requests are retried on each wakeup (new data, deadlines)
+            for (auto &entry : connections) {
+
+                auto &connection = entry.second;
+
+                if (!connection.isHeld || !handleRequest(connection)) continue;
+
+                if (!writeResponse(connection)) {
+                    closedConnections.push_back(entry.first);
+                }
+            }
+
+            for (auto fd : closedConnections) {
+                closeConnection(fd);
+            }
+        }
+    }
+
+    void HlsHttpServer::acceptConnections() {
+
+        while (true) {
+
+            auto fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd < 0) return; // no more pending connections
+
+            if (connections.size() >= MAX_CONNECTIONS) {
+                LOG(WARN) << "Too many HLS connections, rejected";
+                close(fd);
+                continue;
+            }
+
+            // parts are small and latency sensitive
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+            connections[fd].fd = fd;
+
+            Metrics::getInstance().set("hls.connections", static_cast<int64_t>(connections.size()));
+        }
+    }
+
+    bool HlsHttpServer::readRequest(HttpConnection &connection) {
+
+        char buffer[4096];
+
+        while (true) {
+
+            auto size = recv(connection.fd, buffer, sizeof(buffer), 0);
+
+            if (size > 0) {
+                connection.input.append(buffer, static_cast<size_t>(size));
+                continue;
+            }
+
+            if (size == 0) return false; // closed by the client
+
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+    }
+
+    bool HlsHttpServer::processRequest(HttpConnection &connection) {
+
+        auto end = connection.input.find("\r\n\r\n");
+
+        if (end == std::string::npos) { // incomplete
+            return connection.input.size() <= MAX_REQUEST_SIZE;
+        }
+
+        auto request = connection.input.substr(0, end);
+        connection.input.erase(0, end + 4);
+
+        std::string method, target, version;
+        std::istringstream(request.substr(0, request.find("\r\n"))) >> method >> target >> version;
+
+        std::transform(request.begin(), request.end(), request.begin(), ::tolower);
+
+        connection.isHead = method == "HEAD";
+        connection.isClosing = version != "HTTP/1.1" || request.find("\r\nconnection: close") != std::string::npos;
+        connection.target = target;
+        connection.isHeld = false;
+
+        Metrics::getInstance().add("hls.requests", 1);
+
+        if (method != "GET" && method != "HEAD") {
+            respond(connection, 405, "text/plain", nullptr);
+            return true;
+        }
+
+        handleRequest(connection);
+
+        return true;
+    }
+
+    bool HlsHttpServer::handleRequest(HttpConnection &connection) {
+
+        static const std::string PREFIX = "/hls/";
+
+        auto now = std::chrono::steady_clock::now();
+
+        auto querySeparator = connection.target.find('?');
+        auto path = connection.target.substr(0, querySeparator);
+        auto query = querySeparator != std::string::npos ? connection.target.substr(querySeparator + 1) : "";
+
+        auto slash = path.rfind('/');
+
+        if (path.compare(0, PREFIX.size(), PREFIX) != 0 || slash < PREFIX.size()) {
+            respond(connection, 404, "text/plain", nullptr);
+            return true;
+        }
+
+        auto publisher = findPublisher(path.substr(PREFIX.size(), slash - PREFIX.size()));
+        auto resource = path.substr(slash + 1);
+
+        if (!publisher) {
+            respond(connection, 404, "text/plain", nullptr);
+            return true;
+        }
+
+        // whether the request should still be held
+        auto hold = [&]() {
+
+            if (!connection.isHeld) {
+                connection.isHeld = true;
+                connection.deadline = now + std::chrono::seconds(3 * publisher->getTargetDuration());
+            }
+
+            return now < connection.deadline;
+        };
+
+        if (resource == "index.m3u8") {
+
+            int64_t sequenceNumber = 0, partIndex = -1;
+
+            // blocking playlist reload
+            if (getQueryParameter(query, "_HLS_msn", sequenceNumber)) {
+
+                getQueryParameter(query, "_HLS_part", partIndex);
+
+                if (!publisher->contains(sequenceNumber, static_cast<int>(partIndex))) {
+
+                    auto current = publisher->getCurrentSequenceNumber();
+
+                    if (current >= 0 && sequenceNumber > current + 2) {
+                        respond(connection, 400, "text/plain", nullptr);
+                        return true;
+                    }
+
+                    if (hold()) return false;
+
+                    respond(connection, 503, "text/plain", nullptr);
+                    return true;
+                }
+            }
+
+            auto playlist = publisher->getPlaylist();
+
+            respond(connection, 200, "application/vnd.apple.mpegurl",
+                    std::make_shared<const std::vector<uint8_t>>(playlist.begin(), playlist.end()));
+
+            return true;
+        }
+
+        auto data = publisher->getResource(resource);
+
+        if (data) {
+
+            auto isInit = resource.size() > 4 && resource.compare(resource.size() - 4, 4, ".mp4") == 0;
+
+            respond(connection, 200, isInit ? "video/mp4" : "video/iso.segment", data, "max-age=60");
+
+            return true;
+        }
+
+        // preload hint or the part of the current segment
+        if (publisher->isUpcoming(resource) && hold()) return false;
+
+        respond(connection, 404, "text/plain", nullptr);
+
+        return true;
+    }
+
+    void HlsHttpServer::respond(HttpConnection &connection, int status, const std::string &contentType, CmafData body,
+                                const std::string &cacheControl) {
+
+        std::ostringstream header;
+
+        header << "HTTP/1.1 " << status << " " << reasonPhrase(status) << "\r\n"
+               << "Content-Type: " << contentType << "\r\n"
+               << "Content-Length: " << (body ? body->size() : 0) << "\r\n"
+               << "Cache-Control: " << cacheControl << "\r\n"
+               << "Access-Control-Allow-Origin: *\r\n"
+               << "Connection: " << (connection.isClosing ? "close" : "keep-alive") << "\r\n\r\n";
+
+        connection.header = header.str();
+        connection.body = connection.isHead ? nullptr : std::move(body);
+        connection.sent = 0;
+        connection.isHeld = false;
+    }
+
+    bool HlsHttpServer::writeResponse(HttpConnection &connection) {
+
+        while (!connection.header.empty()) {
+
+            const uint8_t *data;
+            size_t size;
+
+            auto bodySize = connection.body ? connection.body->size() : 0;
+
+            if (connection.sent < connection.header.size()) {
+                data = reinterpret_cast<const uint8_t *>(connection.header.data()) + connection.sent;
+                size = connection.header.size() - connection.sent;
+            } else if (connection.sent - connection.header.size() < bodySize) {
+                data = connection.body->data() + (connection.sent - connection.header.size());
+                size = bodySize - (connection.sent - connection.header.size());
+            } else { // the response has been sent
+                connection.header.clear();
+                connection.body.reset();
+                connection.sent = 0;
+                break;
+            }
+
+            auto written = send(connection.fd, data, size, MSG_NOSIGNAL);
+
+            if (written < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+
+            connection.sent += static_cast<size_t>(written);
+
+            Metrics::getInstance().add("hls.bytes_sent", written);
+        }
+
+        return true;
+    }
+
+    void HlsHttpServer::closeConnection(int fd) {
+
+        close(fd);
+
+        connections.erase(fd);
+
+        Metrics::getInstance().set("hls.connections", static_cast<int64_t>(connections.size()));
+    }
+
+    void HlsHttpServer::wakeup() {
+
+        if (wakeupPipe[1] < 0) return;
+
+        char signal = 1;
+
+        // the pipe is non-blocking, a full pipe means the thread is going to wake up anyway
+        auto result = write(wakeupPipe[1], &signal, sizeof(signal));
+        (void) result;
+    }
+}
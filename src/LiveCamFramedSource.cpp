@@ -1,60 +1,79 @@
 #include "LiveCamFramedSource.hpp"
+#include "Metrics.hpp"
 
 namespace LIRS {
 
-    LiveCamFramedSource *LiveCamFramedSource::createNew(UsageEnvironment &env, Transcoder *transcoder) {
-        return new LiveCamFramedSource(env, transcoder);
+    LiveCamFramedSource *LiveCamFramedSource::createNew(UsageEnvironment &env, Transcoder *transcoder,
+                                                        EventNotifier *eventNotifier) {
+        return new LiveCamFramedSource(env, transcoder, eventNotifier);
     }
 
     LiveCamFramedSource::~LiveCamFramedSource() {
 
+        auto deviceName = transcoder->getDeviceName();
+
+        // stop transcoding and wait for the thread to finish before the transcoder is destroyed
+        transcoder->stop();
+
+        if (transcodingThread.joinable()) {
+            transcodingThread.join();
+        }
+
         // cleanup transcoder
         delete transcoder;
 
-        // delete trigger
-        envir().taskScheduler().deleteEventTrigger(eventTriggerId);
-        eventTriggerId = 0;
+        // delete event
+        eventNotifier->deleteEvent(eventId);
+        eventId = 0;
 
         // cleanup encoded data buffer
         encodedDataBuffer.clear();
-        encodedDataBuffer.shrink_to_fit();
 
-        LOG(DEBUG) << "Camera framed source " << transcoder->getDeviceName() << " has been destructed";
+        LOG(DEBUG) << "Camera framed source " << deviceName << " has been destructed";
     }
 
-    LiveCamFramedSource::LiveCamFramedSource(UsageEnvironment &env, Transcoder *transcoder) :
-            FramedSource(env), transcoder(transcoder), eventTriggerId(0) {
-
-        // create trigger invoking method which will deliver frame
-        eventTriggerId = envir().taskScheduler().createEventTrigger(LiveCamFramedSource::deliverFrame0);
+    LiveCamFramedSource::LiveCamFramedSource(UsageEnvironment &env, Transcoder *transcoder,
+                                             EventNotifier *eventNotifier) :
+            FramedSource(env), transcoder(transcoder), eventNotifier(eventNotifier), eventId(0),
+            encodedDataBufferBytes(0),
+            encodedQueueMetricName("memory." + transcoder->getAlias() + ".encoded_queue_bytes") {
 
-        encodedDataBuffer.reserve(5); // reserve enough space for handling incoming encoded data
+        // create event invoking method which will deliver frame (not limited in number, unlike the triggers)
+        eventId = eventNotifier->createEvent(LiveCamFramedSource::deliverFrame0, this);
 
         // set transcoder's callback indicating new encoded data availability
         transcoder->setOnEncodedDataCallback(std::bind(&LiveCamFramedSource::onEncodedData, this,
-                                                       std::placeholders::_1));
+                                                       std::placeholders::_1, std::placeholders::_2));
 
         // start video data encoding/decoding in a new thread
 
-        std::thread([transcoder]() {
+        transcodingThread = std::thread([transcoder]() {
             transcoder->run();
-        }).detach();
+        });
     }
 
-    void LiveCamFramedSource::onEncodedData(std::vector<uint8_t> &&newData) {
-
-        if (!isCurrentlyAwaitingData()) {
-            return;
-        }
+    void LiveCamFramedSource::onEncodedData(std::vector<uint8_t> &&newData, const struct timeval &presentationTime) {
 
         encodedDataMutex.lock();
 
-        encodedDataBuffer.emplace_back(std::move(newData)); // add encoded data to be processed later
+        encodedDataBufferBytes += newData.size();
+
+        // always enqueue: parameter sets and slices of the frame arrive in a burst and must keep their order
+        encodedDataBuffer.push_back({std::move(newData), presentationTime}); // add encoded data to be processed later
+
+        if (encodedDataBuffer.size() > MAX_ENCODED_DATA_BUFFER_SIZE) { // consumer is stalled, drop the oldest data
+            encodedDataBufferBytes -= encodedDataBuffer.front().data.size();
+            encodedDataBuffer.pop_front();
+        }
+
+        auto bufferedBytes = encodedDataBufferBytes;
 
         encodedDataMutex.unlock();
 
+        Metrics::getInstance().set(encodedQueueMetricName, static_cast<int64_t>(bufferedBytes));
+
         // publish an event to be handled by the event loop
-        envir().taskScheduler().triggerEvent(eventTriggerId, this);
+        eventNotifier->signal(eventId);
     }
 
     void LiveCamFramedSource::deliverFrame0(void *clientData) {
@@ -73,21 +92,39 @@ namespace LIRS {
 
         encodedDataMutex.lock(); // using mutex instead of lock, because nothing could happen here (RAII)
 
-        encodedData = std::move(encodedDataBuffer.back());
+        if (encodedDataBuffer.empty()) { // already delivered by the previous request
+            encodedDataMutex.unlock();
+            return;
+        }
 
-        encodedDataBuffer.pop_back();
+        fPresentationTime = encodedDataBuffer.front().presentationTime;
 
-        encodedDataMutex.unlock();
+        auto size = encodedDataBuffer.front().data.size();
 
-        if (encodedData.size() > fMaxSize) { // truncate data
-            fFrameSize = fMaxSize;
-            fNumTruncatedBytes = static_cast<unsigned int>(encodedData.size() - fMaxSize);
-            LOG(WARN) << "Truncated: " << fNumTruncatedBytes << ", size: " << encodedData.size();
-        } else {
-            fFrameSize = static_cast<unsigned int>(encodedData.size());
+        if (size > fMaxSize) { // never truncated: the consumer grows its buffer and reads the NAL unit again
+            encodedDataMutex.unlock();
+
+            fFrameSize = 0;
+            fNumTruncatedBytes = static_cast<unsigned int>(size);
+
+            FramedSource::afterGetting(this);
+            return;
         }
 
-        gettimeofday(&fPresentationTime, nullptr); // can be changed to the actual frame's captured time
+        encodedData = std::move(encodedDataBuffer.front().data);
+
+        encodedDataBuffer.pop_front();
+
+        encodedDataBufferBytes -= encodedData.size();
+
+        auto bufferedBytes = encodedDataBufferBytes;
+
+        encodedDataMutex.unlock();
+
+        Metrics::getInstance().set(encodedQueueMetricName, static_cast<int64_t>(bufferedBytes));
+
+        fFrameSize = static_cast<unsigned int>(encodedData.size());
+        fNumTruncatedBytes = 0;
 
         memcpy(fTo, encodedData.data(), fFrameSize); // DO NOT CHANGE ADDRESS, ONLY COPY (see Live555 docs)
 
@@ -96,11 +133,16 @@ namespace LIRS {
 
     void LiveCamFramedSource::doGetNextFrame() {
 
-        if (!encodedDataBuffer.empty()) {
+        encodedDataMutex.lock();
+
+        auto isDataAvailable = !encodedDataBuffer.empty();
+
+        encodedDataMutex.unlock();
+
+        if (isDataAvailable) {
             deliverData();
         } else {
-            fFrameSize = 0;
-            return;
+            fFrameSize = 0; // wait for the event
         }
     }
 }
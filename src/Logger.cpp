@@ -0,0 +1,175 @@
+#include "Logger.hpp"
+
+#ifdef HAVE_LOG4CPP
+
+#include <chrono>
+
+namespace LIRS {
+
+    LogCallSite::LogCallSite() : intervalStart(0), emitted(0), suppressed(0) {}
+
+    bool LogCallSite::acquire() {
+
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        auto start = intervalStart.load(std::memory_order_relaxed);
+
+        // the first thread noticing the expired interval starts the new one
+        if (now - start >= RATE_LIMIT_INTERVAL_MS &&
+            intervalStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+            emitted.store(0, std::memory_order_relaxed);
+        }
+
+        if (emitted.fetch_add(1, std::memory_order_relaxed) < RATE_LIMIT_BURST) return true;
+
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+
+        return false;
+    }
+
+    uint64_t LogCallSite::takeSuppressed() {
+        return suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+    AsyncLogger &AsyncLogger::getInstance() {
+        static AsyncLogger instance;
+        return instance;
+    }
+
+    AsyncLogger::AsyncLogger() : ring(new Slot[RING_CAPACITY]), enqueuePosition(0), dequeuePosition(0),
+                                 droppedRecords(0), level(log4cpp::Priority::DEBUG), isRunning(false) {
+
+        static_assert((RING_CAPACITY & (RING_CAPACITY - 1)) == 0, "Ring capacity should be a power of two");
+
+        for (size_t index = 0; index < RING_CAPACITY; index++) {
+            ring[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+
+    AsyncLogger::~AsyncLogger() {
+
+        if (isRunning.exchange(false)) {
+            drainThread.join();
+        }
+
+        drain(); // the rest of the records
+    }
+
+    void AsyncLogger::start(log4cpp::Priority::Value level) {
+
+        this->level.store(level, std::memory_order_relaxed);
+
+        if (isRunning.exchange(true)) return;
+
+        drainThread = std::thread(&AsyncLogger::drainLoop, this);
+    }
+
+    bool AsyncLogger::isEnabled(log4cpp::Priority::Value priority) const {
+        return priority <= level.load(std::memory_order_relaxed);
+    }
+
+    void AsyncLogger::push(log4cpp::Priority::Value priority, std::string &&message) {
+
+        if (!isRunning.load(std::memory_order_acquire)) {
+            log4cpp::Category::getRoot().log(priority, message);
+            return;
+        }
+
+        auto position = enqueuePosition.load(std::memory_order_relaxed);
+
+        Slot *slot;
+
+        // reserve the slot (multiple producers)
+        while (true) {
+
+            slot = &ring[position & (RING_CAPACITY - 1)];
+
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<int64_t>(sequence - position);
+
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (difference < 0) { // full, the drain thread is behind
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else { // reserved by another producer
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->priority = priority;
+        slot->message = std::move(message);
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        if (priority <= log4cpp::Priority::ERROR) {
+            flush();
+        }
+    }
+
+    void AsyncLogger::flush() {
+
+        auto position = enqueuePosition.load(std::memory_order_acquire);
+
+        while (isRunning.load(std::memory_order_acquire) &&
+               dequeuePosition.load(std::memory_order_acquire) < position) {
+            std::this_thread::yield();
+        }
+    }
+
+    size_t AsyncLogger::drain() {
+
+        size_t written = 0;
+
+        auto position = dequeuePosition.load(std::memory_order_relaxed);
+
+        while (true) {
+
+            auto &slot = ring[position & (RING_CAPACITY - 1)];
+
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1) break; // not committed yet
+
+            log4cpp::Category::getRoot().log(slot.priority, slot.message);
+
+            slot.message.clear();
+            slot.sequence.store(position + RING_CAPACITY, std::memory_order_release);
+
+            dequeuePosition.store(++position, std::memory_order_release);
+            written++;
+        }
+
+        auto dropped = droppedRecords.exchange(0, std::memory_order_relaxed);
+
+        if (dropped > 0) {
+            log4cpp::Category::getRoot().log(log4cpp::Priority::WARN,
+                                             std::to_string(dropped) + " log records have been dropped (queue is full)");
+        }
+
+        return written;
+    }
+
+    void AsyncLogger::drainLoop() {
+
+        while (isRunning.load(std::memory_order_acquire)) {
+
+            if (drain() == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(DRAIN_INTERVAL_MS)));
+            }
+        }
+    }
+
+    LogRecord::LogRecord(LogCallSite &site, log4cpp::Priority::Value priority) : site(site), priority(priority) {}
+
+    LogRecord::~LogRecord() {
+
+        auto suppressed = site.takeSuppressed();
+
+        if (suppressed > 0) {
+            stream << " (" << suppressed << " similar records have been suppressed)";
+        }
+
+        AsyncLogger::getInstance().push(priority, stream.str());
+    }
+}
+
+#endif
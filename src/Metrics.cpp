@@ -0,0 +1,68 @@
+#include "Metrics.hpp"
+
+#include <sstream>
+
+namespace LIRS {
+
+    Metrics &Metrics::getInstance() {
+        static Metrics instance;
+        return instance;
+    }
+
+    void Metrics::set(const std::string &name, int64_t value) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        metrics[name] = value;
+    }
+
+    void Metrics::add(const std::string &name, int64_t delta) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        metrics[name] += delta;
+    }
+
+    int64_t Metrics::get(const std::string &name) const {
+
+        std::lock_guard<std::mutex> lock(metricsMutex);
+
+        auto it = metrics.find(name);
+
+        return it != metrics.end() ? it->second : 0;
+    }
+
+    void Metrics::removeByPrefix(const std::string &prefix) {
+
+        std::lock_guard<std::mutex> lock(metricsMutex);
+
+        auto it = metrics.lower_bound(prefix);
+
+        while (it != metrics.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+            it = metrics.erase(it);
+        }
+    }
+
+    std::map<std::string, int64_t> Metrics::getByPrefix(const std::string &prefix) const {
+
+        std::lock_guard<std::mutex> lock(metricsMutex);
+
+        std::map<std::string, int64_t> result;
+
+        for (auto it = metrics.lower_bound(prefix);
+             it != metrics.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            result.insert(*it);
+        }
+
+        return result;
+    }
+
+    std::string Metrics::dump() const {
+
+        std::lock_guard<std::mutex> lock(metricsMutex);
+
+        std::stringstream result;
+
+        for (auto &metric : metrics) {
+            result << metric.first << " " << metric.second << "\n";
+        }
+
+        return result.str();
+    }
+}
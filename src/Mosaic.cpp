@@ -0,0 +1,316 @@
+#include "Mosaic.hpp"
+#include "Metrics.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+extern "C" {
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+}
+
+namespace LIRS {
+
+    Mosaic::Mosaic(const std::string &name, const std::vector<Transcoder *> &tiles, const MosaicOptions &options)
+            : name(name), options(options), pixelFormat(av_get_pix_fmt(options.pixelFormat.c_str())), columns(0),
+              rows(0), tiles(tiles.size()), blankFrame(nullptr), filterGraph(nullptr), bufferSinkCtx(nullptr),
+              framesComposed(0), staleTilesMetricName("mosaic." + name + ".stale_tiles"),
+              lateFramesMetricName("mosaic." + name + ".late_frames") {
+
+        assert(!tiles.empty());
+        assert(options.tileWidth > 0 && options.tileHeight > 0 && options.frameRate > 0);
+
+        // the black frame is filled per plane
+        auto descriptor = av_pix_fmt_desc_get(pixelFormat);
+
+        assert(descriptor && !(descriptor->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL)) &&
+               descriptor->comp[0].plane == 0 && descriptor->comp[0].step == 1 && descriptor->comp[0].depth == 8);
+
+        columns = options.columns ? options.columns : static_cast<size_t>(std::ceil(std::sqrt(tiles.size())));
+        rows = (tiles.size() + columns - 1) / columns;
+
+        blankFrame = allocateTileFrame();
+
+        for (int plane = 0; plane < 4 && blankFrame->data[plane]; plane++) {
+
+            auto planeHeight = plane == 0 ? blankFrame->height :
+                               AV_CEIL_RSHIFT(blankFrame->height, descriptor->log2_chroma_h);
+
+            memset(blankFrame->data[plane], plane == 0 ? BLACK_LUMA : BLACK_CHROMA,
+                   static_cast<size_t>(blankFrame->linesize[plane] * planeHeight));
+        }
+
+        for (size_t idx = 0; idx < tiles.size(); idx++) {
+
+            this->tiles[idx].latest = allocateTileFrame();
+            this->tiles[idx].scratch = allocateTileFrame();
+
+            if (tiles[idx]->isPassthrough()) {
+                LOG(WARN) << "Tile \"" << tiles[idx]->getAlias() << "\" of the mosaic \"" << name
+                          << "\" is not decoded (passthrough), shown black";
+                continue;
+            }
+
+            auto receiver = std::make_shared<TileReceiver>();
+            receiver->mosaic = this;
+
+            tileReceivers.push_back(receiver);
+
+            tiles[idx]->setOnFilteredFrameCallback([receiver, idx](const AVFrame *frame) {
+
+                std::lock_guard<std::mutex> lock(receiver->mutex);
+
+                if (receiver->mosaic) receiver->mosaic->onTileFrame(idx, frame);
+            });
+        }
+
+        initFilters();
+
+        LOG(INFO) << "Mosaic \"" << name << "\" has been created: " << tiles.size() << " tiles in " << columns << "x"
+                  << rows << " grid of " << options.tileWidth << "x" << options.tileHeight << " at "
+                  << options.frameRate << " fps";
+    }
+
+    Mosaic::~Mosaic() {
+
+        // the tiles' threads may still be running (the tiles may have been removed already, so they're not touched)
+        for (auto &receiver : tileReceivers) {
+            std::lock_guard<std::mutex> lock(receiver->mutex);
+            receiver->mosaic = nullptr;
+        }
+
+        avfilter_graph_free(&filterGraph);
+
+        for (auto &tile : tiles) {
+            av_frame_free(&tile.latest);
+            av_frame_free(&tile.scratch);
+            sws_freeContext(tile.scaler);
+        }
+
+        av_frame_free(&blankFrame);
+
+        LOG(INFO) << "Mosaic \"" << name << "\" has been destructed";
+    }
+
+    std::string Mosaic::getName() const {
+        return "mosaic:" + name;
+    }
+
+    size_t Mosaic::getWidth() const {
+        return columns * options.tileWidth;
+    }
+
+    size_t Mosaic::getHeight() const {
+        return rows * options.tileHeight;
+    }
+
+    AVPixelFormat Mosaic::getPixelFormat() const {
+        return pixelFormat;
+    }
+
+    AVRational Mosaic::getFrameRate() const {
+        return AVRational{static_cast<int>(options.frameRate), 1};
+    }
+
+    bool Mosaic::readFrame(AVFrame *frame) {
+
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(1.0 / options.frameRate));
+
+        while (true) {
+
+            auto now = std::chrono::steady_clock::now();
+
+            if (framesComposed == 0) {
+                nextFrameTime = now;
+            }
+
+            if (now - nextFrameTime > interval) { // the encoder has fallen behind, the frames aren't bursted
+
+                Metrics::getInstance().add(lateFramesMetricName, 1);
+                nextFrameTime = now;
+
+            } else {
+                std::this_thread::sleep_until(nextFrameTime);
+                now = std::chrono::steady_clock::now();
+            }
+
+            nextFrameTime += interval;
+
+            auto staleTimeout = std::chrono::milliseconds(options.staleTileTimeoutMs);
+            int64_t numStaleTiles = 0;
+
+            {
+                std::lock_guard<std::mutex> lock(tilesMutex);
+
+                for (size_t cell = 0; cell < cellSources.size(); cell++) {
+
+                    auto isTileAvailable = cell < tiles.size() && tiles[cell].hasFrame &&
+                                           now - tiles[cell].updateTime < staleTimeout;
+
+                    if (cell < tiles.size() && !isTileAvailable) numStaleTiles++;
+
+                    auto cellFrame = isTileAvailable ? tiles[cell].latest : blankFrame;
+
+                    cellFrame->pts = framesComposed;
+
+                    // referenced by the graph, the tile's thread scales the next frame into another buffer
+                    auto status = av_buffersrc_add_frame_flags(cellSources[cell], cellFrame,
+                                                               AV_BUFFERSRC_FLAG_KEEP_REF);
+                    assert(status >= 0);
+                }
+            }
+
+            framesComposed++;
+
+            Metrics::getInstance().set(staleTilesMetricName, numStaleTiles);
+
+            auto status = av_buffersink_get_frame(bufferSinkCtx, frame);
+
+            if (status >= 0) return true;
+
+            if (status != AVERROR(EAGAIN)) {
+                LOG(ERROR) << "Mosaic \"" << name << "\" can't compose the frame: " << status;
+                return false;
+            }
+        }
+    }
+
+    void Mosaic::onTileFrame(size_t index, const AVFrame *frame) {
+
+        auto &tile = tiles[index];
+
+        tile.scaler = sws_getCachedContext(tile.scaler, frame->width, frame->height,
+                                           static_cast<AVPixelFormat>(frame->format),
+                                           static_cast<int>(options.tileWidth), static_cast<int>(options.tileHeight),
+                                           pixelFormat, SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+
+        // the buffer may still be referenced by the composing graph (reallocated then)
+        av_frame_make_writable(tile.scratch);
+
+        sws_scale(tile.scaler, frame->data, frame->linesize, 0, frame->height, tile.scratch->data,
+                  tile.scratch->linesize);
+
+        std::lock_guard<std::mutex> lock(tilesMutex);
+
+        std::swap(tile.latest, tile.scratch);
+
+        tile.updateTime = std::chrono::steady_clock::now();
+        tile.hasFrame = true;
+    }
+
+    void Mosaic::initFilters() {
+
+        filterGraph = avfilter_graph_alloc();
+
+        AVFilter *bufferSrc = avfilter_get_by_name("buffer");
+        AVFilter *bufferSink = avfilter_get_by_name("buffersink");
+
+        char args[128];
+        snprintf(args, sizeof(args), "width=%d:height=%d:pix_fmt=%d:time_base=1/%u:sar=1/1:frame_rate=%u/1",
+                 static_cast<int>(options.tileWidth), static_cast<int>(options.tileHeight), pixelFormat,
+                 options.frameRate, options.frameRate);
+
+        auto status = avfilter_graph_create_filter(&bufferSinkCtx, bufferSink, "out", nullptr, nullptr, filterGraph);
+        assert(status >= 0);
+
+        AVFilterInOut *outputs = nullptr;
+
+        // each cell is a source (the grid's cells w/o tiles are black)
+        auto numCells = columns * rows;
+
+        cellSources.resize(numCells);
+
+        for (size_t cell = numCells; cell-- > 0;) {
+
+            auto cellName = "c" + std::to_string(cell);
+
+            status = avfilter_graph_create_filter(&cellSources[cell], bufferSrc, cellName.c_str(), args, nullptr,
+                                                  filterGraph);
+            assert(status >= 0);
+
+            auto output = avfilter_inout_alloc();
+            output->name = av_strdup(cellName.c_str());
+            output->filter_ctx = cellSources[cell];
+            output->pad_idx = 0;
+            output->next = outputs;
+
+            outputs = output;
+        }
+
+        AVFilterInOut *inputs = avfilter_inout_alloc();
+        inputs->name = av_strdup("out");
+        inputs->filter_ctx = bufferSinkCtx;
+        inputs->pad_idx = 0;
+        inputs->next = nullptr;
+
+        // position of the cell: sums of the tiles' widths/heights (all tiles are of the same size)
+        auto offset = [](size_t count, const char *dimension) {
+
+            std::string value = count ? "" : "0";
+
+            for (size_t idx = 0; idx < count; idx++) {
+                value += (idx ? "+" : "") + std::string(dimension);
+            }
+
+            return value;
+        };
+
+        std::string query;
+
+        for (size_t cell = 0; cell < numCells; cell++) {
+            query += "[c" + std::to_string(cell) + "]";
+        }
+
+        if (numCells == 1) {
+
+            query += "null[out]";
+
+        } else if (avfilter_get_by_name("xstack")) {
+
+            query += "xstack=inputs=" + std::to_string(numCells) + ":layout=";
+
+            for (size_t cell = 0; cell < numCells; cell++) {
+                query += (cell ? "|" : "") + offset(cell % columns, "w0") + "_" + offset(cell / columns, "h0");
+            }
+
+            query += "[out]";
+
+        } else { // FFmpeg w/o xstack (before 4.1): the first cell is padded to the grid, the others are overlaid
+
+            query = "[c0]pad=" + std::to_string(getWidth()) + ":" + std::to_string(getHeight()) + ":0:0[s0]";
+
+            for (size_t cell = 1; cell < numCells; cell++) {
+                query += ";[s" + std::to_string(cell - 1) + "][c" + std::to_string(cell) + "]overlay=" +
+                         std::to_string(cell % columns * options.tileWidth) + ":" +
+                         std::to_string(cell / columns * options.tileHeight) +
+                         (cell + 1 < numCells ? "[s" + std::to_string(cell) + "]" : "[out]");
+            }
+        }
+
+        status = avfilter_graph_parse(filterGraph, query.c_str(), inputs, outputs, nullptr);
+        assert(status >= 0);
+
+        status = avfilter_graph_config(filterGraph, nullptr);
+        assert(status >= 0);
+
+        LOG(INFO) << "Mosaic \"" << name << "\" filter graph: " << query;
+    }
+
+    AVFrame *Mosaic::allocateTileFrame() const {
+
+        auto frame = av_frame_alloc();
+
+        frame->width = static_cast<int>(options.tileWidth);
+        frame->height = static_cast<int>(options.tileHeight);
+        frame->format = pixelFormat;
+
+        auto status = av_frame_get_buffer(frame, 0);
+        assert(status == 0);
+
+        return frame;
+    }
+}
@@ -0,0 +1,132 @@
+#include "MotionDetector.hpp"
+
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace LIRS {
+
+    MotionDetector::MotionDetector() : blocksX(0), blocksY(0), hasReference(false) {}
+
+    double MotionDetector::computeScore(const uint8_t *luma, int linesize, size_t width, size_t height) {
+
+        auto newBlocksX = width / BLOCK_SIZE;
+        auto newBlocksY = height / BLOCK_SIZE;
+
+        if (newBlocksX != blocksX || newBlocksY != blocksY) { // resolution has been changed
+            blocksX = newBlocksX;
+            blocksY = newBlocksY;
+            currentPlane.assign(blocksX * blocksY, 0);
+            referencePlane.assign(blocksX * blocksY, 0);
+            hasReference = false;
+        }
+
+        if (currentPlane.empty()) return -1.0; // frame is smaller than a block
+
+        downsample(luma, linesize);
+
+        if (!hasReference) return -1.0;
+
+        return static_cast<double>(sumOfAbsoluteDifferences(currentPlane.data(), referencePlane.data(),
+                                                             currentPlane.size())) / currentPlane.size();
+    }
+
+    void MotionDetector::updateReference() {
+        referencePlane.swap(currentPlane);
+        hasReference = !referencePlane.empty();
+    }
+
+    void MotionDetector::reset() {
+        hasReference = false;
+    }
+
+    void MotionDetector::getChangedBlocks(unsigned threshold, std::vector<uint8_t> &mask) const {
+
+        mask.assign(currentPlane.size(), hasReference ? 0 : 1); // everything is changed w/o reference
+
+        if (!hasReference) return;
+
+        for (size_t idx = 0; idx < currentPlane.size(); ++idx) {
+            mask[idx] = static_cast<unsigned>(std::abs(currentPlane[idx] - referencePlane[idx])) > threshold;
+        }
+    }
+
+    size_t MotionDetector::getBlocksX() const {
+        return blocksX;
+    }
+
+    size_t MotionDetector::getBlocksY() const {
+        return blocksY;
+    }
+
+    void MotionDetector::downsample(const uint8_t *luma, int linesize) {
+
+        static const unsigned BLOCK_AREA = BLOCK_SIZE * BLOCK_SIZE;
+
+        for (size_t by = 0; by < blocksY; ++by) {
+
+            auto blockRow = luma + by * BLOCK_SIZE * linesize;
+            auto out = currentPlane.data() + by * blocksX;
+
+            size_t bx = 0;
+
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+
+            // two blocks per iteration: psadbw against zero sums 8 bytes into each 64-bit lane
+            for (; bx + 2 <= blocksX; bx += 2) {
+
+                __m128i acc = _mm_setzero_si128();
+
+                for (size_t row = 0; row < BLOCK_SIZE; ++row) {
+                    auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                                                          blockRow + row * linesize + bx * BLOCK_SIZE));
+                    acc = _mm_add_epi64(acc, _mm_sad_epu8(pixels, zero));
+                }
+
+                out[bx] = static_cast<uint8_t>((_mm_cvtsi128_si32(acc) + BLOCK_AREA / 2) / BLOCK_AREA);
+                out[bx + 1] = static_cast<uint8_t>((_mm_extract_epi16(acc, 4) + BLOCK_AREA / 2) / BLOCK_AREA);
+            }
+#endif
+            for (; bx < blocksX; ++bx) {
+
+                unsigned sum = 0;
+
+                for (size_t row = 0; row < BLOCK_SIZE; ++row) {
+                    auto pixels = blockRow + row * linesize + bx * BLOCK_SIZE;
+                    for (size_t col = 0; col < BLOCK_SIZE; ++col) {
+                        sum += pixels[col];
+                    }
+                }
+
+                out[bx] = static_cast<uint8_t>((sum + BLOCK_AREA / 2) / BLOCK_AREA);
+            }
+        }
+    }
+
+    uint64_t MotionDetector::sumOfAbsoluteDifferences(const uint8_t *lhs, const uint8_t *rhs, size_t size) {
+
+        uint64_t sum = 0;
+        size_t idx = 0;
+
+#ifdef __SSE2__
+        __m128i acc = _mm_setzero_si128();
+
+        for (; idx + 16 <= size; idx += 16) {
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs + idx));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + idx));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+        }
+
+        sum = static_cast<uint64_t>(_mm_cvtsi128_si32(acc)) +
+              static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+        for (; idx < size; ++idx) {
+            sum += static_cast<uint64_t>(std::abs(lhs[idx] - rhs[idx]));
+        }
+
+        return sum;
+    }
+}
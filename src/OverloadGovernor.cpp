@@ -0,0 +1,87 @@
+#include "OverloadGovernor.hpp"
+
+namespace LIRS {
+
+    constexpr double OverloadGovernor::LOAD_SMOOTHING;
+
+    OverloadGovernor::OverloadGovernor() : levelIndex(0), load(0.0), overloadedFrames(0), headroomFrames(0) {}
+
+    void OverloadGovernor::configure(const OverloadGovernorOptions &options) {
+
+        this->options = options;
+
+        if (this->options.ladder.empty()) {
+            this->options.ladder.emplace_back(); // nominal level only
+        }
+
+        moveTo(0);
+        load = 0.0;
+    }
+
+    bool OverloadGovernor::update(uint64_t processingTime, uint64_t budget) {
+
+        if (!options.enabled || budget == 0) return false;
+
+        auto frameLoad = static_cast<double>(processingTime) / budget;
+
+        load = load > 0.0 ? load + LOAD_SMOOTHING * (frameLoad - load) : frameLoad;
+
+        overloadedFrames = load > options.overloadThreshold ? overloadedFrames + 1 : 0;
+
+        if (overloadedFrames >= options.overloadFrames && levelIndex + 1 < options.ladder.size()) {
+            moveTo(levelIndex + 1);
+            return true;
+        }
+
+        if (levelIndex == 0) return false;
+
+        // load expected at the upper level: more frames per second and larger frames
+        auto &current = options.ladder[levelIndex];
+        auto &upper = options.ladder[levelIndex - 1];
+
+        auto expectedLoad = load * (upper.frameRateFactor / current.frameRateFactor) *
+                            (upper.scale * upper.scale) / (current.scale * current.scale);
+
+        headroomFrames = expectedLoad < options.recoveryThreshold ? headroomFrames + 1 : 0;
+
+        if (headroomFrames >= options.recoveryFrames) {
+            moveTo(levelIndex - 1);
+            return true;
+        }
+
+        return false;
+    }
+
+    size_t OverloadGovernor::getLevelIndex() const {
+        return levelIndex;
+    }
+
+    const QualityLevel &OverloadGovernor::getLevel() const {
+        return options.ladder[levelIndex];
+    }
+
+    double OverloadGovernor::getLoad() const {
+        return load;
+    }
+
+    bool OverloadGovernor::isEnabled() const {
+        return options.enabled;
+    }
+
+    void OverloadGovernor::moveTo(size_t newLevelIndex) {
+
+        // the load is measured against the new budget from now on
+        if (newLevelIndex != levelIndex && !options.ladder.empty()) {
+
+            auto &current = options.ladder[levelIndex];
+            auto &next = options.ladder[newLevelIndex];
+
+            load *= (next.frameRateFactor / current.frameRateFactor) * (next.scale * next.scale) /
+                    (current.scale * current.scale);
+        }
+
+        levelIndex = newLevelIndex;
+        overloadedFrames = 0;
+        headroomFrames = 0;
+    }
+}
@@ -0,0 +1,195 @@
+#include "RetransmissionCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Metrics.hpp"
+
+namespace LIRS {
+
+    /* RetransmissionPayloads */
+
+    RetransmissionPayloads::RetransmissionPayloads(size_t numPayloads, const std::string &streamName)
+            : streamName(streamName), numSlots(std::max<size_t>(numPayloads, 1)), slotSize(0), nextSlot(0) {}
+
+    RetransmissionPayloads::~RetransmissionPayloads() {
+
+        if (storage.empty()) return;
+
+        Metrics::getInstance().add("nack." + streamName + ".cache_bytes", -static_cast<int64_t>(getMemorySize()));
+        Metrics::getInstance().add("memory." + streamName + ".retransmission_bytes",
+                                   -static_cast<int64_t>(getMemorySize()));
+    }
+
+    bool RetransmissionPayloads::store(const uint8_t *payload, size_t size, size_t maxSize, Reference &reference) {
+
+        if (storage.empty()) { // allocated once by the first playing client
+
+            slotSize = std::min<size_t>(std::max<size_t>(maxSize, 1), UINT16_MAX);
+
+            slots.assign(numSlots, Slot{0, 0, 0});
+            storage.resize(numSlots * slotSize);
+
+            Metrics::getInstance().add("nack." + streamName + ".cache_bytes", static_cast<int64_t>(getMemorySize()));
+            Metrics::getInstance().add("memory." + streamName + ".retransmission_bytes",
+                                       static_cast<int64_t>(getMemorySize()));
+        }
+
+        if (size == 0 || size > slotSize) return false;
+
+        auto hash = hashPayload(payload, size);
+
+        auto stored = slotsByHash.find(hash);
+
+        if (stored != slotsByHash.end()) {
+
+            auto index = stored->second;
+            auto &slot = slots[index];
+
+            // the payload overwritten soon (e.g. the parameter sets of the previous GOP) is stored again
+            auto remainingStores = (index + numSlots - nextSlot) % numSlots;
+
+            if (slot.size == size && remainingStores >= numSlots / 2 &&
+                memcmp(&storage[index * slotSize], payload, size) == 0) { // sent to another client
+
+                reference = Reference{index, slot.generation};
+                return true;
+            }
+        }
+
+        auto index = static_cast<uint32_t>(nextSlot);
+        auto &slot = slots[index];
+
+        nextSlot = (nextSlot + 1) % numSlots;
+
+        if (slot.size > 0) { // the oldest payload is overwritten
+
+            auto overwritten = slotsByHash.find(slot.hash);
+
+            if (overwritten != slotsByHash.end() && overwritten->second == index) {
+                slotsByHash.erase(overwritten);
+            }
+        }
+
+        memcpy(&storage[index * slotSize], payload, size);
+
+        slot.generation++;
+        slot.size = static_cast<uint16_t>(size);
+        slot.hash = hash;
+
+        slotsByHash[hash] = index;
+
+        reference = Reference{index, slot.generation};
+
+        return true;
+    }
+
+    const uint8_t *RetransmissionPayloads::find(const Reference &reference, size_t &size) const {
+
+        if (reference.slot >= slots.size()) return nullptr;
+
+        auto &slot = slots[reference.slot];
+
+        if (slot.size == 0 || slot.generation != reference.generation) return nullptr;
+
+        size = slot.size;
+
+        return &storage[reference.slot * slotSize];
+    }
+
+    size_t RetransmissionPayloads::getNumPayloads() const {
+        return numSlots;
+    }
+
+    size_t RetransmissionPayloads::getMemorySize() const {
+        return storage.size() + slots.size() * sizeof(Slot);
+    }
+
+    uint64_t RetransmissionPayloads::hashPayload(const uint8_t *payload, size_t size) {
+
+        const size_t sampleSize = 32;
+
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL ^ size;
+
+        auto add = [&hash](const uint8_t *data, size_t length) {
+            for (size_t idx = 0; idx < length; idx++) {
+                hash = (hash ^ data[idx]) * 1099511628211ULL;
+            }
+        };
+
+        add(payload, std::min(size, sampleSize));
+
+        if (size > sampleSize) {
+            auto tailSize = std::min(size - sampleSize, sampleSize);
+            add(payload + size - tailSize, tailSize);
+        }
+
+        return hash;
+    }
+
+    /* RetransmissionCache */
+
+    RetransmissionCache::RetransmissionCache(size_t numPackets, size_t maxPacketSize,
+                                             const std::shared_ptr<RetransmissionPayloads> &payloads)
+            : payloads(payloads), maxPayloadSize(maxPacketSize > MAX_HEADER_SIZE ? maxPacketSize - MAX_HEADER_SIZE : 0),
+              indexMask(0) {
+
+        size_t numSlots = 1;
+
+        // the sequence numbers wrap at 2^16, so the number of the slots should divide it
+        while (numSlots < std::min<size_t>(numPackets, 1u << 15)) {
+            numSlots <<= 1;
+        }
+
+        indexMask = numSlots - 1;
+
+        slots.assign(numSlots, Slot());
+        packet.reserve(maxPacketSize);
+    }
+
+    void RetransmissionCache::store(uint16_t sequenceNumber, const uint8_t *header, size_t headerSize,
+                                    const uint8_t *payload, size_t payloadSize) {
+
+        auto &slot = slots[sequenceNumber & indexMask];
+
+        // the older packet isn't valid anymore in any case
+        if (headerSize == 0 || headerSize > MAX_HEADER_SIZE ||
+            !payloads->store(payload, payloadSize, maxPayloadSize, slot.payload)) {
+            slot.headerSize = 0;
+            return;
+        }
+
+        memcpy(slot.header, header, headerSize);
+
+        slot.sequenceNumber = sequenceNumber;
+        slot.headerSize = static_cast<uint8_t>(headerSize);
+    }
+
+    const uint8_t *RetransmissionCache::find(uint16_t sequenceNumber, size_t &size) {
+
+        auto &slot = slots[sequenceNumber & indexMask];
+
+        if (slot.headerSize == 0 || slot.sequenceNumber != sequenceNumber) return nullptr;
+
+        size_t payloadSize = 0;
+        auto payload = payloads->find(slot.payload, payloadSize);
+
+        if (!payload) return nullptr; // overwritten by the newer payloads of the stream
+
+        packet.assign(slot.header, slot.header + slot.headerSize);
+        packet.insert(packet.end(), payload, payload + payloadSize);
+
+        size = packet.size();
+
+        return packet.data();
+    }
+
+    size_t RetransmissionCache::getNumPackets() const {
+        return slots.size();
+    }
+
+    size_t RetransmissionCache::getMemorySize() const {
+        return slots.size() * sizeof(Slot) + packet.capacity();
+    }
+}
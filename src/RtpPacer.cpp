@@ -0,0 +1,214 @@
+#include "RtpPacer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "DebugAllocator.hpp"
+#include "Metrics.hpp"
+
+namespace LIRS {
+
+    RtpPacer *RtpPacer::createNew(UsageEnvironment &env, HevcNalPacketizer *inputSource, unsigned maxPayloadSize,
+                                  unsigned spreadUs, const std::string &streamName) {
+        return new RtpPacer(env, inputSource, maxPayloadSize, spreadUs, streamName);
+    }
+
+    RtpPacer::RtpPacer(UsageEnvironment &env, HevcNalPacketizer *inputSource, unsigned maxPayloadSize,
+                       unsigned spreadUs, const std::string &streamName)
+            : FramedFilter(env, inputSource), spreadUs(spreadUs),
+              queuedPacketsMetricName("pacing." + streamName + ".queued_packets"),
+              delayMetricName("pacing." + streamName + ".delay_us"),
+              queuedBytesMetricName("memory." + streamName + ".pacing_bytes"), unreportedPackets(0),
+              unreportedBytes(0), readBuffer(maxPayloadSize), queuedBytes(0), numUnscheduled(0), spreadEndUs(0),
+              isReading(false), isReadingAhead(false), isStopped(false), lastPacketEndsPicture(false),
+              deliveryTask(nullptr) {}
+
+    RtpPacer::~RtpPacer() {
+
+        clearQueue();
+
+        detachInputSource(); // the packetizer is closed by the sink
+    }
+
+    bool RtpPacer::isPictureEnd() const {
+        return lastPacketEndsPicture;
+    }
+
+    int64_t RtpPacer::nowMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void RtpPacer::doGetNextFrame() {
+
+        isStopped = false;
+
+        // reading is resumed here when the queue has been full
+        readAhead();
+
+        deliverPacket();
+    }
+
+    void RtpPacer::doStopGettingFrames() {
+
+        clearQueue();
+
+        isReading = false;
+        isStopped = true;
+        spreadEndUs = 0;
+
+        FramedFilter::doStopGettingFrames();
+    }
+
+    void RtpPacer::clearQueue() {
+
+        envir().taskScheduler().unscheduleDelayedTask(deliveryTask);
+
+        unreportedPackets -= static_cast<int64_t>(queue.size());
+        unreportedBytes -= static_cast<int64_t>(queuedBytes);
+
+        reportQueue();
+
+        queue.clear();
+        queuedBytes = 0;
+        numUnscheduled = 0;
+    }
+
+    void RtpPacer::readPacket() {
+
+        isReading = true;
+
+        fInputSource->getNextFrame(readBuffer.data(), static_cast<unsigned>(readBuffer.size()), afterGettingPacket,
+                                   this, FramedSource::handleClosure, this);
+    }
+
+    void RtpPacer::readAhead() {
+
+        if (isReadingAhead) return; // called by the synchronous delivery, the loop reads the next payload
+
+        isReadingAhead = true;
+
+        // the packetizer delivers synchronously while it has the data (e.g. all fragments of a keyframe)
+        while (!isReading && !isStopped && queue.size() < MAX_QUEUED_PACKETS) {
+            readPacket();
+        }
+
+        isReadingAhead = false;
+    }
+
+    void RtpPacer::reportQueue() {
+
+        if (unreportedPackets != 0) Metrics::getInstance().add(queuedPacketsMetricName, unreportedPackets);
+        if (unreportedBytes != 0) Metrics::getInstance().add(queuedBytesMetricName, unreportedBytes);
+
+        unreportedPackets = 0;
+        unreportedBytes = 0;
+    }
+
+    void RtpPacer::afterGettingPacket(void *clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                      struct timeval presentationTime, unsigned) {
+        static_cast<RtpPacer *>(clientData)->afterGettingPacket(frameSize, numTruncatedBytes, presentationTime);
+    }
+
+    void RtpPacer::afterGettingPacket(unsigned frameSize, unsigned numTruncatedBytes,
+                                      struct timeval presentationTime) {
+
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_RTP);
+
+        isReading = false;
+
+        if (numTruncatedBytes > 0) {
+            LOG(WARN) << "RTP payload of " << (frameSize + numTruncatedBytes) << " bytes has been truncated to "
+                      << frameSize << " bytes";
+        }
+
+        auto endsPicture = static_cast<HevcNalPacketizer *>(fInputSource)->isPictureEnd();
+
+        queue.push_back(PacedPacket{std::vector<uint8_t>(readBuffer.begin(), readBuffer.begin() + frameSize),
+                                    presentationTime, endsPicture, nowMicros(), -1});
+        numUnscheduled++;
+        queuedBytes += frameSize;
+
+        unreportedPackets++;
+        unreportedBytes += frameSize;
+
+        if (endsPicture || queue.size() >= MAX_QUEUED_PACKETS) {
+            schedulePackets();
+            reportQueue();
+        }
+
+        // read ahead, the next picture is scheduled as soon as it's complete
+        readAhead();
+
+        deliverPacket();
+    }
+
+    void RtpPacer::schedulePackets() {
+
+        if (numUnscheduled == 0) return;
+
+        auto startUs = std::max(nowMicros(), spreadEndUs);
+        auto intervalUs = static_cast<int64_t>(spreadUs / numUnscheduled);
+
+        auto packet = queue.end() - numUnscheduled;
+
+        for (size_t idx = 0; packet != queue.end(); ++packet, ++idx) {
+            packet->dueTimeUs = startUs + static_cast<int64_t>(idx) * intervalUs;
+        }
+
+        spreadEndUs = startUs + static_cast<int64_t>(numUnscheduled) * intervalUs;
+        numUnscheduled = 0;
+    }
+
+    void RtpPacer::deliverPacket() {
+
+        // the sink hasn't asked for the payload yet, or it's waiting for the due time
+        if (!isCurrentlyAwaitingData() || deliveryTask) return;
+
+        if (queue.empty() || queue.front().dueTimeUs < 0) return; // delivered when the picture is read
+
+        auto now = nowMicros();
+        auto &packet = queue.front();
+
+        if (packet.dueTimeUs > now) {
+            deliveryTask = envir().taskScheduler().scheduleDelayedTask(packet.dueTimeUs - now, onDeliveryTime, this);
+            return;
+        }
+
+        auto size = static_cast<unsigned>(packet.payload.size());
+
+        fFrameSize = std::min(size, fMaxSize);
+        fNumTruncatedBytes = size - fFrameSize;
+
+        memcpy(fTo, packet.payload.data(), fFrameSize);
+
+        fPresentationTime = packet.presentationTime;
+        fDurationInMicroseconds = 0;
+        lastPacketEndsPicture = packet.endsPicture;
+
+        auto isPictureSent = packet.endsPicture;
+
+        if (isPictureSent) {
+            Metrics::getInstance().set(delayMetricName, now - packet.queueTimeUs);
+        }
+
+        queue.pop_front();
+        queuedBytes -= size;
+
+        unreportedPackets--;
+        unreportedBytes -= size;
+
+        if (isPictureSent || queue.empty()) reportQueue();
+
+        FramedSource::afterGetting(this);
+    }
+
+    void RtpPacer::onDeliveryTime(void *clientData) {
+
+        auto pacer = static_cast<RtpPacer *>(clientData);
+
+        pacer->deliveryTask = nullptr;
+        pacer->deliverPacket();
+    }
+}
@@ -1,86 +1,165 @@
 #include "Transcoder.hpp"
-
+#include "DebugAllocator.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <mutex>
 #include <utility>
 
+#ifdef HAVE_X265_H
+#include <x265.h>
+#endif
+
 namespace LIRS {
 
     Transcoder *Transcoder::newInstance(const std::string &sourceUrl, const std::string &devAlias,
                                         size_t frameWidth, size_t frameHeight, const std::string &rawPixelFormatStr,
                                         const std::string &encoderPixelFormatStr, size_t frameRate, size_t outputFrameRate,
-                                        const std::string &filterQuery) {
+                                        const std::string &filterQuery, const std::string &inputFormatName) {
 
         // create new instance
-        return new Transcoder(sourceUrl, devAlias, frameWidth, frameHeight, rawPixelFormatStr, encoderPixelFormatStr,
-                              frameRate, outputFrameRate, filterQuery);
+        auto transcoder = new Transcoder(sourceUrl, devAlias, frameWidth, frameHeight, rawPixelFormatStr,
+                                         encoderPixelFormatStr, frameRate, outputFrameRate, filterQuery,
+                                         inputFormatName);
+
+        return initializedOrNull(transcoder);
+    }
+
+    Transcoder *Transcoder::newInstance(RawFrameSource *source, const std::string &devAlias,
+                                        const std::string &encoderPixelFormatStr, size_t outputFrameRate,
+                                        const std::string &filterQuery) {
+
+        assert(source);
+
+        // size, pixel format and framerate are given by the source
+        auto transcoder = new Transcoder(source->getName(), devAlias, source->getWidth(), source->getHeight(),
+                                         av_get_pix_fmt_name(source->getPixelFormat()), encoderPixelFormatStr, 0,
+                                         outputFrameRate, filterQuery, {}, source);
+
+        return initializedOrNull(transcoder);
+    }
+
+    Transcoder *Transcoder::initializedOrNull(Transcoder *transcoder) {
+
+        if (transcoder->isInitialized) return transcoder;
+
+        LOG(ERROR) << "Transcoder for \"" << transcoder->videoSourceUrl << "\" couldn't be initialized";
+
+        delete transcoder; // the opened contexts have been released by the constructor
+
+        return nullptr;
+    }
+
+    /**
+     * Logs the failed step of the transcoder's initialization.
+     *
+     * @param url - video source of the transcoder.
+     * @param step - description of the step.
+     * @param statCode - FFmpeg's error code (0 - none).
+     * @return false.
+     */
+    static bool initializationFailed(const std::string &url, const std::string &step, int statCode = 0) {
+
+        char error[AV_ERROR_MAX_STRING_SIZE] = {};
+
+        if (statCode < 0) av_strerror(statCode, error, sizeof(error));
+
+        LOG(ERROR) << "Transcoder for \"" << url << "\": " << step << (statCode < 0 ? std::string(": ") + error : "");
+
+        return false;
+    }
+
+    /**
+     * Returns the number of nanoseconds elapsed since the specified time point.
+     */
+    static uint64_t elapsedNanos(const std::chrono::steady_clock::time_point &since) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - since).count());
+    }
+
+    /**
+     * Returns CPU time consumed by the calling thread in nanoseconds.
+     */
+    static uint64_t threadCpuTimeNanos() {
+        timespec ts{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
     }
 
     // TODO: make the destruction process more easy and controllable
     Transcoder::~Transcoder() {
 
-        isPlayingFlag.store(false); // signal to stop decoding/encoding frames
+        isStopRequested.store(true); // signal to stop decoding/encoding frames
+
+        EncoderThreadBudget::getInstance().unregisterEncoder(this); // if run() has not been called
 
         LOG(INFO) << "Transcoder has been destructed";
     }
 
     void Transcoder::run() {
 
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_TRANSCODER);
+
         // set the flag indicating that we're streaming
         isPlayingFlag.store(true);
 
-        // read raw data from the device into the packet
-        while (isPlayingFlag.load() && av_read_frame(decoderContext.formatContext, decodingPacket) == 0) {
+        // published on start: the stream of the same alias replaced by this one has removed its metrics meanwhile
+        Metrics::getInstance().set("startup." + deviceAlias + ".init_ms", static_cast<int64_t>(initializationTimeMs));
+        updateFramePoolMetric();
 
-            // check whether it is a video stream's data
-            if (decodingPacket->stream_index == decoderContext.videoStream->index) {
+        // options changed before run() are applied before the first frame (nothing is encoded or flushed yet)
+        if (isEncoderReconfigurationRequested.exchange(false)) {
+            reopenEncoder();
+        }
 
-                // fill raw frame with data from decoded packet
-                if (decode(decoderContext.codecContext, rawFrame, decodingPacket)) {
+        auto cpuTimeAtStart = threadCpuTimeNanos();
 
-                    // push frames to the buffer
-                    auto statusCode = av_buffersrc_add_frame_flags(bufferSrcCtx, rawFrame, AV_BUFFERSRC_FLAG_KEEP_REF);
+        // frames produced in the process (e.g. mosaic) are filtered and encoded as the decoded ones
+        while (frameSource && !isStopRequested.load() && frameSource->readFrame(rawFrame)) {
 
-                    if (statusCode < 0) continue; // workaround for buggy cameras
+            statistics.framesDecoded++;
 
-                    // pull frames from the filter graph
-                    while (true) {
+            processRawFrame(rawFrame);
 
-                        statusCode = av_buffersink_get_frame(bufferSinkCtx, filterFrame);
+            av_frame_unref(rawFrame);
 
-                        if (statusCode == AVERROR(EAGAIN) || statusCode == AVERROR_EOF) {
-                            break;
-                        }
+            statistics.threadCpuTime.store(threadCpuTimeNanos() - cpuTimeAtStart);
+        }
 
-                        assert(statusCode >= 0);
+        // read raw data from the device into the packet
+        while (!frameSource && !isStopRequested.load() &&
+               av_read_frame(decoderContext.formatContext, decodingPacket) == 0) {
 
-                        av_frame_make_writable(convertedFrame);
+            // check whether it is a video stream's data
+            if (decodingPacket->stream_index != decoderContext.videoStream->index) {
 
-                        // convert raw frame into another pixel format
-                        sws_scale(converterContext, filterFrame->data,
-                                  filterFrame->linesize, 0, static_cast<int>(frameHeight),
-                                  convertedFrame->data, convertedFrame->linesize);
+                av_packet_unref(decodingPacket);
+                continue;
+            }
 
-                        // copy pts/dts, etc.
-                        av_frame_copy_props(convertedFrame, filterFrame);
+            statistics.packetsRead++;
 
-                        if (encode(encoderContext.codecContext, convertedFrame, encodingPacket) >= 0) {
+            if (passthrough) {
 
-                            // new encoded data is available (one NALU)
-                            if (onEncodedDataCallback) {
-                                onEncodedDataCallback(
-                                        std::vector<uint8_t>(encodingPacket->data + NALU_START_CODE_BYTES_NUMBER,
-                                                             encodingPacket->data + encodingPacket->size)
-                                );
-                            }
-                        }
+                // the source's data is already encoded, forward it as is
+                deliverEncodedData(decodingPacket);
 
-                        av_packet_unref(encodingPacket);
-                    }
+            } else {
 
-                    av_frame_unref(filterFrame);
-                }
+                // decoded frames are filtered and encoded (all of them, a packet can contain multiple frames)
+                decode(decoderContext.codecContext, rawFrame, decodingPacket);
             }
 
             av_packet_unref(decodingPacket);
+
+            statistics.threadCpuTime.store(threadCpuTimeNanos() - cpuTimeAtStart);
+        }
+
+        if (!passthrough) {
+            flush(); // frames buffered by the decoder, the filter graph and the encoder
         }
 
         // capturing from the device is unavailable
@@ -89,104 +168,537 @@ namespace LIRS {
         cleanup(); // free memory, close handles, etc.
     }
 
+    void Transcoder::processRawFrame(AVFrame *frame) {
+
+        auto stageStart = std::chrono::steady_clock::now();
+
+        // push frames to the buffer (nullptr - end of stream)
+        auto statusCode = av_buffersrc_add_frame_flags(bufferSrcCtx, frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+
+        if (statusCode < 0) return; // workaround for buggy cameras
+
+        // pull frames from the filter graph
+        while (true) {
+
+            statusCode = av_buffersink_get_frame(bufferSinkCtx, filterFrame);
+
+            statistics.filterTime += elapsedNanos(stageStart);
+
+            if (statusCode == AVERROR(EAGAIN) || statusCode == AVERROR_EOF) {
+                break;
+            }
+
+            assert(statusCode >= 0);
+
+            statistics.framesFiltered++;
+
+            {
+                std::lock_guard<std::mutex> lock(filteredFrameCallbackMutex);
+
+                if (onFilteredFrameCallback) {
+                    onFilteredFrameCallback(filterFrame);
+                }
+            }
+
+            if (frameBusFrames && !busSinkCtx) { // published as filtered
+                frameBusFrames->publishFrame(filterFrame, av_buffersink_get_time_base(bufferSinkCtx));
+            }
+
+            // the requested keyframe is sent on the next frame, even if the scene is static
+            auto isKeyframe = isKeyframeForced();
+
+            // static scene is detected on the raw frame if possible, skipping the conversion as well
+            auto isEncoding = !motionGating.enabled || !isRawLumaPlanar || isEncodingRequired(filterFrame, isKeyframe);
+
+            if (isEncoding) {
+
+                stageStart = std::chrono::steady_clock::now();
+
+                av_frame_make_writable(convertedFrame);
+
+                // convert raw frame into another pixel format
+                sws_scale(converterContext, filterFrame->data,
+                          filterFrame->linesize, 0, filterFrame->height,
+                          convertedFrame->data, convertedFrame->linesize);
+
+                // copy pts/dts, etc.
+                av_frame_copy_props(convertedFrame, filterFrame);
+
+                // the decoder's picture type (an intra frame for raw input) would force the encoder's one
+                convertedFrame->pict_type = AV_PICTURE_TYPE_NONE;
+
+                // the filter's time base follows the framerate of the quality level
+                convertedFrame->pts = av_rescale_q(filterFrame->pts,
+                                                   av_buffersink_get_time_base(bufferSinkCtx),
+                                                   encoderContext.codecContext->time_base);
+
+                statistics.scaleTime += elapsedNanos(stageStart);
+
+                if (motionGating.enabled && !isRawLumaPlanar) {
+                    isEncoding = isEncodingRequired(convertedFrame, isKeyframe);
+                }
+            }
+
+            if (isEncoding) {
+
+                if (isEncoderReconfigurationRequested.exchange(false)) {
+                    reopenEncoder();
+                }
+
+                if (isKeyframe) {
+                    convertedFrame->pict_type = AV_PICTURE_TYPE_I;
+                }
+
+                // all packets available after this frame are delivered
+                encode(encoderContext.codecContext, convertedFrame, encodingPacket);
+
+            } else {
+                statistics.framesSkipped++;
+            }
+
+            if (governor.isEnabled()) {
+
+                auto processingTime = statistics.decodeTime + statistics.filterTime +
+                                      statistics.scaleTime + statistics.encodeTime;
+
+                // time spent since the previous frame against the frame interval of the current level
+                if (governor.update(processingTime - processingTimeAtLastFrame,
+                                    static_cast<uint64_t>(1e9 / av_q2d(getLevelFrameRate())))) {
+                    isQualityLevelChangePending = true;
+                }
+
+                processingTimeAtLastFrame = processingTime;
+
+                Metrics::getInstance().set(governorLoadMetricName, static_cast<int64_t>(governor.getLoad() * 1000));
+            }
+
+            av_frame_unref(filterFrame);
+
+            stageStart = std::chrono::steady_clock::now();
+        }
+
+        // frames of the frame bus' branch (should be drained along with the main output)
+        while (busSinkCtx && av_buffersink_get_frame(busSinkCtx, busFrame) >= 0) {
+            frameBusFrames->publishFrame(busFrame, av_buffersink_get_time_base(busSinkCtx));
+            av_frame_unref(busFrame);
+        }
+
+        // the graph is not rebuilt while being flushed
+        if (isQualityLevelChangePending && frame) {
+            isQualityLevelChangePending = false;
+            applyQualityLevel();
+        }
+    }
+
+    void Transcoder::flush() {
+
+        // drain the decoder (nullptr packet), the filter graph (end of stream) and the encoder (nullptr frame)
+        if (!frameSource) {
+            decode(decoderContext.codecContext, rawFrame, nullptr);
+        }
+
+        processRawFrame(nullptr);
+
+        encode(encoderContext.codecContext, nullptr, encodingPacket);
+
+        LOG(INFO) << "Transcoding pipeline of \"" << videoSourceUrl << "\" has been flushed";
+    }
 
     Transcoder::Transcoder(const std::string &url, const std::string &alias, size_t w, size_t h,
                            const std::string &rawPixFmtStr, const std::string &encPixFmtStr,
-                           size_t frameRate, size_t outFrameRate, const std::string &filterQuery)
-            : videoSourceUrl(url), deviceAlias(alias), frameWidth(w), frameHeight(h),
+                           size_t frameRate, size_t outFrameRate, const std::string &filterQuery,
+                           const std::string &inputFormatName, RawFrameSource *frameSource)
+            : videoSourceUrl(url), deviceAlias(alias), inputFormatName(inputFormatName), frameSource(frameSource),
+              frameWidth(w), frameHeight(h),
+              outputWidth(w), outputHeight(h),
+              inputCodecId(AV_CODEC_ID_RAWVIDEO), passthrough(false),
               frameRate(AVRational{(int) frameRate, 1}), outputFrameRate(AVRational{(int) outFrameRate, 1}),
-              sourceBitRate(0), decoderContext({}), encoderContext({}), rawFrame(nullptr), convertedFrame(nullptr),
+              sourceBitRate(0), inputTimeBase(AVRational{1, 1}), inputAspectRatio(AVRational{0, 1}),
+              decoderContext({}), encoderContext({}), rawFrame(nullptr), convertedFrame(nullptr),
               filterFrame(nullptr), decodingPacket(nullptr), encodingPacket(nullptr), converterContext(nullptr),
-              filterGraph(nullptr), bufferSrcCtx(nullptr), bufferSinkCtx(nullptr), isPlayingFlag(false) {
+              filterQuery(filterQuery), filterGraph(nullptr), bufferSrcCtx(nullptr), bufferSinkCtx(nullptr),
+              busSinkCtx(nullptr), busFrame(nullptr),
+              isPlayingFlag(false), isStopRequested(false), isEncoderReconfigurationRequested(false),
+              framesSinceMotion(0), isRawLumaPlanar(false), numTemporalLayers(1), isQualityLevelChangePending(false),
+              processingTimeAtLastFrame(0), governorLoadMetricName("governor." + alias + ".load_x1000"),
+              governorLevelMetricName("governor." + alias + ".level"), initializationTimeMs(0),
+              encoderDelayMetricName("encoder." + alias + ".delay_frames"),
+              encoderLatencyMetricName("encoder." + alias + ".latency_us"),
+              framePoolMetricName("memory." + alias + ".frame_pool_bytes"),
+              encoderMemoryMetricName("memory." + alias + ".encoder_lookahead_bytes"), encoderPictureSize(0),
+              isKeyframeRequested(false), minKeyframeIntervalMs(DEFAULT_MIN_KEYFRAME_INTERVAL_MS),
+              keyframeRequestsMetricName("keyframes." + alias + ".requests"),
+              forcedKeyframesMetricName("keyframes." + alias + ".forced"), isInitialized(false) {
+
+        MemoryScope memoryScope(MEMORY_SUBSYSTEM_TRANSCODER);
 
         LOG(INFO) << "Constructing transcoder for \"" << videoSourceUrl << "\"";
 
+        auto constructionStart = std::chrono::steady_clock::now();
+
+        registerAll();
+
         // get the pixel formats enumerations
         this->rawPixFormat = av_get_pix_fmt(rawPixFmtStr.c_str());
         this->encoderPixFormat = av_get_pix_fmt(encPixFmtStr.c_str());
 
-        assert(rawPixFormat != AV_PIX_FMT_NONE && encoderPixFormat != AV_PIX_FMT_NONE);
+        if (rawPixFormat == AV_PIX_FMT_NONE) { // not a pixel format, try compressed input format, e.g. mjpeg, h264
 
-        LOG(INFO) << "Decoder/encoder pixel formats: " << rawPixFmtStr << " and " << encPixFmtStr;
+            auto inputDecoder = avcodec_find_decoder_by_name(rawPixFmtStr.c_str());
 
-        registerAll();
+            if (!inputDecoder) {
+                initializationFailed(videoSourceUrl, "unknown raw format " + rawPixFmtStr);
+                return;
+            }
+
+            inputCodecId = inputDecoder->id;
+            passthrough = inputCodecId == AV_CODEC_ID_H264 || inputCodecId == AV_CODEC_ID_HEVC;
+        }
+
+        if (encoderPixFormat == AV_PIX_FMT_NONE) {
+            initializationFailed(videoSourceUrl, "unknown pixel format " + encPixFmtStr);
+            return;
+        }
+
+        LOG(INFO) << "Decoder/encoder pixel formats: " << rawPixFmtStr << " and " << encPixFmtStr
+                  << (passthrough ? " (passthrough)" : "");
+
+        if (frameSource) {
+            initializeFrameSource();
+        } else if (!initializeDecoder()) {
+            cleanup(); // the device is released, the transcoder is deleted by its factory
+            return;
+        }
+
+        if (!passthrough) {
+
+            updateOutputSize();
+
+            // share the cores with the other encoders (the frame size is known after the decoder initialization)
+            encoderThreads = EncoderThreadBudget::getInstance().registerEncoder(
+                    this, deviceAlias, outputWidth, outputHeight,
+                    std::bind(&Transcoder::onEncoderThreadsChanged, this, std::placeholders::_1));
+
+            if (!initializeEncoder() || !initializeConverter() || !initFilters()) {
+                cleanup();
+                return;
+            }
+        }
+
+        isInitialized = true;
+
+        initializationTimeMs = elapsedNanos(constructionStart) / 1000000;
+
+        LOG(INFO) << "Transcoder for \"" << videoSourceUrl << "\" has been initialized in " << initializationTimeMs
+                  << " ms";
+    }
+
+    void Transcoder::stop() {
+        isStopRequested.store(true);
+    }
+
+    void Transcoder::setMotionGating(const MotionGatingOptions &options) {
+
+        motionGating = options;
+
+        motionDetector.reset();
 
-        initializeDecoder();
+        // the first plane of the planar YUV formats (8-bit) is the luma
+        auto descriptor = av_pix_fmt_desc_get(rawPixFormat);
 
-        initializeEncoder();
+        isRawLumaPlanar = descriptor && !(descriptor->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL)) &&
+                          descriptor->comp[0].plane == 0 && descriptor->comp[0].step == 1 &&
+                          descriptor->comp[0].depth == 8;
 
-        initializeConverter();
+        motionScoreMetricName = "motion." + deviceAlias + ".score_x1000";
 
-        initFilters();
+        LOG(INFO) << "Motion gating for \"" << videoSourceUrl << "\": " << (options.enabled ? "enabled" : "disabled")
+                  << " (threshold: " << options.threshold << ", keep-alive: " << options.keepAliveIntervalMs
+                  << " ms, " << (isRawLumaPlanar ? "raw" : "converted") << " frames)";
     }
 
-    void Transcoder::setOnEncodedDataCallback(std::function<void(std::vector<uint8_t> &&)> callback) {
+    void Transcoder::setRegionsOfInterest(const RegionOfInterestOptions &options) {
+
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(56, 25, 100)
+        if (options.isEnabled()) {
+            LOG(WARN) << "Regions of interest are not supported by this FFmpeg version, ignored";
+        }
+#endif
+
+        // adaptive quantization is required by the encoder to apply the regions (the encoder is reopened if toggled)
+        if (options.isEnabled() != roiOptions.isEnabled() && !passthrough) {
+            isEncoderReconfigurationRequested.store(true);
+        }
+
+        roiOptions = options;
+
+        roiMotionDetector.reset();
+
+        LOG(INFO) << "Regions of interest for \"" << videoSourceUrl << "\": " << options.regions.size()
+                  << " static, motion map: " << (options.motionMap ? "on" : "off")
+                  << ", background offset: " << options.backgroundQualityOffset;
+    }
+
+    void Transcoder::setFrameBus(const FrameBusOptions &options) {
+
+        frameBusOptions = options;
+
+        if (!options.pixelFormat.empty() && av_get_pix_fmt(options.pixelFormat.c_str()) == AV_PIX_FMT_NONE) {
+            LOG(WARN) << "Unknown pixel format of the frame bus: " << options.pixelFormat << ", ignored";
+            frameBusOptions.pixelFormat.clear();
+        }
+
+        if (options.publishFrames && passthrough) {
+            LOG(WARN) << "Frames of \"" << videoSourceUrl << "\" are not decoded (passthrough), only packets "
+                      << "are published";
+        }
+
+        frameBusFrames.reset(options.publishFrames && !passthrough ?
+                             new FrameBusWriter(deviceAlias, FRAME_BUS_FRAMES, options.frameSlots) : nullptr);
+
+        frameBusPackets.reset(options.publishPackets ?
+                              new FrameBusWriter(deviceAlias, FRAME_BUS_PACKETS, options.packetSlots) : nullptr);
+
+        if (!passthrough) {
+
+            if (!busFrame) busFrame = av_frame_alloc();
+
+            // rebuild the filter graph with (or w/o) the frame bus' branch
+            avfilter_graph_free(&filterGraph);
+            av_frame_free(&filterFrame);
+
+            // the graph has been created with the same input before
+            auto isFilterGraphCreated = initFilters();
+            assert(isFilterGraphCreated);
+        }
+
+        LOG(INFO) << "Frame bus for \"" << videoSourceUrl << "\": frames " << (frameBusFrames ? "on" : "off")
+                  << (busSinkCtx ? " (converted)" : "") << ", packets " << (frameBusPackets ? "on" : "off");
+    }
+
+    bool Transcoder::isEncodingRequired(const AVFrame *frame, bool isKeyframe) {
+
+        auto now = std::chrono::steady_clock::now();
+
+        auto score = motionDetector.computeScore(frame->data[0], frame->linesize[0],
+                                                 static_cast<size_t>(frame->width), static_cast<size_t>(frame->height));
+
+        Metrics::getInstance().set(motionScoreMetricName, static_cast<int64_t>(score * 1000));
+
+        // no reference frame yet - encode
+        if (score < 0 || score >= motionGating.threshold) {
+            framesSinceMotion = 0;
+        } else if (framesSinceMotion < motionGating.hangoverFrames + 1) {
+            framesSinceMotion++;
+        }
+
+        auto isKeepAlive = now - lastEncodedFrameTime >= std::chrono::milliseconds(motionGating.keepAliveIntervalMs);
+
+        if (framesSinceMotion > motionGating.hangoverFrames && !isKeepAlive && !isKeyframe) {
+            return false; // static scene
+        }
+
+        // slow changes are accumulated relative to the last encoded frame
+        motionDetector.updateReference();
+        lastEncodedFrameTime = now;
+
+        return true;
+    }
+
+    void Transcoder::setOnEncodedDataCallback(
+            std::function<void(std::vector<uint8_t> &&, const struct timeval &)> callback) {
         onEncodedDataCallback = std::move(callback);
     }
 
+    void Transcoder::setOnEncodedPacketCallback(
+            std::function<void(const AVPacket *, AVRational, const AVCodecParameters *)> callback) {
+        onEncodedPacketCallback = std::move(callback);
+    }
+
+    void Transcoder::requestKeyframe() {
+
+        if (passthrough) return; // keyframes of the source can't be forced
+
+        Metrics::getInstance().add(keyframeRequestsMetricName, 1);
+
+        isKeyframeRequested.store(true);
+    }
+
+    void Transcoder::setMinKeyframeInterval(unsigned milliseconds) {
+        minKeyframeIntervalMs = milliseconds;
+    }
+
+    bool Transcoder::isKeyframeForced() {
+
+        if (!isKeyframeRequested.load()) return false;
+
+        auto now = std::chrono::steady_clock::now();
+
+        // the requests within the interval are answered by the keyframe already sent or by the deferred one
+        if (now - lastForcedKeyframeTime < std::chrono::milliseconds(minKeyframeIntervalMs)) return false;
+
+        isKeyframeRequested.store(false);
+        lastForcedKeyframeTime = now;
+
+        Metrics::getInstance().add(forcedKeyframesMetricName, 1);
+
+        LOG(DEBUG) << "Keyframe of \"" << videoSourceUrl << "\" has been forced";
+
+        return true;
+    }
+
+    void Transcoder::setTemporalLayers(unsigned numLayers) {
+
+        auto previousNumLayers = numTemporalLayers;
+
+        numTemporalLayers = std::min(std::max(numLayers, 1u), MAX_TEMPORAL_LAYERS);
+
+        // temporal-layers of x265 is a flag (a single enhancement layer) before 3.6 (build 209)
+#if !defined(X265_BUILD) || X265_BUILD < 209
+        if (numTemporalLayers > 2) {
+            LOG(WARN) << "Temporal layers of \"" << videoSourceUrl << "\" are limited to 2 (requires x265 3.6+"
+#ifndef X265_BUILD
+                      << ", x265.h hasn't been found"
+#endif
+                      << ")";
+            numTemporalLayers = 2;
+        }
+#endif
+
+        if (numTemporalLayers != previousNumLayers && !passthrough) {
+            isEncoderReconfigurationRequested.store(true);
+        }
+
+        LOG(INFO) << "Temporal layers of \"" << videoSourceUrl << "\": " << numTemporalLayers;
+    }
+
+    void Transcoder::setOnFilteredFrameCallback(std::function<void(const AVFrame *)> callback) {
+
+        std::lock_guard<std::mutex> lock(filteredFrameCallbackMutex);
+
+        onFilteredFrameCallback = std::move(callback);
+    }
+
     void Transcoder::registerAll() {
 
-        av_register_all();
+        // the transcoders may be constructed in parallel
+        static std::once_flag registrationFlag;
+
+        std::call_once(registrationFlag, []() {
+
+            av_register_all();
 
-        avdevice_register_all();
+            avdevice_register_all();
 
-        avcodec_register_all();
+            avcodec_register_all();
 
-        avfilter_register_all();
+            avfilter_register_all();
+        });
     }
 
-    void Transcoder::initializeDecoder() {
+    bool Transcoder::initializeDecoder() {
 
         // holds the general (header) information about the format (container)
         decoderContext.formatContext = avformat_alloc_context();
 
-        AVInputFormat *inputFormat = av_find_input_format("v4l2"); // using Video4Linux API for capturing
+        // e.g. Video4Linux API for capturing, lavfi for synthetic sources (nullptr - detect automatically)
+        AVInputFormat *inputFormat = nullptr;
+
+        if (!inputFormatName.empty()) {
+            inputFormat = av_find_input_format(inputFormatName.c_str());
+
+            if (!inputFormat) return initializationFailed(videoSourceUrl, "unknown input format " + inputFormatName);
+        }
 
         auto frameResolutionStr = utils::concatParams({frameWidth, frameHeight}, "x");
         auto framerateStr = utils::concatParams({(size_t) frameRate.num, (size_t) frameRate.den}, "/");
 
         AVDictionary *options = nullptr;
         av_dict_set(&options, "video_size", frameResolutionStr.data(), 0);
-        av_dict_set(&options, "pixel_format", av_get_pix_fmt_name(rawPixFormat), 0);
         av_dict_set(&options, "framerate", framerateStr.data(), 0);
 
+        if (inputCodecId == AV_CODEC_ID_RAWVIDEO) {
+            av_dict_set(&options, "pixel_format", av_get_pix_fmt_name(rawPixFormat), 0);
+        } else { // compressed data from the device, e.g. mjpeg, h264
+            av_dict_set(&options, "input_format", avcodec_get_name(inputCodecId), 0);
+        }
+
         int statCode = avformat_open_input(&decoderContext.formatContext, videoSourceUrl.data(),
                                            inputFormat, &options);
         av_dict_free(&options);
-        assert(statCode == 0);
 
-        // get the info on all available streams
-        statCode = avformat_find_stream_info(decoderContext.formatContext, nullptr);
-        assert(statCode >= 0);
+        // e.g. unreachable URL, busy device, unsupported mode (the context is freed on failure)
+        if (statCode != 0) return initializationFailed(videoSourceUrl, "failed to open the source", statCode);
+
+        // raw frames of the known size and framerate: the parameters reported by the demuxer's header are enough,
+        // reading (and decoding) the frames to probe the streams would take a few seconds for some devices
+        auto isProbeRequired = inputCodecId != AV_CODEC_ID_RAWVIDEO || frameWidth == 0 || frameHeight == 0 ||
+                               frameRate.num == 0 || !isStreamInfoAvailable();
+
+        if (isProbeRequired) {
+
+            // get the info on all available streams
+            statCode = avformat_find_stream_info(decoderContext.formatContext, nullptr);
+
+            if (statCode < 0) return initializationFailed(videoSourceUrl, "failed to probe the streams", statCode);
+        }
 
         av_dump_format(decoderContext.formatContext, 0, videoSourceUrl.data(), 0);
 
         // find video stream (if multiple video streams are available then you should choose one manually)
         int videoStreamIndex = av_find_best_stream(decoderContext.formatContext, AVMEDIA_TYPE_VIDEO, -1, -1,
                                                    &decoderContext.codec, 0);
-        assert(videoStreamIndex >= 0);
-        assert(decoderContext.codec);
+
+        if (videoStreamIndex < 0 || !decoderContext.codec) {
+            return initializationFailed(videoSourceUrl, "no decodable video stream", videoStreamIndex);
+        }
+
         decoderContext.videoStream = decoderContext.formatContext->streams[videoStreamIndex];
 
         // create codec context (for each codec its own codec context)
         decoderContext.codecContext = avcodec_alloc_context3(decoderContext.codec);
-        assert(decoderContext.codecContext);
+
+        if (!decoderContext.codecContext) return initializationFailed(videoSourceUrl, "out of memory");
 
         // copy video stream parameters to the codec context
         statCode = avcodec_parameters_to_context(decoderContext.codecContext, decoderContext.videoStream->codecpar);
-        assert(statCode >= 0);
 
-        // initialize the codec context to use the created codec context
-        statCode = avcodec_open2(decoderContext.codecContext, decoderContext.codec, &options);
-        assert(statCode == 0);
+        if (statCode < 0) return initializationFailed(videoSourceUrl, "invalid stream parameters", statCode);
+
+        if (inputCodecId != AV_CODEC_ID_RAWVIDEO) {
+
+            // compressed frames (e.g. MJPEG) are decoded using all available cores
+            decoderContext.codecContext->thread_count = 0;
+            decoderContext.codecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        }
+
+        // initialize the codec context to use the created codec context (not used for passthrough)
+        if (!passthrough) {
+            statCode = avcodec_open2(decoderContext.codecContext, decoderContext.codec, &options);
+
+            if (statCode != 0) return initializationFailed(videoSourceUrl, "failed to open the decoder", statCode);
+        }
+
+        // save info (w/o probing the framerate is reported by the demuxer if known, the requested one otherwise)
+        if (isProbeRequired) {
+            frameRate = decoderContext.videoStream->r_frame_rate;
+        } else {
+
+            auto reportedFrameRate = decoderContext.videoStream->avg_frame_rate;
+
+            if (reportedFrameRate.num > 0 && reportedFrameRate.den > 0) {
+                frameRate = reportedFrameRate;
+            }
+        }
 
-        // save info
-        frameRate = decoderContext.videoStream->r_frame_rate;
         frameWidth = static_cast<size_t>(decoderContext.codecContext->width);
         frameHeight = static_cast<size_t>(decoderContext.codecContext->height);
         rawPixFormat = decoderContext.codecContext->pix_fmt;
         sourceBitRate = static_cast<size_t>(decoderContext.codecContext->bit_rate);
 
+        inputTimeBase = decoderContext.videoStream->time_base;
+        inputAspectRatio = decoderContext.videoStream->sample_aspect_ratio;
+
         // allocate decoding packet
         decodingPacket = av_packet_alloc();
         av_init_packet(decodingPacket);
@@ -195,35 +707,95 @@ namespace LIRS {
         rawFrame = av_frame_alloc();
 
         LOG(INFO) << "Decoder for \"" << videoSourceUrl << "\" has been created (framerate: "
+                  << frameRate.num << "/" << frameRate.den << ", w x h: " << frameWidth << "x" << frameHeight
+                  << (isProbeRequired ? ", probed" : ", w/o probing") << ")";
+
+        return true;
+    }
+
+    void Transcoder::initializeFrameSource() {
+
+        frameRate = frameSource->getFrameRate();
+
+        // the source's timestamps count the frames
+        inputTimeBase = av_inv_q(frameRate);
+        inputAspectRatio = AVRational{1, 1};
+
+        rawFrame = av_frame_alloc();
+
+        LOG(INFO) << "Frame source \"" << videoSourceUrl << "\" has been attached (framerate: "
                   << frameRate.num << "/" << frameRate.den << ", w x h: " << frameWidth << "x" << frameHeight << ")";
     }
 
-    void Transcoder::initializeEncoder() {
+    bool Transcoder::isStreamInfoAvailable() const {
+
+        auto formatContext = decoderContext.formatContext;
+
+        for (unsigned idx = 0; idx < formatContext->nb_streams; idx++) {
+
+            auto parameters = formatContext->streams[idx]->codecpar;
+
+            if (parameters->codec_type == AVMEDIA_TYPE_VIDEO && parameters->width > 0 && parameters->height > 0 &&
+                parameters->format != AV_PIX_FMT_NONE) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool Transcoder::initializeEncoder() {
 
         // allocate format context for an output format (null - no output file)
         int statCode = avformat_alloc_output_context2(&encoderContext.formatContext, nullptr, "null", nullptr);
-        assert(statCode >= 0);
+
+        if (statCode < 0) return initializationFailed(videoSourceUrl, "failed to create the null muxer", statCode);
 
         encoderContext.codec = avcodec_find_encoder_by_name("libx265");
-        assert(encoderContext.codec);
+
+        if (!encoderContext.codec) return initializationFailed(videoSourceUrl, "libx265 isn't available");
 
         // create new video output stream (dummy)
         encoderContext.videoStream = avformat_new_stream(encoderContext.formatContext, encoderContext.codec);
-        assert(encoderContext.videoStream);
+
+        if (!encoderContext.videoStream) return initializationFailed(videoSourceUrl, "out of memory");
+
         encoderContext.videoStream->id = encoderContext.formatContext->nb_streams - 1;
 
+        if (!openEncoder()) return false;
+
+        // initializes time base automatically
+        statCode = avformat_write_header(encoderContext.formatContext, nullptr);
+
+        if (statCode < 0) return initializationFailed(videoSourceUrl, "failed to write the null header", statCode);
+
+        // report info to the console
+        av_dump_format(encoderContext.formatContext, encoderContext.videoStream->index, "null", 1);
+
+        // allocate encoding packet
+        encodingPacket = av_packet_alloc();
+        av_init_packet(encodingPacket);
+
+        return true;
+    }
+
+    bool Transcoder::openEncoder() {
+
         // create codec context (for each codec new codec context)
         encoderContext.codecContext = avcodec_alloc_context3(encoderContext.codec);
-        assert(encoderContext.codecContext);
+
+        if (!encoderContext.codecContext) return initializationFailed(videoSourceUrl, "out of memory");
 
         // set up parameters
-        encoderContext.codecContext->width = static_cast<int>(frameWidth);
-        encoderContext.codecContext->height = static_cast<int>(frameHeight);
+        encoderContext.codecContext->width = static_cast<int>(outputWidth);
+        encoderContext.codecContext->height = static_cast<int>(outputHeight);
 
         encoderContext.codecContext->profile = FF_PROFILE_HEVC_MAIN;
 
-        encoderContext.codecContext->time_base = (AVRational) {outputFrameRate.den, outputFrameRate.num};
-        encoderContext.codecContext->framerate = outputFrameRate;
+        auto levelFrameRate = getLevelFrameRate();
+
+        encoderContext.codecContext->time_base = (AVRational) {levelFrameRate.den, levelFrameRate.num};
+        encoderContext.codecContext->framerate = levelFrameRate;
 
         // set encoder's pixel format (it is advised to use yuv420p)
         encoderContext.codecContext->pix_fmt = encoderPixFormat;
@@ -232,13 +804,11 @@ namespace LIRS {
             encoderContext.codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
         }
 
-        // copy encoder parameters to the video stream parameters
-        avcodec_parameters_from_context(encoderContext.videoStream->codecpar, encoderContext.codecContext);
-
         AVDictionary *options = nullptr;
 
-        // the faster you get, the less compression is achieved
-        av_dict_set(&options, "preset", "ultrafast", 0);
+        // the faster you get, the less compression is achieved (can be changed by the overload governor)
+        encoderPreset = governor.getLevel().preset;
+        av_dict_set(&options, "preset", encoderPreset.c_str(), 0);
 
         // optimization for fast encoding and low latency streaming
         av_dict_set(&options, "tune", "zerolatency", 0);
@@ -246,44 +816,106 @@ namespace LIRS {
         // constant rate factor
         av_dict_set_int(&options, "crf", 32, 0);
 
-        // set additional codec options
-        av_opt_set(encoderContext.codecContext->priv_data, "x265-params", "slices=1:intra-refresh=0", 0);
+        std::string threadParams;
+
+        encoderThreadsMutex.lock();
+
+        threadParams = encoderThreads.toX265Params();
+
+        encoderThreadsMutex.unlock();
+
+        // the regions of interest are applied by the encoder via adaptive quantization offsets
+        auto roiParams = roiOptions.isEnabled() ? ":aq-mode=2" : "";
+
+        // hierarchical B-frames of the fixed structure, the non-referenced ones form the upper layer:
+        // 2 layers - P b P b, 3 layers - P b B b (the middle B-frame is referenced), overrides the zero latency tune
+        std::string layerParams;
+
+        if (numTemporalLayers > 1) {
+
+            auto numBFrames = (1u << (numTemporalLayers - 1)) - 1;
+
+            // a flag before x265 3.6 (a single enhancement layer), the number of layers since (see setTemporalLayers)
+            layerParams = ":temporal-layers=" + std::string(numTemporalLayers > 2 ? "3" : "1") +
+                          ":bframes=" + std::to_string(numBFrames) + ":b-adapt=0:b-pyramid=" +
+                          (numTemporalLayers > 2 ? "1" : "0") + ":rc-lookahead=" + std::to_string(numBFrames);
+        }
+
+        // an intra frame forced by the request is an IDR (a closed GOP may start at any frame)
+        std::string keyframeParams = ":open-gop=0:min-keyint=1";
+
+        // set additional codec options (threading is assigned by the global budget)
+        av_opt_set(encoderContext.codecContext->priv_data, "x265-params",
+                   ("slices=1:intra-refresh=0:" + threadParams + roiParams + layerParams + keyframeParams).c_str(), 0);
+
+        // FFmpeg 4.0+ sends the forced intra frame as an IDR explicitly (the option is absent before)
+        av_opt_set_int(encoderContext.codecContext->priv_data, "forced-idr", 1, 0);
 
         // open the output format to use given codec
-        statCode = avcodec_open2(encoderContext.codecContext, encoderContext.codec, &options);
+        auto statCode = avcodec_open2(encoderContext.codecContext, encoderContext.codec, &options);
         av_dict_free(&options);
-        assert(statCode == 0);
 
-        // initializes time base automatically
-        statCode = avformat_write_header(encoderContext.formatContext, nullptr);
-        assert(statCode >= 0);
+        // e.g. the frame size or the pixel format isn't supported
+        if (statCode != 0) return initializationFailed(videoSourceUrl, "failed to open the encoder", statCode);
 
-        // report info to the console
-        av_dump_format(encoderContext.formatContext, encoderContext.videoStream->index, "null", 1);
+        // copy encoder parameters to the video stream parameters
+        avcodec_parameters_from_context(encoderContext.videoStream->codecpar, encoderContext.codecContext);
 
-        // allocate encoding packet
-        encodingPacket = av_packet_alloc();
-        av_init_packet(encodingPacket);
+        LOG(INFO) << "Encoder for \"" << videoSourceUrl << "\" has been opened (" << outputWidth << "x" << outputHeight
+                  << ", " << encoderPreset << ", " << threadParams << ")";
+
+        return true;
+    }
+
+    void Transcoder::reopenEncoder() {
+
+        // deliver the frames still buffered by the encoder (the stream restarts with a keyframe)
+        encode(encoderContext.codecContext, nullptr, encodingPacket);
+
+        encoderInputTimes.clear();
+
+        avcodec_free_context(&encoderContext.codecContext);
+
+        // the encoder has been opened with the same codec before
+        auto isEncoderOpened = openEncoder();
+        assert(isEncoderOpened);
     }
 
-    void Transcoder::initializeConverter() {
+    void Transcoder::onEncoderThreadsChanged(const EncoderThreadAllocation &allocation) {
+
+        encoderThreadsMutex.lock();
+
+        encoderThreads = allocation;
+
+        encoderThreadsMutex.unlock();
+
+        // applied by the transcoding thread before the next frame is encoded
+        isEncoderReconfigurationRequested.store(true);
+    }
+
+    bool Transcoder::initializeConverter() {
 
         // allocate frame to be used in converter
         convertedFrame = av_frame_alloc();
-        convertedFrame->width = static_cast<int>(frameWidth);
-        convertedFrame->height = static_cast<int>(frameHeight);
+        convertedFrame->width = static_cast<int>(outputWidth);
+        convertedFrame->height = static_cast<int>(outputHeight);
         convertedFrame->format = encoderPixFormat;
         int statCode = av_frame_get_buffer(convertedFrame, 0); // ref counted
-        assert(statCode == 0);
 
-        // create converter from raw pixel format to encoder supported pixel format
-        converterContext = sws_getCachedContext(nullptr, static_cast<int>(frameWidth), static_cast<int>(frameHeight),
-                                                rawPixFormat, static_cast<int>(frameWidth),
-                                                static_cast<int>(frameHeight), encoderPixFormat, SWS_FAST_BILINEAR,
+        if (statCode != 0) return initializationFailed(videoSourceUrl, "failed to allocate the frame", statCode);
+
+        // create converter from raw pixel format to encoder supported pixel format (frames are scaled by the filter)
+        converterContext = sws_getCachedContext(nullptr, static_cast<int>(outputWidth), static_cast<int>(outputHeight),
+                                                rawPixFormat, static_cast<int>(outputWidth),
+                                                static_cast<int>(outputHeight), encoderPixFormat, SWS_FAST_BILINEAR,
                                                 nullptr, nullptr, nullptr);
+
+        if (!converterContext) return initializationFailed(videoSourceUrl, "unsupported pixel format conversion");
+
+        return true;
     }
 
-    void Transcoder::initFilters() {
+    bool Transcoder::initFilters() {
 
         // allocate filter frame (where the filtered frame will be stored)
         filterFrame = av_frame_alloc();
@@ -300,17 +932,29 @@ namespace LIRS {
 
         char args[128];
         snprintf(args, sizeof(args), "width=%d:height=%d:pix_fmt=%d:time_base=%d/%d:sar=%d/%d:frame_rate=%d/%d",
-                 (int) frameWidth, (int) frameHeight, rawPixFormat, decoderContext.videoStream->time_base.num,
-                 decoderContext.videoStream->time_base.den, decoderContext.videoStream->sample_aspect_ratio.num,
-                 decoderContext.videoStream->sample_aspect_ratio.den, frameRate.num, frameRate.den);
+                 (int) frameWidth, (int) frameHeight, rawPixFormat, inputTimeBase.num, inputTimeBase.den,
+                 inputAspectRatio.num, inputAspectRatio.den, frameRate.num, frameRate.den);
 
         // create buffer source with the specified params
         auto status = avfilter_graph_create_filter(&bufferSrcCtx, bufferSrc, "in", args, nullptr, filterGraph);
-        assert(status >= 0);
 
         // create buffer sink
-        status = avfilter_graph_create_filter(&bufferSinkCtx, bufferSink, "out", nullptr, nullptr, filterGraph);
-        assert(status >= 0);
+        if (status >= 0) {
+            status = avfilter_graph_create_filter(&bufferSinkCtx, bufferSink, "out", nullptr, nullptr, filterGraph);
+        }
+
+        busSinkCtx = nullptr;
+
+        // buffer sink of the frame bus' branch
+        if (status >= 0 && frameBusFrames && frameBusOptions.isFrameConversionRequired()) {
+            status = avfilter_graph_create_filter(&busSinkCtx, bufferSink, "bus", nullptr, nullptr, filterGraph);
+        }
+
+        if (status < 0) {
+            avfilter_inout_free(&outputs);
+            avfilter_inout_free(&inputs);
+            return initializationFailed(videoSourceUrl, "failed to create the buffer filters", status);
+        }
 
         outputs->name = av_strdup("in");
         outputs->filter_ctx = bufferSrcCtx;
@@ -322,81 +966,461 @@ namespace LIRS {
         inputs->pad_idx = 0;
         inputs->next = nullptr;
 
+        if (busSinkCtx) {
+            inputs->next = avfilter_inout_alloc();
+            inputs->next->name = av_strdup("bus");
+            inputs->next->filter_ctx = busSinkCtx;
+            inputs->next->pad_idx = 0;
+            inputs->next->next = nullptr;
+        }
+
         // create filter query
-        char frameStepFilterQuery[16];
+        char frameStepFilterQuery[64];
 
-        if (this->filterQuery.empty()) {
+        auto levelFrameRate = getLevelFrameRate();
 
-            snprintf(frameStepFilterQuery, sizeof(frameStepFilterQuery), "fps=fps=%d/%d",
-                     outputFrameRate.num, outputFrameRate.den);
+        snprintf(frameStepFilterQuery, sizeof(frameStepFilterQuery), "fps=fps=%d/%d",
+                 levelFrameRate.num, levelFrameRate.den);
 
-            // add graph represented by the filter query
-            status = avfilter_graph_parse(filterGraph, frameStepFilterQuery, inputs, outputs, nullptr);
-            assert(status >= 0);
+        std::string query;
 
-        } else {
+        if (governor.getLevelIndex() == 0) { // nominal level
+
+            query = this->filterQuery.empty() ? frameStepFilterQuery : filterQuery;
+
+        } else { // degraded level, the framerate and scale are applied after the user's filters
+
+            query = (filterQuery.empty() ? "" : filterQuery + ",") + frameStepFilterQuery;
+
+            if (outputWidth != frameWidth || outputHeight != frameHeight) {
+                query += ",scale=" + utils::concatParams({outputWidth, outputHeight}, ":");
+            }
+        }
+
+        // the frame bus' branch converts a copy of the filtered frames
+        if (busSinkCtx) {
+
+            std::string busQuery;
+
+            if (frameBusOptions.frameWidth != 0 || frameBusOptions.frameHeight != 0) {
+
+                // -2 - keep the aspect ratio (even dimension)
+                auto dimension = [](size_t value) { return value ? std::to_string(value) : std::string("-2"); };
+
+                busQuery = "scale=" + dimension(frameBusOptions.frameWidth) + ":" +
+                           dimension(frameBusOptions.frameHeight);
+            }
+
+            if (!frameBusOptions.pixelFormat.empty()) {
+                busQuery += (busQuery.empty() ? "" : ",") + std::string("format=pix_fmts=") +
+                            frameBusOptions.pixelFormat;
+            }
 
-            status = avfilter_graph_parse(filterGraph, filterQuery.c_str(), inputs, outputs, nullptr);
-            assert(status >= 0);
+            query += ",split=2[out][bus_split];[bus_split]" + busQuery + "[bus]";
         }
 
+        // add graph represented by the filter query (the inputs and outputs are freed)
+        status = avfilter_graph_parse(filterGraph, query.c_str(), inputs, outputs, nullptr);
+
+        if (status < 0) return initializationFailed(videoSourceUrl, "invalid filter query " + query, status);
+
         status = avfilter_graph_config(filterGraph, nullptr);
-        assert(status >= 0);
+
+        if (status < 0) return initializationFailed(videoSourceUrl, "failed to configure the filters", status);
+
+        updateFramePoolMetric();
+
+        return true;
+    }
+
+    void Transcoder::updateFramePoolMetric() {
+
+        auto pictureSize = [](AVPixelFormat format, size_t width, size_t height) {
+            return std::max<int64_t>(av_image_get_buffer_size(format, static_cast<int>(width),
+                                                              static_cast<int>(height), 1), 0);
+        };
+
+        encoderPictureSize = pictureSize(encoderPixFormat, outputWidth, outputHeight);
+
+        // decoded frame, filtered frame (and its copy for the frame bus), converted frame
+        auto filteredSize = pictureSize(rawPixFormat, outputWidth, outputHeight);
+        auto framePoolSize = pictureSize(rawPixFormat, frameWidth, frameHeight) + filteredSize +
+                             (busSinkCtx ? filteredSize : 0) + encoderPictureSize;
+
+        Metrics::getInstance().set(framePoolMetricName, framePoolSize);
+    }
+
+    AVRational Transcoder::getLevelFrameRate() const {
+
+        auto factor = governor.getLevel().frameRateFactor;
+
+        if (factor == 1.0) return outputFrameRate;
+
+        return av_d2q(av_q2d(outputFrameRate) * factor, 1001);
+    }
+
+    void Transcoder::updateOutputSize() {
+
+        auto scale = governor.getLevel().scale;
+
+        if (scale == 1.0) {
+            outputWidth = frameWidth;
+            outputHeight = frameHeight;
+            return;
+        }
+
+        // encoder requires even frame dimensions for the chroma subsampling
+        outputWidth = std::max<size_t>(2, static_cast<size_t>(std::lround(frameWidth * scale / 2)) * 2);
+        outputHeight = std::max<size_t>(2, static_cast<size_t>(std::lround(frameHeight * scale / 2)) * 2);
+    }
+
+    void Transcoder::applyQualityLevel() {
+
+        auto &level = governor.getLevel();
+
+        auto previousWidth = outputWidth;
+        auto previousHeight = outputHeight;
+
+        updateOutputSize();
+
+        auto levelFrameRate = getLevelFrameRate();
+
+        LOG(WARN) << "Quality level of \"" << videoSourceUrl << "\" has been changed to " << governor.getLevelIndex()
+                  << " (load: " << governor.getLoad() << ", fps: " << levelFrameRate.num << "/" << levelFrameRate.den
+                  << ", size: " << outputWidth << "x" << outputHeight << ", preset: " << level.preset << ")";
+
+        Metrics::getInstance().set(governorLevelMetricName, static_cast<int64_t>(governor.getLevelIndex()));
+
+        // rebuild the filter graph, the capture device stays open (frames buffered in the old graph are dropped)
+        avfilter_graph_free(&filterGraph);
+        av_frame_free(&filterFrame);
+
+        // the graph has been created with the same input before
+        auto isFilterGraphCreated = initFilters();
+        assert(isFilterGraphCreated);
+
+        auto isResized = outputWidth != previousWidth || outputHeight != previousHeight;
+
+        if (isResized) {
+
+            av_frame_free(&convertedFrame);
+            sws_freeContext(converterContext);
+
+            auto isConverterCreated = initializeConverter();
+            assert(isConverterCreated);
+
+            // the thread budget is shared proportionally to the frame size
+            auto allocation = EncoderThreadBudget::getInstance().registerEncoder(
+                    this, deviceAlias, outputWidth, outputHeight,
+                    std::bind(&Transcoder::onEncoderThreadsChanged, this, std::placeholders::_1));
+
+            encoderThreadsMutex.lock();
+
+            encoderThreads = allocation;
+
+            encoderThreadsMutex.unlock();
+        }
+
+        // the framerate (time base) is changed in any case
+        isEncoderReconfigurationRequested.store(false);
+
+        reopenEncoder();
+    }
+
+    void Transcoder::setOverloadGovernor(const OverloadGovernorOptions &options) {
+
+        auto previousLevelIndex = governor.getLevelIndex();
+
+        governor.configure(options);
+
+        // back to the nominal level
+        isQualityLevelChangePending = previousLevelIndex != governor.getLevelIndex();
+
+        LOG(INFO) << "Overload governor for \"" << videoSourceUrl << "\": " << (options.enabled ? "enabled" : "disabled")
+                  << " (" << options.ladder.size() << " levels)";
     }
 
     int Transcoder::decode(AVCodecContext *codecContext, AVFrame *frame, AVPacket *packet) {
 
-        // send a packet to be filled with raw data
+        auto stageStart = std::chrono::steady_clock::now();
+
+        // send a packet to be filled with raw data (nullptr - flush the decoder)
         int statCode = avcodec_send_packet(codecContext, packet);
 
+        statistics.decodeTime += elapsedNanos(stageStart);
+
         if (statCode < 0) {
             LOG(ERROR) << "Error sending a packet for decoding: " << videoSourceUrl;
             return statCode;
         }
 
-        // receive decoded raw frame
-        statCode = avcodec_receive_frame(codecContext, frame);
+        // receive all decoded raw frames
+        while (true) {
 
-        if (statCode == AVERROR(EAGAIN) || statCode == AVERROR_EOF) {
-            LOG(WARN) << "No frames available or end of file has been reached";
-            return statCode;
-        }
+            stageStart = std::chrono::steady_clock::now();
 
-        if (statCode < 0) {
-            LOG(ERROR) << "Error during decoding";
-            return statCode;
-        }
+            statCode = avcodec_receive_frame(codecContext, frame);
 
-        return true;
+            statistics.decodeTime += elapsedNanos(stageStart);
+
+            if (statCode == AVERROR(EAGAIN) || statCode == AVERROR_EOF) {
+                return 0; // needs the next packet or fully flushed
+            }
+
+            if (statCode < 0) {
+                LOG(ERROR) << "Error during decoding";
+                return statCode;
+            }
+
+            statistics.framesDecoded++;
+
+            processRawFrame(frame);
+
+            av_frame_unref(frame);
+        }
     }
 
     int Transcoder::encode(AVCodecContext *codecContext, AVFrame *frame, AVPacket *packet) {
 
-        // send a raw frame to be encoded
+        if (frame) {
+            attachRegionsOfInterest(frame);
+        }
+
+        auto stageStart = std::chrono::steady_clock::now();
+
+        // send a raw frame to be encoded (nullptr - flush the encoder)
         int statCode = avcodec_send_frame(codecContext, frame);
 
+        statistics.encodeTime += elapsedNanos(stageStart);
+
+        if (statCode == AVERROR(EAGAIN)) { // the encoder's output should be drained first
+
+            statCode = receiveEncodedPackets(codecContext, packet);
+
+            if (statCode < 0) return statCode;
+
+            stageStart = std::chrono::steady_clock::now();
+
+            statCode = avcodec_send_frame(codecContext, frame);
+
+            statistics.encodeTime += elapsedNanos(stageStart);
+        }
+
         if (statCode < 0) {
             LOG(ERROR) << "Error during sending frame for encoding";
             return statCode;
         }
 
-        // receive a packet containing encoded data
-        statCode = avcodec_receive_packet(codecContext, packet);
+        if (frame) {
+            statistics.framesEncoded++;
+            encoderInputTimes[frame->pts] = std::chrono::steady_clock::now();
+        }
 
-        if (statCode == AVERROR(EAGAIN) || statCode == AVERROR_EOF) {
-            LOG(WARN) << "EAGAIN or EOF while encoding";
-            return statCode;
+        statCode = receiveEncodedPackets(codecContext, packet);
 
-        }
+        // frames accepted by the encoder, but not yet emitted
+        statistics.encoderDelayFrames.store(encoderInputTimes.size());
 
-        if (statCode < 0) {
-            LOG(ERROR) << "Error during receiving packet for encoding";
-            return statCode;
+        if (encoderInputTimes.size() > statistics.maxEncoderDelayFrames.load()) {
+            statistics.maxEncoderDelayFrames.store(encoderInputTimes.size());
         }
 
+        Metrics::getInstance().set(encoderDelayMetricName, static_cast<int64_t>(encoderInputTimes.size()));
+
+        // lookahead and frame threads hold the delayed pictures (x265's internal buffers are padded, so it's a floor)
+        Metrics::getInstance().set(encoderMemoryMetricName, encoderPictureSize *
+                                   static_cast<int64_t>(encoderInputTimes.size() + ENCODER_REFERENCE_PICTURES));
+
         return statCode;
     }
 
+    int Transcoder::receiveEncodedPackets(AVCodecContext *codecContext, AVPacket *packet) {
+
+        while (true) {
+
+            auto stageStart = std::chrono::steady_clock::now();
+
+            // receive a packet containing encoded data
+            int statCode = avcodec_receive_packet(codecContext, packet);
+
+            statistics.encodeTime += elapsedNanos(stageStart);
+
+            if (statCode == AVERROR(EAGAIN) || statCode == AVERROR_EOF) {
+                return 0; // needs the next frame or fully flushed
+            }
+
+            if (statCode < 0) {
+                LOG(ERROR) << "Error during receiving packet for encoding";
+                return statCode;
+            }
+
+            statistics.packetsEncoded++;
+
+            // time the frame has spent inside the encoder
+            auto inputTime = encoderInputTimes.find(packet->pts);
+
+            if (inputTime != encoderInputTimes.end()) {
+
+                auto latency = elapsedNanos(inputTime->second);
+
+                statistics.encoderLatency += latency;
+
+                Metrics::getInstance().set(encoderLatencyMetricName, static_cast<int64_t>(latency / 1000));
+
+                encoderInputTimes.erase(inputTime);
+            }
+
+            // new encoded data is available
+            deliverEncodedData(packet);
+
+            av_packet_unref(packet);
+        }
+    }
+
+    void Transcoder::attachRegionsOfInterest(AVFrame *frame) {
+
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(56, 25, 100)
+
+        av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+        if (!roiOptions.isEnabled()) return;
+
+        std::vector<AVRegionOfInterest> regions;
+
+        auto addRegion = [&regions, frame](int left, int top, int right, int bottom, double qualityOffset) {
+
+            AVRegionOfInterest region{};
+            region.self_size = sizeof(AVRegionOfInterest);
+            region.left = std::max(0, left);
+            region.top = std::max(0, top);
+            region.right = std::min(frame->width, right);
+            region.bottom = std::min(frame->height, bottom);
+            region.qoffset = av_make_q(static_cast<int>(std::lround(qualityOffset * 1000)), 1000);
+
+            if (region.left < region.right && region.top < region.bottom) {
+                regions.push_back(region);
+            }
+        };
+
+        // static regions are specified for the source's frame size
+        auto scale = governor.getLevel().scale;
+
+        for (auto &roi : roiOptions.regions) {
+            addRegion(static_cast<int>(roi.x * scale), static_cast<int>(roi.y * scale),
+                      static_cast<int>((roi.x + roi.width) * scale), static_cast<int>((roi.y + roi.height) * scale),
+                      roi.qualityOffset);
+        }
+
+        if (roiOptions.motionMap) {
+
+            roiMotionDetector.computeScore(frame->data[0], frame->linesize[0], static_cast<size_t>(frame->width),
+                                           static_cast<size_t>(frame->height));
+            roiMotionDetector.getChangedBlocks(roiOptions.motionThreshold, roiMotionMask);
+            roiMotionDetector.updateReference();
+
+            auto blocksX = static_cast<int>(roiMotionDetector.getBlocksX());
+            auto blocksY = static_cast<int>(roiMotionDetector.getBlocksY());
+            auto blocksPerCell = ROI_MOTION_CELL_SIZE / static_cast<int>(MotionDetector::BLOCK_SIZE);
+
+            auto cellsX = (blocksX + blocksPerCell - 1) / blocksPerCell;
+            auto cellsY = (blocksY + blocksPerCell - 1) / blocksPerCell;
+
+            // the cell is moving if any of its blocks has been changed
+            auto isCellMoving = [&](int cellX, int cellY) {
+                for (int by = cellY * blocksPerCell; by < std::min(blocksY, (cellY + 1) * blocksPerCell); ++by) {
+                    for (int bx = cellX * blocksPerCell; bx < std::min(blocksX, (cellX + 1) * blocksPerCell); ++bx) {
+                        if (roiMotionMask[by * blocksX + bx]) return true;
+                    }
+                }
+                return false;
+            };
+
+            // horizontal runs of the moving cells are merged into a single region
+            for (int cellY = 0; cellY < cellsY; ++cellY) {
+
+                int runStart = -1;
+
+                for (int cellX = 0; cellX <= cellsX; ++cellX) {
+
+                    auto isMoving = cellX < cellsX && isCellMoving(cellX, cellY);
+
+                    if (isMoving && runStart < 0) {
+                        runStart = cellX;
+                    } else if (!isMoving && runStart >= 0) {
+                        addRegion(runStart * ROI_MOTION_CELL_SIZE, cellY * ROI_MOTION_CELL_SIZE,
+                                  cellX * ROI_MOTION_CELL_SIZE, (cellY + 1) * ROI_MOTION_CELL_SIZE,
+                                  roiOptions.motionQualityOffset);
+                        runStart = -1;
+                    }
+                }
+            }
+        }
+
+        if (roiOptions.backgroundQualityOffset != 0.0) {
+            addRegion(0, 0, frame->width, frame->height, roiOptions.backgroundQualityOffset);
+        }
+
+        if (regions.empty()) return;
+
+        auto sideData = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                                               static_cast<int>(regions.size() * sizeof(AVRegionOfInterest)));
+
+        if (!sideData) {
+            LOG(WARN) << "Failed to attach regions of interest";
+            return;
+        }
+
+        memcpy(sideData->data, regions.data(), regions.size() * sizeof(AVRegionOfInterest));
+#else
+        (void) frame;
+#endif
+    }
+
+    void Transcoder::deliverEncodedData(const AVPacket *packet) {
+
+        statistics.encodedBytes += static_cast<uint64_t>(packet->size);
+
+        if (frameBusPackets) {
+            frameBusPackets->publishPacket(packet, passthrough ? decoderContext.videoStream->time_base
+                                                               : encoderContext.codecContext->time_base);
+        }
+
+        if (onEncodedPacketCallback) {
+            if (passthrough) {
+                onEncodedPacketCallback(packet, decoderContext.videoStream->time_base,
+                                        decoderContext.videoStream->codecpar);
+            } else {
+                onEncodedPacketCallback(packet, encoderContext.codecContext->time_base,
+                                        encoderContext.videoStream->codecpar);
+            }
+        }
+
+        if (!onEncodedDataCallback) return;
+
+        // all NAL units of the access unit share the presentation time
+        struct timeval presentationTime;
+        gettimeofday(&presentationTime, nullptr);
+
+        // frames are emitted in the decoding order, the reordered ones (B-frames) are presented later
+        if (packet->pts != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE && packet->pts > packet->dts) {
+
+            auto timeBase = passthrough ? decoderContext.videoStream->time_base
+                                        : encoderContext.codecContext->time_base;
+            auto delayUs = av_rescale_q(packet->pts - packet->dts, timeBase, AVRational{1, 1000000});
+
+            presentationTime.tv_usec += delayUs % 1000000;
+            presentationTime.tv_sec += delayUs / 1000000 + presentationTime.tv_usec / 1000000;
+            presentationTime.tv_usec %= 1000000;
+        }
+
+        // each NAL unit is passed separately (discrete framer on the consumer's side)
+        utils::forEachNalUnit(packet->data, static_cast<size_t>(packet->size),
+                              [this, &presentationTime](const uint8_t *nalUnit, size_t size) {
+                                  onEncodedDataCallback(std::vector<uint8_t>(nalUnit, nalUnit + size),
+                                                        presentationTime);
+                              });
+    }
+
     std::string Transcoder::getDeviceName() const {
         return videoSourceUrl;
     }
@@ -407,10 +1431,14 @@ namespace LIRS {
 
     void Transcoder::cleanup() {
 
+        EncoderThreadBudget::getInstance().unregisterEncoder(this); // release the cores for the other encoders
+
         avfilter_graph_free(&filterGraph);
 
-        // close dummy file
-        avio_close(encoderContext.formatContext->pb);
+        // close dummy file (no encoder in passthrough mode)
+        if (encoderContext.formatContext) {
+            avio_close(encoderContext.formatContext->pb);
+        }
 
         // cleanup converter
         sws_freeContext(converterContext);
@@ -423,6 +1451,11 @@ namespace LIRS {
         av_frame_free(&rawFrame);
         av_frame_free(&convertedFrame);
         av_frame_free(&filterFrame);
+        av_frame_free(&busFrame);
+
+        // the readers are notified
+        frameBusFrames.reset();
+        frameBusPackets.reset();
 
         // cleanup decoder and encoder codec contexts
         avcodec_free_context(&decoderContext.codecContext);
@@ -443,4 +1476,24 @@ namespace LIRS {
     const bool Transcoder::isReadable() const {
         return isPlayingFlag.load();
     }
+
+    AVCodecID Transcoder::getOutputCodecId() const {
+        return passthrough ? inputCodecId : AV_CODEC_ID_HEVC;
+    }
+
+    AVRational Transcoder::getOutputFrameRate() const {
+        return outputFrameRate;
+    }
+
+    uint64_t Transcoder::getInitializationTimeMs() const {
+        return initializationTimeMs;
+    }
+
+    bool Transcoder::isPassthrough() const {
+        return passthrough;
+    }
+
+    const TranscoderStatistics &Transcoder::getStatistics() const {
+        return statistics;
+    }
 }
\ No newline at end of file
@@ -14,5 +14,43 @@ namespace LIRS {
             resultStream << tail;
             return resultStream.str();
         }
+
+        /**
+         * Finds the position of the next 3 bytes start code {0x0, 0x0, 0x1} beginning from the offset.
+         *
+         * @return position of the start code or size if not found.
+         */
+        static size_t findStartCode(const uint8_t *data, size_t size, size_t offset) {
+            for (size_t idx = offset; idx + 2 < size; ++idx) {
+                if (data[idx + 2] > 1) {
+                    idx += 2; // fast skip, the start code couldn't begin at idx, idx + 1, idx + 2
+                } else if (data[idx] == 0 && data[idx + 1] == 0 && data[idx + 2] == 1) {
+                    return idx;
+                }
+            }
+            return size;
+        }
+
+        void forEachNalUnit(const uint8_t *data, size_t size,
+                            const std::function<void(const uint8_t *, size_t)> &callback) {
+
+            auto start = findStartCode(data, size, 0);
+
+            while (start < size) {
+
+                auto nalBegin = start + 3; // skip start code
+                auto nalEnd = findStartCode(data, size, nalBegin);
+                start = nalEnd;
+
+                // trailing zero bytes (including the leading zero of the 4 bytes start code)
+                while (nalEnd > nalBegin && data[nalEnd - 1] == 0) {
+                    --nalEnd;
+                }
+
+                if (nalEnd > nalBegin) {
+                    callback(data + nalBegin, nalEnd - nalBegin);
+                }
+            }
+        }
     }
 }
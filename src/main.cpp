@@ -7,11 +7,20 @@ int main(int argc, char **argv) {
 
     av_log_set_level(AV_LOG_VERBOSE);
 
-    auto transcoder = LIRS::Transcoder::newInstance("/dev/video0", "camera", 640, 480, "yuyv422", "yuv420p", 15, 3);
+    // epoll event loop isn't limited to FD_SETSIZE sockets of the clients
+    auto server = new LIRS::LiveCameraRTSPServer(LIRS::LiveCameraRTSPServer::DEFAULT_RTSP_PORT_NUMBER, -1,
+                                                 LIRS::TASK_SCHEDULER_EPOLL);
 
-    auto server = new LIRS::LiveCameraRTSPServer();
+    // sources are opened in parallel by run(), raw formats of the given size and framerate aren't probed
+    server->addSource([]() {
+        return LIRS::Transcoder::newInstance("/dev/video0", "camera", 640, 480, "yuyv422", "yuv420p", 15, 3);
+    });
 
-    server->addTranscoder(transcoder);
+    // low-latency HLS: http://<host>:8080/hls/camera/index.m3u8
+    server->enableHls();
+
+    // streams are added, removed and reconfigured at runtime: echo list | socat - UNIX-CONNECT:/tmp/lirs-control.sock
+    server->enableControl();
 
     server->run();
 